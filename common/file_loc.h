@@ -65,4 +65,8 @@
 #define XRDP_X11RDP_STR "/tmp/.xrdp/xrdp_display_%d"
 #endif
 
+#if !defined(XRDP_PERF_STR)
+#define XRDP_PERF_STR XRDP_PID_PATH "/xrdp_perf_%d_%d"
+#endif
+
 #endif
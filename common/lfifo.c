@@ -0,0 +1,243 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * lock free single producer / single consumer FIFO to store pointer to
+ * data struct
+ *
+ * items are kept in chunks of LFIFO_CHUNK_ITEMS slots, a slot that is not
+ * nil has been written by the producer, a consumed chunk is kept as a
+ * spare so a steady stream of items does not call malloc / free
+ */
+
+#include "lfifo.h"
+#include "os_calls.h"
+
+#if defined(__GNUC__)
+#define LFIFO_BARRIER() __sync_synchronize()
+#define LFIFO_ADD(_ptr, _val) __sync_fetch_and_add(_ptr, _val)
+#define LFIFO_SWAP(_ptr, _val) __sync_lock_test_and_set(_ptr, _val)
+#else
+#error lfifo needs __sync builtins
+#endif
+
+/*****************************************************************************/
+/* producer side, get a zeroed chunk */
+static struct lfifo_chunk *
+lfifo_get_chunk(LFIFO *self)
+{
+    struct lfifo_chunk *chunk;
+
+    LFIFO_BARRIER();
+    chunk = LFIFO_SWAP(&(self->spare), 0);
+    LFIFO_BARRIER();
+    if (chunk == 0)
+    {
+        chunk = (struct lfifo_chunk *)
+                g_malloc(sizeof(struct lfifo_chunk), 1);
+    }
+    return chunk;
+}
+
+/*****************************************************************************/
+/* consumer side, keep a used chunk for the producer or free it */
+static void
+lfifo_put_chunk(LFIFO *self, struct lfifo_chunk *chunk)
+{
+    g_memset(chunk, 0, sizeof(struct lfifo_chunk));
+    LFIFO_BARRIER();
+    chunk = LFIFO_SWAP(&(self->spare), chunk);
+    LFIFO_BARRIER();
+    g_free(chunk);
+}
+
+/**
+ * Create new lfifo data struct
+ *
+ * @return pointer to new LFIFO or NULL if system out of memory
+ *****************************************************************************/
+
+LFIFO * APP_CC
+lfifo_create(void)
+{
+    LFIFO *self;
+
+    self = (LFIFO *) g_malloc(sizeof(LFIFO), 1);
+    if (self == 0)
+    {
+        return 0;
+    }
+    self->head = (struct lfifo_chunk *)
+                 g_malloc(sizeof(struct lfifo_chunk), 1);
+    if (self->head == 0)
+    {
+        g_free(self);
+        return 0;
+    }
+    self->tail = self->head;
+    return self;
+}
+
+/**
+ * Delete specified LFIFO, no other thread may be using it
+ *****************************************************************************/
+
+void APP_CC
+lfifo_delete(LFIFO *self)
+{
+    struct lfifo_chunk *chunk;
+    void *item;
+
+    if (self == 0)
+    {
+        return;
+    }
+    LFIFO_BARRIER();
+    while ((item = lfifo_remove_item(self)) != 0)
+    {
+        if (self->auto_free)
+        {
+            g_free(item);
+        }
+    }
+    while (self->head != 0)
+    {
+        chunk = self->head;
+        self->head = chunk->next;
+        g_free(chunk);
+    }
+    g_free(self->spare);
+    g_free(self);
+}
+
+/**
+ * Add an item to the specified LFIFO, producer thread only
+ *
+ * @param self LFIFO to operate on
+ * @param item item to add to specified LFIFO
+ *
+ * @return 1 if the LFIFO was empty and the consumer may need waking,
+ *         0 on success otherwise, -1 on error
+ *****************************************************************************/
+
+int APP_CC
+lfifo_add_item(LFIFO *self, void *item)
+{
+    struct lfifo_chunk *chunk;
+
+    if (self == 0 || item == 0)
+    {
+        return -1;
+    }
+
+    if (self->tail_index == LFIFO_CHUNK_ITEMS)
+    {
+        chunk = lfifo_get_chunk(self);
+        if (chunk == 0)
+        {
+            return -1;
+        }
+        /* publish the zeroed chunk before linking it */
+        LFIFO_BARRIER();
+        self->tail->next = chunk;
+        self->tail = chunk;
+        self->tail_index = 0;
+    }
+
+    /* everything written to *item must be visible before the slot */
+    LFIFO_BARRIER();
+    self->tail->items[self->tail_index] = item;
+    self->tail_index++;
+
+    return LFIFO_ADD(&(self->count), 1) == 0;
+}
+
+/**
+ * Return an item from top of LFIFO, consumer thread only
+ *
+ * @param self LFIFO to operate on
+ *
+ * @return top item from LFIFO or NULL if LFIFO is empty
+ *****************************************************************************/
+
+void * APP_CC
+lfifo_remove_item(LFIFO *self)
+{
+    struct lfifo_chunk *chunk;
+    void *item;
+
+    if (self == 0)
+    {
+        return 0;
+    }
+
+    if (self->head_index == LFIFO_CHUNK_ITEMS)
+    {
+        chunk = self->head->next;
+        LFIFO_BARRIER();
+        if (chunk == 0)
+        {
+            return 0;
+        }
+        lfifo_put_chunk(self, self->head);
+        self->head = chunk;
+        self->head_index = 0;
+    }
+
+    item = self->head->items[self->head_index];
+    LFIFO_BARRIER();
+    if (item == 0)
+    {
+        return 0;
+    }
+    self->head_index++;
+    LFIFO_ADD(&(self->count), -1);
+    return item;
+}
+
+/**
+ * Return LFIFO status, consumer thread only
+ *
+ * @param self LFIFO to operate on
+ *
+ * @return true if LFIFO is empty, false otherwise
+ *****************************************************************************/
+
+int APP_CC
+lfifo_is_empty(LFIFO *self)
+{
+    struct lfifo_chunk *chunk;
+    int index;
+
+    if (self == 0)
+    {
+        return 1;
+    }
+
+    chunk = self->head;
+    index = self->head_index;
+    if (index == LFIFO_CHUNK_ITEMS)
+    {
+        chunk = chunk->next;
+        index = 0;
+        if (chunk == 0)
+        {
+            return 1;
+        }
+    }
+    LFIFO_BARRIER();
+    return chunk->items[index] == 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * lock free single producer / single consumer FIFO to store pointer to
+ * data struct
+ * one thread may add while another removes without a mutex, more than one
+ * producer or consumer must be serialized by the caller
+ */
+
+#if !defined(LFIFO_H)
+#define LFIFO_H
+
+#include "arch.h"
+
+#define LFIFO_CHUNK_ITEMS 256
+#define LFIFO_CACHE_LINE 64
+
+struct lfifo_chunk
+{
+    struct lfifo_chunk *next;
+    void *items[LFIFO_CHUNK_ITEMS];
+};
+
+typedef struct lfifo
+{
+    /* producer only */
+    struct lfifo_chunk *tail;
+    int tail_index;
+    char pad0[LFIFO_CACHE_LINE];
+    /* consumer only */
+    struct lfifo_chunk *head;
+    int head_index;
+    char pad1[LFIFO_CACHE_LINE];
+    /* shared */
+    int count;
+    struct lfifo_chunk *spare;
+    int auto_free;
+} LFIFO;
+
+LFIFO * APP_CC lfifo_create(void);
+void    APP_CC lfifo_delete(LFIFO *self);
+int     APP_CC lfifo_add_item(LFIFO *self, void *item);
+void *  APP_CC lfifo_remove_item(LFIFO *self);
+int     APP_CC lfifo_is_empty(LFIFO *self);
+
+#endif
@@ -38,6 +38,11 @@
 /* Here we store the current state and configuration of the log */
 static struct log_config *g_staticLogConfig = NULL;
 
+/* log_message is called from several threads, the lock also keeps a fork
+   from copying it, or the localtime and syslog locks, in a held state */
+static pthread_mutex_t g_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_log_atfork = 0;
+
 /* This file first start with all private functions.
    In the end of the file the public functions is defined */
 
@@ -130,6 +135,20 @@ internal_log_lvl2str(const enum logLevels lvl, char *str)
     }
 }
 
+/******************************************************************************/
+static void
+internal_log_fork_prepare(void)
+{
+    pthread_mutex_lock(&g_log_mutex);
+}
+
+/******************************************************************************/
+static void
+internal_log_fork_done(void)
+{
+    pthread_mutex_unlock(&g_log_mutex);
+}
+
 /******************************************************************************/
 enum logReturns DEFAULT_CC
 internal_log_start(struct log_config *l_cfg)
@@ -170,6 +189,13 @@ internal_log_start(struct log_config *l_cfg)
         openlog(l_cfg->program_name, LOG_CONS | LOG_PID, LOG_DAEMON);
     }
 
+    if (!g_log_atfork)
+    {
+        pthread_atfork(internal_log_fork_prepare, internal_log_fork_done,
+                       internal_log_fork_done);
+        g_log_atfork = 1;
+    }
+
 #ifdef LOG_ENABLE_THREAD
     pthread_mutexattr_init(&(l_cfg->log_lock_attr));
     pthread_mutex_init(&(l_cfg->log_lock), &(l_cfg->log_lock_attr));
@@ -543,6 +569,7 @@ log_message(const enum logLevels lvl, const char *msg, ...)
     char buff[LOG_BUFFER_SIZE + 31]; /* 19 (datetime) 4 (space+cr+lf+\0) */
     va_list ap;
     int len = 0;
+    int truncated;
     enum logReturns rv = LOG_STARTUP_OK;
     int writereply = 0;
     time_t now_t;
@@ -559,6 +586,7 @@ log_message(const enum logLevels lvl, const char *msg, ...)
         return LOG_ERROR_FILE_NOT_OPEN;
     }
 
+    pthread_mutex_lock(&g_log_mutex);
     now_t = time(&now_t);
     now = localtime(&now_t);
 
@@ -571,11 +599,10 @@ log_message(const enum logLevels lvl, const char *msg, ...)
     va_start(ap, msg);
     len = vsnprintf(buff + 28, LOG_BUFFER_SIZE, msg, ap);
     va_end(ap);
-
-    /* checking for truncated messages */
-    if (len > LOG_BUFFER_SIZE)
+    truncated = len >= LOG_BUFFER_SIZE;
+    if (truncated)
     {
-        log_message(LOG_LEVEL_WARNING, "next message will be truncated");
+        len = LOG_BUFFER_SIZE - 1;
     }
 
     /* forcing the end of message string */
@@ -626,6 +653,14 @@ log_message(const enum logLevels lvl, const char *msg, ...)
 #endif
     }
 
+    pthread_mutex_unlock(&g_log_mutex);
+
+    /* checking for truncated messages */
+    if (truncated)
+    {
+        log_message(LOG_LEVEL_WARNING, "previous message was truncated");
+    }
+
     return rv;
 }
 
@@ -654,3 +689,20 @@ getLogFile(char *replybuf, int bufsize)
 
     return replybuf;
 }
+
+/******************************************************************************/
+int DEFAULT_CC
+log_child_fd(void)
+{
+    if (g_staticLogConfig == NULL)
+    {
+        return -1;
+    }
+
+    if (g_staticLogConfig->enable_syslog)
+    {
+        closelog();
+    }
+
+    return g_staticLogConfig->fd;
+}
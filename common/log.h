@@ -190,4 +190,12 @@ int APP_CC text2bool(char *s);
  * @return
  */
 char *getLogFile(char *replybuf, int bufsize);
+
+/**
+ * For a child after fork that is about to close the fds it does not need.
+ * Closes syslog, it opens again with the next message.
+ * @return the log file fd to keep open, -1 if there is none
+ */
+int DEFAULT_CC
+log_child_fd(void);
 #endif
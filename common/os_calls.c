@@ -41,6 +41,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/time.h>
 #include <sys/times.h>
@@ -49,6 +50,8 @@
 #include <sys/stat.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <dlfcn.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -84,6 +87,9 @@ extern char **environ;
 
 #if defined(__linux__)
 #include <linux/unistd.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#define XRDP_EPOLL 1
 #endif
 
 /* sys/ucred.h needs to be included to use struct xucred
@@ -100,6 +106,122 @@ extern char **environ;
 #define INADDR_NONE ((unsigned long)-1)
 #endif
 
+#if defined(XRDP_EPOLL)
+
+struct wait_set_fd
+{
+    int events; /* registered with epoll, zero if not registered */
+    int want; /* events asked for in this wait */
+    int want_gen;
+    int ready; /* events returned by epoll_wait */
+    int ready_gen;
+    tui32 tag; /* in the epoll data, events with another tag are stale */
+    int open_gen; /* g_fd_gens when registered, zero if not from os_calls */
+};
+
+struct wait_set
+{
+    struct wait_set *next;
+    int epfd;
+    int gen; /* bumped on each wait */
+    int fallback_gen; /* gen of the last wait done with select */
+    tui32 tag; /* last tag given out */
+    int rebuild; /* stale events seen, make a new epoll set */
+    struct wait_set_fd *fds; /* indexed by fd */
+    int fds_alloc;
+    int *reg; /* fds that are registered or asked for */
+    int reg_count;
+    int reg_alloc;
+    struct epoll_event *events;
+    int events_alloc;
+};
+
+/* all wait sets, so closing an fd through os_calls can take it out of
+   every set that has it before the fd number is reused, the mutex also
+   covers the fds arrays of the sets */
+static struct wait_set *g_wait_sets = 0;
+static pthread_mutex_t g_wait_sets_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* per fd, non zero from when os_calls opens it until g_fd_closing and
+   different each time, zero for fds opened some other way, under
+   g_wait_sets_mutex */
+static int *g_fd_gens = 0;
+static int g_fd_gens_alloc = 0;
+static int g_fd_gen = 0;
+
+/*****************************************************************************/
+/* call after open, an fd that is not marked here still works in a wait
+   set, it is just checked on every wait */
+static void
+g_fd_opened(int fd)
+{
+    int *gens;
+    int new_alloc;
+
+    if (fd < 1)
+    {
+        return;
+    }
+    pthread_mutex_lock(&g_wait_sets_mutex);
+    if (fd >= g_fd_gens_alloc)
+    {
+        new_alloc = fd + 256;
+        gens = (int *) g_malloc(sizeof(int) * new_alloc, 1);
+        if (gens == 0)
+        {
+            pthread_mutex_unlock(&g_wait_sets_mutex);
+            return;
+        }
+        g_memcpy(gens, g_fd_gens, sizeof(int) * g_fd_gens_alloc);
+        g_free(g_fd_gens);
+        g_fd_gens = gens;
+        g_fd_gens_alloc = new_alloc;
+    }
+    g_fd_gen++;
+    if (g_fd_gen < 1)
+    {
+        g_fd_gen = 1;
+    }
+    g_fd_gens[fd] = g_fd_gen;
+    pthread_mutex_unlock(&g_wait_sets_mutex);
+}
+
+/*****************************************************************************/
+/* call before close */
+static void
+g_fd_closing(int fd)
+{
+    struct wait_set *ws;
+    struct epoll_event ev;
+
+    if (fd < 1)
+    {
+        return;
+    }
+    pthread_mutex_lock(&g_wait_sets_mutex);
+    if (fd < g_fd_gens_alloc)
+    {
+        g_fd_gens[fd] = 0;
+    }
+    for (ws = g_wait_sets; ws != 0; ws = ws->next)
+    {
+        if ((fd < ws->fds_alloc) && (ws->fds[fd].events != 0))
+        {
+            g_memset(&ev, 0, sizeof(ev));
+            epoll_ctl(ws->epfd, EPOLL_CTL_DEL, fd, &ev);
+            ws->fds[fd].events = 0;
+        }
+    }
+    pthread_mutex_unlock(&g_wait_sets_mutex);
+}
+
+#else
+
+#define g_fd_opened(_fd)
+#define g_fd_closing(_fd)
+
+#endif
+
 /*****************************************************************************/
 int APP_CC
 g_rm_temp_dir(void)
@@ -420,6 +542,7 @@ g_tcp_socket(void)
     {
         return -1;
     }
+    g_fd_opened(rv);
 #if defined(XRDP_ENABLE_IPV6)
     option_len = sizeof(option_value);
     if (getsockopt(rv, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&option_value,
@@ -499,6 +622,49 @@ g_sck_set_send_buffer_bytes(int sck, int bytes)
     return 0;
 }
 
+/*****************************************************************************/
+/* bytes written to sck that the peer has not acked yet
+   returns error, 1 if the platform can not tell */
+int APP_CC
+g_sck_get_send_queue_bytes(int sck, int *bytes)
+{
+#if defined(TIOCOUTQ)
+    int value;
+
+    value = 0;
+    if (ioctl(sck, TIOCOUTQ, &value) != 0)
+    {
+        return 1;
+    }
+    *bytes = value;
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/*****************************************************************************/
+/* while corked, the kernel only sends full segments, uncorking sends what
+   is left right away
+   returns error, 1 if the platform has no cork */
+int APP_CC
+g_sck_set_cork(int sck, int cork)
+{
+#if defined(TCP_CORK)
+    int option_value;
+
+    option_value = cork ? 1 : 0;
+    if (setsockopt(sck, IPPROTO_TCP, TCP_CORK, (char *)&option_value,
+                   sizeof(option_value)) != 0)
+    {
+        return 1;
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
 /*****************************************************************************/
 /* returns error */
 int APP_CC
@@ -574,7 +740,11 @@ g_sck_local_socket(void)
 #if defined(_WIN32)
     return 0;
 #else
-    return socket(PF_LOCAL, SOCK_STREAM, 0);
+    int rv;
+
+    rv = socket(PF_LOCAL, SOCK_STREAM, 0);
+    g_fd_opened(rv);
+    return rv;
 #endif
 }
 
@@ -657,6 +827,7 @@ g_sck_close(int sck)
     g_write_ip_address(sck, ip, 255);
     log_message(LOG_LEVEL_INFO, "An established connection closed to "
                 "endpoint: %s", ip);
+    g_fd_closing(sck);
     close(sck);
 #endif
 }
@@ -979,6 +1150,11 @@ g_tcp_accept(int sck)
     ret = accept(sck, (struct sockaddr *)&s, &i);
     if(ret>0)
     {
+        g_fd_opened(ret);
+#if defined(FD_CLOEXEC)
+        /* nothing started with exec should get the connection */
+        fcntl(ret, F_SETFD, FD_CLOEXEC);
+#endif
         snprintf(ipAddr,255,"A connection received from: %s port %d"
         ,inet_ntoa(s.sin_addr),ntohs(s.sin_port));
         log_message(LOG_LEVEL_INFO,ipAddr);
@@ -1004,6 +1180,10 @@ g_sck_accept(int sck, char *addr, int addr_bytes, char *port, int port_bytes)
     ret = accept(sck, (struct sockaddr *)&s, &i);
     if (ret > 0)
     {
+        g_fd_opened(ret);
+#if defined(FD_CLOEXEC)
+        fcntl(ret, F_SETFD, FD_CLOEXEC);
+#endif
         g_snprintf(ipAddr, 255, "A connection received from: %s port %d",
                    inet_ntoa(s.sin_addr), ntohs(s.sin_port));
         log_message(LOG_LEVEL_INFO,ipAddr);
@@ -1103,6 +1283,35 @@ g_sck_send(int sck, const void *ptr, int len, int flags)
 #endif
 }
 
+/*****************************************************************************/
+/* gather send, ptrs and lens hold count buffers, returns bytes sent or -1
+   like g_sck_send */
+int APP_CC
+g_sck_sendv(int sck, const char **ptrs, const int *lens, int count)
+{
+#if defined(_WIN32)
+    if (count < 1)
+    {
+        return 0;
+    }
+    return send(sck, ptrs[0], lens[0], 0);
+#else
+    struct iovec iov[16];
+    int index;
+
+    if (count > 16)
+    {
+        count = 16;
+    }
+    for (index = 0; index < count; index++)
+    {
+        iov[index].iov_base = (void *) (ptrs[index]);
+        iov[index].iov_len = lens[index];
+    }
+    return writev(sck, iov, count);
+#endif
+}
+
 /*****************************************************************************/
 /* returns boolean */
 int APP_CC
@@ -1317,6 +1526,8 @@ g_create_wait_obj(char *name)
         close(fds[1]);
         return 0;
     }
+    g_fd_opened(fds[0]);
+    g_fd_opened(fds[1]);
     return (fds[1] << 16) | fds[0];
 #endif
 }
@@ -1516,6 +1727,8 @@ g_delete_wait_obj(tintptr obj)
     {
         return 0;
     }
+    g_fd_closing(obj & 0xffff);
+    g_fd_closing(obj >> 16);
     close(obj & 0xffff);
     close(obj >> 16);
     return 0;
@@ -1654,6 +1867,470 @@ g_obj_wait(tintptr *read_objs, int rcount, tintptr *write_objs, int wcount,
 #endif
 }
 
+/*****************************************************************************/
+/* a wait set keeps its fds registered with the kernel between waits so a
+   wait only costs the fds that changed and the fds that are ready
+   fds opened and closed through os_calls cost nothing more, any other fd,
+   from a library or a backend module, may be closed and its number
+   reused behind the set's back so it is checked with one epoll_ctl on
+   each wait
+   returns 0 if there is no wait set support, g_obj_wait_set and
+   g_is_wait_obj_ready still work with a zero wait set */
+tintptr APP_CC
+g_create_wait_set(void)
+{
+#if defined(XRDP_EPOLL)
+    struct wait_set *self;
+
+    self = (struct wait_set *) g_malloc(sizeof(struct wait_set), 1);
+    if (self == 0)
+    {
+        return 0;
+    }
+    self->epfd = epoll_create(64);
+    if (self->epfd == -1)
+    {
+        g_free(self);
+        return 0;
+    }
+    fcntl(self->epfd, F_SETFD, FD_CLOEXEC);
+    pthread_mutex_lock(&g_wait_sets_mutex);
+    self->next = g_wait_sets;
+    g_wait_sets = self;
+    pthread_mutex_unlock(&g_wait_sets_mutex);
+    return (tintptr) self;
+#else
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+void APP_CC
+g_delete_wait_set(tintptr wait_set)
+{
+#if defined(XRDP_EPOLL)
+    struct wait_set *self;
+    struct wait_set **pws;
+
+    self = (struct wait_set *) wait_set;
+    if (self == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&g_wait_sets_mutex);
+    for (pws = &g_wait_sets; *pws != 0; pws = &((*pws)->next))
+    {
+        if (*pws == self)
+        {
+            *pws = self->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_wait_sets_mutex);
+    close(self->epfd);
+    g_free(self->fds);
+    g_free(self->reg);
+    g_free(self->events);
+    g_free(self);
+#endif
+}
+
+#if defined(XRDP_EPOLL)
+
+/*****************************************************************************/
+/* returns error */
+static int
+g_wait_set_want(struct wait_set *self, int fd, int events)
+{
+    struct wait_set_fd *wfd;
+    int *reg;
+    int new_alloc;
+
+    if (fd < 1)
+    {
+        return 0;
+    }
+    if (fd >= self->fds_alloc)
+    {
+        new_alloc = self->fds_alloc * 2;
+        if (new_alloc < fd + 1)
+        {
+            new_alloc = fd + 64;
+        }
+        wfd = (struct wait_set_fd *)
+              g_malloc(sizeof(struct wait_set_fd) * new_alloc, 1);
+        if (wfd == 0)
+        {
+            return 1;
+        }
+        g_memcpy(wfd, self->fds, sizeof(struct wait_set_fd) * self->fds_alloc);
+        g_free(self->fds);
+        self->fds = wfd;
+        self->fds_alloc = new_alloc;
+    }
+    wfd = self->fds + fd;
+    if (wfd->want_gen != self->gen)
+    {
+        wfd->want_gen = self->gen;
+        wfd->want = 0;
+        if (wfd->events == 0)
+        {
+            /* not registered, remember it so it gets added */
+            if (self->reg_count >= self->reg_alloc)
+            {
+                new_alloc = self->reg_alloc < 16 ? 32 : self->reg_alloc * 2;
+                reg = (int *) g_malloc(sizeof(int) * new_alloc, 0);
+                if (reg == 0)
+                {
+                    return 1;
+                }
+                g_memcpy(reg, self->reg, sizeof(int) * self->reg_count);
+                g_free(self->reg);
+                self->reg = reg;
+                self->reg_alloc = new_alloc;
+            }
+            self->reg[self->reg_count++] = fd;
+        }
+    }
+    wfd->want |= events;
+    return 0;
+}
+
+/*****************************************************************************/
+static tui64
+g_wait_set_data(int fd, tui32 tag)
+{
+    return (((tui64) tag) << 32) | (tui32) fd;
+}
+
+/*****************************************************************************/
+/* zero is never given out, it is the tag of an fd that is not registered */
+static tui32
+g_wait_set_next_tag(struct wait_set *self)
+{
+    return (self->tag + 1 == 0) ? 1 : self->tag + 1;
+}
+
+/*****************************************************************************/
+/* add or change fd in the epoll set with a new tag
+   returns error */
+static int
+g_wait_set_ctl(struct wait_set *self, int fd, struct wait_set_fd *wfd,
+               int gen)
+{
+    struct epoll_event ev;
+    int rv;
+
+    self->tag = g_wait_set_next_tag(self);
+    g_memset(&ev, 0, sizeof(ev));
+    ev.events = wfd->want;
+    ev.data.u64 = g_wait_set_data(fd, self->tag);
+    if (wfd->events == 0)
+    {
+        rv = epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev);
+        if ((rv != 0) && (errno == EEXIST))
+        {
+            rv = epoll_ctl(self->epfd, EPOLL_CTL_MOD, fd, &ev);
+        }
+    }
+    else
+    {
+        rv = epoll_ctl(self->epfd, EPOLL_CTL_MOD, fd, &ev);
+        if ((rv != 0) && (errno == ENOENT))
+        {
+            rv = epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+    if (rv != 0)
+    {
+        return 1;
+    }
+    wfd->events = wfd->want;
+    wfd->tag = self->tag;
+    wfd->open_gen = gen;
+    return 0;
+}
+
+/*****************************************************************************/
+/* fd is registered, returns 1 if the registration is still for the file
+   fd is now, 0 if fd was added again, -1 on error
+   fds from os_calls are checked with g_fd_gens, any other fd can have
+   been closed and its number reused without the set knowing, epoll keys
+   registrations on the fd and the file so an add only works if the fd is
+   now a different file */
+static int
+g_wait_set_check(struct wait_set *self, int fd, struct wait_set_fd *wfd,
+                 int gen)
+{
+    struct epoll_event ev;
+    tui32 tag;
+
+    if ((gen != 0) && (gen == wfd->open_gen))
+    {
+        return 1;
+    }
+    tag = g_wait_set_next_tag(self);
+    g_memset(&ev, 0, sizeof(ev));
+    ev.events = wfd->want;
+    ev.data.u64 = g_wait_set_data(fd, tag);
+    if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    {
+        /* the old file is gone from the set with its last close, or it
+           is still open somewhere and g_obj_wait_set sees stale events */
+        self->tag = tag;
+        wfd->events = wfd->want;
+        wfd->tag = tag;
+        wfd->open_gen = gen;
+        return 0;
+    }
+    if (errno != EEXIST)
+    {
+        return -1;
+    }
+    wfd->open_gen = gen;
+    return 1;
+}
+
+/*****************************************************************************/
+/* bring the epoll set in line with what was asked for in this wait
+   returns error */
+static int
+g_wait_set_sync(struct wait_set *self)
+{
+    struct wait_set_fd *wfd;
+    struct epoll_event ev;
+    int index;
+    int fd;
+    int gen;
+    int rv;
+    int error;
+
+    error = 0;
+    for (index = self->reg_count - 1; index >= 0; index--)
+    {
+        fd = self->reg[index];
+        wfd = self->fds + fd;
+        if (wfd->want_gen != self->gen)
+        {
+            /* no longer wanted */
+            if (wfd->events != 0)
+            {
+                g_memset(&ev, 0, sizeof(ev));
+                epoll_ctl(self->epfd, EPOLL_CTL_DEL, fd, &ev);
+                wfd->events = 0;
+                wfd->tag = 0;
+            }
+            self->reg_count--;
+            self->reg[index] = self->reg[self->reg_count];
+            continue;
+        }
+        gen = (fd < g_fd_gens_alloc) ? g_fd_gens[fd] : 0;
+        rv = 1;
+        if (wfd->events != 0)
+        {
+            rv = g_wait_set_check(self, fd, wfd, gen);
+            if (rv == 0)
+            {
+                continue;
+            }
+        }
+        if ((rv == 1) && (wfd->events == wfd->want))
+        {
+            continue;
+        }
+        if ((rv != 1) || (g_wait_set_ctl(self, fd, wfd, gen) != 0))
+        {
+            /* bad fd or an fd epoll does not support, it is added to the
+               list again if it is asked for in the next wait */
+            wfd->events = 0;
+            wfd->tag = 0;
+            self->reg_count--;
+            self->reg[index] = self->reg[self->reg_count];
+            error = 1;
+        }
+    }
+    return error;
+}
+
+/*****************************************************************************/
+/* a registration the set no longer knows about is giving events, it can
+   not be removed by fd so start over with a new epoll set
+   returns error */
+static int
+g_wait_set_rebuild(struct wait_set *self)
+{
+    int epfd;
+    int index;
+
+    epfd = epoll_create(64);
+    if (epfd == -1)
+    {
+        return 1;
+    }
+    fcntl(epfd, F_SETFD, FD_CLOEXEC);
+    close(self->epfd);
+    self->epfd = epfd;
+    for (index = 0; index < self->reg_count; index++)
+    {
+        self->fds[self->reg[index]].events = 0;
+    }
+    return 0;
+}
+
+#endif
+
+/*****************************************************************************/
+/* like g_obj_wait but using a wait set from g_create_wait_set, the objects
+   that are ready can be checked with g_is_wait_obj_ready until the next
+   call, the set is level triggered
+   returns error */
+int APP_CC
+g_obj_wait_set(tintptr wait_set, tintptr *read_objs, int rcount,
+               tintptr *write_objs, int wcount, int mstimeout)
+{
+#if defined(XRDP_EPOLL)
+    struct wait_set *self;
+    struct wait_set_fd *wfd;
+    tui32 tag;
+    int index;
+    int count;
+    int error;
+    int fd;
+
+    self = (struct wait_set *) wait_set;
+    if (self == 0)
+    {
+        return g_obj_wait(read_objs, rcount, write_objs, wcount, mstimeout);
+    }
+    if (((read_objs == 0) && (rcount > 0)) ||
+        ((write_objs == 0) && (wcount > 0)))
+    {
+        g_writeln("Programming error read_objs or write_objs is null");
+        return 1;
+    }
+    self->gen++;
+    if (self->gen == 0)
+    {
+        self->gen++;
+    }
+    error = 0;
+    pthread_mutex_lock(&g_wait_sets_mutex);
+    if (self->rebuild)
+    {
+        self->rebuild = 0;
+        error = g_wait_set_rebuild(self);
+    }
+    for (index = 0; index < rcount; index++)
+    {
+        error |= g_wait_set_want(self, read_objs[index] & 0xffff, EPOLLIN);
+    }
+    for (index = 0; index < wcount; index++)
+    {
+        error |= g_wait_set_want(self, (int) (write_objs[index]), EPOLLOUT);
+    }
+    if (error == 0)
+    {
+        error = g_wait_set_sync(self);
+    }
+    pthread_mutex_unlock(&g_wait_sets_mutex);
+    if (error != 0)
+    {
+        /* something could not be registered, select still works */
+        self->fallback_gen = self->gen;
+        return g_obj_wait(read_objs, rcount, write_objs, wcount, mstimeout);
+    }
+    if ((self->events_alloc < self->reg_count) || (self->events_alloc < 1))
+    {
+        g_free(self->events);
+        self->events_alloc = self->reg_count + 32;
+        self->events = (struct epoll_event *)
+                       g_malloc(sizeof(struct epoll_event) *
+                                self->events_alloc, 0);
+        if (self->events == 0)
+        {
+            self->events_alloc = 0;
+            self->fallback_gen = self->gen;
+            return g_obj_wait(read_objs, rcount, write_objs, wcount,
+                              mstimeout);
+        }
+    }
+    count = epoll_wait(self->epfd, self->events, self->events_alloc,
+                       mstimeout < 1 ? -1 : mstimeout);
+    if (count < 0)
+    {
+        /* these are not really errors */
+        if (errno == EINTR) /* signal occurred */
+        {
+            return 0;
+        }
+        return 1; /* error */
+    }
+    pthread_mutex_lock(&g_wait_sets_mutex);
+    for (index = 0; index < count; index++)
+    {
+        fd = (int) (self->events[index].data.u64 & 0xffffffff);
+        tag = (tui32) (self->events[index].data.u64 >> 32);
+        if ((fd >= self->fds_alloc) || (self->fds[fd].tag != tag))
+        {
+            /* from a file closed outside os_calls that is still open
+               somewhere else */
+            self->rebuild = 1;
+            continue;
+        }
+        wfd = self->fds + fd;
+        if (wfd->events == 0)
+        {
+            /* closed by another thread during the wait */
+            continue;
+        }
+        wfd->ready = self->events[index].events;
+        wfd->ready_gen = self->gen;
+    }
+    pthread_mutex_unlock(&g_wait_sets_mutex);
+    return 0;
+#else
+    return g_obj_wait(read_objs, rcount, write_objs, wcount, mstimeout);
+#endif
+}
+
+/*****************************************************************************/
+/* returns boolean, if obj was ready in the last g_obj_wait_set
+   obj must have been passed to that wait, write selects the write list */
+int APP_CC
+g_is_wait_obj_ready(tintptr wait_set, tintptr obj, int write)
+{
+#if defined(XRDP_EPOLL)
+    struct wait_set *self;
+    struct wait_set_fd *wfd;
+    int fd;
+
+    self = (struct wait_set *) wait_set;
+    if ((self != 0) && (self->fallback_gen != self->gen))
+    {
+        fd = write ? (int) obj : (int) (obj & 0xffff);
+        if ((fd < 1) || (fd >= self->fds_alloc))
+        {
+            return 0;
+        }
+        wfd = self->fds + fd;
+        if (wfd->ready_gen != self->gen)
+        {
+            return 0;
+        }
+        if (write)
+        {
+            return (wfd->ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0;
+        }
+        return (wfd->ready & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0;
+    }
+#endif
+    if (write)
+    {
+        return g_sck_can_send((int) obj, 0);
+    }
+    return g_is_wait_obj_set(obj);
+}
+
 /*****************************************************************************/
 void APP_CC
 g_random(char *data, int len)
@@ -1768,6 +2445,69 @@ g_file_open_ex(const char *file_name, int aread, int awrite,
 #endif
 }
 
+/*****************************************************************************/
+/* 0x644 style mode to mode_t bits */
+static int
+g_mode_from_hex(int flags)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    int fl;
+
+    fl = 0;
+    fl |= (flags & 0x4000) ? S_ISUID : 0;
+    fl |= (flags & 0x2000) ? S_ISGID : 0;
+    fl |= (flags & 0x1000) ? S_ISVTX : 0;
+    fl |= (flags & 0x0400) ? S_IRUSR : 0;
+    fl |= (flags & 0x0200) ? S_IWUSR : 0;
+    fl |= (flags & 0x0100) ? S_IXUSR : 0;
+    fl |= (flags & 0x0040) ? S_IRGRP : 0;
+    fl |= (flags & 0x0020) ? S_IWGRP : 0;
+    fl |= (flags & 0x0010) ? S_IXGRP : 0;
+    fl |= (flags & 0x0004) ? S_IROTH : 0;
+    fl |= (flags & 0x0002) ? S_IWOTH : 0;
+    fl |= (flags & 0x0001) ? S_IXOTH : 0;
+    return fl;
+#endif
+}
+
+/*****************************************************************************/
+/* creates a new file for read and write, fails if anything, even a
+   symlink, is already there, mode_hex is like g_chmod_hex and is not
+   masked by the umask
+   returns -1 on error */
+int APP_CC
+g_file_open_new(const char *file_name, int mode_hex)
+{
+#if defined(_WIN32)
+    return -1;
+#else
+    int fd;
+    int flags;
+
+    flags = O_RDWR | O_CREAT | O_EXCL;
+#if defined(O_NOFOLLOW)
+    flags |= O_NOFOLLOW;
+#endif
+#if defined(O_CLOEXEC)
+    flags |= O_CLOEXEC;
+#endif
+    fd = open(file_name, flags, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (fchmod(fd, g_mode_from_hex(mode_hex)) != 0)
+    {
+        close(fd);
+        unlink(file_name);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
 /*****************************************************************************/
 /* returns error, always 0 */
 int APP_CC
@@ -1776,6 +2516,7 @@ g_file_close(int fd)
 #if defined(_WIN32)
     CloseHandle((HANDLE)fd);
 #else
+    g_fd_closing(fd);
     close(fd);
 #endif
     return 0;
@@ -1823,6 +2564,38 @@ g_file_write(int fd, char *ptr, int len)
 #endif
 }
 
+/*****************************************************************************/
+/* map size bytes of an open file shared and writable,
+   returns nil on error */
+void *APP_CC
+g_file_map(int fd, int size)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    void *rv;
+
+    rv = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (rv == MAP_FAILED)
+    {
+        return 0;
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+/* returns error */
+int APP_CC
+g_file_unmap(void *ptr, int size)
+{
+#if defined(_WIN32)
+    return 1;
+#else
+    return munmap(ptr, size) != 0;
+#endif
+}
+
 /*****************************************************************************/
 /* move file pointer, returns offset on success, -1 on failure */
 int APP_CC
@@ -1880,22 +2653,7 @@ g_chmod_hex(const char *filename, int flags)
 #if defined(_WIN32)
     return 0;
 #else
-    int fl;
-
-    fl = 0;
-    fl |= (flags & 0x4000) ? S_ISUID : 0;
-    fl |= (flags & 0x2000) ? S_ISGID : 0;
-    fl |= (flags & 0x1000) ? S_ISVTX : 0;
-    fl |= (flags & 0x0400) ? S_IRUSR : 0;
-    fl |= (flags & 0x0200) ? S_IWUSR : 0;
-    fl |= (flags & 0x0100) ? S_IXUSR : 0;
-    fl |= (flags & 0x0040) ? S_IRGRP : 0;
-    fl |= (flags & 0x0020) ? S_IWGRP : 0;
-    fl |= (flags & 0x0010) ? S_IXGRP : 0;
-    fl |= (flags & 0x0004) ? S_IROTH : 0;
-    fl |= (flags & 0x0002) ? S_IWOTH : 0;
-    fl |= (flags & 0x0001) ? S_IXOTH : 0;
-    return chmod(filename, fl);
+    return chmod(filename, g_mode_from_hex(flags));
 #endif
 }
 
@@ -2779,6 +3537,31 @@ g_fork(void)
 #endif
 }
 
+/*****************************************************************************/
+/* closes every fd from start_fd up except keep_fd, for a child after fork
+   that should not hold on to what other threads of the parent had open */
+void APP_CC
+g_close_fds(int start_fd, int keep_fd)
+{
+#if !defined(_WIN32)
+    int fd;
+    int max_fd;
+
+    max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0)
+    {
+        max_fd = 1024;
+    }
+    for (fd = start_fd; fd < max_fd; fd++)
+    {
+        if (fd != keep_fd)
+        {
+            close(fd);
+        }
+    }
+#endif
+}
+
 /*****************************************************************************/
 /* does not work in win32 */
 int APP_CC
@@ -2981,9 +3764,30 @@ g_getuser_info(const char *username, int *gid, int *uid, char *shell,
 #if defined(_WIN32)
     return 1;
 #else
+    struct passwd pwd;
     struct passwd *pwd_1;
+    char *buf;
+    int buf_size;
+    int rv;
+
+    /* reentrant lookup, sesman calls this from several threads */
+    buf_size = 16 * 1024;
+    pwd_1 = 0;
+    buf = (char *)g_malloc(buf_size, 0);
+
+    while (buf != 0)
+    {
+        rv = getpwnam_r(username, &pwd, buf, buf_size, &pwd_1);
 
-    pwd_1 = getpwnam(username);
+        if ((rv != ERANGE) || (buf_size >= 1024 * 1024))
+        {
+            break;
+        }
+
+        g_free(buf);
+        buf_size *= 2;
+        buf = (char *)g_malloc(buf_size, 0);
+    }
 
     if (pwd_1 != 0)
     {
@@ -3012,9 +3816,11 @@ g_getuser_info(const char *username, int *gid, int *uid, char *shell,
             g_strcpy(gecos, pwd_1->pw_gecos);
         }
 
+        g_free(buf);
         return 0;
     }
 
+    g_free(buf);
     return 1;
 #endif
 }
@@ -3028,9 +3834,29 @@ g_getgroup_info(const char *groupname, int *gid)
 #if defined(_WIN32)
     return 1;
 #else
+    struct group grp;
     struct group *g;
+    char *buf;
+    int buf_size;
+    int rv;
 
-    g = getgrnam(groupname);
+    buf_size = 16 * 1024;
+    g = 0;
+    buf = (char *)g_malloc(buf_size, 0);
+
+    while (buf != 0)
+    {
+        rv = getgrnam_r(groupname, &grp, buf, buf_size, &g);
+
+        if ((rv != ERANGE) || (buf_size >= 1024 * 1024))
+        {
+            break;
+        }
+
+        g_free(buf);
+        buf_size *= 2;
+        buf = (char *)g_malloc(buf_size, 0);
+    }
 
     if (g != 0)
     {
@@ -3039,9 +3865,11 @@ g_getgroup_info(const char *groupname, int *gid)
             *gid = g->gr_gid;
         }
 
+        g_free(buf);
         return 0;
     }
 
+    g_free(buf);
     return 1;
 #endif
 }
@@ -3056,13 +3884,34 @@ g_check_user_in_group(const char *username, int gid, int *ok)
 #if defined(_WIN32)
     return 1;
 #else
+    struct group grp;
     struct group *groups;
+    char *buf;
+    int buf_size;
+    int rv;
     int i;
 
-    groups = getgrgid(gid);
+    buf_size = 16 * 1024;
+    groups = 0;
+    buf = (char *)g_malloc(buf_size, 0);
+
+    while (buf != 0)
+    {
+        rv = getgrgid_r(gid, &grp, buf, buf_size, &groups);
+
+        if ((rv != ERANGE) || (buf_size >= 1024 * 1024))
+        {
+            break;
+        }
+
+        g_free(buf);
+        buf_size *= 2;
+        buf = (char *)g_malloc(buf_size, 0);
+    }
 
     if (groups == 0)
     {
+        g_free(buf);
         return 1;
     }
 
@@ -3080,6 +3929,7 @@ g_check_user_in_group(const char *username, int gid, int *ok)
         i++;
     }
 
+    g_free(buf);
     return 0;
 #endif
 }
@@ -3132,6 +3982,22 @@ g_time3(void)
 #endif
 }
 
+/*****************************************************************************/
+/* returns time in microseconds, uses gettimeofday
+   does not work in win32 */
+tui64 APP_CC
+g_time4(void)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    struct timeval tp;
+
+    gettimeofday(&tp, 0);
+    return ((tui64) tp.tv_sec) * 1000000 + tp.tv_usec;
+#endif
+}
+
 /******************************************************************************/
 /******************************************************************************/
 struct bmp_magic
@@ -61,6 +61,8 @@ int APP_CC      g_tcp_set_keepalive(int sck);
 int APP_CC      g_tcp_socket(void);
 int APP_CC      g_sck_set_send_buffer_bytes(int sck, int bytes);
 int APP_CC      g_sck_get_send_buffer_bytes(int sck, int *bytes);
+int APP_CC      g_sck_get_send_queue_bytes(int sck, int *bytes);
+int APP_CC      g_sck_set_cork(int sck, int cork);
 int APP_CC      g_sck_set_recv_buffer_bytes(int sck, int bytes);
 int APP_CC      g_sck_get_recv_buffer_bytes(int sck, int *bytes);
 int APP_CC      g_sck_local_socket(void);
@@ -78,6 +80,8 @@ int APP_CC      g_sck_accept(int sck, char *addr, int addr_bytes,
                              char *port, int port_bytes);
 int APP_CC      g_sck_recv(int sck, void* ptr, int len, int flags);
 int APP_CC      g_sck_send(int sck, const void* ptr, int len, int flags);
+int APP_CC      g_sck_sendv(int sck, const char **ptrs, const int *lens,
+                            int count);
 int APP_CC      g_sck_last_error_would_block(int sck);
 int APP_CC      g_sck_socket_ok(int sck);
 int APP_CC      g_sck_can_send(int sck, int millis);
@@ -94,13 +98,21 @@ int APP_CC      g_is_wait_obj_set(tintptr obj);
 int APP_CC      g_delete_wait_obj(tintptr obj);
 int APP_CC      g_obj_wait(tintptr* read_objs, int rcount, tintptr* write_objs,
                            int wcount,int mstimeout);
+tintptr APP_CC  g_create_wait_set(void);
+void APP_CC     g_delete_wait_set(tintptr wait_set);
+int APP_CC      g_obj_wait_set(tintptr wait_set, tintptr* read_objs, int rcount,
+                               tintptr* write_objs, int wcount, int mstimeout);
+int APP_CC      g_is_wait_obj_ready(tintptr wait_set, tintptr obj, int write);
 void APP_CC     g_random(char* data, int len);
 int APP_CC      g_abs(int i);
 int APP_CC      g_memcmp(const void* s1, const void* s2, int len);
 int APP_CC      g_file_open(const char* file_name);
 int APP_CC      g_file_open_ex(const char *file_name, int aread, int awrite,
                                int acreate, int atrunc);
+int APP_CC      g_file_open_new(const char *file_name, int mode_hex);
 int APP_CC      g_file_close(int fd);
+void * APP_CC   g_file_map(int fd, int size);
+int APP_CC      g_file_unmap(void *ptr, int size);
 int APP_CC      g_file_read(int fd, char* ptr, int len);
 int APP_CC      g_file_write(int fd, char* ptr, int len);
 int APP_CC      g_file_seek(int fd, int offset);
@@ -152,6 +164,7 @@ void APP_CC     g_signal_terminate(void (*func)(int));
 void APP_CC     g_signal_pipe(void (*func)(int));
 void APP_CC     g_signal_usr1(void (*func)(int));
 int APP_CC      g_fork(void);
+void APP_CC     g_close_fds(int start_fd, int keep_fd);
 int APP_CC      g_setgid(int pid);
 int APP_CC      g_initgroups(const char* user, int gid);
 int APP_CC      g_getuid(void);
@@ -172,6 +185,7 @@ int APP_CC      g_check_user_in_group(const char* username, int gid, int* ok);
 int APP_CC      g_time1(void);
 int APP_CC      g_time2(void);
 int APP_CC      g_time3(void);
+tui64 APP_CC    g_time4(void);
 int APP_CC      g_save_to_bmp(const char* filename, char* data, int stride_bytes,
                               int width, int height, int depth, int bits_per_pixel);
 int APP_CC      g_text2bool(const char *s);
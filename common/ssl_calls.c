@@ -40,6 +40,39 @@
 #define OLD_RSA_GEN1
 #endif
 
+/* openssl 1.1 made these structs opaque, give older versions the 1.1
+   accessors so there is one code path */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/*****************************************************************************/
+static HMAC_CTX *
+HMAC_CTX_new(void)
+{
+    HMAC_CTX *hmac_ctx;
+
+    hmac_ctx = (HMAC_CTX *) g_malloc(sizeof(HMAC_CTX), 1);
+    HMAC_CTX_init(hmac_ctx);
+    return hmac_ctx;
+}
+
+/*****************************************************************************/
+static void
+HMAC_CTX_free(HMAC_CTX *hmac_ctx)
+{
+    HMAC_CTX_cleanup(hmac_ctx);
+    g_free(hmac_ctx);
+}
+
+/*****************************************************************************/
+static void
+RSA_get0_key(const RSA *key, const BIGNUM **n, const BIGNUM **e,
+             const BIGNUM **d)
+{
+    *n = key->n;
+    *e = key->e;
+    *d = key->d;
+}
+#endif
+
 /*****************************************************************************/
 int
 ssl_init(void)
@@ -170,8 +203,7 @@ ssl_des3_encrypt_info_create(const char *key, const char* ivec)
     const tui8 *lkey;
     const tui8 *livec;
 
-    des3_ctx = (EVP_CIPHER_CTX *) g_malloc(sizeof(EVP_CIPHER_CTX), 1);
-    EVP_CIPHER_CTX_init(des3_ctx);
+    des3_ctx = EVP_CIPHER_CTX_new();
     lkey = (const tui8 *) key;
     livec = (const tui8 *) ivec;
     EVP_EncryptInit_ex(des3_ctx, EVP_des_ede3_cbc(), NULL, lkey, livec);
@@ -187,8 +219,7 @@ ssl_des3_decrypt_info_create(const char *key, const char* ivec)
     const tui8 *lkey;
     const tui8 *livec;
 
-    des3_ctx = g_malloc(sizeof(EVP_CIPHER_CTX), 1);
-    EVP_CIPHER_CTX_init(des3_ctx);
+    des3_ctx = EVP_CIPHER_CTX_new();
     lkey = (const tui8 *) key;
     livec = (const tui8 *) ivec;
     EVP_DecryptInit_ex(des3_ctx, EVP_des_ede3_cbc(), NULL, lkey, livec);
@@ -205,8 +236,7 @@ ssl_des3_info_delete(void *des3)
     des3_ctx = (EVP_CIPHER_CTX *) des3;
     if (des3_ctx != 0)
     {
-        EVP_CIPHER_CTX_cleanup(des3_ctx);
-        g_free(des3_ctx);
+        EVP_CIPHER_CTX_free(des3_ctx);
     }
 }
 
@@ -250,8 +280,7 @@ ssl_hmac_info_create(void)
 {
     HMAC_CTX *hmac_ctx;
 
-    hmac_ctx = (HMAC_CTX *) g_malloc(sizeof(HMAC_CTX), 1);
-    HMAC_CTX_init(hmac_ctx);
+    hmac_ctx = HMAC_CTX_new();
     return hmac_ctx;
 }
 
@@ -264,8 +293,7 @@ ssl_hmac_info_delete(void *hmac)
     hmac_ctx = (HMAC_CTX *) hmac;
     if (hmac_ctx != 0)
     {
-        HMAC_CTX_cleanup(hmac_ctx);
-        g_free(hmac_ctx);
+        HMAC_CTX_free(hmac_ctx);
     }
 }
 
@@ -332,10 +360,10 @@ ssl_mod_exp(char *out, int out_len, char *in, int in_len,
             char *mod, int mod_len, char *exp, int exp_len)
 {
     BN_CTX *ctx;
-    BIGNUM lmod;
-    BIGNUM lexp;
-    BIGNUM lin;
-    BIGNUM lout;
+    BIGNUM *lmod;
+    BIGNUM *lexp;
+    BIGNUM *lin;
+    BIGNUM *lout;
     int rv;
     char *l_out;
     char *l_in;
@@ -353,15 +381,15 @@ ssl_mod_exp(char *out, int out_len, char *in, int in_len,
     ssl_reverse_it(l_mod, mod_len);
     ssl_reverse_it(l_exp, exp_len);
     ctx = BN_CTX_new();
-    BN_init(&lmod);
-    BN_init(&lexp);
-    BN_init(&lin);
-    BN_init(&lout);
-    BN_bin2bn((tui8 *)l_mod, mod_len, &lmod);
-    BN_bin2bn((tui8 *)l_exp, exp_len, &lexp);
-    BN_bin2bn((tui8 *)l_in, in_len, &lin);
-    BN_mod_exp(&lout, &lin, &lexp, &lmod, ctx);
-    rv = BN_bn2bin(&lout, (tui8 *)l_out);
+    lmod = BN_new();
+    lexp = BN_new();
+    lin = BN_new();
+    lout = BN_new();
+    BN_bin2bn((tui8 *)l_mod, mod_len, lmod);
+    BN_bin2bn((tui8 *)l_exp, exp_len, lexp);
+    BN_bin2bn((tui8 *)l_in, in_len, lin);
+    BN_mod_exp(lout, lin, lexp, lmod, ctx);
+    rv = BN_bn2bin(lout, (tui8 *)l_out);
 
     if (rv <= out_len)
     {
@@ -373,10 +401,10 @@ ssl_mod_exp(char *out, int out_len, char *in, int in_len,
         rv = 0;
     }
 
-    BN_free(&lin);
-    BN_free(&lout);
-    BN_free(&lexp);
-    BN_free(&lmod);
+    BN_free(lin);
+    BN_free(lout);
+    BN_free(lexp);
+    BN_free(lmod);
     BN_CTX_free(ctx);
     g_free(l_out);
     g_free(l_in);
@@ -466,6 +494,9 @@ ssl_gen_key_xrdp1(int key_size_in_bits, char *exp, int exp_len,
 {
     BIGNUM *my_e;
     RSA *my_key;
+    const BIGNUM *n;
+    const BIGNUM *e;
+    const BIGNUM *d;
     char *lexp;
     char *lmod;
     char *lpri;
@@ -490,25 +521,26 @@ ssl_gen_key_xrdp1(int key_size_in_bits, char *exp, int exp_len,
 
     if (error == 0)
     {
-        len = BN_num_bytes(my_key->n);
+        RSA_get0_key(my_key, &n, &e, &d);
+        len = BN_num_bytes(n);
         error = len != mod_len;
     }
 
     if (error == 0)
     {
-        BN_bn2bin(my_key->n, (tui8 *)lmod);
+        BN_bn2bin(n, (tui8 *)lmod);
         ssl_reverse_it(lmod, mod_len);
     }
 
     if (error == 0)
     {
-        len = BN_num_bytes(my_key->d);
+        len = BN_num_bytes(d);
         error = len != pri_len;
     }
 
     if (error == 0)
     {
-        BN_bn2bin(my_key->d, (tui8 *)lpri);
+        BN_bn2bin(d, (tui8 *)lpri);
         ssl_reverse_it(lpri, pri_len);
     }
 
@@ -582,7 +614,7 @@ ssl_tls_print_error(char *func, SSL *connection, int value)
 
 /*****************************************************************************/
 int APP_CC
-ssl_tls_accept(struct ssl_tls *self)
+ssl_tls_accept(struct ssl_tls *self, int ktls)
 {
     int connection_status;
     long options = 0;
@@ -624,6 +656,20 @@ ssl_tls_accept(struct ssl_tls *self)
      */
     options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
 
+#if defined(SSL_OP_ENABLE_KTLS)
+    /**
+     * SSL_OP_ENABLE_KTLS:
+     *
+     * Once the handshake is done, openssl passes the keys to the kernel
+     * tls module if it and the negotiated cipher allow it. The kernel
+     * then builds the records, so writes can go to the socket directly.
+     */
+    if (ktls)
+    {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+#endif
+
     self->ctx = SSL_CTX_new(SSLv23_server_method());
     /* set context options */
     SSL_CTX_set_mode(self->ctx,
@@ -678,7 +724,17 @@ ssl_tls_accept(struct ssl_tls *self)
              * retry when SSL_get_error returns:
              *     SSL_ERROR_WANT_READ
              *     SSL_ERROR_WANT_WRITE
+             * once the socket is ready
              */
+            if (SSL_get_error(self->ssl, connection_status) ==
+                    SSL_ERROR_WANT_WRITE)
+            {
+                g_sck_can_send(self->trans->sck, 100);
+            }
+            else
+            {
+                g_sck_can_recv(self->trans->sck, 100);
+            }
         }
         else
         {
@@ -688,6 +744,23 @@ ssl_tls_accept(struct ssl_tls *self)
 
     g_writeln("ssl_tls_accept: TLS connection accepted");
 
+    if (ktls)
+    {
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+        self->ktls_send = BIO_get_ktls_send(SSL_get_wbio(self->ssl));
+#endif
+        if (self->ktls_send)
+        {
+            g_writeln("ssl_tls_accept: kernel TLS send enabled, cipher %s",
+                      SSL_get_cipher_name(self->ssl));
+        }
+        else
+        {
+            g_writeln("ssl_tls_accept: kernel TLS not available for cipher "
+                      "%s, using openssl", SSL_get_cipher_name(self->ssl));
+        }
+    }
+
     return 0;
 }
 
@@ -720,7 +793,16 @@ ssl_tls_disconnect(struct ssl_tls *self)
              * retry when SSL_get_error returns:
              *     SSL_ERROR_WANT_READ
              *     SSL_ERROR_WANT_WRITE
+             * once the socket is ready
              */
+            if (SSL_get_error(self->ssl, status) == SSL_ERROR_WANT_WRITE)
+            {
+                g_sck_can_send(self->trans->sck, 100);
+            }
+            else
+            {
+                g_sck_can_recv(self->trans->sck, 100);
+            }
         }
     }
     return 0;
@@ -745,41 +827,45 @@ ssl_tls_delete(struct ssl_tls *self)
 }
 
 /*****************************************************************************/
+/* map an SSL_read or SSL_write result to SSL_TLS_WANT_*, 0 if the call
+   did not stop on I/O, error is set if it failed for another reason */
+static int APP_CC
+ssl_tls_get_want(struct ssl_tls *tls, const char *func, int status,
+                 int *error)
+{
+    *error = 0;
+    switch (SSL_get_error(tls->ssl, status))
+    {
+        case SSL_ERROR_NONE:
+            return 0;
+
+        case SSL_ERROR_WANT_READ:
+            return SSL_TLS_WANT_READ;
+
+        case SSL_ERROR_WANT_WRITE:
+            return SSL_TLS_WANT_WRITE;
+
+        default:
+            ssl_tls_print_error((char *) func, tls->ssl, status);
+            *error = 1;
+            return 0;
+    }
+}
+
+/*****************************************************************************/
+/* returns bytes read or -1, does not block, if -1 and tls->rd_want is set
+   try again once the socket is ready for tls->rd_want */
 int APP_CC
 ssl_tls_read(struct ssl_tls *tls, char *data, int length)
 {
     int status;
-    int break_flag;
-
-    while(1) {
-        status = SSL_read(tls->ssl, data, length);
-
-        switch (SSL_get_error(tls->ssl, status))
-        {
-            case SSL_ERROR_NONE:
-                break_flag = 1;
-                break;
-
-            case SSL_ERROR_WANT_READ:
-            case SSL_ERROR_WANT_WRITE:
-                /**
-                 * retry when SSL_get_error returns:
-                 *     SSL_ERROR_WANT_READ
-                 *     SSL_ERROR_WANT_WRITE
-                 */
-                continue;
-
-            default:
-                ssl_tls_print_error("SSL_read", tls->ssl, status);
-                status = -1;
-                break_flag = 1;
-                break;
-        }
+    int error;
 
-        if (break_flag)
-        {
-            break;
-        }
+    status = SSL_read(tls->ssl, data, length);
+    tls->rd_want = ssl_tls_get_want(tls, "SSL_read", status, &error);
+    if ((tls->rd_want != 0) || error)
+    {
+        status = -1;
     }
 
     if (SSL_pending(tls->ssl) > 0)
@@ -791,41 +877,21 @@ ssl_tls_read(struct ssl_tls *tls, char *data, int length)
 }
 
 /*****************************************************************************/
+/* returns bytes written or -1, does not block, if -1 and tls->wr_want is
+   set openssl holds on to the record it already made and the same data,
+   or more that starts with it, has to be written again once the socket is
+   ready for tls->wr_want */
 int APP_CC
 ssl_tls_write(struct ssl_tls *tls, const char *data, int length)
 {
     int status;
-    int break_flag;
-
-    while(1) {
-        status = SSL_write(tls->ssl, data, length);
-
-        switch (SSL_get_error(tls->ssl, status))
-        {
-            case SSL_ERROR_NONE:
-                break_flag = 1;
-                break;
-
-            case SSL_ERROR_WANT_READ:
-            case SSL_ERROR_WANT_WRITE:
-                /**
-                 * retry when SSL_get_error returns:
-                 *     SSL_ERROR_WANT_READ
-                 *     SSL_ERROR_WANT_WRITE
-                 */
-                continue;
-
-            default:
-                ssl_tls_print_error("SSL_write", tls->ssl, status);
-                status = -1;
-                break_flag = 1;
-                break;
-        }
+    int error;
 
-        if (break_flag)
-        {
-            break;
-        }
+    status = SSL_write(tls->ssl, data, length);
+    tls->wr_want = ssl_tls_get_want(tls, "SSL_write", status, &error);
+    if ((tls->wr_want != 0) || error)
+    {
+        status = -1;
     }
 
     return status;
@@ -841,6 +907,24 @@ ssl_tls_can_recv(struct ssl_tls *tls, int sck, int millis)
         return 1;
     }
     g_reset_wait_obj(tls->rwo);
+    if (tls->rd_want == SSL_TLS_WANT_WRITE)
+    {
+        /* the read has to send something first */
+        return g_sck_can_send(sck, millis);
+    }
     return g_sck_can_recv(sck, millis);
 }
 
+/*****************************************************************************/
+/* returns boolean */
+int APP_CC
+ssl_tls_can_send(struct ssl_tls *tls, int sck, int millis)
+{
+    if (tls->wr_want == SSL_TLS_WANT_READ)
+    {
+        /* the write has to get something from the peer first */
+        return g_sck_can_recv(sck, millis);
+    }
+    return g_sck_can_send(sck, millis);
+}
+
@@ -81,6 +81,10 @@ int APP_CC
 ssl_gen_key_xrdp1(int key_size_in_bits, char* exp, int exp_len,
                   char* mod, int mod_len, char* pri, int pri_len);
 
+/* what a tls read or write that could not finish is waiting for */
+#define SSL_TLS_WANT_READ  1
+#define SSL_TLS_WANT_WRITE 2
+
 /* ssl_tls */
 struct ssl_tls
 {
@@ -90,13 +94,16 @@ struct ssl_tls
     char *key;
     struct trans *trans;
     tintptr rwo; /* wait obj */
+    int rd_want; /* SSL_TLS_WANT_* if the last read would block, else 0 */
+    int wr_want; /* SSL_TLS_WANT_* if the last write would block, else 0 */
+    int ktls_send; /* kernel makes the records, write to the socket */
 };
 
 /* xrdp_tls.c */
 struct ssl_tls *APP_CC
 ssl_tls_create(struct trans *trans, const char *key, const char *cert);
 int APP_CC
-ssl_tls_accept(struct ssl_tls *self);
+ssl_tls_accept(struct ssl_tls *self, int ktls);
 int APP_CC
 ssl_tls_disconnect(struct ssl_tls *self);
 void APP_CC
@@ -107,5 +114,7 @@ int APP_CC
 ssl_tls_write(struct ssl_tls *tls, const char *data, int length);
 int APP_CC
 ssl_tls_can_recv(struct ssl_tls *tls, int sck, int millis);
+int APP_CC
+ssl_tls_can_send(struct ssl_tls *tls, int sck, int millis);
 
 #endif
@@ -23,9 +23,20 @@
 #include "arch.h"
 #include "parse.h"
 #include "ssl_calls.h"
+#include "defines.h"
 
 #define MAX_SBYTES 0
 
+/* largest tls record payload, small segments are merged up to this */
+#define TRANS_TLS_BATCH_SIZE 16384
+
+/* writes held between trans_batch_begin and trans_batch_end go out once
+   this much has built up */
+#define TRANS_BATCH_SIZE (64 * 1024)
+
+static int APP_CC
+trans_batch_flush(struct trans *self);
+
 /*****************************************************************************/
 int APP_CC
 trans_tls_recv(struct trans *self, void *ptr, int len)
@@ -48,6 +59,95 @@ trans_tls_send(struct trans *self, const void *data, int len)
     return ssl_tls_write(self->tls, data, len);
 }
 
+/*****************************************************************************/
+/* tls has no gather write, copy small segments into one record so a
+   header and its payload do not each cost a record */
+static int APP_CC
+trans_tls_send_record(struct trans *self, const char **ptrs,
+                      const int *lens, int count)
+{
+    int index;
+    int bytes;
+    int total;
+
+    if ((count == 1) || (lens[0] >= TRANS_TLS_BATCH_SIZE))
+    {
+        return ssl_tls_write(self->tls, ptrs[0], lens[0]);
+    }
+    if (self->tls_batch == 0)
+    {
+        self->tls_batch = (char *) g_malloc(TRANS_TLS_BATCH_SIZE, 0);
+        if (self->tls_batch == 0)
+        {
+            return ssl_tls_write(self->tls, ptrs[0], lens[0]);
+        }
+    }
+    total = 0;
+    for (index = 0; index < count; index++)
+    {
+        bytes = MIN(lens[index], TRANS_TLS_BATCH_SIZE - total);
+        g_memcpy(self->tls_batch + total, ptrs[index], bytes);
+        total += bytes;
+        if (total >= TRANS_TLS_BATCH_SIZE)
+        {
+            break;
+        }
+    }
+    return ssl_tls_write(self->tls, self->tls_batch, total);
+}
+
+/*****************************************************************************/
+/* each SSL_write sends at most one record, keep going until it all went
+   or the socket is full */
+int APP_CC
+trans_tls_sendv(struct trans *self, const char **ptrs, const int *lens,
+                int count)
+{
+    const char *lptrs[TRANS_MAX_SEGS];
+    int llens[TRANS_MAX_SEGS];
+    int index;
+    int sent;
+    int total;
+
+    if (self->tls == NULL)
+    {
+        return 1;
+    }
+    if ((count < 1) || (count > TRANS_MAX_SEGS))
+    {
+        return -1;
+    }
+    for (index = 0; index < count; index++)
+    {
+        lptrs[index] = ptrs[index];
+        llens[index] = lens[index];
+    }
+    total = 0;
+    index = 0;
+    while (index < count)
+    {
+        sent = trans_tls_send_record(self, lptrs + index, llens + index,
+                                     count - index);
+        if (sent <= 0)
+        {
+            /* the caller retries from here, which is what openssl wants */
+            return total > 0 ? total : sent;
+        }
+        total += sent;
+        while ((index < count) && (sent >= llens[index]))
+        {
+            sent -= llens[index];
+            index++;
+        }
+        if (index < count)
+        {
+            lptrs[index] += sent;
+            llens[index] -= sent;
+        }
+    }
+    return total;
+}
+
 /*****************************************************************************/
 int APP_CC
 trans_tls_can_recv(struct trans *self, int sck, int millis)
@@ -59,6 +159,17 @@ trans_tls_can_recv(struct trans *self, int sck, int millis)
     return ssl_tls_can_recv(self->tls, sck, millis);
 }
 
+/*****************************************************************************/
+int APP_CC
+trans_tls_can_send(struct trans *self, int sck, int millis)
+{
+    if (self->tls == NULL)
+    {
+        return 1;
+    }
+    return ssl_tls_can_send(self->tls, sck, millis);
+}
+
 /*****************************************************************************/
 int APP_CC
 trans_tcp_recv(struct trans *self, void *ptr, int len)
@@ -73,13 +184,57 @@ trans_tcp_send(struct trans *self, const void *data, int len)
     return g_tcp_send(self->sck, data, len, 0);
 }
 
+/*****************************************************************************/
+int APP_CC
+trans_tcp_sendv(struct trans *self, const char **ptrs, const int *lens,
+                int count)
+{
+    return g_sck_sendv(self->sck, ptrs, lens, count);
+}
+
 /*****************************************************************************/
 int APP_CC
 trans_tcp_can_recv(struct trans *self, int sck, int millis)
 {
+    if ((millis == 0) && (self->wait_set != 0))
+    {
+        return g_is_wait_obj_ready(self->wait_set, sck, 0);
+    }
     return g_sck_can_recv(sck, millis);
 }
 
+/*****************************************************************************/
+int APP_CC
+trans_tcp_can_send(struct trans *self, int sck, int millis)
+{
+    return g_sck_can_send(sck, millis);
+}
+
+/*****************************************************************************/
+/* returns boolean, true if the trans_recv that just failed can be retried
+   later */
+static int APP_CC
+trans_recv_would_block(struct trans *self)
+{
+    if (self->tls != NULL)
+    {
+        return self->tls->rd_want != 0;
+    }
+    return g_tcp_last_error_would_block(self->sck);
+}
+
+/*****************************************************************************/
+/* returns boolean, same for trans_send and trans_sendv */
+static int APP_CC
+trans_send_would_block(struct trans *self)
+{
+    if ((self->tls != NULL) && !self->tls->ktls_send)
+    {
+        return self->tls->wr_want != 0;
+    }
+    return g_tcp_last_error_would_block(self->sck);
+}
+
 /*****************************************************************************/
 struct trans *
 APP_CC
@@ -101,11 +256,39 @@ trans_create(int mode, int in_size, int out_size)
         self->trans_recv = trans_tcp_recv;
         self->trans_send = trans_tcp_send;
         self->trans_can_recv = trans_tcp_can_recv;
+        self->trans_sendv = trans_tcp_sendv;
+        self->trans_can_send = trans_tcp_can_send;
     }
 
     return self;
 }
 
+/*****************************************************************************/
+/* unlink and release the head of the wait queue */
+static void APP_CC
+trans_wait_pop(struct trans *self)
+{
+    struct trans_wait *wait;
+
+    wait = self->wait_head;
+    self->wait_head = wait->next;
+    if (self->wait_head == 0)
+    {
+        self->wait_tail = 0;
+    }
+    if (wait->source != 0)
+    {
+        wait->source[0] -= (int) (wait->end - wait->p);
+    }
+    self->wait_bytes -= (int) (wait->end - wait->p);
+    g_free(wait->copy);
+    if (wait->done != 0)
+    {
+        wait->done(wait->done_data);
+    }
+    g_free(wait);
+}
+
 /*****************************************************************************/
 void APP_CC
 trans_delete(struct trans *self)
@@ -118,6 +301,14 @@ trans_delete(struct trans *self)
     free_stream(self->in_s);
     free_stream(self->out_s);
 
+    /* data that never left still has to be handed back to its owner */
+    while (self->wait_head != 0)
+    {
+        trans_wait_pop(self);
+    }
+    g_free(self->tls_batch);
+    g_free(self->batch);
+
     if (self->sck > 0)
     {
         g_tcp_close(self->sck);
@@ -173,6 +364,8 @@ int APP_CC
 trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
                        tbus *wobjs, int *wcount, int *timeout)
 {
+    int read_added;
+
     if (self == 0)
     {
         return 1;
@@ -183,6 +376,7 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
         return 1;
     }
 
+    read_added = 0;
     if ((self->si != 0) && (self->si->source[self->my_source] > MAX_SBYTES))
     {
     }
@@ -192,10 +386,29 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
         {
             return 1;
         }
+        read_added = 1;
     }
 
-    if (self->wait_s != 0)
+    if (self->wait_head != 0)
     {
+        if ((self->tls != 0) && (self->tls->wr_want == SSL_TLS_WANT_READ))
+        {
+            /* the tls write can not go on until the peer sends */
+            if (!read_added)
+            {
+                robjs[*rcount] = self->sck;
+                (*rcount)++;
+            }
+        }
+        else
+        {
+            wobjs[*wcount] = self->sck;
+            (*wcount)++;
+        }
+    }
+    else if ((self->tls != 0) && (self->tls->rd_want == SSL_TLS_WANT_WRITE))
+    {
+        /* the tls read can not go on until this side sends */
         wobjs[*wcount] = self->sck;
         (*wcount)++;
     }
@@ -203,12 +416,40 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
     return 0;
 }
 
+/*****************************************************************************/
+/* consume sent bytes from the front of the wait queue */
+static void APP_CC
+trans_wait_consume(struct trans *self, int sent)
+{
+    struct trans_wait *wait;
+    int bytes;
+
+    while ((sent > 0) && (self->wait_head != 0))
+    {
+        wait = self->wait_head;
+        bytes = MIN(sent, (int) (wait->end - wait->p));
+        wait->p += bytes;
+        if (wait->source != 0)
+        {
+            wait->source[0] -= bytes;
+        }
+        self->wait_bytes -= bytes;
+        sent -= bytes;
+        if (wait->p >= wait->end)
+        {
+            trans_wait_pop(self);
+        }
+    }
+}
+
 /*****************************************************************************/
 int APP_CC
 trans_send_waiting(struct trans *self, int block)
 {
-    struct stream *temp_s;
-    int bytes;
+    struct trans_wait *wait;
+    const char *ptrs[TRANS_MAX_SEGS];
+    int lens[TRANS_MAX_SEGS];
+    int count;
     int sent;
     int timeout;
     int cont;
@@ -217,25 +458,23 @@ trans_send_waiting(struct trans *self, int block)
     cont = 1;
     while (cont)
     {
-        if (self->wait_s != 0)
+        if (self->wait_head != 0)
         {
-            temp_s = self->wait_s;
-            if (g_tcp_can_send(self->sck, timeout))
+            if (self->trans_can_send(self, self->sck, timeout))
             {
-                bytes = (int) (temp_s->end - temp_s->p);
-                sent = self->trans_send(self, temp_s->p, bytes);
+                count = 0;
+                wait = self->wait_head;
+                while ((wait != 0) && (count < TRANS_MAX_SEGS))
+                {
+                    ptrs[count] = wait->p;
+                    lens[count] = (int) (wait->end - wait->p);
+                    count++;
+                    wait = wait->next;
+                }
+                sent = self->trans_sendv(self, ptrs, lens, count);
                 if (sent > 0)
                 {
-                    temp_s->p += sent;
-                    if (temp_s->source != 0)
-                    {
-                        temp_s->source[0] -= sent;
-                    }
-                    if (temp_s->p >= temp_s->end)
-                    {
-                        self->wait_s = temp_s->next;
-                        free_stream(temp_s);
-                    }
+                    trans_wait_consume(self, sent);
                 }
                 else if (sent == 0)
                 {
@@ -243,7 +482,7 @@ trans_send_waiting(struct trans *self, int block)
                 }
                 else
                 {
-                    if (!g_tcp_last_error_would_block(self->sck))
+                    if (!trans_send_would_block(self))
                     {
                         return 1;
                     }
@@ -297,7 +536,7 @@ trans_check_wait_objs(struct trans *self)
 
     if (self->type1 == TRANS_TYPE_LISTENER) /* listening */
     {
-        if (g_sck_can_recv(self->sck, 0))
+        if (trans_tcp_can_recv(self, self->sck, 0))
         {
             in_sck = g_sck_accept(self->sck, self->addr, sizeof(self->addr),
                                   self->port, sizeof(self->port));
@@ -365,7 +604,7 @@ trans_check_wait_objs(struct trans *self)
 
                 if (read_bytes == -1)
                 {
-                    if (g_tcp_last_error_would_block(self->sck))
+                    if (trans_recv_would_block(self))
                     {
                         /* ok, but shouldn't happen */
                     }
@@ -447,7 +686,7 @@ trans_force_read_s(struct trans *self, struct stream *in_s, int size)
             rcvd = self->trans_recv(self, in_s->end, size);
             if (rcvd == -1)
             {
-                if (g_tcp_last_error_would_block(self->sck))
+                if (trans_recv_would_block(self))
                 {
                 }
                 else
@@ -507,6 +746,10 @@ trans_force_write_s(struct trans *self, struct stream *out_s)
     }
     size = (int) (out_s->end - out_s->data);
     total = 0;
+    if (trans_batch_flush(self) != 0)
+    {
+        return 1;
+    }
     if (trans_send_waiting(self, 1) != 0)
     {
         self->status = TRANS_STATUS_DOWN;
@@ -514,12 +757,12 @@ trans_force_write_s(struct trans *self, struct stream *out_s)
     }
     while (total < size)
     {
-        if (g_tcp_can_send(self->sck, 100))
+        if (self->trans_can_send(self, self->sck, 100))
         {
             sent = self->trans_send(self, out_s->data + total, size - total);
             if (sent == -1)
             {
-                if (g_tcp_last_error_would_block(self->sck))
+                if (trans_send_would_block(self))
                 {
                 }
                 else
@@ -565,19 +808,84 @@ trans_force_write(struct trans *self)
 }
 
 /*****************************************************************************/
+/* add a wait item to the end of the queue */
+static struct trans_wait *APP_CC
+trans_wait_add(struct trans *self, const char *data, int bytes, int copy)
+{
+    struct trans_wait *wait;
+
+    wait = (struct trans_wait *) g_malloc(sizeof(struct trans_wait), 1);
+    if (copy)
+    {
+        wait->copy = (char *) g_malloc(bytes, 0);
+        g_memcpy(wait->copy, data, bytes);
+        data = wait->copy;
+    }
+    wait->p = data;
+    wait->end = data + bytes;
+    self->wait_bytes += bytes;
+    if (self->si != 0)
+    {
+        if ((self->si->cur_source != 0) &&
+            (self->si->cur_source != self->my_source))
+        {
+            self->si->source[self->si->cur_source] += bytes;
+            wait->source = self->si->source + self->si->cur_source;
+        }
+    }
+    if (self->wait_tail == 0)
+    {
+        self->wait_head = wait;
+    }
+    else
+    {
+        self->wait_tail->next = wait;
+    }
+    self->wait_tail = wait;
+    return wait;
+}
+
+/*****************************************************************************/
+/* bytes written but not yet acked by the peer, both what is still waiting
+   here and what the kernel holds */
 int APP_CC
-trans_write_copy_s(struct trans *self, struct stream *out_s)
+trans_get_send_queue_bytes(struct trans *self)
 {
-    int size;
+    int bytes;
+
+    bytes = 0;
+    if (g_sck_get_send_queue_bytes(self->sck, &bytes) != 0)
+    {
+        bytes = 0;
+    }
+    return self->wait_bytes + bytes;
+}
+
+/*****************************************************************************/
+/* send what can go right away, queue the rest, copied into one buffer if
+   copy is set, else by reference with done called once it has all left */
+static int APP_CC
+trans_write_segs_internal(struct trans *self, struct trans_seg *segs,
+                          int count, int copy,
+                          trans_seg_done_proc done, void *done_data)
+{
+    struct trans_wait *wait;
+    const char *ptrs[TRANS_MAX_SEGS];
+    int lens[TRANS_MAX_SEGS];
+    int index;
+    int total;
     int sent;
-    struct stream *wait_s;
-    struct stream *temp_s;
-    char *out_data;
+    int bytes;
+    char *copy_data;
 
     if (self->status != TRANS_STATUS_UP)
     {
         return 1;
     }
+    if ((count < 1) || (count > TRANS_MAX_SEGS))
+    {
+        return 1;
+    }
     /* try to send any left over */
     if (trans_send_waiting(self, 0) != 0)
     {
@@ -585,68 +893,213 @@ trans_write_copy_s(struct trans *self, struct stream *out_s)
         self->status = TRANS_STATUS_DOWN;
         return 1;
     }
-    out_data = out_s->data;
+    total = 0;
+    for (index = 0; index < count; index++)
+    {
+        ptrs[index] = segs[index].data;
+        lens[index] = segs[index].bytes;
+        total += segs[index].bytes;
+    }
     sent = 0;
-    size = (int) (out_s->end - out_s->data);
-    if (self->wait_s == 0)
+    if (self->wait_head == 0)
     {
         /* if no left over, try to send this new data */
-        if (g_tcp_can_send(self->sck, 0))
+        if (self->trans_can_send(self, self->sck, 0))
         {
-            sent = self->trans_send(self, out_s->data, size);
-            if (sent > 0)
-            {
-                out_data += sent;
-                size -= sent;
-            }
-            else if (sent == 0)
+            sent = self->trans_sendv(self, ptrs, lens, count);
+            if (sent == 0)
             {
                 return 1;
             }
-            else
+            if (sent < 0)
             {
-                if (!g_tcp_last_error_would_block(self->sck))
+                if (!trans_send_would_block(self))
                 {
                     return 1;
                 }
+                sent = 0;
             }
         }
     }
-    if (size < 1)
+    if (sent >= total)
     {
+        if (done != 0)
+        {
+            done(done_data);
+        }
         return 0;
     }
-    /* did not send right away, have to copy */
-    make_stream(wait_s);
-    init_stream(wait_s, size);
-    if (self->si != 0)
+    /* skip what did go out */
+    index = 0;
+    while (sent >= lens[index])
     {
-        if ((self->si->cur_source != 0) &&
-            (self->si->cur_source != self->my_source))
+        sent -= lens[index];
+        index++;
+    }
+    ptrs[index] += sent;
+    lens[index] -= sent;
+    if (copy)
+    {
+        /* did not send right away, have to copy */
+        bytes = 0;
+        copy_data = (char *) g_malloc(total, 0);
+        for (; index < count; index++)
+        {
+            g_memcpy(copy_data + bytes, ptrs[index], lens[index]);
+            bytes += lens[index];
+        }
+        wait = trans_wait_add(self, copy_data, bytes, 0);
+        wait->copy = copy_data;
+    }
+    else
+    {
+        wait = 0;
+        for (; index < count; index++)
         {
-            self->si->source[self->si->cur_source] += size;
-            wait_s->source = self->si->source + self->si->cur_source;
+            if (lens[index] > 0)
+            {
+                wait = trans_wait_add(self, ptrs[index], lens[index], 0);
+            }
         }
     }
-    out_uint8a(wait_s, out_data, size);
-    s_mark_end(wait_s);
-    wait_s->p = wait_s->data;
-    if (self->wait_s == 0)
+    wait->done = done;
+    wait->done_data = done_data;
+    return 0;
+}
+
+/*****************************************************************************/
+/* send segs in order without copying them, returns error
+   the memory segs point to must stay valid until done is called, done is
+   called once all the data has been sent, possibly before this returns,
+   or when self is deleted, it is not called if this returns error */
+int APP_CC
+trans_write_segs(struct trans *self, struct trans_seg *segs, int count,
+                 trans_seg_done_proc done, void *done_data)
+{
+    /* keep order with anything batched */
+    if (trans_batch_flush(self) != 0)
     {
-        self->wait_s = wait_s;
+        return 1;
     }
-    else
+    return trans_write_segs_internal(self, segs, count, 0, done, done_data);
+}
+
+/*****************************************************************************/
+/* send what the batch holds, returns error */
+static int APP_CC
+trans_batch_flush(struct trans *self)
+{
+    struct trans_seg seg;
+
+    if (self->batch_bytes < 1)
     {
-        temp_s = self->wait_s;
-        while (temp_s->next != 0)
+        return 0;
+    }
+    seg.data = self->batch;
+    seg.bytes = self->batch_bytes;
+    self->batch_bytes = 0;
+    return trans_write_segs_internal(self, &seg, 1, 1, 0, 0);
+}
+
+/*****************************************************************************/
+/* hold trans_write_copy and trans_write_copy_s data until the matching
+   trans_batch_end so many small pdus leave in a few large writes, calls
+   nest, returns error */
+int APP_CC
+trans_batch_begin(struct trans *self)
+{
+    if (self->batch == 0)
+    {
+        self->batch = (char *) g_malloc(TRANS_BATCH_SIZE, 0);
+        if (self->batch == 0)
         {
-            temp_s = temp_s->next;
+            return 1;
         }
-        temp_s->next = wait_s;
     }
+    self->batch_level++;
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int APP_CC
+trans_batch_end(struct trans *self)
+{
+    int rv;
+
+    if (self->batch_level < 1)
+    {
+        return 0;
+    }
+    self->batch_level--;
+    if (self->batch_level > 0)
+    {
+        return 0;
+    }
+    rv = trans_batch_flush(self);
+    if (self->corked)
+    {
+        /* push out the last partial segment now */
+        g_sck_set_cork(self->sck, 0);
+        self->corked = 0;
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+/* add to the batch, sending the batch first if it is full */
+static int APP_CC
+trans_batch_add(struct trans *self, const char *data, int bytes)
+{
+    struct trans_seg seg;
+
+    if (self->batch_bytes + bytes > TRANS_BATCH_SIZE)
+    {
+        if (!self->corked)
+        {
+            /* more of this batch follows, do not let the kernel send
+               the tail of this write in a short segment */
+            self->corked = g_sck_set_cork(self->sck, 1) == 0;
+        }
+        if (trans_batch_flush(self) != 0)
+        {
+            return 1;
+        }
+    }
+    if (bytes >= TRANS_BATCH_SIZE)
+    {
+        seg.data = data;
+        seg.bytes = bytes;
+        return trans_write_segs_internal(self, &seg, 1, 1, 0, 0);
+    }
+    g_memcpy(self->batch + self->batch_bytes, data, bytes);
+    self->batch_bytes += bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+int APP_CC
+trans_write_copy_s(struct trans *self, struct stream *out_s)
+{
+    struct trans_seg seg;
+
+    seg.data = out_s->data;
+    seg.bytes = (int) (out_s->end - out_s->data);
+    if (seg.bytes < 1)
+    {
+        return 0;
+    }
+    if (self->batch_level > 0)
+    {
+        if (self->status != TRANS_STATUS_UP)
+        {
+            return 1;
+        }
+        return trans_batch_add(self, seg.data, seg.bytes);
+    }
+    return trans_write_segs_internal(self, &seg, 1, 1, 0, 0);
+}
+
 /*****************************************************************************/
 int APP_CC
 trans_write_copy(struct trans* self)
@@ -885,9 +1338,11 @@ trans_get_out_s(struct trans *self, int size)
 }
 
 /*****************************************************************************/
-/* returns error */
+/* returns error, if ktls is set and the kernel took over encrypting
+   records, data is sent straight to the socket */
 int APP_CC
-trans_set_tls_mode(struct trans *self, const char *key, const char *cert)
+trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
+                   int ktls)
 {
     self->tls = ssl_tls_create(self, key, cert);
     if (self->tls == NULL)
@@ -896,7 +1351,7 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert)
         return 1;
     }
 
-    if (ssl_tls_accept(self->tls) != 0)
+    if (ssl_tls_accept(self->tls, ktls) != 0)
     {
         g_writeln("trans_set_tls_mode: ssl_tls_accept failed");
         return 1;
@@ -904,8 +1359,19 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert)
 
     /* assign tls functions */
     self->trans_recv = trans_tls_recv;
-    self->trans_send = trans_tls_send;
     self->trans_can_recv = trans_tls_can_recv;
+    if (self->tls->ktls_send)
+    {
+        self->trans_send = trans_tcp_send;
+        self->trans_sendv = trans_tcp_sendv;
+        self->trans_can_send = trans_tcp_can_send;
+    }
+    else
+    {
+        self->trans_send = trans_tls_send;
+        self->trans_sendv = trans_tls_sendv;
+        self->trans_can_send = trans_tls_can_send;
+    }
 
     return 0;
 }
@@ -924,6 +1390,7 @@ trans_shutdown_tls_mode(struct trans *self)
     self->trans_recv = trans_tcp_recv;
     self->trans_send = trans_tcp_send;
     self->trans_can_recv = trans_tcp_can_recv;
+    self->trans_sendv = trans_tcp_sendv;
 
     return 0;
 }
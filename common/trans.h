@@ -44,6 +44,32 @@ typedef int (DEFAULT_CC *tis_term)(void);
 typedef int (APP_CC *trans_recv_proc) (struct trans *self, void *ptr, int len);
 typedef int (APP_CC *trans_send_proc) (struct trans *self, const void *data, int len);
 typedef int (APP_CC *trans_can_recv_proc) (struct trans *self, int sck, int millis);
+typedef int (APP_CC *trans_can_send_proc) (struct trans *self, int sck, int millis);
+typedef int (APP_CC *trans_sendv_proc) (struct trans *self, const char **ptrs,
+                                        const int *lens, int count);
+typedef void (DEFAULT_CC *trans_seg_done_proc) (void *done_data);
+
+#define TRANS_MAX_SEGS 16
+
+/* one piece of a gather write, see trans_write_segs */
+struct trans_seg
+{
+    const char *data;
+    int bytes;
+};
+
+/* queued data not yet sent, either a private copy or caller owned memory
+   that is released through done once all of it has left */
+struct trans_wait
+{
+    struct trans_wait *next;
+    const char *p;
+    const char *end;
+    char *copy;
+    int *source;
+    trans_seg_done_proc done;
+    void *done_data;
+};
 
 /* optional source info */
 
@@ -73,7 +99,9 @@ struct trans
     struct stream* out_s;
     char* listen_filename;
     tis_term is_term; /* used to test for exit */
-    struct stream* wait_s;
+    struct trans_wait *wait_head;
+    struct trans_wait *wait_tail;
+    int wait_bytes; /* total not yet sent in the wait queue */
     char addr[256];
     char port[256];
     int no_stream_init_on_data_in;
@@ -82,8 +110,18 @@ struct trans
     trans_recv_proc trans_recv;
     trans_send_proc trans_send;
     trans_can_recv_proc trans_can_recv;
+    trans_sendv_proc trans_sendv;
+    trans_can_send_proc trans_can_send;
+    char *tls_batch; /* used to merge small segments into one tls record */
+    int batch_level; /* trans_batch_begin nesting, copied writes are held
+                        in batch until it gets back to 0 */
+    char *batch;
+    int batch_bytes;
+    int corked; /* socket corked since the batch overflowed */
     struct source_info *si;
     int my_source;
+    tbus wait_set; /* if set, trans_check_wait_objs takes socket readiness
+                      from the last g_obj_wait_set on it */
 };
 
 struct trans* APP_CC
@@ -109,8 +147,17 @@ trans_force_write(struct trans* self);
 int APP_CC
 trans_write_copy(struct trans* self);
 int APP_CC
+trans_batch_begin(struct trans *self);
+int APP_CC
+trans_batch_end(struct trans *self);
+int APP_CC
 trans_write_copy_s(struct trans* self, struct stream* out_s);
 int APP_CC
+trans_get_send_queue_bytes(struct trans *self);
+int APP_CC
+trans_write_segs(struct trans *self, struct trans_seg *segs, int count,
+                 trans_seg_done_proc done, void *done_data);
+int APP_CC
 trans_connect(struct trans* self, const char* server, const char* port,
               int timeout);
 int APP_CC
@@ -122,7 +169,8 @@ trans_get_in_s(struct trans* self);
 struct stream* APP_CC
 trans_get_out_s(struct trans* self, int size);
 int APP_CC
-trans_set_tls_mode(struct trans *self, const char *key, const char *cert);
+trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
+                   int ktls);
 int APP_CC
 trans_shutdown_tls_mode(struct trans *self);
 int APP_CC
@@ -127,6 +127,7 @@ struct xrdp_client_info
 
   char certificate[1024];
   char key_file[1024];
+  int ktls; /* let the kernel encrypt tls records when it can */
 
   /* X11 keyboard layout - inferred from keyboard type/subtype */
   char model[16];
@@ -142,6 +143,24 @@ struct xrdp_client_info
   int use_frame_acks;
   int max_unacknowledged_frame_count;
 
+  int encoder_threads; /* number of codec mode encoder threads */
+
+  int cache_persist_flags; /* bit n set if bitmap cache n is persistent */
+
+  int perf_stats; /* publish counters, see xrdp_perf.h */
+
+  int mppc_level; /* bulk compression match finder level, 0 to 9 */
+
+  int planar_cll; /* 32 bpp planar bitmap color loss level, 0 to 7 */
+  int planar_cs; /* planar chroma subsampling, needs a color loss level */
+
+  /* CAPSTYPE_GLYPHCACHE, zero entries if the client did not send it */
+  int glyph_support_level;
+  int glyph_cache_entries[10];
+  int glyph_cache_cell_size[10]; /* max glyph data bytes per entry */
+
+  int large_pointer_flags; /* CAPSETTYPE_LARGE_POINTER, 1 96x96 2 384x384 */
+
 };
 
 #endif
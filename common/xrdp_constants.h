@@ -135,8 +135,13 @@
 #define RDP_DATA_PDU_PLAY_SOUND        34
 #define RDP_DATA_PDU_LOGON             38
 #define RDP_DATA_PDU_FONT2             39
+#define RDP_DATA_PDU_PERSIST_LIST      43
 #define RDP_DATA_PDU_DISCONNECT        47
 
+/* TS_BITMAPCACHE_PERSISTENT_LIST_PDU bBitMask */
+#define RDP_PERSIST_FIRST_PDU          0x01
+#define RDP_PERSIST_LAST_PDU           0x02
+
 #define RDP_CTL_REQUEST_CONTROL        1
 #define RDP_CTL_GRANT_CONTROL          2
 #define RDP_CTL_DETACH                 3
@@ -256,6 +261,9 @@
 #define RDP_CAPSET_BRUSHCACHE          15
 #define RDP_CAPLEN_BRUSHCACHE          0x08
 
+#define RDP_CAPSET_GLYPHCACHE          16
+#define RDP_CAPLEN_GLYPHCACHE          0x34
+
 #define RDP_CAPSET_BITMAP_OFFSCREEN    18
 #define RDP_CAPLEN_BITMAP_OFFSCREEN    0x08
 
@@ -272,6 +280,8 @@
 #define RDP_LOGON_AUTO                 0x0008
 #define RDP_LOGON_NORMAL               0x0033
 #define RDP_COMPRESSION                0x0080
+#define RDP_COMPRESSION_TYPE_MASK      0x1E00 /* highest type supported */
+#define RDP_COMPRESSION_TYPE_8K        0x0000
 #define RDP_LOGON_BLOB                 0x0100
 #define RDP_LOGON_LEAVE_AUDIO          0x2000
 
@@ -567,8 +577,10 @@
 #define RDP_CAPLEN_BMPCODECS      0x1c
 #define RDP_CAPSET_COMPDESK       0x19
 #define RDP_CAPLEN_COMPDESK       0x06
-#define RDP_CAPSET_LPOINTER       0x27
+#define RDP_CAPSET_LPOINTER       0x1b
 #define RDP_CAPLEN_LPOINTER       0x06
+#define LARGE_POINTER_FLAG_96x96   0x01
+#define LARGE_POINTER_FLAG_384x384 0x02
 
 /* fastpath input */
 #define FASTPATH_INPUT_SECURE_CHECKSUM 0x1
@@ -605,6 +617,7 @@
 #define FASTPATH_UPDATETYPE_COLOR         0x9
 #define FASTPATH_UPDATETYPE_CACHED        0xA
 #define FASTPATH_UPDATETYPE_POINTER       0xB
+#define FASTPATH_UPDATETYPE_LARGE_POINTER 0xC
 
 #define FASTPATH_FRAGMENT_SINGLE     0x0
 #define FASTPATH_FRAGMENT_LAST       0x1
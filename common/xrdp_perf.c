@@ -0,0 +1,135 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * per session performance counters
+ */
+
+#include "arch.h"
+#include "os_calls.h"
+#include "file_loc.h"
+#include "xrdp_perf.h"
+
+/*****************************************************************************/
+/* create the stats file and map it, returns nil on error */
+struct xrdp_perf_stats *APP_CC
+xrdp_perf_create(int pid, int session_id)
+{
+    struct xrdp_perf_stats *self;
+    char filename[256];
+    char *zeros;
+    int size;
+    int fd;
+
+    /* the pid directory is only writable by root, a file left behind by
+       an old process with this pid is replaced, never followed */
+    g_snprintf(filename, 255, XRDP_PERF_STR, pid, session_id);
+    g_file_delete(filename);
+    /* exporters do not have to run as the session owner */
+    fd = g_file_open_new(filename, 0x644);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    size = sizeof(struct xrdp_perf_stats);
+    zeros = (char *) g_malloc(size, 1);
+    if (g_file_write(fd, zeros, size) != size)
+    {
+        g_free(zeros);
+        g_file_close(fd);
+        g_file_delete(filename);
+        return 0;
+    }
+    g_free(zeros);
+    /* the mapping stays valid after the close */
+    self = (struct xrdp_perf_stats *) g_file_map(fd, size);
+    g_file_close(fd);
+    if (self == 0)
+    {
+        g_file_delete(filename);
+        return 0;
+    }
+    self->version = XRDP_PERF_VERSION;
+    self->size = size;
+    self->pid = pid;
+    self->session_id = session_id;
+    self->start_time = g_time1();
+    g_strncpy(self->filename, filename, 255);
+    /* magic last, a reader checks it before trusting anything else */
+    self->magic = XRDP_PERF_MAGIC;
+    return self;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_perf_delete(struct xrdp_perf_stats *self)
+{
+    char filename[256];
+
+    if (self == 0)
+    {
+        return;
+    }
+    g_strncpy(filename, self->filename, 255);
+    self->magic = 0;
+    g_file_unmap(self, sizeof(struct xrdp_perf_stats));
+    g_file_delete(filename);
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_perf_hist_add(struct xrdp_perf_hist *hist, tui64 value)
+{
+    int bucket;
+
+    bucket = 0;
+    while ((bucket < XRDP_PERF_BUCKETS - 1) && ((value >> bucket) != 0))
+    {
+        bucket++;
+    }
+    hist->buckets[bucket]++;
+    hist->sum += value;
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+    hist->count++;
+}
+
+/*****************************************************************************/
+/* returns the counters for channel index, name is recorded the first time,
+   returns nil if self is nil or index is out of range */
+struct xrdp_perf_channel *APP_CC
+xrdp_perf_get_channel(struct xrdp_perf_stats *self, int index,
+                      const char *name)
+{
+    struct xrdp_perf_channel *chan;
+
+    if ((self == 0) || (index < 0) || (index >= XRDP_PERF_MAX_CHANNELS))
+    {
+        return 0;
+    }
+    chan = self->channels + index;
+    if (chan->name[0] == 0)
+    {
+        g_strncpy(chan->name, name, 15);
+    }
+    if (index >= (int) (self->num_channels))
+    {
+        self->num_channels = index + 1;
+    }
+    return chan;
+}
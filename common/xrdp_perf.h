@@ -0,0 +1,82 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * per session performance counters
+ * the counters live in a file mapped shared in the pid directory so an exporter
+ * can read them while the session runs, there is no locking, a reader
+ * may see a histogram in the middle of an update
+ */
+
+#if !defined(XRDP_PERF_H)
+#define XRDP_PERF_H
+
+#include "arch.h"
+
+#define XRDP_PERF_MAGIC 0x46524550 /* "PERF" */
+#define XRDP_PERF_VERSION 2
+#define XRDP_PERF_BUCKETS 32
+#define XRDP_PERF_MAX_CHANNELS 32
+
+/* bucket 0 counts zeros, bucket n counts values from 2^(n-1) to 2^n - 1 */
+struct xrdp_perf_hist
+{
+    tui64 count;
+    tui64 sum;
+    tui64 max;
+    tui64 buckets[XRDP_PERF_BUCKETS];
+};
+
+struct xrdp_perf_channel
+{
+    char name[16];
+    tui64 bytes_out; /* to the client */
+    tui64 bytes_in; /* from the client */
+};
+
+struct xrdp_perf_stats
+{
+    tui32 magic;
+    tui32 version;
+    tui32 size; /* sizeof(struct xrdp_perf_stats) */
+    tui32 pid;
+    tui32 session_id;
+    tui32 num_channels;
+    tui64 start_time; /* seconds since 1970 */
+    struct xrdp_perf_hist encode_usec; /* codec mode, per encoder task */
+    struct xrdp_perf_hist frame_msec; /* server_paint_rects to frame ack */
+    tui64 fifo_to_proc_depth; /* encoder input queue, last seen */
+    tui64 fifo_to_proc_max;
+    tui64 mppc_bytes_in;
+    tui64 mppc_bytes_out;
+    tui64 srtt_msec; /* smoothed frame ack rtt */
+    tui64 send_queue_bytes; /* last seen */
+    tui64 enc_level; /* codec mode congestion level, 0 is full quality */
+    struct xrdp_perf_channel channels[XRDP_PERF_MAX_CHANNELS];
+    char filename[256];
+};
+
+struct xrdp_perf_stats *APP_CC
+xrdp_perf_create(int pid, int session_id);
+void APP_CC
+xrdp_perf_delete(struct xrdp_perf_stats *self);
+void APP_CC
+xrdp_perf_hist_add(struct xrdp_perf_hist *hist, tui64 value);
+struct xrdp_perf_channel *APP_CC
+xrdp_perf_get_channel(struct xrdp_perf_stats *self, int index,
+                      const char *name);
+
+#endif
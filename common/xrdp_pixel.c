@@ -0,0 +1,670 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pixel format conversion
+ * this file is also built into the X11rdp module so it only uses arch.h
+ * and the compiler intrinsics, the x86 kernels are built with target
+ * attributes and picked at run time, neon is picked at compile time
+ */
+
+#include "arch.h"
+#include "xrdp_pixel.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+    (defined(__GNUC__) && \
+     ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))))
+#define XRDP_PIXEL_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define XRDP_PIXEL_ARM 1
+#include <arm_neon.h>
+#endif
+
+#define PIXEL_R(_p) (((_p) >> 16) & 0xff)
+#define PIXEL_G(_p) (((_p) >> 8) & 0xff)
+#define PIXEL_B(_p) ((_p) & 0xff)
+
+/*****************************************************************************/
+static void APP_CC
+scalar_to_r5g6b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d16[index] = ((pixel >> 8) & 0xf800) | ((pixel >> 5) & 0x07e0) |
+                     ((pixel >> 3) & 0x001f);
+    }
+}
+
+/*****************************************************************************/
+static void APP_CC
+scalar_to_x1r5g5b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d16[index] = ((pixel >> 9) & 0x7c00) | ((pixel >> 6) & 0x03e0) |
+                     ((pixel >> 3) & 0x001f);
+    }
+}
+
+/*****************************************************************************/
+static void APP_CC
+scalar_to_r3g3b2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    tui32 pixel;
+    int index;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    for (index = 0; index < num_pixels; index++)
+    {
+        pixel = s32[index];
+        d8[index] = ((pixel >> 21) & 0x07) | ((pixel >> 10) & 0x38) |
+                    (pixel & 0xc0);
+    }
+}
+
+/*****************************************************************************/
+static void APP_CC
+scalar_to_a8(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    int index;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    for (index = 0; index < num_pixels; index++)
+    {
+        d8[index] = s32[index] >> 24;
+    }
+}
+
+#if defined(XRDP_PIXEL_X86)
+
+/*****************************************************************************/
+/* 4 pixels to 4 r5g6b5 in 32 bit lanes, sign extended so
+   _mm_packs_epi32 keeps them */
+static __m128i __attribute__((target("sse2")))
+sse2_565(__m128i p)
+{
+    __m128i v;
+
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8),
+                                   _mm_set1_epi32(0xf800)),
+                     _mm_and_si128(_mm_srli_epi32(p, 5),
+                                   _mm_set1_epi32(0x07e0)));
+    v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 3),
+                                      _mm_set1_epi32(0x001f)));
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+/*****************************************************************************/
+static __m128i __attribute__((target("sse2")))
+sse2_555(__m128i p)
+{
+    __m128i v;
+
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 9),
+                                   _mm_set1_epi32(0x7c00)),
+                     _mm_and_si128(_mm_srli_epi32(p, 6),
+                                   _mm_set1_epi32(0x03e0)));
+    return _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 3),
+                                         _mm_set1_epi32(0x001f)));
+}
+
+/*****************************************************************************/
+static __m128i __attribute__((target("sse2")))
+sse2_332(__m128i p)
+{
+    __m128i v;
+
+    v = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 21),
+                                   _mm_set1_epi32(0x07)),
+                     _mm_and_si128(_mm_srli_epi32(p, 10),
+                                   _mm_set1_epi32(0x38)));
+    return _mm_or_si128(v, _mm_and_si128(p, _mm_set1_epi32(0xc0)));
+}
+
+/*****************************************************************************/
+static __m128i __attribute__((target("sse2")))
+sse2_a8(__m128i p)
+{
+    return _mm_srli_epi32(p, 24);
+}
+
+/*****************************************************************************/
+static void __attribute__((target("sse2")))
+sse2_to_r5g6b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m128i a;
+    __m128i b;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    while (num_pixels >= 8)
+    {
+        a = sse2_565(_mm_loadu_si128((const __m128i *) s32));
+        b = sse2_565(_mm_loadu_si128((const __m128i *) (s32 + 4)));
+        _mm_storeu_si128((__m128i *) d16, _mm_packs_epi32(a, b));
+        s32 += 8;
+        d16 += 8;
+        num_pixels -= 8;
+    }
+    scalar_to_r5g6b5(s32, d16, num_pixels);
+}
+
+/*****************************************************************************/
+static void __attribute__((target("sse2")))
+sse2_to_x1r5g5b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m128i a;
+    __m128i b;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    while (num_pixels >= 8)
+    {
+        a = sse2_555(_mm_loadu_si128((const __m128i *) s32));
+        b = sse2_555(_mm_loadu_si128((const __m128i *) (s32 + 4)));
+        _mm_storeu_si128((__m128i *) d16, _mm_packs_epi32(a, b));
+        s32 += 8;
+        d16 += 8;
+        num_pixels -= 8;
+    }
+    scalar_to_x1r5g5b5(s32, d16, num_pixels);
+}
+
+/*****************************************************************************/
+static void __attribute__((target("sse2")))
+sse2_to_r3g3b2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    __m128i a;
+    __m128i b;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    while (num_pixels >= 16)
+    {
+        a = _mm_packs_epi32(sse2_332(_mm_loadu_si128((const __m128i *) s32)),
+                            sse2_332(_mm_loadu_si128((const __m128i *) (s32 + 4))));
+        b = _mm_packs_epi32(sse2_332(_mm_loadu_si128((const __m128i *) (s32 + 8))),
+                            sse2_332(_mm_loadu_si128((const __m128i *) (s32 + 12))));
+        _mm_storeu_si128((__m128i *) d8, _mm_packus_epi16(a, b));
+        s32 += 16;
+        d8 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_r3g3b2(s32, d8, num_pixels);
+}
+
+/*****************************************************************************/
+static void __attribute__((target("sse2")))
+sse2_to_a8(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    __m128i a;
+    __m128i b;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    while (num_pixels >= 16)
+    {
+        a = _mm_packs_epi32(sse2_a8(_mm_loadu_si128((const __m128i *) s32)),
+                            sse2_a8(_mm_loadu_si128((const __m128i *) (s32 + 4))));
+        b = _mm_packs_epi32(sse2_a8(_mm_loadu_si128((const __m128i *) (s32 + 8))),
+                            sse2_a8(_mm_loadu_si128((const __m128i *) (s32 + 12))));
+        _mm_storeu_si128((__m128i *) d8, _mm_packus_epi16(a, b));
+        s32 += 16;
+        d8 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_a8(s32, d8, num_pixels);
+}
+
+/*****************************************************************************/
+/* the avx2 packs work per 128 bit lane, the permutes put the pixels back
+   in order */
+static void __attribute__((target("avx2")))
+avx2_to_r5g6b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m256i p;
+    __m256i v[2];
+    int index;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    while (num_pixels >= 16)
+    {
+        for (index = 0; index < 2; index++)
+        {
+            p = _mm256_loadu_si256((const __m256i *) (s32 + index * 8));
+            v[index] = _mm256_or_si256(
+                           _mm256_and_si256(_mm256_srli_epi32(p, 8),
+                                            _mm256_set1_epi32(0xf800)),
+                           _mm256_and_si256(_mm256_srli_epi32(p, 5),
+                                            _mm256_set1_epi32(0x07e0)));
+            v[index] = _mm256_or_si256(v[index],
+                           _mm256_and_si256(_mm256_srli_epi32(p, 3),
+                                            _mm256_set1_epi32(0x001f)));
+            v[index] = _mm256_srai_epi32(_mm256_slli_epi32(v[index], 16), 16);
+        }
+        p = _mm256_permute4x64_epi64(_mm256_packs_epi32(v[0], v[1]), 0xd8);
+        _mm256_storeu_si256((__m256i *) d16, p);
+        s32 += 16;
+        d16 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_r5g6b5(s32, d16, num_pixels);
+}
+
+/*****************************************************************************/
+static void __attribute__((target("avx2")))
+avx2_to_x1r5g5b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    __m256i p;
+    __m256i v[2];
+    int index;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    while (num_pixels >= 16)
+    {
+        for (index = 0; index < 2; index++)
+        {
+            p = _mm256_loadu_si256((const __m256i *) (s32 + index * 8));
+            v[index] = _mm256_or_si256(
+                           _mm256_and_si256(_mm256_srli_epi32(p, 9),
+                                            _mm256_set1_epi32(0x7c00)),
+                           _mm256_and_si256(_mm256_srli_epi32(p, 6),
+                                            _mm256_set1_epi32(0x03e0)));
+            v[index] = _mm256_or_si256(v[index],
+                           _mm256_and_si256(_mm256_srli_epi32(p, 3),
+                                            _mm256_set1_epi32(0x001f)));
+        }
+        p = _mm256_permute4x64_epi64(_mm256_packs_epi32(v[0], v[1]), 0xd8);
+        _mm256_storeu_si256((__m256i *) d16, p);
+        s32 += 16;
+        d16 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_x1r5g5b5(s32, d16, num_pixels);
+}
+
+/*****************************************************************************/
+/* 32 pixels in 4 loads down to 32 bytes */
+static __m256i __attribute__((target("avx2")))
+avx2_pack8(__m256i v0, __m256i v1, __m256i v2, __m256i v3)
+{
+    __m256i p;
+
+    p = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1),
+                            _mm256_packs_epi32(v2, v3));
+    return _mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 4, 1, 5,
+                                                            2, 6, 3, 7));
+}
+
+/*****************************************************************************/
+static void __attribute__((target("avx2")))
+avx2_to_r3g3b2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    __m256i p;
+    __m256i v[4];
+    int index;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    while (num_pixels >= 32)
+    {
+        for (index = 0; index < 4; index++)
+        {
+            p = _mm256_loadu_si256((const __m256i *) (s32 + index * 8));
+            v[index] = _mm256_or_si256(
+                           _mm256_and_si256(_mm256_srli_epi32(p, 21),
+                                            _mm256_set1_epi32(0x07)),
+                           _mm256_and_si256(_mm256_srli_epi32(p, 10),
+                                            _mm256_set1_epi32(0x38)));
+            v[index] = _mm256_or_si256(v[index],
+                           _mm256_and_si256(p, _mm256_set1_epi32(0xc0)));
+        }
+        _mm256_storeu_si256((__m256i *) d8,
+                            avx2_pack8(v[0], v[1], v[2], v[3]));
+        s32 += 32;
+        d8 += 32;
+        num_pixels -= 32;
+    }
+    scalar_to_r3g3b2(s32, d8, num_pixels);
+}
+
+/*****************************************************************************/
+static void __attribute__((target("avx2")))
+avx2_to_a8(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    __m256i v[4];
+    int index;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    while (num_pixels >= 32)
+    {
+        for (index = 0; index < 4; index++)
+        {
+            v[index] = _mm256_srli_epi32(
+                           _mm256_loadu_si256((const __m256i *)
+                                              (s32 + index * 8)), 24);
+        }
+        _mm256_storeu_si256((__m256i *) d8,
+                            avx2_pack8(v[0], v[1], v[2], v[3]));
+        s32 += 32;
+        d8 += 32;
+        num_pixels -= 32;
+    }
+    scalar_to_a8(s32, d8, num_pixels);
+}
+
+#endif
+
+#if defined(XRDP_PIXEL_ARM)
+
+/*****************************************************************************/
+/* vld4q splits 16 pixels into b, g, r and a planes */
+static void APP_CC
+neon_to_r5g6b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    uint8x16x4_t p;
+    uint16x8_t lo;
+    uint16x8_t hi;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    while (num_pixels >= 16)
+    {
+        p = vld4q_u8((const uint8_t *) s32);
+        lo = vshll_n_u8(vget_low_u8(p.val[2]), 8);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(p.val[1]), 8), 5);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(p.val[0]), 8), 11);
+        hi = vshll_n_u8(vget_high_u8(p.val[2]), 8);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(p.val[1]), 8), 5);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(p.val[0]), 8), 11);
+        vst1q_u16(d16, lo);
+        vst1q_u16(d16 + 8, hi);
+        s32 += 16;
+        d16 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_r5g6b5(s32, d16, num_pixels);
+}
+
+/*****************************************************************************/
+static void APP_CC
+neon_to_x1r5g5b5(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui16 *d16;
+    uint8x16x4_t p;
+    uint16x8_t lo;
+    uint16x8_t hi;
+
+    s32 = (const tui32 *) src;
+    d16 = (tui16 *) dst;
+    while (num_pixels >= 16)
+    {
+        p = vld4q_u8((const uint8_t *) s32);
+        lo = vshll_n_u8(vget_low_u8(p.val[2]), 7);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(p.val[1]), 8), 6);
+        lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(p.val[0]), 8), 11);
+        hi = vshll_n_u8(vget_high_u8(p.val[2]), 7);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(p.val[1]), 8), 6);
+        hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(p.val[0]), 8), 11);
+        vst1q_u16(d16, lo);
+        vst1q_u16(d16 + 8, hi);
+        s32 += 16;
+        d16 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_x1r5g5b5(s32, d16, num_pixels);
+}
+
+/*****************************************************************************/
+static void APP_CC
+neon_to_r3g3b2(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    uint8x16x4_t p;
+    uint8x16_t v;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    while (num_pixels >= 16)
+    {
+        p = vld4q_u8((const uint8_t *) s32);
+        v = vorrq_u8(vshrq_n_u8(p.val[2], 5),
+                     vshlq_n_u8(vshrq_n_u8(p.val[1], 5), 3));
+        v = vorrq_u8(v, vandq_u8(p.val[0], vdupq_n_u8(0xc0)));
+        vst1q_u8(d8, v);
+        s32 += 16;
+        d8 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_r3g3b2(s32, d8, num_pixels);
+}
+
+/*****************************************************************************/
+static void APP_CC
+neon_to_a8(const void *src, void *dst, int num_pixels)
+{
+    const tui32 *s32;
+    tui8 *d8;
+    uint8x16x4_t p;
+
+    s32 = (const tui32 *) src;
+    d8 = (tui8 *) dst;
+    while (num_pixels >= 16)
+    {
+        p = vld4q_u8((const uint8_t *) s32);
+        vst1q_u8(d8, p.val[3]);
+        s32 += 16;
+        d8 += 16;
+        num_pixels -= 16;
+    }
+    scalar_to_a8(s32, d8, num_pixels);
+}
+
+#endif
+
+static struct xrdp_pixel_procs g_pixel_procs =
+{
+    scalar_to_r5g6b5,
+    scalar_to_x1r5g5b5,
+    scalar_to_r3g3b2,
+    scalar_to_a8
+};
+static int g_pixel_simd = -1;
+
+/*****************************************************************************/
+/* fills procs with the kernels for simd, returns error if this build or
+   cpu can not run them */
+int APP_CC
+xrdp_pixel_get_procs(int simd, struct xrdp_pixel_procs *procs)
+{
+    switch (simd)
+    {
+        case XRDP_PIXEL_SCALAR:
+            procs->to_r5g6b5 = scalar_to_r5g6b5;
+            procs->to_x1r5g5b5 = scalar_to_x1r5g5b5;
+            procs->to_r3g3b2 = scalar_to_r3g3b2;
+            procs->to_a8 = scalar_to_a8;
+            return 0;
+#if defined(XRDP_PIXEL_X86)
+        case XRDP_PIXEL_SSE2:
+            if (!__builtin_cpu_supports("sse2"))
+            {
+                return 1;
+            }
+            procs->to_r5g6b5 = sse2_to_r5g6b5;
+            procs->to_x1r5g5b5 = sse2_to_x1r5g5b5;
+            procs->to_r3g3b2 = sse2_to_r3g3b2;
+            procs->to_a8 = sse2_to_a8;
+            return 0;
+        case XRDP_PIXEL_AVX2:
+            if (!__builtin_cpu_supports("avx2"))
+            {
+                return 1;
+            }
+            procs->to_r5g6b5 = avx2_to_r5g6b5;
+            procs->to_x1r5g5b5 = avx2_to_x1r5g5b5;
+            procs->to_r3g3b2 = avx2_to_r3g3b2;
+            procs->to_a8 = avx2_to_a8;
+            return 0;
+#endif
+#if defined(XRDP_PIXEL_ARM)
+        case XRDP_PIXEL_NEON:
+            procs->to_r5g6b5 = neon_to_r5g6b5;
+            procs->to_x1r5g5b5 = neon_to_x1r5g5b5;
+            procs->to_r3g3b2 = neon_to_r3g3b2;
+            procs->to_a8 = neon_to_a8;
+            return 0;
+#endif
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+const char *APP_CC
+xrdp_pixel_get_name(int simd)
+{
+    switch (simd)
+    {
+        case XRDP_PIXEL_SCALAR:
+            return "scalar";
+        case XRDP_PIXEL_SSE2:
+            return "sse2";
+        case XRDP_PIXEL_AVX2:
+            return "avx2";
+        case XRDP_PIXEL_NEON:
+            return "neon";
+    }
+    return "unknown";
+}
+
+/*****************************************************************************/
+/* pick the best kernels, safe to call more than once, returns the
+   XRDP_PIXEL_* in use */
+int APP_CC
+xrdp_pixel_init(void)
+{
+    int simd;
+
+    if (g_pixel_simd >= 0)
+    {
+        return g_pixel_simd;
+    }
+    for (simd = XRDP_PIXEL_COUNT - 1; simd > XRDP_PIXEL_SCALAR; simd--)
+    {
+        if (xrdp_pixel_get_procs(simd, &g_pixel_procs) == 0)
+        {
+            break;
+        }
+    }
+    if (simd == XRDP_PIXEL_SCALAR)
+    {
+        xrdp_pixel_get_procs(simd, &g_pixel_procs);
+    }
+    g_pixel_simd = simd;
+    return simd;
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_r5g6b5(const void *src, void *dst, int num_pixels)
+{
+    if (g_pixel_simd < 0)
+    {
+        xrdp_pixel_init();
+    }
+    g_pixel_procs.to_r5g6b5(src, dst, num_pixels);
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_x1r5g5b5(const void *src, void *dst, int num_pixels)
+{
+    if (g_pixel_simd < 0)
+    {
+        xrdp_pixel_init();
+    }
+    g_pixel_procs.to_x1r5g5b5(src, dst, num_pixels);
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_r3g3b2(const void *src, void *dst, int num_pixels)
+{
+    if (g_pixel_simd < 0)
+    {
+        xrdp_pixel_init();
+    }
+    g_pixel_procs.to_r3g3b2(src, dst, num_pixels);
+}
+
+/*****************************************************************************/
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_a8(const void *src, void *dst, int num_pixels)
+{
+    if (g_pixel_simd < 0)
+    {
+        xrdp_pixel_init();
+    }
+    g_pixel_procs.to_a8(src, dst, num_pixels);
+}
@@ -0,0 +1,62 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * pixel format conversion
+ * the source is always a8r8g8b8 as the frame buffer holds it, 32 bit
+ * little endian words, the results match the COLOR16, COLOR15 and COLOR8
+ * macros in defines.h bit for bit
+ */
+
+#if !defined(XRDP_PIXEL_H)
+#define XRDP_PIXEL_H
+
+#include "arch.h"
+
+/* kernel sets, xrdp_pixel_init picks the best one the cpu has */
+#define XRDP_PIXEL_SCALAR 0
+#define XRDP_PIXEL_SSE2   1
+#define XRDP_PIXEL_AVX2   2
+#define XRDP_PIXEL_NEON   3
+#define XRDP_PIXEL_COUNT  4
+
+typedef void (*xrdp_pixel_proc)(const void *src, void *dst, int num_pixels);
+
+struct xrdp_pixel_procs
+{
+    xrdp_pixel_proc to_r5g6b5; /* 16 bpp */
+    xrdp_pixel_proc to_x1r5g5b5; /* 15 bpp */
+    xrdp_pixel_proc to_r3g3b2; /* 8 bpp, COLOR8 order */
+    xrdp_pixel_proc to_a8; /* alpha only */
+};
+
+int APP_CC
+xrdp_pixel_init(void);
+int APP_CC
+xrdp_pixel_get_procs(int simd, struct xrdp_pixel_procs *procs);
+const char *APP_CC
+xrdp_pixel_get_name(int simd);
+
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_r5g6b5(const void *src, void *dst, int num_pixels);
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_x1r5g5b5(const void *src, void *dst, int num_pixels);
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_r3g3b2(const void *src, void *dst, int num_pixels);
+void APP_CC
+xrdp_pixel_a8r8g8b8_to_a8(const void *src, void *dst, int num_pixels);
+
+#endif
@@ -720,6 +720,123 @@ libxrdp_send_pointer(struct xrdp_session *session, int cache_idx,
     return 0;
 }
 
+/*****************************************************************************/
+/* largest pointer width and height the client takes, the whole update
+   has to fit in the client's multifragment reassembly buffer */
+int EXPORT_CC
+libxrdp_get_pointer_max(struct xrdp_session *session)
+{
+    struct xrdp_client_info *ci;
+
+    ci = session->client_info;
+    if (((ci->use_fast_path & 1) == 0) || ((ci->pointer_flags & 1) == 0))
+    {
+        return 32;
+    }
+    if ((ci->large_pointer_flags & LARGE_POINTER_FLAG_384x384) &&
+        (ci->max_fastpath_frag_bytes >= 384 * 384 * 4 + 384 * 48 + 1024))
+    {
+        return 384;
+    }
+    if ((ci->large_pointer_flags &
+         (LARGE_POINTER_FLAG_96x96 | LARGE_POINTER_FLAG_384x384)) &&
+        (ci->max_fastpath_frag_bytes >= 96 * 96 * 4 + 96 * 12 + 1024))
+    {
+        return 96;
+    }
+    return 32;
+}
+
+/*****************************************************************************/
+/* 2.2.9.1.2.1.11 Fast-Path Large Pointer Update (TS_FP_LARGEPOINTERATTRIBUTE)
+   data rows are width * Bpp bytes and mask rows ((width + 15) / 16) * 2
+   bytes, both bottom up */
+int EXPORT_CC
+libxrdp_send_pointer_large(struct xrdp_session *session, int cache_idx,
+                           char *data, char *mask, int x, int y, int bpp,
+                           int width, int height)
+{
+    struct stream *s;
+    char *p;
+    tui16 *p16;
+    tui32 *p32;
+    int i;
+    int j;
+    int Bpp;
+    int xor_line;
+    int and_line;
+    int max;
+
+    max = libxrdp_get_pointer_max(session);
+    if ((width < 1) || (height < 1) || (width > max) || (height > max))
+    {
+        g_writeln("libxrdp_send_pointer_large: error %dx%d not supported",
+                  width, height);
+        return 1;
+    }
+    if ((bpp != 16) && (bpp != 24) && (bpp != 32))
+    {
+        g_writeln("libxrdp_send_pointer_large: error bpp %d", bpp);
+        return 1;
+    }
+    Bpp = (bpp + 7) / 8;
+    xor_line = (width * Bpp + 1) & ~1;
+    and_line = ((width + 15) / 16) * 2;
+    make_stream(s);
+    init_stream(s, (xor_line + and_line) * height + 8192);
+    if (xrdp_rdp_init_fastpath((struct xrdp_rdp *)session->rdp, s) != 0)
+    {
+        free_stream(s);
+        return 1;
+    }
+    out_uint16_le(s, bpp);
+    out_uint16_le(s, cache_idx);
+    out_uint16_le(s, x);
+    out_uint16_le(s, y);
+    out_uint16_le(s, width);
+    out_uint16_le(s, height);
+    out_uint32_le(s, and_line * height);
+    out_uint32_le(s, xor_line * height);
+    for (j = 0; j < height; j++)
+    {
+        switch (bpp)
+        {
+            case 16:
+                p16 = ((tui16 *) data) + j * width;
+                for (i = 0; i < width; i++)
+                {
+                    out_uint16_le(s, p16[i]);
+                }
+                break;
+            case 24:
+                p = data + j * width * 3;
+                out_uint8a(s, p, width * 3);
+                break;
+            case 32:
+                p32 = ((tui32 *) data) + j * width;
+                for (i = 0; i < width; i++)
+                {
+                    out_uint32_le(s, p32[i]);
+                }
+                break;
+        }
+        if (xor_line > width * Bpp)
+        {
+            out_uint8(s, 0); /* pad */
+        }
+    }
+    out_uint8a(s, mask, and_line * height);
+    s_mark_end(s);
+    if (xrdp_rdp_send_fastpath((struct xrdp_rdp *)session->rdp, s,
+                               FASTPATH_UPDATETYPE_LARGE_POINTER) != 0)
+    {
+        free_stream(s);
+        return 1;
+    }
+    free_stream(s);
+    return 0;
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_set_pointer(struct xrdp_session *session, int cache_idx)
@@ -989,22 +1106,24 @@ libxrdp_reset(struct xrdp_session *session,
 int EXPORT_CC
 libxrdp_orders_send_raw_bitmap2(struct xrdp_session *session,
                                 int width, int height, int bpp, char *data,
-                                int cache_id, int cache_idx)
+                                int cache_id, int cache_idx,
+                                int key1, int key2)
 {
     return xrdp_orders_send_raw_bitmap2((struct xrdp_orders *)session->orders,
                                         width, height, bpp, data,
-                                        cache_id, cache_idx);
+                                        cache_id, cache_idx, key1, key2);
 }
 
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_orders_send_bitmap2(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
-                            int cache_id, int cache_idx, int hints)
+                            int cache_id, int cache_idx, int hints,
+                            int key1, int key2)
 {
     return xrdp_orders_send_bitmap2((struct xrdp_orders *)session->orders,
                                     width, height, bpp, data,
-                                    cache_id, cache_idx, hints);
+                                    cache_id, cache_idx, hints, key1, key2);
 }
 
 /*****************************************************************************/
@@ -1267,9 +1386,26 @@ libxrdp_monitored_desktop(struct xrdp_session *session,
     return xrdp_orders_send_monitored_desktop(orders, mdo, flags);
 }
 
+/*****************************************************************************/
+/* returns a jpeg handle that is not shared with the session, for use by
+   encoder threads */
+void *EXPORT_CC
+libxrdp_codec_jpeg_create(struct xrdp_session *session)
+{
+    return xrdp_jpeg_init();
+}
+
 /*****************************************************************************/
 int EXPORT_CC
-libxrdp_codec_jpeg_compress(struct xrdp_session *session,
+libxrdp_codec_jpeg_delete(struct xrdp_session *session, void *handle)
+{
+    return xrdp_jpeg_deinit(handle);
+}
+
+/*****************************************************************************/
+/* if handle is nil, the session's jpeg handle is used */
+int EXPORT_CC
+libxrdp_codec_jpeg_compress(struct xrdp_session *session, void *handle,
                             int format, char *inp_data,
                             int width, int height,
                             int stride, int x, int y,
@@ -1279,8 +1415,12 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session,
     struct xrdp_orders *orders;
     void* jpeg_han;
 
-    orders = (struct xrdp_orders *)(session->orders);
-    jpeg_han = orders->jpeg_han;
+    jpeg_han = handle;
+    if (jpeg_han == 0)
+    {
+        orders = (struct xrdp_orders *)(session->orders);
+        jpeg_han = orders->jpeg_han;
+    }
     return xrdp_codec_jpeg_compress(jpeg_han, format, inp_data,
                                     width, height, stride, x, y,
                                     cx, cy, quality, out_data, io_len);
@@ -1373,8 +1513,7 @@ libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
         return 1;
     }
     rdp = (struct xrdp_rdp *) (session->rdp);
-    make_stream(s);
-    init_stream(s, 8192);
+    s = rdp->marker_s;
     xrdp_rdp_init_fastpath(rdp, s);
     out_uint16_le(s, 0x0004); /* CMDTYPE_FRAME_MARKER */
     out_uint16_le(s, frame_action);
@@ -1383,11 +1522,52 @@ libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
     /* 4 = FASTPATH_UPDATETYPE_SURFCMDS */
     if (xrdp_rdp_send_fastpath(rdp, s, 4) != 0)
     {
-        free_stream(s);
         return 1;
     }
-    free_stream(s);
     return 0;
+}
 
+/*****************************************************************************/
+/* hold everything sent to the client until libxrdp_batch_end so the pdus
+   of one update leave in as few writes as possible, calls nest */
+int EXPORT_CC
+libxrdp_batch_begin(struct xrdp_session *session)
+{
+    return trans_batch_begin(session->trans);
 }
 
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_batch_end(struct xrdp_session *session)
+{
+    return trans_batch_end(session->trans);
+}
+
+/*****************************************************************************/
+/* returns XRDP_CPU_* flags, used by the server to pick optimised code paths */
+int EXPORT_CC
+libxrdp_detect_cpu(void)
+{
+    return (int) xrdp_rdp_detect_cpu();
+}
+
+/*****************************************************************************/
+/* keys from the client's persistent key list, keys[i] is the bitmap the
+   client loaded into cache_idx i, returns error */
+int EXPORT_CC
+libxrdp_get_persist_keys(struct xrdp_session *session, int cache_id,
+                         tui64 **keys, int *count)
+{
+    struct xrdp_rdp *rdp;
+
+    *keys = 0;
+    *count = 0;
+    if ((cache_id < 0) || (cache_id >= XRDP_MAX_BITMAP_CACHE_ID))
+    {
+        return 1;
+    }
+    rdp = (struct xrdp_rdp *) (session->rdp);
+    *keys = rdp->persist_keys[cache_id];
+    *count = rdp->persist_keys_count[cache_id];
+    return 0;
+}
@@ -36,6 +36,7 @@
 #include "libxrdpinc.h"
 #include "file_loc.h"
 #include "xrdp_client_info.h"
+#include "xrdp_perf.h"
 
 
 /* iso */
@@ -149,6 +150,11 @@ struct xrdp_rdp
     struct xrdp_client_info client_info;
     struct xrdp_mppc_enc *mppc_enc;
     void *rfx_enc;
+    /* persistent bitmap cache keys sent by the client, in cache index order */
+    tui64 *persist_keys[XRDP_MAX_BITMAP_CACHE_ID];
+    int persist_keys_count[XRDP_MAX_BITMAP_CACHE_ID];
+    int persist_keys_alloc[XRDP_MAX_BITMAP_CACHE_ID];
+    struct stream *marker_s; /* reused for every frame marker */
 };
 
 /* state */
@@ -274,6 +280,9 @@ struct xrdp_orders
 #define PROTO_RDP_40 1
 #define PROTO_RDP_50 2
 
+#define MPPC_ENC_MAX_LEVEL 9
+#define MPPC_ENC_DEFAULT_LEVEL 3
+
 struct xrdp_mppc_enc
 {
     int    protocol_type;    /* PROTO_RDP_40, PROTO_RDP_50 etc */
@@ -287,6 +296,12 @@ struct xrdp_mppc_enc
     int    flagsHold;
     int    first_pkt;        /* this is the first pkt passing through enc */
     tui16 *hash_table;
+    tui16 *hash_chain;
+    int    hash_bits;        /* log2 of hash_table entries */
+    int    max_lom;          /* longest match the protocol can encode */
+    int    depth;            /* match finder settings, see mppc_enc_set_level */
+    int    lazy;
+    int    nice;
 };
 
 
@@ -296,6 +311,8 @@ struct xrdp_mppc_enc * APP_CC
 mppc_enc_new(int protocol_type);
 void APP_CC
 mppc_enc_free(struct xrdp_mppc_enc *enc);
+int APP_CC
+mppc_enc_set_level(struct xrdp_mppc_enc *enc, int level);
 
 /* xrdp_tcp.c */
 struct xrdp_tcp * APP_CC
@@ -374,6 +391,8 @@ struct xrdp_rdp * APP_CC
 xrdp_rdp_create(struct xrdp_session *session, struct trans *trans);
 void APP_CC
 xrdp_rdp_delete(struct xrdp_rdp *self);
+tui32 APP_CC
+xrdp_rdp_detect_cpu(void);
 int APP_CC
 xrdp_rdp_init(struct xrdp_rdp *self, struct stream *s);
 int APP_CC
@@ -483,11 +502,13 @@ xrdp_orders_send_font(struct xrdp_orders *self,
 int APP_CC
 xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
                              int width, int height, int bpp, char *data,
-                             int cache_id, int cache_idx);
+                             int cache_id, int cache_idx,
+                             int key1, int key2);
 int APP_CC
 xrdp_orders_send_bitmap2(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
-                         int cache_id, int cache_idx, int hints);
+                         int cache_id, int cache_idx, int hints,
+                         int key1, int key2);
 int APP_CC
 xrdp_orders_send_bitmap3(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
@@ -509,6 +530,11 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
                      int start_line, struct stream *temp_s,
                      int e);
 int APP_CC
+xrdp_bitmap_compress_ref(char *in_data, int width, int height,
+                         struct stream *s, int bpp, int byte_limit,
+                         int start_line, struct stream *temp_s,
+                         int e);
+int APP_CC
 xrdp_bitmap32_compress(char *in_data, int width, int height,
                        struct stream *s, int bpp, int byte_limit,
                        int start_line, struct stream *temp_s,
@@ -25,6 +25,12 @@
 
 /* struct xrdp_client_info moved to xrdp_client_info.h */
 
+struct xrdp_perf_stats;
+
+/* libxrdp_detect_cpu flags */
+#define XRDP_CPU_SSE2  0x0001
+#define XRDP_CPU_SSE42 0x0002
+
 struct xrdp_brush
 {
     int x_orgin;
@@ -74,6 +80,7 @@ struct xrdp_session
     int in_process_data; /* inc / dec libxrdp_process_data calls */
 
     struct source_info si;
+    struct xrdp_perf_stats *perf; /* nil unless perf_stats is set */
 };
 
 struct xrdp_session * DEFAULT_CC
@@ -101,6 +108,12 @@ int DEFAULT_CC
 libxrdp_send_pointer(struct xrdp_session *session, int cache_idx,
                      char *data, char *mask, int x, int y, int bpp);
 int DEFAULT_CC
+libxrdp_send_pointer_large(struct xrdp_session *session, int cache_idx,
+                           char *data, char *mask, int x, int y, int bpp,
+                           int width, int height);
+int DEFAULT_CC
+libxrdp_get_pointer_max(struct xrdp_session *session);
+int DEFAULT_CC
 libxrdp_set_pointer(struct xrdp_session *session, int cache_idx);
 int DEFAULT_CC
 libxrdp_orders_init(struct xrdp_session *session);
@@ -176,11 +189,13 @@ libxrdp_reset(struct xrdp_session *session,
 int DEFAULT_CC
 libxrdp_orders_send_raw_bitmap2(struct xrdp_session *session,
                                 int width, int height, int bpp, char *data,
-                                int cache_id, int cache_idx);
+                                int cache_id, int cache_idx,
+                                int key1, int key2);
 int DEFAULT_CC
 libxrdp_orders_send_bitmap2(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
-                            int cache_id, int cache_idx, int hints);
+                            int cache_id, int cache_idx, int hints,
+                            int key1, int key2);
 int DEFAULT_CC
 libxrdp_orders_send_bitmap3(struct xrdp_session *session,
                             int width, int height, int bpp, char *data,
@@ -230,8 +245,12 @@ int DEFAULT_CC
 libxrdp_monitored_desktop(struct xrdp_session *session,
                           struct rail_monitored_desktop_order *mdo,
                           int flags);
+void *DEFAULT_CC
+libxrdp_codec_jpeg_create(struct xrdp_session *session);
 int DEFAULT_CC
-libxrdp_codec_jpeg_compress(struct xrdp_session *session,
+libxrdp_codec_jpeg_delete(struct xrdp_session *session, void *handle);
+int DEFAULT_CC
+libxrdp_codec_jpeg_compress(struct xrdp_session *session, void *handle,
                             int format, char *inp_data,
                             int width, int height,
                             int stride, int x, int y,
@@ -247,5 +266,14 @@ libxrdp_fastpath_send_surface(struct xrdp_session *session,
 int EXPORT_CC
 libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
                                    int frame_action, int frame_id);
+int EXPORT_CC
+libxrdp_batch_begin(struct xrdp_session *session);
+int EXPORT_CC
+libxrdp_batch_end(struct xrdp_session *session);
+int EXPORT_CC
+libxrdp_detect_cpu(void);
+int EXPORT_CC
+libxrdp_get_persist_keys(struct xrdp_session *session, int cache_id,
+                         tui64 **keys, int *count);
 
 #endif
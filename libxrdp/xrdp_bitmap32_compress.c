@@ -26,221 +26,229 @@ http://msdn.microsoft.com/en-us/library/cc241877.aspx
 
 #include "libxrdp.h"
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define PL_SSE2 1
+#endif
+
+#define FLAGS_CLL     0x07
+#define FLAGS_CS      0x08
 #define FLAGS_RLE     0x10
 #define FLAGS_NOALPHA 0x20
 
+/* widest line chroma subsampling is done for, bitmap orders are 64x64 */
+#define CS_MAX_CX 64
+
 #define LLOG_LEVEL 1
 #define LLOGLN(_level, _args) \
   do { if (_level < LLOG_LEVEL) { g_writeln _args ; } } while (0)
 #define LHEXDUMP(_level, _args) \
   do { if (_level < LLOG_LEVEL) { g_hexdump _args ; } } while (0)
 
+#if defined(PL_SSE2)
 /*****************************************************************************/
-/* split RGB */
+/* split 16 pixels, see fsplit_line */
+static void APP_CC
+fsplit16(int *ptr32, int cll, char *a_data, char *r_data, char *g_data,
+         char *b_data)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i ff;
+    __m128i r[2];
+    __m128i g[2];
+    __m128i b[2];
+    __m128i t0;
+    __m128i t1;
+    __m128i t2;
+    int index;
+
+    p0 = _mm_loadu_si128((__m128i *) (ptr32 + 0));
+    p1 = _mm_loadu_si128((__m128i *) (ptr32 + 4));
+    p2 = _mm_loadu_si128((__m128i *) (ptr32 + 8));
+    p3 = _mm_loadu_si128((__m128i *) (ptr32 + 12));
+    if (a_data != 0)
+    {
+        t0 = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+        t1 = _mm_packs_epi32(_mm_srli_epi32(p2, 24), _mm_srli_epi32(p3, 24));
+        _mm_storeu_si128((__m128i *) a_data, _mm_packus_epi16(t0, t1));
+    }
+    /* 16 bit lanes, 8 pixels in each */
+    ff = _mm_set1_epi32(0xff);
+    r[0] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), ff),
+                           _mm_and_si128(_mm_srli_epi32(p1, 16), ff));
+    r[1] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), ff),
+                           _mm_and_si128(_mm_srli_epi32(p3, 16), ff));
+    g[0] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), ff),
+                           _mm_and_si128(_mm_srli_epi32(p1, 8), ff));
+    g[1] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), ff),
+                           _mm_and_si128(_mm_srli_epi32(p3, 8), ff));
+    b[0] = _mm_packs_epi32(_mm_and_si128(p0, ff), _mm_and_si128(p1, ff));
+    b[1] = _mm_packs_epi32(_mm_and_si128(p2, ff), _mm_and_si128(p3, ff));
+    if (cll == 0)
+    {
+        _mm_storeu_si128((__m128i *) r_data, _mm_packus_epi16(r[0], r[1]));
+        _mm_storeu_si128((__m128i *) g_data, _mm_packus_epi16(g[0], g[1]));
+        _mm_storeu_si128((__m128i *) b_data, _mm_packus_epi16(b[0], b[1]));
+        return;
+    }
+    for (index = 0; index < 2; index++)
+    {
+        t0 = _mm_add_epi16(_mm_add_epi16(r[index], b[index]),
+                           _mm_slli_epi16(g[index], 1));
+        t0 = _mm_srli_epi16(t0, 2);
+        t1 = _mm_sra_epi16(_mm_sub_epi16(r[index], b[index]),
+                           _mm_cvtsi32_si128(cll));
+        t2 = _mm_sub_epi16(_mm_slli_epi16(g[index], 1),
+                           _mm_add_epi16(r[index], b[index]));
+        t2 = _mm_sra_epi16(t2, _mm_cvtsi32_si128(cll + 1));
+        r[index] = t0;
+        g[index] = t1;
+        b[index] = t2;
+    }
+    _mm_storeu_si128((__m128i *) r_data, _mm_packus_epi16(r[0], r[1]));
+    _mm_storeu_si128((__m128i *) g_data, _mm_packs_epi16(g[0], g[1]));
+    _mm_storeu_si128((__m128i *) b_data, _mm_packs_epi16(b[0], b[1]));
+}
+#endif
+
+/*****************************************************************************/
+/* split one line of ARGB into planes, padded with e copies of the last
+   pixel, a_data can be nil
+   with a color loss level r, g and b get luma, orange chroma and green
+   chroma, the chroma is cut by cll bits */
 static int APP_CC
-fsplit3(char *in_data, int start_line, int width, int e,
-        char *r_data, char *g_data, char *b_data)
+fsplit_line(char *in_data, int width, int e, int cll,
+            char *a_data, char *r_data, char *g_data, char *b_data)
 {
-#if defined(L_ENDIAN)
+    int index;
+    int pixel;
     int rp;
     int gp;
     int bp;
-#endif
-    int index;
-    int out_index;
-    int pixel;
-    int cy;
     int *ptr32;
 
-    cy = 0;
-    out_index = 0;
-    while (start_line >= 0)
+    ptr32 = (int *) in_data;
+    index = 0;
+#if defined(PL_SSE2)
+    while (index + 16 <= width)
+    {
+        fsplit16(ptr32 + index, cll,
+                 a_data == 0 ? 0 : a_data + index,
+                 r_data + index, g_data + index, b_data + index);
+        index += 16;
+    }
+#endif
+    while (index < width)
     {
-        ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
+        pixel = ptr32[index];
+        rp = (pixel >> 16) & 0xff;
+        gp = (pixel >> 8) & 0xff;
+        bp = pixel & 0xff;
+        if (a_data != 0)
         {
-            pixel = *ptr32;
-            ptr32++;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int*)(r_data + out_index)) = rp;
-            *((int*)(g_data + out_index)) = gp;
-            *((int*)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
+            a_data[index] = pixel >> 24;
         }
-#endif
-        while (index < width)
+        if (cll == 0)
         {
-            pixel = *ptr32;
-            ptr32++;
-            r_data[out_index] = pixel >> 16;
-            g_data[out_index] = pixel >> 8;
-            b_data[out_index] = pixel >> 0;
-            out_index++;
-            index++;
+            r_data[index] = rp;
+            g_data[index] = gp;
+            b_data[index] = bp;
         }
-        for (index = 0; index < e; index++)
+        else
         {
-            r_data[out_index] = r_data[out_index - 1];
-            g_data[out_index] = g_data[out_index - 1];
-            b_data[out_index] = b_data[out_index - 1];
-            out_index++;
+            r_data[index] = (rp + gp * 2 + bp) >> 2;
+            g_data[index] = (rp - bp) >> cll;
+            b_data[index] = (gp * 2 - rp - bp) >> (cll + 1);
         }
-        start_line--;
-        cy++;
-        if (out_index > 64 * 64)
+        index++;
+    }
+    for (; index < width + e; index++)
+    {
+        if (a_data != 0)
         {
-            break;
+            a_data[index] = a_data[index - 1];
         }
+        r_data[index] = r_data[index - 1];
+        g_data[index] = g_data[index - 1];
+        b_data[index] = b_data[index - 1];
     }
-    return cy;
+    return 0;
 }
 
 /*****************************************************************************/
-/* split ARGB */
+/* average 2x2 chroma samples, cut at level 1, down to one at level
+   cll, row1 can be nil for a last odd line */
 static int APP_CC
-fsplit4(char *in_data, int start_line, int width, int e,
-        char *a_data, char *r_data, char *g_data, char *b_data)
+fsubsample_line(char *row0, char *row1, int cx, int cll, char *out_data)
 {
-#if defined(L_ENDIAN)
-    int ap;
-    int rp;
-    int gp;
-    int bp;
-#endif
     int index;
-    int out_index;
-    int pixel;
-    int cy;
-    int *ptr32;
+    int x1;
+    int sum;
 
-    cy = 0;
-    out_index = 0;
-    while (start_line >= 0)
+    for (index = 0; index < cx; index += 2)
     {
-        ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
+        x1 = index + 1 < cx ? index + 1 : index;
+        sum = row0[index] + row0[x1];
+        if (row1 == 0)
         {
-            pixel = *ptr32;
-            ptr32++;
-            ap  = (pixel >> 24) & 0x000000ff;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            ap |= (pixel >> 16) & 0x0000ff00;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel >>  8) & 0x00ff0000;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel <<  0) & 0xff000000;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int*)(a_data + out_index)) = ap;
-            *((int*)(r_data + out_index)) = rp;
-            *((int*)(g_data + out_index)) = gp;
-            *((int*)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
+            sum *= 2;
         }
-#endif
-        while (index < width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            a_data[out_index] = pixel >> 24;
-            r_data[out_index] = pixel >> 16;
-            g_data[out_index] = pixel >> 8;
-            b_data[out_index] = pixel >> 0;
-            out_index++;
-            index++;
-        }
-        for (index = 0; index < e; index++)
-        {
-            a_data[out_index] = a_data[out_index - 1];
-            r_data[out_index] = r_data[out_index - 1];
-            g_data[out_index] = g_data[out_index - 1];
-            b_data[out_index] = b_data[out_index - 1];
-            out_index++;
-        }
-        start_line--;
-        cy++;
-        if (out_index > 64 * 64)
+        else
         {
-            break;
+            sum += row1[index] + row1[x1];
         }
+        out_data[index / 2] = sum >> (cll + 1);
     }
-    return cy;
+    return 0;
 }
 
 /*****************************************************************************/
-#define DELTA_ONE \
-do { \
-    delta = src8[cx] - src8[0]; \
-    is_neg = (delta >> 7) & 1; \
-    dst8[cx] = (((delta ^ -is_neg) + is_neg) << 1) - is_neg; \
-    src8++; \
-    dst8++; \
-} while (0)
-
-/*****************************************************************************/
+/* delta of plane line y against line y - 1, the first line is sent as
+   is, negative deltas are made odd and positive even */
 static int APP_CC
-fdelta(char *in_plane, char *out_plane, int cx, int cy)
+fdelta_line(char *in_plane, char *out_plane, int cx, int y)
 {
+    char *cur;
+    char *prev;
+    char *dst;
     char delta;
     char is_neg;
-    char *src8;
-    char *dst8;
-    char *src8_end;
+    int index;
+#if defined(PL_SSE2)
+    __m128i d;
+    __m128i m;
+#endif
 
-    g_memcpy(out_plane, in_plane, cx);
-    src8 = in_plane;
-    dst8 = out_plane;
-    src8_end = src8 + (cx * cy - cx);
-    while (src8 + 8 <= src8_end)
+    cur = in_plane + y * cx;
+    dst = out_plane + y * cx;
+    if (y == 0)
+    {
+        g_memcpy(dst, cur, cx);
+        return 0;
+    }
+    prev = cur - cx;
+    index = 0;
+#if defined(PL_SSE2)
+    while (index + 16 <= cx)
     {
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
+        d = _mm_sub_epi8(_mm_loadu_si128((__m128i *) (cur + index)),
+                         _mm_loadu_si128((__m128i *) (prev + index)));
+        m = _mm_cmplt_epi8(d, _mm_setzero_si128());
+        d = _mm_sub_epi8(_mm_xor_si128(d, m), m);
+        d = _mm_add_epi8(_mm_add_epi8(d, d), m);
+        _mm_storeu_si128((__m128i *) (dst + index), d);
+        index += 16;
     }
-    while (src8 < src8_end)
+#endif
+    while (index < cx)
     {
-        DELTA_ONE;
+        delta = cur[index] - prev[index];
+        is_neg = (delta >> 7) & 1;
+        dst[index] = (((delta ^ -is_neg) + is_neg) << 1) - is_neg;
+        index++;
     }
     return 0;
 }
@@ -321,6 +329,10 @@ fpack(char *plane, int cx, int cy, struct stream *s)
     int jndex;
     int collen;
     int replen;
+#if defined(PL_SSE2)
+    int mask;
+    int n;
+#endif
 
     LLOGLN(10, ("fpack:"));
     holdp = s->p;
@@ -343,6 +355,29 @@ fpack(char *plane, int cx, int cy, struct stream *s)
         }
         while (ptr8 < lend)
         {
+#if defined(PL_SSE2)
+            /* take 16 compares at once while in a run or in colors */
+            if (ptr8 + 16 <= lend)
+            {
+                mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                           _mm_loadu_si128((__m128i *) ptr8),
+                           _mm_loadu_si128((__m128i *) (ptr8 + 1))));
+                if (mask & 1)
+                {
+                    n = __builtin_ctz(~mask | 0x10000);
+                    replen += n;
+                    ptr8 += n;
+                    continue;
+                }
+                if (replen == 0)
+                {
+                    n = __builtin_ctz(mask | 0x10000);
+                    collen += n;
+                    ptr8 += n;
+                    continue;
+                }
+            }
+#endif
             if (ptr8[0] == ptr8[1])
             {
                 replen++;
@@ -379,35 +414,26 @@ fpack(char *plane, int cx, int cy, struct stream *s)
 
 /*****************************************************************************/
 static int APP_CC
-foutraw3(struct stream *s, int bytes, int header,
-         char *r_data, char *g_data, char *b_data)
-{
-    out_uint8(s, header);
-    out_uint8a(s, r_data, bytes);
-    out_uint8a(s, g_data, bytes);
-    out_uint8a(s, b_data, bytes);
-    /* pad if no RLE */
-    out_uint8(s, 0x00);
-    return 0;
-}
-
-/*****************************************************************************/
-static int APP_CC
-foutraw4(struct stream *s, int bytes, int header,
-         char *a_data, char *r_data, char *g_data, char *b_data)
+foutraw(struct stream *s, int header, int cx, int cy, int ccx, int ccy,
+        char *a_data, char *r_data, char *g_data, char *b_data)
 {
     out_uint8(s, header);
-    out_uint8a(s, a_data, bytes);
-    out_uint8a(s, r_data, bytes);
-    out_uint8a(s, g_data, bytes);
-    out_uint8a(s, b_data, bytes);
+    if (a_data != 0)
+    {
+        out_uint8a(s, a_data, cx * cy);
+    }
+    out_uint8a(s, r_data, cx * cy);
+    out_uint8a(s, g_data, ccx * ccy);
+    out_uint8a(s, b_data, ccx * ccy);
     /* pad if no RLE */
     out_uint8(s, 0x00);
     return 0;
 }
 
 /*****************************************************************************/
-/* returns the number of lines compressed */
+/* returns the number of lines compressed
+   flags is the planar format header, RLE, NOALPHA, a color loss level
+   in the low 3 bits and, with a level, chroma subsampling */
 int APP_CC
 xrdp_bitmap32_compress(char *in_data, int width, int height,
                        struct stream *s, int bpp, int byte_limit,
@@ -422,12 +448,18 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     char *sr_data;
     char *sg_data;
     char *sb_data;
+    char *line;
+    char co_rows[2][CS_MAX_CX];
+    char cg_rows[2][CS_MAX_CX];
     int a_bytes;
     int r_bytes;
     int g_bytes;
     int b_bytes;
     int cx;
     int cy;
+    int ccx;
+    int ccy;
+    int cll;
     int max_bytes;
     int total_bytes;
     int header;
@@ -441,6 +473,12 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     }
     header = flags & 0xFF;
     cx = width + e;
+    cll = header & FLAGS_CLL;
+    if ((cll == 0) || (cx > CS_MAX_CX))
+    {
+        header &= ~FLAGS_CS;
+    }
+    ccx = (header & FLAGS_CS) ? (cx + 1) / 2 : cx;
     sa_data = temp_s->data;
     sr_data = sa_data + max_bytes;
     sg_data = sr_data + max_bytes;
@@ -450,87 +488,102 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     g_data = r_data + max_bytes;
     b_data = g_data + max_bytes;
 
-    if (header & FLAGS_NOALPHA)
+    /* one pass over the lines, split, color loss and delta */
+    cy = 0;
+    ccy = 0;
+    while ((start_line >= 0) && ((cy + 1) * cx <= max_bytes))
     {
-        cy = fsplit3(in_data, start_line, width, e,
-                     sr_data, sg_data, sb_data);
-        if (header & FLAGS_RLE)
+        line = in_data + start_line * width * 4;
+        if (header & FLAGS_CS)
         {
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
-            out_uint8(s, header);
-            r_bytes = fpack(r_data, cx, cy, s);
-            g_bytes = fpack(g_data, cx, cy, s);
-            b_bytes = fpack(b_data, cx, cy, s);
-            total_bytes = r_bytes + g_bytes + b_bytes;
-            if (1 + total_bytes > byte_limit)
-            {
-                /* failed */
-                LLOGLN(0, ("xrdp_bitmap32_compress: too big, rgb "
-                       "bytes %d %d %d total_bytes %d cx %d cy %d "
-                       "byte_limit %d", r_bytes, g_bytes, b_bytes,
-                       total_bytes, cx, cy, byte_limit));
-                return 0;
-            }
-            max_bytes = cx * cy * 3;
-            if (total_bytes > max_bytes)
+            /* chroma at level 1, subsampled once there are two lines */
+            fsplit_line(line, width, e, 1,
+                        (header & FLAGS_NOALPHA) ? 0 : sa_data + cy * cx,
+                        sr_data + cy * cx, co_rows[cy & 1], cg_rows[cy & 1]);
+            if (cy & 1)
             {
-                /* raw is better */
-                LLOGLN(10, ("xrdp_bitmap32_compress: too big, rgb "
-                       "bytes %d %d %d total_bytes %d cx %d cy %d "
-                       "max_bytes %d", r_bytes, g_bytes, b_bytes,
-                       total_bytes, cx, cy, max_bytes));
-                init_stream(s, 0);
-                foutraw3(s, cx * cy, FLAGS_NOALPHA, sr_data, sg_data, sb_data);
+                fsubsample_line(co_rows[0], co_rows[1], cx, cll,
+                                sg_data + ccy * ccx);
+                fsubsample_line(cg_rows[0], cg_rows[1], cx, cll,
+                                sb_data + ccy * ccx);
+                ccy++;
             }
         }
         else
         {
-            foutraw3(s, cx * cy, FLAGS_NOALPHA, sr_data, sg_data, sb_data);
+            fsplit_line(line, width, e, cll,
+                        (header & FLAGS_NOALPHA) ? 0 : sa_data + cy * cx,
+                        sr_data + cy * cx, sg_data + cy * cx,
+                        sb_data + cy * cx);
+            ccy++;
         }
-    }
-    else
-    {
-        cy = fsplit4(in_data, start_line, width, e,
-                     sa_data, sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
-            fdelta(sa_data, a_data, cx, cy);
-            fdelta(sr_data, r_data, cx, cy);
-            fdelta(sg_data, g_data, cx, cy);
-            fdelta(sb_data, b_data, cx, cy);
-            out_uint8(s, header);
-            a_bytes = fpack(a_data, cx, cy, s);
-            r_bytes = fpack(r_data, cx, cy, s);
-            g_bytes = fpack(g_data, cx, cy, s);
-            b_bytes = fpack(b_data, cx, cy, s);
-            max_bytes = cx * cy * 4;
-            total_bytes = a_bytes + r_bytes + g_bytes + b_bytes;
-            if (1 + total_bytes > byte_limit)
+            if (!(header & FLAGS_NOALPHA))
             {
-                /* failed */
-                LLOGLN(0, ("xrdp_bitmap32_compress: too big, argb "
-                       "bytes %d %d %d %d total_bytes %d cx %d cy %d "
-                       "byte_limit %d", a_bytes, r_bytes, g_bytes, b_bytes,
-                       total_bytes, cx, cy, byte_limit));
-                return 0;
+                fdelta_line(sa_data, a_data, cx, cy);
             }
-            if (total_bytes > max_bytes)
+            fdelta_line(sr_data, r_data, cx, cy);
+            if ((ccy > 0) && ((header & FLAGS_CS) == 0 || (cy & 1)))
             {
-                /* raw is better */
-                LLOGLN(10, ("xrdp_bitmap32_compress: too big, argb "
-                       "bytes %d %d %d %d total_bytes %d cx %d cy %d "
-                       "max_bytes %d", a_bytes, r_bytes, g_bytes, b_bytes,
-                       total_bytes, cx, cy, max_bytes));
-                init_stream(s, 0);
-                foutraw4(s, cx * cy, 0, sa_data, sr_data, sg_data, sb_data);
+                fdelta_line(sg_data, g_data, ccx, ccy - 1);
+                fdelta_line(sb_data, b_data, ccx, ccy - 1);
             }
         }
-        else
+        start_line--;
+        cy++;
+    }
+    if ((header & FLAGS_CS) && (cy & 1))
+    {
+        fsubsample_line(co_rows[0], 0, cx, cll, sg_data + ccy * ccx);
+        fsubsample_line(cg_rows[0], 0, cx, cll, sb_data + ccy * ccx);
+        ccy++;
+        if (header & FLAGS_RLE)
         {
-            foutraw4(s, cx * cy, 0, sa_data, sr_data, sg_data, sb_data);
+            fdelta_line(sg_data, g_data, ccx, ccy - 1);
+            fdelta_line(sb_data, b_data, ccx, ccy - 1);
         }
     }
+
+    if ((header & FLAGS_RLE) == 0)
+    {
+        foutraw(s, header, cx, cy, ccx, ccy,
+                (header & FLAGS_NOALPHA) ? 0 : sa_data,
+                sr_data, sg_data, sb_data);
+        return cy;
+    }
+    out_uint8(s, header);
+    a_bytes = 0;
+    max_bytes = cx * cy + ccx * ccy * 2;
+    if (!(header & FLAGS_NOALPHA))
+    {
+        a_bytes = fpack(a_data, cx, cy, s);
+        max_bytes += cx * cy;
+    }
+    r_bytes = fpack(r_data, cx, cy, s);
+    g_bytes = fpack(g_data, ccx, ccy, s);
+    b_bytes = fpack(b_data, ccx, ccy, s);
+    total_bytes = a_bytes + r_bytes + g_bytes + b_bytes;
+    if (1 + total_bytes > byte_limit)
+    {
+        /* failed */
+        LLOGLN(0, ("xrdp_bitmap32_compress: too big, argb "
+               "bytes %d %d %d %d total_bytes %d cx %d cy %d "
+               "byte_limit %d", a_bytes, r_bytes, g_bytes, b_bytes,
+               total_bytes, cx, cy, byte_limit));
+        return 0;
+    }
+    if (total_bytes > max_bytes)
+    {
+        /* raw is better */
+        LLOGLN(10, ("xrdp_bitmap32_compress: too big, argb "
+               "bytes %d %d %d %d total_bytes %d cx %d cy %d "
+               "max_bytes %d", a_bytes, r_bytes, g_bytes, b_bytes,
+               total_bytes, cx, cy, max_bytes));
+        init_stream(s, 0);
+        foutraw(s, header & ~FLAGS_RLE, cx, cy, ccx, ccy,
+                (header & FLAGS_NOALPHA) ? 0 : sa_data,
+                sr_data, sg_data, sb_data);
+    }
     return cy;
 }
@@ -22,6 +22,92 @@
 
 #include "libxrdp.h"
 
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define BC_AVX2 1
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define BC_SSE2 1
+#endif
+
+/*****************************************************************************/
+/* number of leading bytes that are the same in p1 and p2, at most max */
+static int APP_CC
+xrdp_bitmap_match_len(const char *p1, const char *p2, int max)
+{
+    int len;
+#if defined(BC_AVX2)
+    __m256i a;
+    __m256i b;
+    unsigned int mask;
+#elif defined(BC_SSE2)
+    __m128i a;
+    __m128i b;
+    int mask;
+#endif
+
+    len = 0;
+#if defined(BC_AVX2)
+    while (len + 32 <= max)
+    {
+        a = _mm256_loadu_si256((const __m256i *) (p1 + len));
+        b = _mm256_loadu_si256((const __m256i *) (p2 + len));
+        mask = ~((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        if (mask != 0)
+        {
+            return len + __builtin_ctz(mask);
+        }
+        len += 32;
+    }
+#elif defined(BC_SSE2)
+    while (len + 16 <= max)
+    {
+        a = _mm_loadu_si128((const __m128i *) (p1 + len));
+        b = _mm_loadu_si128((const __m128i *) (p2 + len));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+        if (mask != 0)
+        {
+            return len + __builtin_ctz(mask);
+        }
+        len += 16;
+    }
+#endif
+    while ((len < max) && (p1[len] == p2[len]))
+    {
+        len++;
+    }
+    return len;
+}
+
+/*****************************************************************************/
+/* add n bits, all set or all clear, to the fill or mix mask that already
+   holds fom_count bits */
+static void APP_CC
+xrdp_bitmap_fom_add(char *mask, int *mask_len, int fom_count, int n, int set)
+{
+    while ((n > 0) && ((fom_count % 8) != 0))
+    {
+        if (set)
+        {
+            mask[*mask_len - 1] |= 1 << (fom_count % 8);
+        }
+        fom_count++;
+        n--;
+    }
+    while (n >= 8)
+    {
+        mask[*mask_len] = set ? 0xff : 0;
+        (*mask_len)++;
+        fom_count += 8;
+        n -= 8;
+    }
+    if (n > 0)
+    {
+        mask[*mask_len] = set ? (1 << n) - 1 : 0;
+        (*mask_len)++;
+    }
+}
+
 /*****************************************************************************/
 #define IN_PIXEL8(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
     do { \
@@ -630,6 +716,111 @@
         (bicolor_spin && pixel == bicolor2 && last_pixel == bicolor1) \
       ) \
     )
+/*****************************************************************************/
+/* called once pixel i went through the tests above, skips ahead over the
+   pixels after it that can only add to the counts, the output is the
+   same as running them through one by one
+   a: pixel and the one above stay the same, nothing can end so fill, mix,
+      color and fom counts that are going on just grow
+   b: pixel matches the one above, fill and fom grow, mix stays 0, color
+      and bicolor can not win over fill while they are shorter so only
+      their counts need following */
+#define SKIP_RUNS(in_getpixel, in_bytes, in_out_pixel) \
+    do { \
+        if (!use_runs || (i + 1 >= width)) \
+        { \
+            break; \
+        } \
+        run_pixel = in_getpixel(line, i + 1, 0, width); \
+        run_ypixel = last_line == 0 ? 0 : \
+                     in_getpixel(last_line, i + 1, 0, width); \
+        if ((color_count > 0) && (run_pixel == pixel) && \
+            (run_ypixel == ypixel)) \
+        { \
+            run = xrdp_bitmap_match_len(line + (i + 1) * in_bytes, \
+                                        line + i * in_bytes, \
+                                        (width - i - 1) * in_bytes); \
+            if (last_line != 0) \
+            { \
+                run = xrdp_bitmap_match_len(last_line + (i + 1) * in_bytes, \
+                                            last_line + i * in_bytes, \
+                                            run); \
+            } \
+            run /= in_bytes; \
+            if (TEST_FILL) \
+            { \
+                fill_count += run; \
+            } \
+            if (TEST_MIX) \
+            { \
+                mix_count += run; \
+            } \
+            if (TEST_FOM) \
+            { \
+                xrdp_bitmap_fom_add(fom_mask, &fom_mask_len, fom_count, run, \
+                                    pixel == (ypixel ^ mix)); \
+                fom_count += run; \
+            } \
+            color_count += run; \
+            count += run; \
+            for (k = 0; k < run; k++) \
+            { \
+                in_out_pixel(pixel); \
+            } \
+            i += run; \
+        } \
+        else if ((last_line != 0) && (pixel == ypixel) && \
+                 (run_pixel == run_ypixel) && \
+                 (color_count < fill_count) && (bicolor_count < fill_count)) \
+        { \
+            run = xrdp_bitmap_match_len(line + (i + 1) * in_bytes, \
+                                        last_line + (i + 1) * in_bytes, \
+                                        (width - i - 1) * in_bytes); \
+            run /= in_bytes; \
+            for (k = 0; k < run; k++) \
+            { \
+                pixel = in_getpixel(line, i + 1 + k, 0, width); \
+                if (TEST_COLOR) \
+                { \
+                    color_count++; \
+                } \
+                else \
+                { \
+                    color_count = 0; \
+                } \
+                if (TEST_BICOLOR) \
+                { \
+                    bicolor_spin = !bicolor_spin; \
+                    bicolor_count++; \
+                } \
+                else \
+                { \
+                    bicolor_count = 0; \
+                    bicolor1 = last_pixel; \
+                    bicolor2 = pixel; \
+                    bicolor_spin = 0; \
+                } \
+                in_out_pixel(pixel); \
+                last_pixel = pixel; \
+            } \
+            xrdp_bitmap_fom_add(fom_mask, &fom_mask_len, fom_count, run, 0); \
+            fill_count += run; \
+            fom_count += run; \
+            count += run; \
+            i += run; \
+            last_ypixel = pixel; \
+        } \
+    } while (0)
+
+#define OUT_PIXEL1(in_pixel) out_uint8(temp_s, in_pixel)
+#define OUT_PIXEL2(in_pixel) out_uint16_le(temp_s, in_pixel)
+#define OUT_PIXEL3(in_pixel) \
+    do { \
+        out_uint8(temp_s, (in_pixel) & 0xff); \
+        out_uint8(temp_s, ((in_pixel) >> 8) & 0xff); \
+        out_uint8(temp_s, ((in_pixel) >> 16) & 0xff); \
+    } while (0)
+
 #define RESET_COUNTS \
     do { \
         bicolor_count = 0; \
@@ -642,11 +833,11 @@
     } while (0)
 
 /*****************************************************************************/
-int APP_CC
-xrdp_bitmap_compress(char *in_data, int width, int height,
-                     struct stream *s, int bpp, int byte_limit,
-                     int start_line, struct stream *temp_s,
-                     int e)
+static int APP_CC
+xrdp_bitmap_compress_pixels(char *in_data, int width, int height,
+                            struct stream *s, int bpp, int byte_limit,
+                            int start_line, struct stream *temp_s,
+                            int e, int use_runs)
 {
     char *line;
     char *last_line;
@@ -671,6 +862,10 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
     int fom_count;
     int fom_mask_len;
     int temp; /* used in macros */
+    int run_pixel;
+    int run_ypixel;
+    int run;
+    int k;
 
     init_stream(temp_s, 0);
     fom_mask_len = 0;
@@ -857,6 +1052,7 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
                 count++;
                 last_pixel = pixel;
                 last_ypixel = ypixel;
+                SKIP_RUNS(GETPIXEL8, 1, OUT_PIXEL1);
             }
 
             /* can't take fix, mix, or fom past first line */
@@ -1149,6 +1345,7 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
                 count++;
                 last_pixel = pixel;
                 last_ypixel = ypixel;
+                SKIP_RUNS(GETPIXEL16, 2, OUT_PIXEL2);
             }
 
             /* can't take fix, mix, or fom past first line */
@@ -1443,6 +1640,7 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
                 count++;
                 last_pixel = pixel;
                 last_ypixel = ypixel;
+                SKIP_RUNS(GETPIXEL32, 4, OUT_PIXEL3);
             }
 
             /* can't take fix, mix, or fom past first line */
@@ -1570,3 +1768,29 @@ xrdp_bitmap_compress(char *in_data, int width, int height,
 
     return lines_sent;
 }
+
+/*****************************************************************************/
+int APP_CC
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e)
+{
+    return xrdp_bitmap_compress_pixels(in_data, width, height, s, bpp,
+                                       byte_limit, start_line, temp_s,
+                                       e, 1);
+}
+
+/*****************************************************************************/
+/* same output as xrdp_bitmap_compress but looks at each pixel in turn,
+   kept to check the fast one against */
+int APP_CC
+xrdp_bitmap_compress_ref(char *in_data, int width, int height,
+                         struct stream *s, int bpp, int byte_limit,
+                         int start_line, struct stream *temp_s,
+                         int e)
+{
+    return xrdp_bitmap_compress_pixels(in_data, width, height, s, bpp,
+                                       byte_limit, start_line, temp_s,
+                                       e, 0);
+}
@@ -219,17 +219,33 @@ xrdp_caps_process_bmpcache2(struct xrdp_rdp *self, struct stream *s,
     in_uint16_le(s, i); /* cache flags */
     self->client_info.bitmap_cache_persist_enable = i;
     in_uint8s(s, 2); /* number of caches in set, 3 */
+    /* TS_BITMAPCACHE_CELL_CACHE_INFO, high bit is the persistent flag */
+    self->client_info.cache_persist_flags = 0;
     in_uint32_le(s, i);
+    if (i & 0x80000000)
+    {
+        self->client_info.cache_persist_flags |= 1;
+    }
+    i = i & 0x7fffffff;
     i = MIN(i, XRDP_MAX_BITMAP_CACHE_IDX);
     i = MAX(i, 0);
     self->client_info.cache1_entries = i;
     self->client_info.cache1_size = 256 * Bpp;
     in_uint32_le(s, i);
+    if (i & 0x80000000)
+    {
+        self->client_info.cache_persist_flags |= 2;
+    }
+    i = i & 0x7fffffff;
     i = MIN(i, XRDP_MAX_BITMAP_CACHE_IDX);
     i = MAX(i, 0);
     self->client_info.cache2_entries = i;
     self->client_info.cache2_size = 1024 * Bpp;
     in_uint32_le(s, i);
+    if (i & 0x80000000)
+    {
+        self->client_info.cache_persist_flags |= 4;
+    }
     i = i & 0x7fffffff;
     i = MIN(i, XRDP_MAX_BITMAP_CACHE_IDX);
     i = MAX(i, 0);
@@ -342,6 +358,51 @@ xrdp_caps_process_brushcache(struct xrdp_rdp *self, struct stream *s,
     return 0;
 }
 
+/*****************************************************************************/
+/* get the client glyph caches, entry count and cell size of each */
+static int APP_CC
+xrdp_caps_process_glyphcache(struct xrdp_rdp *self, struct stream *s,
+                             int len)
+{
+    int index;
+    int entries;
+    int cell_size;
+
+    if (len < 10 * 4 + 4 + 2 + 2)
+    {
+        g_writeln("xrdp_caps_process_glyphcache: error");
+        return 1;
+    }
+    for (index = 0; index < 10; index++)
+    {
+        in_uint16_le(s, entries);
+        in_uint16_le(s, cell_size);
+        self->client_info.glyph_cache_entries[index] = entries;
+        self->client_info.glyph_cache_cell_size[index] = cell_size;
+    }
+    in_uint8s(s, 4); /* fragCache */
+    in_uint16_le(s, self->client_info.glyph_support_level);
+    g_writeln("xrdp_caps_process_glyphcache: support level %d",
+              self->client_info.glyph_support_level);
+    return 0;
+}
+
+/*****************************************************************************/
+static int APP_CC
+xrdp_caps_process_large_pointer(struct xrdp_rdp *self, struct stream *s,
+                                int len)
+{
+    if (len < 2)
+    {
+        g_writeln("xrdp_caps_process_large_pointer: error");
+        return 1;
+    }
+    in_uint16_le(s, self->client_info.large_pointer_flags);
+    g_writeln("xrdp_caps_process_large_pointer: flags 0x%4.4x",
+              self->client_info.large_pointer_flags);
+    return 0;
+}
+
 /*****************************************************************************/
 int APP_CC
 xrdp_caps_process_offscreen_bmpcache(struct xrdp_rdp *self, struct stream *s,
@@ -614,8 +675,9 @@ xrdp_caps_process_confirm_active(struct xrdp_rdp *self, struct stream *s)
             case RDP_CAPSET_BRUSHCACHE: /* 15 */
                 xrdp_caps_process_brushcache(self, s, len);
                 break;
-            case 16: /* 16 */
-                DEBUG(("--16"));
+            case RDP_CAPSET_GLYPHCACHE: /* 16 */
+                DEBUG(("RDP_CAPSET_GLYPHCACHE"));
+                xrdp_caps_process_glyphcache(self, s, len);
                 break;
             case 17: /* 17 */
                 DEBUG(("CAPSET_TYPE_OFFSCREEN_CACHE"));
@@ -643,6 +705,9 @@ xrdp_caps_process_confirm_active(struct xrdp_rdp *self, struct stream *s)
             case 0x001A: /* 26 CAPSETTYPE_MULTIFRAGMENTUPDATE */
                 xrdp_caps_process_multifragmetupdate(self, s, len);
                 break;
+            case RDP_CAPSET_LPOINTER: /* 27 CAPSETTYPE_LARGE_POINTER */
+                xrdp_caps_process_large_pointer(self, s, len);
+                break;
             case RDP_CAPSET_BMPCODECS: /* 0x1d(29) */
                 xrdp_caps_process_codecs(self, s, len);
                 break;
@@ -901,6 +966,13 @@ xrdp_caps_send_demand_active(struct xrdp_rdp *self)
         out_uint16_le(s, 0x001A); /* 26 CAPSETTYPE_MULTIFRAGMENTUPDATE */
         out_uint16_le(s, 8);
         out_uint32_le(s, 3 * 1024 * 1024); /* 3MB */
+
+        /* large pointers are fastpath only */
+        caps_count++;
+        out_uint16_le(s, RDP_CAPSET_LPOINTER); /* 27 CAPSETTYPE_LARGE_POINTER */
+        out_uint16_le(s, RDP_CAPLEN_LPOINTER);
+        out_uint16_le(s, LARGE_POINTER_FLAG_96x96 |
+                         LARGE_POINTER_FLAG_384x384);
     }
 
     /* frame acks */
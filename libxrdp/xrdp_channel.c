@@ -93,6 +93,7 @@ xrdp_channel_send(struct xrdp_channel *self, struct stream *s, int channel_id,
                   int total_data_len, int flags)
 {
     struct mcs_channel_item *channel;
+    struct xrdp_perf_channel *perf;
 
     channel = xrdp_channel_get_item(self, channel_id);
 
@@ -102,6 +103,13 @@ xrdp_channel_send(struct xrdp_channel *self, struct stream *s, int channel_id,
         return 1;
     }
 
+    perf = xrdp_perf_get_channel(self->sec_layer->rdp_layer->session->perf,
+                                 channel_id, channel->name);
+    if (perf != 0)
+    {
+        perf->bytes_out += (int)(s->end - s->channel_hdr) - 8;
+    }
+
     s_pop_layer(s, channel_hdr);
     out_uint32_le(s, total_data_len);
 
@@ -186,7 +194,7 @@ xrdp_channel_process(struct xrdp_channel *self, struct stream *s,
     int rv;
     int channel_id;
     struct mcs_channel_item *channel;
-
+    struct xrdp_perf_channel *perf;
 
     /* this assumes that the channels are in order of chanid(mcs channel id)
        but they should be, see xrdp_sec_process_mcs_data_channels
@@ -204,6 +212,12 @@ xrdp_channel_process(struct xrdp_channel *self, struct stream *s,
     rv = 0;
     in_uint32_le(s, length);
     in_uint32_le(s, flags);
+    perf = xrdp_perf_get_channel(self->sec_layer->rdp_layer->session->perf,
+                                 channel_id, channel->name);
+    if (perf != 0)
+    {
+        perf->bytes_in += (int)(s->end - s->p);
+    }
     rv = xrdp_channel_call_callback(self, s, channel_id, length, flags);
     return rv;
 }
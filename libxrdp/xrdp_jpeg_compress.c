@@ -202,51 +202,71 @@ xrdp_jpeg_deinit(void *handle)
 
 #elif defined(XRDP_JPEG)
 
-/* libjpeg */
+/* libjpeg, one compressor per handle, set up once and used for every
+   image so the quant and huffman tables are only made when the quality
+   changes */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
 #include <jpeglib.h>
 
-#define JP_QUALITY 75
+struct jp_error_mgr
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
 
-struct mydata_comp
+struct jp_comp
 {
+    struct jpeg_compress_struct cinfo;
+    struct jp_error_mgr jerr;
+    struct jpeg_destination_mgr dst_mgr;
     char *cb;
     int cb_bytes;
-    int total_done;
     int overwrite;
+    int quality; /* tables in cinfo are for this quality */
+    char *row; /* only for padding or without JCS_EXTENSIONS */
+    int row_bytes;
 };
 
+/*****************************************************************************/
+/* libjpeg would exit the process */
+static void DEFAULT_CC
+my_error_exit(j_common_ptr cinfo)
+{
+    struct jp_error_mgr *jerr;
+
+    jerr = (struct jp_error_mgr *) (cinfo->err);
+    (*(cinfo->err->output_message))(cinfo);
+    longjmp(jerr->jmp, 1);
+}
+
 /*****************************************************************************/
 /* called at beginning */
 static void DEFAULT_CC
 my_init_destination(j_compress_ptr cinfo)
 {
-    struct mydata_comp *md;
+    struct jp_comp *jp;
 
-    md = (struct mydata_comp *)(cinfo->client_data);
-    md->total_done = 0;
-    md->overwrite = 0;
-    cinfo->dest->next_output_byte = md->cb;
-    cinfo->dest->free_in_buffer = md->cb_bytes;
+    jp = (struct jp_comp *) (cinfo->client_data);
+    jp->overwrite = 0;
+    cinfo->dest->next_output_byte = (JOCTET *) (jp->cb);
+    cinfo->dest->free_in_buffer = jp->cb_bytes;
 }
 
 /*****************************************************************************/
-/* called when buffer is full and we need more space */
-static int DEFAULT_CC
+/* called when buffer is full, the image will be dropped */
+static boolean DEFAULT_CC
 my_empty_output_buffer(j_compress_ptr cinfo)
 {
-    struct mydata_comp *md;
-    int chunk_bytes;
-
-    md = (struct mydata_comp *)(cinfo->client_data);
-    chunk_bytes = md->cb_bytes;
-    md->total_done += chunk_bytes;
-    cinfo->dest->next_output_byte = md->cb;
-    cinfo->dest->free_in_buffer = md->cb_bytes;
-    md->overwrite = 1;
+    struct jp_comp *jp;
+
+    jp = (struct jp_comp *) (cinfo->client_data);
+    cinfo->dest->next_output_byte = (JOCTET *) (jp->cb);
+    cinfo->dest->free_in_buffer = jp->cb_bytes;
+    jp->overwrite = 1;
     return 1;
 }
 
@@ -255,134 +275,92 @@ my_empty_output_buffer(j_compress_ptr cinfo)
 static void DEFAULT_CC
 my_term_destination(j_compress_ptr cinfo)
 {
-    struct mydata_comp *md;
-    int chunk_bytes;
-
-    md = (struct mydata_comp *)(cinfo->client_data);
-    chunk_bytes = md->cb_bytes - cinfo->dest->free_in_buffer;
-    md->total_done += chunk_bytes;
 }
 
 /*****************************************************************************/
+/* rows of 4 byte pixels, stored as r, g, b, x in memory, padded on the
+   right with e copies of the last pixel
+   returns error */
 static int APP_CC
-jp_do_compress(char *data, int width, int height, int bpp, int quality,
+jp_do_compress(struct jp_comp *jp, char *data, int width, int height,
+               int stride, int e, int quality,
                char *comp_data, int *comp_data_bytes)
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    struct jpeg_destination_mgr dst_mgr;
-    struct mydata_comp md;
-    JSAMPROW row_pointer[4];
-    int Bpp;
-
-    Bpp = (bpp + 7) / 8;
-    memset(&cinfo, 0, sizeof(cinfo));
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    memset(&md, 0, sizeof(md));
-    md.cb = comp_data,
-       md.cb_bytes = *comp_data_bytes;
-    cinfo.client_data = &md;
-    memset(&dst_mgr, 0, sizeof(dst_mgr));
-    dst_mgr.init_destination = my_init_destination;
-    dst_mgr.empty_output_buffer = my_empty_output_buffer;
-    dst_mgr.term_destination = my_term_destination;
-    cinfo.dest = &dst_mgr;
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = Bpp;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    cinfo.num_components = 3;
-    cinfo.dct_method = JDCT_FLOAT;
-    jpeg_set_quality(&cinfo, quality, 1);
-    jpeg_start_compress(&cinfo, 1);
-
-    while (cinfo.next_scanline + 3 < cinfo.image_height)
+    struct jpeg_compress_struct *cinfo;
+    JSAMPROW row_pointer[1];
+    char *src;
+    char *dst;
+    int bytes;
+    int index;
+
+    cinfo = &(jp->cinfo);
+#if defined(JCS_EXTENSIONS)
+    bytes = (width + e) * 4;
+#else
+    bytes = (width + e) * 3;
+#endif
+    if (((e != 0) || (bytes != (width + e) * 4)) && (bytes > jp->row_bytes))
     {
-        row_pointer[0] = data;
-        data += width * Bpp;
-        row_pointer[1] = data;
-        data += width * Bpp;
-        row_pointer[2] = data;
-        data += width * Bpp;
-        row_pointer[3] = data;
-        data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 4);
+        g_free(jp->row);
+        jp->row = (char *) g_malloc(bytes, 0);
+        jp->row_bytes = bytes;
     }
-
-    while (cinfo.next_scanline < cinfo.image_height)
+    jp->cb = comp_data;
+    jp->cb_bytes = *comp_data_bytes;
+    if (setjmp(jp->jerr.jmp))
     {
-        row_pointer[0] = data;
-        data += width * Bpp;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        jpeg_abort_compress(cinfo);
+        return 1;
     }
-
-    jpeg_finish_compress(&cinfo);
-    *comp_data_bytes = md.total_done;
-    jpeg_destroy_compress(&cinfo);
-
-    if (md.overwrite)
+    cinfo->image_width = width + e;
+    cinfo->image_height = height;
+    if (quality != jp->quality)
     {
-        return 1;
+        jpeg_set_quality(cinfo, quality, 1);
+        jp->quality = quality;
     }
-
-    return 0;
-}
-
-/*****************************************************************************/
-static int APP_CC
-jpeg_compress(char *in_data, int width, int height,
-              struct stream *s, struct stream *temp_s, int bpp,
-              int byte_limit, int e, int quality)
-{
-    char *data;
-    tui32 *src32;
-    tui16 *src16;
-    tui8 *dst8;
-    tui32 pixel;
-    int red;
-    int blue;
-    int green;
-    int j;
-    int i;
-    int cdata_bytes;
-
-    data = temp_s->data;
-    dst8 = data;
-
-    if (bpp == 24)
+    jpeg_start_compress(cinfo, 1);
+    while (cinfo->next_scanline < cinfo->image_height)
     {
-        src32 = (tui32 *)in_data;
-
-        for (j = 0; j < height; j++)
+        src = data + cinfo->next_scanline * stride;
+#if defined(JCS_EXTENSIONS)
+        if (e == 0)
         {
-            for (i = 0; i < width; i++)
-            {
-                pixel = src32[i + j * width];
-                SPLITCOLOR32(red, green, blue, pixel);
-                *(dst8++) = blue;
-                *(dst8++) = green;
-                *(dst8++) = red;
-            }
-
-            for (i = 0; i < e; i++)
+            row_pointer[0] = (JSAMPROW) src;
+        }
+        else
+        {
+            g_memcpy(jp->row, src, width * 4);
+            dst = jp->row + width * 4;
+            for (index = 0; index < e; index++)
             {
-                *(dst8++) = blue;
-                *(dst8++) = green;
-                *(dst8++) = red;
+                g_memcpy(dst, dst - 4, 4);
+                dst += 4;
             }
+            row_pointer[0] = (JSAMPROW) (jp->row);
         }
+#else
+        dst = jp->row;
+        for (index = 0; index < width; index++)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            src += 4;
+            dst += 3;
+        }
+        for (index = 0; index < e; index++)
+        {
+            g_memcpy(dst, dst - 3, 3);
+            dst += 3;
+        }
+        row_pointer[0] = (JSAMPROW) (jp->row);
+#endif
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
     }
-    else
-    {
-        g_writeln("bpp wrong %d", bpp);
-    }
-
-    cdata_bytes = byte_limit;
-    jp_do_compress(data, width + e, height, 24, quality, s->p, &cdata_bytes);
-    s->p += cdata_bytes;
-    return cdata_bytes;
+    jpeg_finish_compress(cinfo);
+    *comp_data_bytes = jp->cb_bytes - (int) (cinfo->dest->free_in_buffer);
+    return jp->overwrite;
 }
 
 /*****************************************************************************/
@@ -392,31 +370,106 @@ xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    int start_line, struct stream *temp_s,
                    int e, int quality)
 {
-    jpeg_compress(in_data, width, height, s, temp_s, bpp, byte_limit,
-                  e, quality);
+    int cdata_bytes;
+
+    if (bpp != 24)
+    {
+        g_writeln("xrdp_jpeg_compress: bpp wrong %d", bpp);
+        return height;
+    }
+    if (handle == 0)
+    {
+        g_writeln("xrdp_jpeg_compress: handle is nil");
+        return height;
+    }
+    /* blue is sent in the red channel, same as with turbo jpeg */
+    cdata_bytes = byte_limit;
+    if (jp_do_compress((struct jp_comp *) handle, in_data, width, height,
+                       width * 4, e, quality, s->p, &cdata_bytes) != 0)
+    {
+        g_writeln("xrdp_jpeg_compress: compress failed");
+        return height;
+    }
+    s->p += cdata_bytes;
     return height;
 }
 
 /*****************************************************************************/
+/* format is ignored, the frame is r, g, b, x in memory
+   returns height or -1 on error */
 int APP_CC
 xrdp_codec_jpeg_compress(void *handle, int format, char *inp_data, int width,
                          int height, int stride, int x, int y, int cx, int cy,
                          int quality, char *out_data, int *io_len)
 {
-    return 0;
+    char *src_ptr;
+
+    if (handle == 0)
+    {
+        g_writeln("xrdp_codec_jpeg_compress: handle is nil");
+        return -1;
+    }
+    src_ptr = inp_data + (y * stride + x * 4);
+    if (jp_do_compress((struct jp_comp *) handle, src_ptr, cx, cy, stride, 0,
+                       quality, out_data, io_len) != 0)
+    {
+        return -1;
+    }
+    return height;
 }
 
 /*****************************************************************************/
 void *APP_CC
 xrdp_jpeg_init(void)
 {
-    return 0;
+    struct jp_comp *jp;
+
+    jp = (struct jp_comp *) g_malloc(sizeof(struct jp_comp), 1);
+    if (jp == 0)
+    {
+        return 0;
+    }
+    jp->cinfo.err = jpeg_std_error(&(jp->jerr.pub));
+    jp->jerr.pub.error_exit = my_error_exit;
+    if (setjmp(jp->jerr.jmp))
+    {
+        jpeg_destroy_compress(&(jp->cinfo));
+        g_free(jp);
+        return 0;
+    }
+    jpeg_create_compress(&(jp->cinfo));
+    jp->cinfo.client_data = jp;
+    jp->dst_mgr.init_destination = my_init_destination;
+    jp->dst_mgr.empty_output_buffer = my_empty_output_buffer;
+    jp->dst_mgr.term_destination = my_term_destination;
+    jp->cinfo.dest = &(jp->dst_mgr);
+#if defined(JCS_EXTENSIONS)
+    jp->cinfo.input_components = 4;
+    jp->cinfo.in_color_space = JCS_EXT_RGBX;
+#else
+    jp->cinfo.input_components = 3;
+    jp->cinfo.in_color_space = JCS_RGB;
+#endif
+    jpeg_set_defaults(&(jp->cinfo));
+    jp->cinfo.dct_method = JDCT_ISLOW;
+    jp->quality = -1;
+    return jp;
 }
 
 /*****************************************************************************/
 int APP_CC
 xrdp_jpeg_deinit(void *handle)
 {
+    struct jp_comp *jp;
+
+    jp = (struct jp_comp *) handle;
+    if (jp == 0)
+    {
+        return 0;
+    }
+    jpeg_destroy_compress(&(jp->cinfo));
+    g_free(jp->row);
+    g_free(jp);
     return 0;
 }
 
@@ -20,6 +20,11 @@
 
 #include "libxrdp.h"
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define MPPC_SSE2 1
+#endif
+
 #define MPPC_ENC_DEBUG 0
 
 #if MPPC_ENC_DEBUG
@@ -43,47 +48,32 @@
 #define PACKET_COMPR_TYPE_RDP61 0x03
 #define CompressionTypeMask     0x0F
 
-#define CRC_INIT 0xFFFF
-#define CRC(_crcval, _newchar) _crcval = \
-    ((_crcval) >> 8) ^ g_crc_table[((_crcval) ^ (_newchar)) & 0x00ff]
+/* match finder settings for each level, see mppc_enc_set_level */
+struct mppc_level
+{
+    int depth; /* hash chain entries to look at */
+    int lazy; /* try the next byte before taking a match */
+    int nice; /* stop looking once a match is this long */
+};
 
-/* CRC16 defs */
-static const tui16 g_crc_table[256] =
+static const struct mppc_level g_mppc_levels[MPPC_ENC_MAX_LEVEL + 1] =
 {
-    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
+    {    1, 0,    16 }, /* 0, single slot like the old encoder */
+    {    2, 0,    32 },
+    {    4, 0,    32 },
+    {    8, 1,    64 },
+    {   16, 1,   128 },
+    {   32, 1,   256 },
+    {   64, 1,   512 },
+    {  128, 1,  1024 },
+    {  256, 1,  4096 },
+    { 1024, 1, 65535 }  /* 9 */
 };
 
+#define MPPC_HASH(_p, _bits) \
+    ((((((tui8) (_p)[0]) << 16) | (((tui8) (_p)[1]) << 8) | \
+       ((tui8) (_p)[2])) * 0x9E3779B1u) >> (32 - (_bits)))
+
 /*****************************************************************************
                      insert 2 bits into outputBuffer
 ******************************************************************************/
@@ -444,11 +434,15 @@ mppc_enc_new(int protocol_type)
         case PROTO_RDP_40:
             enc->protocol_type = PROTO_RDP_40;
             enc->buf_len = RDP_40_HIST_BUF_LEN;
+            enc->hash_bits = 13;
+            enc->max_lom = 8191;
             break;
 
         case PROTO_RDP_50:
             enc->protocol_type = PROTO_RDP_50;
             enc->buf_len = RDP_50_HIST_BUF_LEN;
+            enc->hash_bits = 16;
+            enc->max_lom = 65535;
             break;
 
         default:
@@ -475,19 +469,49 @@ mppc_enc_new(int protocol_type)
     }
 
     enc->outputBuffer = enc->outputBufferPlus + 64;
+    /* hash_table holds the newest position for each hash, hash_chain the
+       position before it with the same hash, both are buf_len entries */
     enc->hash_table = (tui16 *) g_malloc(enc->buf_len * 2, 1);
+    enc->hash_chain = (tui16 *) g_malloc(enc->buf_len * 2, 1);
 
-    if (enc->hash_table == 0)
+    if ((enc->hash_table == 0) || (enc->hash_chain == 0))
     {
         g_free(enc->historyBuffer);
         g_free(enc->outputBufferPlus);
+        g_free(enc->hash_table);
+        g_free(enc->hash_chain);
         g_free(enc);
         return 0;
     }
 
+    mppc_enc_set_level(enc, MPPC_ENC_DEFAULT_LEVEL);
+
     return enc;
 }
 
+/**
+ * set how hard the match finder looks, 0 is fastest, MPPC_ENC_MAX_LEVEL
+ * compresses best
+ *
+ * @param   enc    encoder state info
+ * @param   level  0 to MPPC_ENC_MAX_LEVEL
+ *
+ * @return  0 on success, 1 if level is out of range
+ */
+
+int APP_CC
+mppc_enc_set_level(struct xrdp_mppc_enc *enc, int level)
+{
+    if ((level < 0) || (level > MPPC_ENC_MAX_LEVEL))
+    {
+        return 1;
+    }
+    enc->depth = g_mppc_levels[level].depth;
+    enc->lazy = g_mppc_levels[level].lazy;
+    enc->nice = g_mppc_levels[level].nice;
+    return 0;
+}
+
 /**
  * deinit mppc_enc structure
  *
@@ -504,28 +528,116 @@ mppc_enc_free(struct xrdp_mppc_enc *enc)
     g_free(enc->historyBuffer);
     g_free(enc->outputBufferPlus);
     g_free(enc->hash_table);
+    g_free(enc->hash_chain);
     g_free(enc);
 }
 
 /**
- * encode (compress) data using RDP 4.0 protocol
- *
- * @param   enc           encoder state info
- * @param   srcData       uncompressed data
- * @param   len           length of srcData
+ * count matching bytes, at most max
+ */
+
+static int
+mppc_match_len(const char *p1, const char *p2, int max)
+{
+    int len;
+#if defined(MPPC_SSE2)
+    __m128i a;
+    __m128i b;
+    int mask;
+#endif
+
+    len = 0;
+#if defined(MPPC_SSE2)
+    while (len + 16 <= max)
+    {
+        a = _mm_loadu_si128((const __m128i *) (p1 + len));
+        b = _mm_loadu_si128((const __m128i *) (p2 + len));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+        if (mask != 0)
+        {
+            return len + __builtin_ctz(mask);
+        }
+        len += 16;
+    }
+#endif
+    while ((len < max) && (p1[len] == p2[len]))
+    {
+        len++;
+    }
+    return len;
+}
+
+/**
+ * add history position pos to the hash chains
+ */
+
+static void
+mppc_insert(struct xrdp_mppc_enc *enc, int pos)
+{
+    int hash;
+
+    hash = MPPC_HASH(enc->historyBuffer + pos, enc->hash_bits);
+    enc->hash_chain[pos] = enc->hash_table[hash];
+    enc->hash_table[hash] = pos;
+}
+
+/**
+ * find the longest earlier match for history position pos and add pos
+ * to the hash chains, end is one past the last byte of history
  *
- * @return  TRUE on success, FALSE on failure
+ * @return  length of match, 0 if none of at least 3 bytes
  */
 
-static int APP_CC
-compress_rdp_4(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+static int
+mppc_find_match(struct xrdp_mppc_enc *enc, int pos, int end, int *offset)
 {
-    /* RDP 4.0 encoding not yet implemented */
-    return 0;
+    char *hbuf;
+    tui16 *chain;
+    int cand;
+    int next;
+    int depth;
+    int best;
+    int len;
+    int max;
+
+    hbuf = enc->historyBuffer;
+    chain = enc->hash_chain;
+    cand = enc->hash_table[MPPC_HASH(hbuf + pos, enc->hash_bits)];
+    mppc_insert(enc, pos);
+    max = MIN(end - pos, enc->max_lom);
+    best = 2;
+    depth = enc->depth;
+    /* positions only go down along a chain, an entry that does not is
+       left over from before the last flush */
+    while ((depth > 0) && (cand < pos))
+    {
+        if (hbuf[cand + best] == hbuf[pos + best])
+        {
+            len = mppc_match_len(hbuf + pos, hbuf + cand, max);
+            if (len > best)
+            {
+                best = len;
+                *offset = pos - cand;
+                if ((len >= enc->nice) || (len >= max))
+                {
+                    break;
+                }
+            }
+        }
+        next = chain[cand];
+        if (next >= cand)
+        {
+            break;
+        }
+        cand = next;
+        depth--;
+    }
+    return best > 2 ? best : 0;
 }
 
 /**
- * encode (compress) data using RDP 5.0 protocol using hash table
+ * encode (compress) data using RDP 4.0 (8K history) or RDP 5.0 (64K
+ * history) protocol, they only differ in how copy offsets are encoded
  *
  * @param   enc           encoder state info
  * @param   srcData       uncompressed data
@@ -535,50 +647,42 @@ compress_rdp_4(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
  */
 
 static int APP_CC
-compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+compress_rdp_4_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 {
     char *outputBuffer;     /* points to enc->outputBuffer */
-    char *hptr_end;         /* points to end of history data */
-    char *historyPointer;   /* points to first byte of srcData in
-                             * historyBuffer */
-    char *hbuf_start;       /* points to start of history buffer */
-    char *cptr1;
-    char *cptr2;
     int opb_index;          /* index into outputBuffer */
     int bits_left;          /* unused bits in current byte in outputBuffer */
     tui32 copy_offset;      /* pattern match starts here... */
     tui32 lom;              /* ...and matches this many bytes */
-    int last_crc_index;     /* don't compute CRC beyond this index */
-    tui16 *hash_table;      /* hash table for pattern matching */
+    int last_crc_index;     /* don't hash beyond this index */
+    int offset;
+    int next_offset;        /* match at the next byte, for lazy matching */
+    int next_lom;
+    int inserted;           /* history below this is in the hash chains */
+    int hist_end;
+    int pos;
 
     tui32 i;
     tui32 j;
     tui32 k;
-    tui32 x;
     tui8 data;
     tui16 data16;
     tui32 historyOffset;
-    tui16 crc;
-    tui32 ctr;
-    tui32 saved_ctr;
-    tui32 data_end;
-    tui8 byte_val;
+    int ctr;
+    int data_end;           /* signed, len can be 1 or 2 */
 
-    crc = 0;
     opb_index = 0;
     bits_left = 8;
-    copy_offset = 0;
-    hash_table = enc->hash_table;
-    hbuf_start = enc->historyBuffer;
     outputBuffer = enc->outputBuffer;
     g_memset(outputBuffer, 0, len);
-    enc->flags = PACKET_COMPR_TYPE_64K;
+    enc->flags = enc->protocol_type == PROTO_RDP_40 ?
+                 PACKET_COMPR_TYPE_8K : PACKET_COMPR_TYPE_64K;
 
     if ((enc->historyOffset + len) >= enc->buf_len - 3)
     {
         /* historyBuffer cannot hold srcData - rewind it */
         enc->historyOffset = 0;
-        g_memset(hash_table, 0, enc->buf_len * 2);
+        g_memset(enc->hash_table, 0, enc->buf_len * 2);
         g_memset(enc->historyBuffer, 0, enc->buf_len); // added
         enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
     }
@@ -589,96 +693,55 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     /* add / append new data to historyBuffer */
     g_memcpy(&(enc->historyBuffer[historyOffset]), srcData, len);
 
-    /* point to start of data to be compressed */
-    historyPointer = &(enc->historyBuffer[historyOffset]);
-
-    ctr = copy_offset = lom = 0;
-
-    /* if we are at start of history buffer, do not attempt to compress */
-    /* first 2 bytes, because minimum LoM is 3                          */
-    if (historyOffset == 0)
-    {
-        /* encode first two bytes as literals */
-        for (x = 0; x < 2; x++)
-        {
-            data = *(historyPointer + x);
-            DLOG(("%.2x ", (tui8) data));
-            if (data & 0x80)
-            {
-                /* insert encoded literal */
-                insert_2_bits(0x02);
-                data &= 0x7f;
-                insert_7_bits(data);
-            }
-            else
-            {
-                /* insert literal */
-                insert_8_bits(data);
-            }
-        }
-
-        /* store hash for first two entries in historyBuffer */
-        crc = CRC_INIT;
-        byte_val = enc->historyBuffer[0];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[1];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[2];
-        CRC(crc, byte_val);
-        hash_table[crc] = 0;
-
-        crc = CRC_INIT;
-        byte_val = enc->historyBuffer[1];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[2];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[3];
-        CRC(crc, byte_val);
-        hash_table[crc] = 1;
-
-        /* first two bytes have already been processed */
-        ctr = 2;
-    }
-
     enc->historyOffset += len;
+    hist_end = enc->historyOffset;
 
-    /* point to last byte in new data */
-    hptr_end = &(enc->historyBuffer[enc->historyOffset - 1]);
-
-    /* do not compute CRC beyond this */
+    /* do not hash beyond this */
     last_crc_index = enc->historyOffset - 3;
 
     /* do not search for pattern match beyond this */
     data_end = len - 2;
 
+    ctr = 0;
+    copy_offset = 0;
+    next_offset = 0;
+    next_lom = 0;
+    inserted = historyOffset;
+
     /* start compressing data */
 
     while (ctr < data_end)
     {
-        cptr1 = historyPointer + ctr;
-
-        crc = CRC_INIT;
-        byte_val = *cptr1;
-        CRC(crc, byte_val);
-        byte_val = *(cptr1 + 1);
-        CRC(crc, byte_val);
-        byte_val = *(cptr1 + 2);
-        CRC(crc, byte_val);
-
-        /* cptr2 points to start of pattern match */
-        cptr2 = hbuf_start + hash_table[crc];
-        copy_offset = cptr1 - cptr2;
-
-        /* save current entry */
-        hash_table[crc] = cptr1 - hbuf_start;
-
-        /* double check that we have a pattern match */
-        if ((*cptr1 != *cptr2) ||
-            (*(cptr1 + 1) != *(cptr2 + 1)) ||
-            (*(cptr1 + 2) != *(cptr2 + 2)))
+        pos = historyOffset + ctr;
+        if (inserted > pos)
+        {
+            /* looked at as the next byte in the last pass */
+            lom = next_lom;
+            copy_offset = next_offset;
+        }
+        else
+        {
+            lom = mppc_find_match(enc, pos, hist_end, &offset);
+            copy_offset = offset;
+            inserted = pos + 1;
+        }
+
+        if ((lom > 0) && enc->lazy && (lom < enc->nice) &&
+            (ctr + 1 < data_end))
+        {
+            /* a longer match at the next byte is worth a literal */
+            next_lom = mppc_find_match(enc, pos + 1, hist_end, &next_offset);
+            inserted = pos + 2;
+            if (next_lom > lom)
+            {
+                lom = 0;
+            }
+        }
+
+        if (lom == 0)
         {
             /* no match found; encode literal byte */
-            data = *cptr1;
+            data = srcData[ctr];
 
             DLOG(("%.2x ", data));
             if (data < 0x80)
@@ -697,55 +760,55 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
             continue;
         }
 
-        /* we have a match - compute Length of Match */
-        cptr1 += 3;
-        cptr2 += 3;
-        lom = 3;
-        while ((cptr1 <= hptr_end) && (*(cptr1++) == *(cptr2++)))
+        DLOG(("<%d: %ld,%d> ", pos, copy_offset, lom));
+
+        /* store the rest of the matching segment in the hash chains */
+        j = MIN(pos + lom, last_crc_index + 1);
+        for (i = inserted; i < j; i++)
         {
-            lom++;
+            mppc_insert(enc, i);
         }
-        saved_ctr = ctr + lom;
-        DLOG(("<%d: %ld,%d> ",  (historyPointer + ctr) - hbuf_start,
-              copy_offset, lom));
+        inserted = MAX(inserted, (int) j);
+        ctr += lom;
 
-        /* compute CRC for matching segment and store in hash table */
+        /* encode copy_offset and insert into output buffer */
 
-        cptr1 = historyPointer + ctr;
-        if (cptr1 + lom > hbuf_start + last_crc_index)
-        {
-            /* we have gone beyond last_crc_index - go back */
-            j = last_crc_index - (cptr1 - hbuf_start);
-        }
-        else
+        if (enc->protocol_type == PROTO_RDP_40)
         {
-            j = lom - 1;
-        }
-        ctr++;
-        for (i = 0; i < j; i++)
-        {
-            cptr1 = historyPointer + ctr;
-
-            /* compute CRC on triplet */
-            crc = CRC_INIT;
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
+            if (copy_offset <= 63)
+            {
+                /* insert binary header */
+                data = 0x0f;
+                insert_4_bits(data);
 
-            /* save current entry */
-            hash_table[crc] = (cptr1 - 3) - hbuf_start;
+                /* insert 6 bits of copy_offset */
+                data = (char) (copy_offset & 0x3f);
+                insert_6_bits(data);
+            }
+            else if (copy_offset <= 319)
+            {
+                /* insert binary header */
+                data = 0x0e;
+                insert_4_bits(data);
 
-            /* point to next triplet */
-            ctr++;
-        }
-        ctr = saved_ctr;
+                /* insert 8 bits of copy offset */
+                data = (char) (copy_offset - 64);
+                insert_8_bits(data);
+            }
+            else
+            {
+                /* copy_offset is 320+, history is only 8K */
 
-        /* encode copy_offset and insert into output buffer */
+                /* insert binary header */
+                data = 0x06;
+                insert_3_bits(data);
 
-        if (copy_offset <= 63) /* (copy_offset >= 0) is always true */
+                /* insert 13 bits of copy offset */
+                data16 = copy_offset - 320;
+                insert_13_bits(data16);
+            }
+        }
+        else if (copy_offset <= 63) /* (copy_offset >= 0) is always true */
         {
             /* insert binary header */
             data = 0x1f;
@@ -974,7 +1037,7 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
         /* compressed data longer than uncompressed data */
         /* give up */
         enc->historyOffset = 0;
-        g_memset(hash_table, 0, enc->buf_len * 2);
+        g_memset(enc->hash_table, 0, enc->buf_len * 2);
         g_memset(enc->historyBuffer, 0, enc->buf_len);
         enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
         return 0;
@@ -1014,12 +1077,8 @@ compress_rdp(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     switch (enc->protocol_type)
     {
         case PROTO_RDP_40:
-            return compress_rdp_4(enc, srcData, len);
-            break;
-
         case PROTO_RDP_50:
-            return compress_rdp_5(enc, srcData, len);
-            break;
+            return compress_rdp_4_5(enc, srcData, len);
     }
 
     return 0;
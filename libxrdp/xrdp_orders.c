@@ -2287,6 +2287,28 @@ xrdp_orders_send_raw_bitmap(struct xrdp_orders *self,
     return 0;
 }
 
+/*****************************************************************************/
+/* planar format header for 32 bpp bitmaps, rle plus the configured
+   color loss level and chroma subsampling */
+static int APP_CC
+xrdp_orders_planar_flags(struct xrdp_orders *self)
+{
+    int flags;
+    int cll;
+
+    flags = 0x10; /* rle */
+    cll = self->rdp_layer->client_info.planar_cll;
+    if (cll != 0)
+    {
+        flags |= cll;
+        if (self->rdp_layer->client_info.planar_cs)
+        {
+            flags |= 0x08;
+        }
+    }
+    return flags;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* max size width * height * Bpp + 16 */
@@ -2335,7 +2357,8 @@ xrdp_orders_send_bitmap(struct xrdp_orders *self,
     {
         lines_sending = xrdp_bitmap32_compress(data, width, height, s,
                                                bpp, 16384,
-                                               i - 1, temp_s, e, 0x10);
+                                               i - 1, temp_s, e,
+                                               xrdp_orders_planar_flags(self));
     }
     else
     {
@@ -2441,15 +2464,35 @@ xrdp_orders_send_font(struct xrdp_orders *self,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns non zero if a rev2 cache bitmap order should carry the persistent
+   key, the client only keeps keys for caches it flagged persistent */
+static int APP_CC
+xrdp_orders_use_persist_key(struct xrdp_orders *self, int cache_id,
+                            int key1, int key2)
+{
+    struct xrdp_client_info *ci;
+
+    ci = &(self->rdp_layer->client_info);
+    if (((ci->cache_persist_flags >> cache_id) & 1) == 0)
+    {
+        return 0;
+    }
+    return (key1 != 0) || (key2 != 0);
+}
+
 /*****************************************************************************/
 /* returns error */
-/* max size width * height * Bpp + 14 */
+/* max size width * height * Bpp + 22 */
+/* key1 and key2 are the persistent key, 0 if none */
 int APP_CC
 xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
                              int width, int height, int bpp, char *data,
-                             int cache_id, int cache_idx)
+                             int cache_id, int cache_idx,
+                             int key1, int key2)
 {
     int order_flags = 0;
+    int key_bytes = 0;
     int len = 0;
     int bufsize = 0;
     int Bpp = 0;
@@ -2479,18 +2522,32 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
 
     Bpp = (bpp + 7) / 8;
     bufsize = (width + e) * height * Bpp;
-    if (xrdp_orders_check(self, bufsize + 14) != 0)
+    key_bytes = 0;
+    if (xrdp_orders_use_persist_key(self, cache_id, key1, key2))
+    {
+        key_bytes = 8;
+    }
+    if (xrdp_orders_check(self, bufsize + 14 + key_bytes) != 0)
     {
         return 1;
     }
     self->order_count++;
     order_flags = RDP_ORDER_STANDARD | RDP_ORDER_SECONDARY;
     out_uint8(self->out_s, order_flags);
-    len = (bufsize + 6) - 7; /* length after type minus 7 */
+    len = (bufsize + 6 + key_bytes) - 7; /* length after type minus 7 */
     out_uint16_le(self->out_s, len);
     i = (((Bpp + 2) << 3) & 0x38) | (cache_id & 7);
+    if (key_bytes != 0)
+    {
+        i = i | (0x02 << 7); /* CBR2_PERSISTENT_KEY_PRESENT */
+    }
     out_uint16_le(self->out_s, i); /* flags */
     out_uint8(self->out_s, RDP_ORDER_RAW_BMPCACHE2); /* type */
+    if (key_bytes != 0)
+    {
+        out_uint32_le(self->out_s, key1);
+        out_uint32_le(self->out_s, key2);
+    }
     out_uint8(self->out_s, width + e);
     out_uint8(self->out_s, height);
     out_uint16_be(self->out_s, bufsize | 0x4000);
@@ -2558,9 +2615,11 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
 int APP_CC
 xrdp_orders_send_bitmap2(struct xrdp_orders *self,
                          int width, int height, int bpp, char *data,
-                         int cache_id, int cache_idx, int hints)
+                         int cache_id, int cache_idx, int hints,
+                         int key1, int key2)
 {
     int order_flags = 0;
+    int key_bytes = 0;
     int len = 0;
     int bufsize = 0;
     int Bpp = 0;
@@ -2600,7 +2659,8 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
     {
         lines_sending = xrdp_bitmap32_compress(data, width, height, s,
                                                bpp, 16384,
-                                               i - 1, temp_s, e, 0x10);
+                                               i - 1, temp_s, e,
+                                               xrdp_orders_planar_flags(self));
     }
     else
     {
@@ -2617,19 +2677,33 @@ height(%d)", lines_sending, height);
 
     bufsize = (int)(s->p - p);
     Bpp = (bpp + 7) / 8;
-    if (xrdp_orders_check(self, bufsize + 14) != 0)
+    key_bytes = 0;
+    if (xrdp_orders_use_persist_key(self, cache_id, key1, key2))
+    {
+        key_bytes = 8;
+    }
+    if (xrdp_orders_check(self, bufsize + 14 + key_bytes) != 0)
     {
         return 1;
     }
     self->order_count++;
     order_flags = RDP_ORDER_STANDARD | RDP_ORDER_SECONDARY;
     out_uint8(self->out_s, order_flags);
-    len = (bufsize + 6) - 7; /* length after type minus 7 */
+    len = (bufsize + 6 + key_bytes) - 7; /* length after type minus 7 */
     out_uint16_le(self->out_s, len);
     i = (((Bpp + 2) << 3) & 0x38) | (cache_id & 7);
     i = i | (0x08 << 7); /* CBR2_NO_BITMAP_COMPRESSION_HDR */
+    if (key_bytes != 0)
+    {
+        i = i | (0x02 << 7); /* CBR2_PERSISTENT_KEY_PRESENT */
+    }
     out_uint16_le(self->out_s, i); /* flags */
     out_uint8(self->out_s, RDP_ORDER_BMPCACHE2); /* type */
+    if (key_bytes != 0)
+    {
+        out_uint32_le(self->out_s, key1);
+        out_uint32_le(self->out_s, key2);
+    }
     out_uint8(self->out_s, width + e);
     out_uint8(self->out_s, height);
     out_uint16_be(self->out_s, bufsize | 0x4000);
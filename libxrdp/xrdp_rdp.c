@@ -74,6 +74,18 @@ xrdp_rdp_read_config(struct xrdp_client_info *client_info)
         {
             client_info->use_bulk_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "bulk_compression_level") == 0)
+        {
+            client_info->mppc_level = g_atoi(value);
+        }
+        else if (g_strcasecmp(item, "planar_color_loss") == 0)
+        {
+            client_info->planar_cll = g_atoi(value) & 7;
+        }
+        else if (g_strcasecmp(item, "planar_subsampling") == 0)
+        {
+            client_info->planar_cs = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "crypt_level") == 0)
         {
             if (g_strcasecmp(value, "none") == 0)
@@ -127,6 +139,14 @@ xrdp_rdp_read_config(struct xrdp_client_info *client_info)
         {
             client_info->rfx_min_pixel = g_atoi(value);
         }
+        else if (g_strcasecmp(item, "encoder_threads") == 0)
+        {
+            client_info->encoder_threads = g_atoi(value);
+        }
+        else if (g_strcasecmp(item, "perf_stats") == 0)
+        {
+            client_info->perf_stats = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "new_cursors") == 0)
         {
             client_info->pointer_flags = g_text2bool(value) == 0 ? 2 : 0;
@@ -197,6 +217,10 @@ xrdp_rdp_read_config(struct xrdp_client_info *client_info)
                 g_strncpy(client_info->certificate, value, 1023);
             }
         }
+        else if (g_strcasecmp(item, "ktls") == 0)
+        {
+            client_info->ktls = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "key_file") == 0)
         {
             g_memset(client_info->key_file, 0, sizeof(char) * 1024);
@@ -221,7 +245,6 @@ xrdp_rdp_read_config(struct xrdp_client_info *client_info)
     return 0;
 }
 
-#if defined(XRDP_NEUTRINORDP)
 /*****************************************************************************/
 static void
 cpuid(tui32 info, tui32 *eax, tui32 *ebx, tui32 *ecx, tui32 *edx)
@@ -249,7 +272,8 @@ cpuid(tui32 info, tui32 *eax, tui32 *ebx, tui32 *ecx, tui32 *edx)
 }
 
 /*****************************************************************************/
-static tui32
+/* returns XRDP_CPU_* flags for the cpu we are running on */
+tui32 APP_CC
 xrdp_rdp_detect_cpu(void)
 {
     tui32 eax;
@@ -268,12 +292,17 @@ xrdp_rdp_detect_cpu(void)
     if (edx & (1 << 26))
     {
         DEBUG(("SSE2 detected"));
-        cpu_opt |= CPU_SSE2;
+        cpu_opt |= XRDP_CPU_SSE2;
+    }
+
+    if (ecx & (1 << 20))
+    {
+        DEBUG(("SSE4.2 detected"));
+        cpu_opt |= XRDP_CPU_SSE42;
     }
 
     return cpu_opt;
 }
-#endif
 
 /*****************************************************************************/
 struct xrdp_rdp *APP_CC
@@ -286,6 +315,7 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     self = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
     self->session = session;
     self->share_id = 66538;
+    self->client_info.mppc_level = MPPC_ENC_DEFAULT_LEVEL;
     /* read ini settings */
     xrdp_rdp_read_config(&self->client_info);
     /* create sec layer */
@@ -301,9 +331,19 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     bytes = sizeof(self->client_info.client_ip) - 1;
     g_write_ip_address(trans->sck, self->client_info.client_ip, bytes);
     self->mppc_enc = mppc_enc_new(PROTO_RDP_50);
+    make_stream(self->marker_s);
+    if (mppc_enc_set_level(self->mppc_enc, self->client_info.mppc_level) != 0)
+    {
+        log_message(LOG_LEVEL_WARNING, "bulk_compression_level %d out of "
+                    "range, using %d", self->client_info.mppc_level,
+                    MPPC_ENC_DEFAULT_LEVEL);
+    }
 #if defined(XRDP_NEUTRINORDP)
     self->rfx_enc = rfx_context_new();
-    rfx_context_set_cpu_opt(self->rfx_enc, xrdp_rdp_detect_cpu());
+    if (xrdp_rdp_detect_cpu() & XRDP_CPU_SSE2)
+    {
+        rfx_context_set_cpu_opt(self->rfx_enc, CPU_SSE2);
+    }
 #endif
     self->client_info.size = sizeof(self->client_info);
     DEBUG(("out xrdp_rdp_create"));
@@ -314,6 +354,8 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
 void APP_CC
 xrdp_rdp_delete(struct xrdp_rdp *self)
 {
+    int index;
+
     if (self == 0)
     {
         return;
@@ -321,6 +363,11 @@ xrdp_rdp_delete(struct xrdp_rdp *self)
 
     xrdp_sec_delete(self->sec_layer);
     mppc_enc_free(self->mppc_enc);
+    free_stream(self->marker_s);
+    for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
+    {
+        g_free(self->persist_keys[index]);
+    }
 #if defined(XRDP_NEUTRINORDP)
     rfx_context_free((RFX_CONTEXT *)(self->rfx_enc));
 #endif
@@ -515,6 +562,11 @@ xrdp_rdp_send_data(struct xrdp_rdp *self, struct stream *s,
                    mppc_enc->historyOffset, tocomplen));
 
             clen = mppc_enc->bytes_in_opb + 18;
+            if (self->session->perf != 0)
+            {
+                self->session->perf->mppc_bytes_in += tocomplen;
+                self->session->perf->mppc_bytes_out += clen - 18;
+            }
             pdulen = clen;
             ctype = mppc_enc->flags;
             iso_offset = (int)(s->iso_hdr - s->data);
@@ -540,6 +592,11 @@ xrdp_rdp_send_data(struct xrdp_rdp *self, struct stream *s,
             LLOGLN(10, ("xrdp_rdp_send_data: mppc_encode not ok "
                    "type %d flags %d", mppc_enc->protocol_type,
                    mppc_enc->flags));
+            if (self->session->perf != 0)
+            {
+                self->session->perf->mppc_bytes_in += tocomplen;
+                self->session->perf->mppc_bytes_out += tocomplen;
+            }
         }
     }
 
@@ -678,6 +735,12 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
                 comp_len = mppc_enc->bytes_in_opb + header_bytes;
                 LLOGLN(10, ("xrdp_rdp_send_fastpath: no_comp_len %d "
                        "comp_len %d", no_comp_len, comp_len));
+                if (self->session->perf != 0)
+                {
+                    self->session->perf->mppc_bytes_in += to_comp_len;
+                    self->session->perf->mppc_bytes_out += comp_len -
+                                                           header_bytes;
+                }
                 send_len = comp_len;
                 comp_type = mppc_enc->flags;
                 /* outputBuffer has 64 bytes preceding it */
@@ -696,6 +759,11 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
                 LLOGLN(10, ("xrdp_rdp_send_fastpath: mppc_encode not ok "
                        "type %d flags %d", mppc_enc->protocol_type,
                        mppc_enc->flags));
+                if (self->session->perf != 0)
+                {
+                    self->session->perf->mppc_bytes_in += to_comp_len;
+                    self->session->perf->mppc_bytes_out += to_comp_len;
+                }
             }
         }
         updateHeader = (updateCode & 15) |
@@ -1124,6 +1192,86 @@ xrdp_rdp_process_frame_ack(struct xrdp_rdp *self, struct stream *s)
     return 0;
 }
 
+/*****************************************************************************/
+/* 2.2.1.17 Persistent Key List PDU, the keys name bitmaps the client has
+   stored on disk and will load into each cache in the order listed */
+static int APP_CC
+xrdp_rdp_process_persist_list(struct xrdp_rdp *self, struct stream *s)
+{
+    int num_entries[5];
+    int total_entries[5];
+    int total;
+    int flags;
+    int index;
+    int jndex;
+    int count;
+    tui32 key1;
+    tui32 key2;
+
+    if (!s_check_rem(s, 24))
+    {
+        return 1;
+    }
+    total = 0;
+    for (index = 0; index < 5; index++)
+    {
+        in_uint16_le(s, num_entries[index]);
+        total += num_entries[index];
+    }
+    for (index = 0; index < 5; index++)
+    {
+        in_uint16_le(s, total_entries[index]);
+    }
+    in_uint8(s, flags); /* bBitMask */
+    in_uint8s(s, 3); /* pad */
+    if (!s_check_rem(s, total * 8))
+    {
+        g_writeln("xrdp_rdp_process_persist_list: bad length");
+        return 1;
+    }
+    if (flags & RDP_PERSIST_FIRST_PDU)
+    {
+        for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
+        {
+            count = MIN(total_entries[index], XRDP_MAX_BITMAP_CACHE_IDX);
+            g_free(self->persist_keys[index]);
+            self->persist_keys[index] = 0;
+            if (count > 0)
+            {
+                self->persist_keys[index] = (tui64 *)
+                                            g_malloc(count * sizeof(tui64), 0);
+            }
+            self->persist_keys_count[index] = 0;
+            self->persist_keys_alloc[index] = count;
+        }
+    }
+    for (index = 0; index < 5; index++)
+    {
+        for (jndex = 0; jndex < num_entries[index]; jndex++)
+        {
+            in_uint32_le(s, key1);
+            in_uint32_le(s, key2);
+            if (index >= XRDP_MAX_BITMAP_CACHE_ID)
+            {
+                continue;
+            }
+            count = self->persist_keys_count[index];
+            if (count < self->persist_keys_alloc[index])
+            {
+                self->persist_keys[index][count] = ((tui64) key2 << 32) | key1;
+                self->persist_keys_count[index] = count + 1;
+            }
+        }
+    }
+    if (flags & RDP_PERSIST_LAST_PDU)
+    {
+        g_writeln("xrdp_rdp_process_persist_list: persistent keys %d %d %d",
+                  self->persist_keys_count[0], self->persist_keys_count[1],
+                  self->persist_keys_count[2]);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* RDP_PDU_DATA */
 int APP_CC
@@ -1173,6 +1321,9 @@ xrdp_rdp_process_data(struct xrdp_rdp *self, struct stream *s)
         case RDP_DATA_PDU_FONT2: /* 39(0x27) */
             xrdp_rdp_process_data_font(self, s);
             break;
+        case RDP_DATA_PDU_PERSIST_LIST: /* 43(0x2b) */
+            xrdp_rdp_process_persist_list(self, s);
+            break;
         case 56: /* PDUTYPE2_FRAME_ACKNOWLEDGE 0x38 */
             xrdp_rdp_process_frame_ack(self, s);
             break;
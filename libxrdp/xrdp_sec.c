@@ -635,6 +635,25 @@ unicode_in(struct stream *s, int uni_len, char *dst, int dst_len)
     return 0;
 }
 
+/*****************************************************************************/
+/* replace the 64K history bulk compressor with an 8K one
+   returns error */
+static int APP_CC
+xrdp_sec_mppc_enc_8k(struct xrdp_sec *self)
+{
+    struct xrdp_mppc_enc *mppc_enc;
+
+    mppc_enc = mppc_enc_new(PROTO_RDP_40);
+    if (mppc_enc == 0)
+    {
+        return 1;
+    }
+    mppc_enc_set_level(mppc_enc, self->rdp_layer->client_info.mppc_level);
+    mppc_enc_free(self->rdp_layer->mppc_enc);
+    self->rdp_layer->mppc_enc = mppc_enc;
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 static int APP_CC
@@ -691,6 +710,14 @@ xrdp_sec_process_logon_info(struct xrdp_sec *self, struct stream *s)
         {
             DEBUG(("flag RDP_COMPRESSION set"));
             self->rdp_layer->client_info.rdp_compression = 1;
+            if ((flags & RDP_COMPRESSION_TYPE_MASK) == RDP_COMPRESSION_TYPE_8K)
+            {
+                /* client can only decode RDP 4.0, 8K history */
+                if (xrdp_sec_mppc_enc_8k(self) != 0)
+                {
+                    self->rdp_layer->client_info.rdp_compression = 0;
+                }
+            }
         }
         else
         {
@@ -2194,7 +2221,8 @@ xrdp_sec_incoming(struct xrdp_sec *self)
 
         if (trans_set_tls_mode(self->mcs_layer->iso_layer->trans,
                 self->rdp_layer->client_info.key_file,
-                self->rdp_layer->client_info.certificate) != 0)
+                self->rdp_layer->client_info.certificate,
+                self->rdp_layer->client_info.ktls) != 0)
         {
             g_writeln("xrdp_sec_incoming: trans_set_tls_mode failed");
             return 1;
@@ -29,8 +29,8 @@
 extern struct config_sesman *g_cfg; /* in sesman.c */
 
 /******************************************************************************/
-int DEFAULT_CC
-access_login_allowed(char *user)
+static int APP_CC
+access_login_allowed_nolock(char *user)
 {
     int gid;
     int ok;
@@ -78,8 +78,8 @@ access_login_allowed(char *user)
 }
 
 /******************************************************************************/
-int DEFAULT_CC
-access_login_mng_allowed(char *user)
+static int APP_CC
+access_login_mng_allowed_nolock(char *user)
 {
     int gid;
     int ok;
@@ -125,3 +125,28 @@ access_login_mng_allowed(char *user)
 
     return 0;
 }
+
+/******************************************************************************/
+/* the group checks go to nss, see session_auth_lock */
+int DEFAULT_CC
+access_login_allowed(char *user)
+{
+    int rv;
+
+    session_auth_lock();
+    rv = access_login_allowed_nolock(user);
+    session_auth_unlock();
+    return rv;
+}
+
+/******************************************************************************/
+int DEFAULT_CC
+access_login_mng_allowed(char *user)
+{
+    int rv;
+
+    session_auth_lock();
+    rv = access_login_mng_allowed_nolock(user);
+    session_auth_unlock();
+    return rv;
+}
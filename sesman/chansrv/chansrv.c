@@ -221,6 +221,24 @@ g_is_term(void)
     return g_is_wait_obj_set(g_term_event);
 }
 
+/*****************************************************************************/
+/* drop a reference to cod, chunks are sent by reference so the last one to
+   go frees it */
+static void DEFAULT_CC
+chan_out_data_done(void *done_data)
+{
+    struct chan_out_data *cod;
+
+    cod = (struct chan_out_data *)done_data;
+    cod->refs--;
+    if (cod->refs < 1)
+    {
+        free_stream(cod->s);
+        g_free(cod->headers);
+        g_free(cod);
+    }
+}
+
 /*****************************************************************************/
 /* add data to chan_item, on its way to the client */
 /* returns error */
@@ -228,7 +246,11 @@ static int APP_CC
 add_data_to_chan_item(struct chan_item *chan_item, char *data, int size)
 {
     struct stream *s;
+    struct stream hs;
     struct chan_out_data *cod;
+    int index;
+    int chunk_size;
+    int chan_flags;
 
     make_stream(s);
     init_stream(s, size);
@@ -236,6 +258,35 @@ add_data_to_chan_item(struct chan_item *chan_item, char *data, int size)
     s->end = s->data + size;
     cod = (struct chan_out_data *)g_malloc(sizeof(struct chan_out_data), 1);
     cod->s = s;
+    cod->refs = 1;
+    cod->num_chunks = MAX(1, (size + 1599) / 1600);
+    cod->headers = (char *)g_malloc(cod->num_chunks * 26, 0);
+    /* the headers only depend on the chunk, build them all once here */
+    g_memset(&hs, 0, sizeof(hs));
+    hs.data = cod->headers;
+    hs.p = hs.data;
+    hs.size = cod->num_chunks * 26;
+    for (index = 0; index < cod->num_chunks; index++)
+    {
+        chunk_size = MIN(1600, size - index * 1600);
+        chan_flags = 0;
+        if (index == 0)
+        {
+            chan_flags |= 1; /* first */
+        }
+        if (index == cod->num_chunks - 1)
+        {
+            chan_flags |= 2; /* last */
+        }
+        out_uint32_le(&hs, 0); /* version */
+        out_uint32_le(&hs, 8 + 8 + 2 + 2 + 2 + 4 + chunk_size); /* size */
+        out_uint32_le(&hs, 8); /* msg id */
+        out_uint32_le(&hs, 8 + 2 + 2 + 2 + 4 + chunk_size); /* size */
+        out_uint16_le(&hs, chan_item->id);
+        out_uint16_le(&hs, chan_flags);
+        out_uint16_le(&hs, chunk_size);
+        out_uint32_le(&hs, size);
+    }
 
     if (chan_item->tail == 0)
     {
@@ -256,11 +307,11 @@ add_data_to_chan_item(struct chan_item *chan_item, char *data, int size)
 static int APP_CC
 send_data_from_chan_item(struct chan_item *chan_item)
 {
-    struct stream *s;
+    struct trans_seg segs[2];
     struct chan_out_data *cod;
     int bytes_left;
     int size;
-    int chan_flags;
+    int chunk;
     int error;
 
     if (chan_item->head == 0)
@@ -271,35 +322,23 @@ send_data_from_chan_item(struct chan_item *chan_item)
     cod = chan_item->head;
     bytes_left = (int)(cod->s->end - cod->s->p);
     size = MIN(1600, bytes_left);
-    chan_flags = 0;
-
-    if (cod->s->p == cod->s->data)
-    {
-        chan_flags |= 1; /* first */
-    }
-
-    if (cod->s->p + size >= cod->s->end)
-    {
-        chan_flags |= 2; /* last */
-    }
-
-    s = trans_get_out_s(g_con_trans, 8192);
-    out_uint32_le(s, 0); /* version */
-    out_uint32_le(s, 8 + 8 + 2 + 2 + 2 + 4 + size); /* size */
-    out_uint32_le(s, 8); /* msg id */
-    out_uint32_le(s, 8 + 2 + 2 + 2 + 4 + size); /* size */
-    out_uint16_le(s, chan_item->id);
-    out_uint16_le(s, chan_flags);
-    out_uint16_le(s, size);
-    out_uint32_le(s, cod->s->size);
-    out_uint8a(s, cod->s->p, size);
-    s_mark_end(s);
+    chunk = (int)(cod->s->p - cod->s->data) / 1600;
+
+    /* header and payload go out by reference, cod stays alive until
+       trans is done with both */
+    segs[0].data = cod->headers + chunk * 26;
+    segs[0].bytes = 26;
+    segs[1].data = cod->s->p;
+    segs[1].bytes = size;
     LOGM((LOG_LEVEL_DEBUG, "chansrv::send_data_from_chan_item: -- "
-          "size %d chan_flags 0x%8.8x", size, chan_flags));
+          "size %d chunk %d of %d", size, chunk, cod->num_chunks));
 
-    error = trans_write_copy(g_con_trans);
+    cod->refs++;
+    error = trans_write_segs(g_con_trans, segs, size > 0 ? 2 : 1,
+                             chan_out_data_done, cod);
     if (error != 0)
     {
+        cod->refs--;
         return 1;
     }
 
@@ -307,7 +346,6 @@ send_data_from_chan_item(struct chan_item *chan_item)
 
     if (cod->s->p >= cod->s->end)
     {
-        free_stream(cod->s);
         chan_item->head = chan_item->head->next;
 
         if (chan_item->head == 0)
@@ -315,7 +353,7 @@ send_data_from_chan_item(struct chan_item *chan_item)
             chan_item->tail = 0;
         }
 
-        g_free(cod);
+        chan_out_data_done(cod);
     }
 
     return 0;
@@ -512,10 +550,9 @@ process_message_channel_setup(struct stream *s)
             cod = ci->head;
             while (1)
             {
-                free_stream(cod->s);
                 old_cod = cod;
                 cod = cod->next;
-                g_free(old_cod);
+                chan_out_data_done(old_cod);
                 if (ci->tail == old_cod)
                 {
                     break;
@@ -1087,11 +1124,13 @@ channel_thread_loop(void *in_val)
     int index;
     THREAD_RV rv;
     struct trans *ltran;
+    tbus wait_set;
 
     LOGM((LOG_LEVEL_INFO, "channel_thread_loop: thread start"));
     rv = 0;
     setup_api_listen();
     error = setup_listen();
+    wait_set = g_create_wait_set();
 
     if (error == 0)
     {
@@ -1103,7 +1142,8 @@ channel_thread_loop(void *in_val)
         trans_get_wait_objs(g_lis_trans, objs, &num_objs);
         trans_get_wait_objs(g_api_lis_trans, objs, &num_objs);
 
-        while (g_obj_wait(objs, num_objs, wobjs, num_wobjs, timeout) == 0)
+        while (g_obj_wait_set(wait_set, objs, num_objs, wobjs, num_wobjs,
+                              timeout) == 0)
         {
             check_timeout();
             if (g_is_wait_obj_set(g_term_event))
@@ -1204,9 +1244,11 @@ channel_thread_loop(void *in_val)
             dev_redir_get_wait_objs(objs, &num_objs, &timeout);
             xfuse_get_wait_objs(objs, &num_objs, &timeout);
             get_timeout(&timeout);
-        } /* end while (g_obj_wait(objs, num_objs, 0, 0, timeout) == 0) */
+        } /* end while (g_obj_wait_set(...) == 0) */
     }
 
+    g_delete_wait_set(wait_set);
+
     trans_delete(g_lis_trans);
     g_lis_trans = 0;
     trans_delete(g_con_trans);
@@ -30,6 +30,9 @@ struct chan_out_data
 {
     struct stream *s;
     struct chan_out_data *next;
+    int refs; /* the chan_item list and each chunk still queued in trans */
+    int num_chunks;
+    char *headers; /* 26 byte message header for each 1600 byte chunk */
 };
 
 struct chan_item
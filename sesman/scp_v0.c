@@ -37,7 +37,9 @@ scp_v0_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
     struct session_item *s_item;
     int errorcode = 0;
 
+    session_auth_lock();
     data = auth_userpass(s->username, s->password, &errorcode);
+    session_auth_unlock();
 
     if (s->type == SCP_GW_AUTHENTICATION)
     {
@@ -69,7 +71,9 @@ scp_v0_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
             scp_v0s_replyauthentication(c, errorcode);
         }
 
+        session_auth_lock();
         auth_end(data);
+        session_auth_unlock();
     }
     else if (data)
     {
@@ -94,7 +98,10 @@ scp_v0_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
             }
 
             session_reconnect(display, s->username);
+            g_free(s_item);
+            session_auth_lock();
             auth_end(data);
+            session_auth_unlock();
             /* don't set data to null here */
         }
         else
@@ -148,7 +155,9 @@ scp_v0_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
 
         if (display == 0)
         {
+            session_auth_lock();
             auth_end(data);
+            session_auth_unlock();
             scp_v0s_deny_connection(c);
         }
         else
@@ -50,7 +50,9 @@ scp_v1_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
     retries = g_cfg->sec.login_retry;
     current_try = retries;
 
+    session_auth_lock();
     data = auth_userpass(s->username, s->password,NULL);
+    session_auth_unlock();
     /*LOG_DBG("user: %s\npass: %s", s->username, s->password);*/
 
     while ((!data) && ((retries == 0) || (current_try > 0)))
@@ -65,7 +67,9 @@ scp_v1_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
         {
             case SCP_SERVER_STATE_OK:
                 /* all ok, we got new username and password */
+                session_auth_lock();
                 data = auth_userpass(s->username, s->password,NULL);
+                session_auth_unlock();
 
                 /* one try less */
                 if (current_try > 0)
@@ -205,7 +209,9 @@ scp_v1_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
 
     /* cleanup */
     scp_session_destroy(s);
+    session_auth_lock();
     auth_end(data);
+    session_auth_unlock();
     g_free(slist);
 }
 
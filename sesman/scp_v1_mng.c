@@ -42,7 +42,9 @@ scp_v1_mng_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
     int scount;
     int end = 0;
 
+    session_auth_lock();
     data = auth_userpass(s->username, s->password,NULL);
+    session_auth_unlock();
     /*LOG_DBG("user: %s\npass: %s", s->username, s->password);*/
 
     if (!data)
@@ -51,7 +53,9 @@ scp_v1_mng_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
         log_message(LOG_LEVEL_INFO,
                     "[MNG] Login failed for user %s. Connection terminated", s->username);
         scp_session_destroy(s);
+        session_auth_lock();
         auth_end(data);
+        session_auth_unlock();
         return;
     }
 
@@ -62,7 +66,9 @@ scp_v1_mng_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
         log_message(LOG_LEVEL_INFO,
                     "[MNG] User %s not allowed on TS. Connection terminated", s->username);
         scp_session_destroy(s);
+        session_auth_lock();
         auth_end(data);
+        session_auth_unlock();
         return;
     }
 
@@ -106,7 +112,9 @@ scp_v1_mng_process(struct SCP_CONNECTION *c, struct SCP_SESSION *s)
 
     /* cleanup */
     scp_session_destroy(s);
+    session_auth_lock();
     auth_end(data);
+    session_auth_unlock();
 }
 
 static void parseCommonStates(enum SCP_SERVER_STATES_E e, char *f)
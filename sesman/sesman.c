@@ -25,6 +25,12 @@
  */
 
 #include "sesman.h"
+#include "thread_calls.h"
+
+/* scp connections are handled by a pool of threads so a slow client or
+   a slow authentication does not hold up the other logins */
+#define SESMAN_SCP_WORKERS 8
+#define SESMAN_SCP_QUEUE 64
 
 int g_sck;
 int g_pid;
@@ -32,6 +38,97 @@ unsigned char g_fixedkey[8] = { 23, 82, 107, 6, 35, 78, 88, 7 };
 struct config_sesman *g_cfg; /* defined in config.h */
 
 tintptr g_term_event = 0;
+tintptr g_sigchld_event = 0;
+tintptr g_sync_event = 0;
+
+static tbus g_scp_mutex = 0;
+static tbus g_scp_sem = 0;
+static int g_scp_queue[SESMAN_SCP_QUEUE];
+static int g_scp_queue_start = 0;
+static int g_scp_queue_count = 0;
+
+/******************************************************************************/
+static THREAD_RV THREAD_CC
+sesman_scp_worker(void *arg)
+{
+    int in_sck;
+
+    while (1)
+    {
+        tc_sem_dec(g_scp_sem);
+        tc_mutex_lock(g_scp_mutex);
+        in_sck = g_scp_queue[g_scp_queue_start];
+        g_scp_queue_start = (g_scp_queue_start + 1) % SESMAN_SCP_QUEUE;
+        g_scp_queue_count--;
+        tc_mutex_unlock(g_scp_mutex);
+        /* closes the socket */
+        scp_process_start((void *)(tintptr)in_sck);
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* returns error */
+static int APP_CC
+sesman_scp_workers_start(void)
+{
+    int index;
+
+    g_scp_mutex = tc_mutex_create();
+    g_scp_sem = tc_sem_create(0);
+
+    for (index = 0; index < SESMAN_SCP_WORKERS; index++)
+    {
+        if (tc_thread_create(sesman_scp_worker, 0) != 0)
+        {
+            log_message(LOG_LEVEL_ERROR, "error starting scp worker thread");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* hand an accepted socket to the worker threads */
+static void APP_CC
+sesman_scp_queue_add(int in_sck)
+{
+    int index;
+
+    tc_mutex_lock(g_scp_mutex);
+
+    if (g_scp_queue_count >= SESMAN_SCP_QUEUE)
+    {
+        tc_mutex_unlock(g_scp_mutex);
+        log_message(LOG_LEVEL_WARNING, "too many pending scp connections, "
+                    "connection refused");
+        g_tcp_close(in_sck);
+        return;
+    }
+
+    index = (g_scp_queue_start + g_scp_queue_count) % SESMAN_SCP_QUEUE;
+    g_scp_queue[index] = in_sck;
+    g_scp_queue_count++;
+    tc_mutex_unlock(g_scp_mutex);
+    tc_sem_inc(g_scp_sem);
+}
+
+/******************************************************************************/
+static void APP_CC
+sesman_reap_children(void)
+{
+    int pid;
+
+    g_reset_wait_obj(g_sigchld_event);
+
+    /* signals can merge, collect every child that exited */
+    while ((pid = g_waitchild()) > 0)
+    {
+        session_kill(pid);
+    }
+}
 
 /******************************************************************************/
 /**
@@ -46,7 +143,6 @@ sesman_main_loop(void)
     int error;
     int robjs_count;
     int cont;
-    int pid;
     tbus sck_obj;
     tbus robjs[8];
 
@@ -60,6 +156,12 @@ sesman_main_loop(void)
         return;
     }
 
+    if (sesman_scp_workers_start() != 0)
+    {
+        g_tcp_close(g_sck);
+        return;
+    }
+
     g_tcp_set_non_blocking(g_sck);
     error = scp_tcp_bind(g_sck, g_cfg->listen_address, g_cfg->listen_port);
 
@@ -78,6 +180,8 @@ sesman_main_loop(void)
                 robjs_count = 0;
                 robjs[robjs_count++] = sck_obj;
                 robjs[robjs_count++] = g_term_event;
+                robjs[robjs_count++] = g_sigchld_event;
+                robjs[robjs_count++] = g_sync_event;
 
                 /* wait */
                 if (g_obj_wait(robjs, robjs_count, 0, 0, -1) != 0)
@@ -88,9 +192,20 @@ sesman_main_loop(void)
 
                 if (g_is_wait_obj_set(g_term_event)) /* term */
                 {
+                    session_sigkill_all();
                     break;
                 }
 
+                if (g_is_wait_obj_set(g_sigchld_event)) /* a session ended */
+                {
+                    sesman_reap_children();
+                }
+
+                if (g_is_wait_obj_set(g_sync_event)) /* session start */
+                {
+                    session_sync_start();
+                }
+
                 if (g_is_wait_obj_set(sck_obj)) /* incoming connection */
                 {
                     in_sck = g_tcp_accept(g_sck);
@@ -109,8 +224,7 @@ sesman_main_loop(void)
                     {
                         /* we've got a connection, so we pass it to scp code */
                         LOG_DBG("new connection");
-                        scp_process_start((void*)(tintptr)in_sck);
-                        g_sck_close(in_sck);
+                        sesman_scp_queue_add(in_sck);
                     }
                 }
             }
@@ -292,6 +406,7 @@ main(int argc, char **argv)
 
     /* libscp initialization */
     scp_init();
+    session_init();
 
     if (daemon)
     {
@@ -376,6 +491,10 @@ main(int argc, char **argv)
 
     g_snprintf(text, 255, "xrdp_sesman_%8.8x_main_term", g_pid);
     g_term_event = g_create_wait_obj(text);
+    g_snprintf(text, 255, "xrdp_sesman_%8.8x_main_sigchld", g_pid);
+    g_sigchld_event = g_create_wait_obj(text);
+    g_snprintf(text, 255, "xrdp_sesman_%8.8x_main_sync", g_pid);
+    g_sync_event = g_create_wait_obj(text);
 
     sesman_main_loop();
 
@@ -386,6 +505,8 @@ main(int argc, char **argv)
     }
 
     g_delete_wait_obj(g_term_event);
+    g_delete_wait_obj(g_sigchld_event);
+    g_delete_wait_obj(g_sync_event);
 
     if (!daemon)
     {
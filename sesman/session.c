@@ -31,12 +31,253 @@
 
 #include "sesman.h"
 #include "libscp_types.h"
+#include "thread_calls.h"
+
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
 extern unsigned char g_fixedkey[8];
 extern struct config_sesman *g_cfg; /* in sesman.c */
 extern int g_sck; /* in sesman.c */
 struct session_chain *g_sessions;
 int g_session_count;
+/* scp worker threads and the main loop share the session chain */
+static tbus g_session_mutex = 0;
+
+/* forking a process with threads leaves the child with whatever the other
+   threads had open or locked, so the workers hand session starts to the
+   main thread, the worker holding g_sync_mutex fills in the request, sets
+   g_sync_event and waits on g_sync_sem till session_sync_start is done */
+extern tbus g_sync_event; /* in sesman.c */
+static tbus g_sync_mutex = 0;
+static tbus g_sync_sem = 0;
+static int g_sync_cmd = 0; /* 0 start, 1 reconnect */
+static int g_sync_width;
+static int g_sync_height;
+static int g_sync_bpp;
+static char *g_sync_username;
+static char *g_sync_password;
+static tbus g_sync_data;
+static tui8 g_sync_type;
+static char *g_sync_domain;
+static char *g_sync_program;
+static char *g_sync_directory;
+static char *g_sync_client_ip;
+static int g_sync_display;
+static int g_sync_result;
+
+/* a fork only copies the thread calling it, a lock some other thread held
+   in pam, nss or crypt stays locked in the child for good, so the workers
+   make those calls between session_auth_lock and session_auth_unlock and
+   the main thread waits for them to finish before it forks */
+static pthread_mutex_t g_fork_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_fork_cond = PTHREAD_COND_INITIALIZER;
+static int g_fork_auth_count = 0; /* workers inside auth calls */
+static int g_fork_pending = 0;
+
+/* the chain is also hashed by pid and by user name, and the displays in
+   use are kept in a bitmap, so lookups do not walk every session */
+#define SESSION_HASH_SIZE 1024 /* power of 2 */
+static struct session_chain *g_session_by_pid[SESSION_HASH_SIZE];
+static struct session_chain *g_session_by_user[SESSION_HASH_SIZE];
+static tui32 *g_display_bits = 0;
+static int g_display_bits_words = 0;
+static int g_display_bits_base = 0;
+
+/******************************************************************************/
+static int APP_CC
+session_hash_pid(int pid)
+{
+    return pid & (SESSION_HASH_SIZE - 1);
+}
+
+/******************************************************************************/
+/* case insensitive so session_get_byuser can use it too */
+static int APP_CC
+session_hash_user(const char *name)
+{
+    tui32 hash;
+    int index;
+    int c;
+
+    hash = 2166136261U;
+
+    for (index = 0; (index < 255) && (name[index] != 0); index++)
+    {
+        c = (unsigned char)(name[index]);
+
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            c += 'a' - 'A';
+        }
+
+        hash = (hash ^ c) * 16777619U;
+    }
+
+    return hash & (SESSION_HASH_SIZE - 1);
+}
+
+/******************************************************************************/
+/* returns pointer to the bit word or 0 if the display is out of range */
+static tui32 *APP_CC
+session_display_word(int display, tui32 *mask)
+{
+    int bit;
+
+    bit = display - g_display_bits_base;
+
+    if ((bit < 0) || (bit >= g_display_bits_words * 32))
+    {
+        return 0;
+    }
+
+    *mask = ((tui32)1) << (bit & 31);
+    return g_display_bits + (bit >> 5);
+}
+
+/******************************************************************************/
+static void APP_CC
+session_display_mark(int display, int in_use)
+{
+    tui32 *word;
+    tui32 mask;
+
+    word = session_display_word(display, &mask);
+
+    if (word != 0)
+    {
+        if (in_use)
+        {
+            *word |= mask;
+        }
+        else
+        {
+            *word &= ~mask;
+        }
+    }
+}
+
+/******************************************************************************/
+/* called with the session lock held
+   sizes the bitmap for the configured display range, the range can
+   change on config reload so the bitmap is rebuilt from the chain then
+   returns error */
+static int APP_CC
+session_display_bits_check(void)
+{
+    struct session_chain *chain;
+    int words;
+
+    words = (g_cfg->sess.max_sessions + 1 + 31) / 32;
+
+    if ((g_display_bits != 0) && (words == g_display_bits_words) &&
+        (g_display_bits_base == g_cfg->sess.x11_display_offset))
+    {
+        return 0;
+    }
+
+    g_free(g_display_bits);
+    g_display_bits = (tui32 *)g_malloc(words * sizeof(tui32), 1);
+
+    if (g_display_bits == 0)
+    {
+        g_display_bits_words = 0;
+        return 1;
+    }
+
+    g_display_bits_words = words;
+    g_display_bits_base = g_cfg->sess.x11_display_offset;
+
+    for (chain = g_sessions; chain != 0; chain = chain->next)
+    {
+        session_display_mark(chain->item->display, 1);
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/* called with the session lock held */
+static void APP_CC
+session_chain_add(struct session_chain *chain)
+{
+    int hash;
+
+    chain->prev = 0;
+    chain->next = g_sessions;
+
+    if (g_sessions != 0)
+    {
+        g_sessions->prev = chain;
+    }
+
+    g_sessions = chain;
+
+    hash = session_hash_pid(chain->item->pid);
+    chain->next_pid = g_session_by_pid[hash];
+    g_session_by_pid[hash] = chain;
+
+    hash = session_hash_user(chain->item->name);
+    chain->next_user = g_session_by_user[hash];
+    g_session_by_user[hash] = chain;
+
+    session_display_mark(chain->item->display, 1);
+    g_session_count++;
+}
+
+/******************************************************************************/
+/* called with the session lock held */
+static void APP_CC
+session_chain_remove(struct session_chain *chain)
+{
+    struct session_chain **pp;
+
+    if (chain->prev != 0)
+    {
+        chain->prev->next = chain->next;
+    }
+    else
+    {
+        g_sessions = chain->next;
+    }
+
+    if (chain->next != 0)
+    {
+        chain->next->prev = chain->prev;
+    }
+
+    pp = g_session_by_pid + session_hash_pid(chain->item->pid);
+
+    while (*pp != 0)
+    {
+        if (*pp == chain)
+        {
+            *pp = chain->next_pid;
+            break;
+        }
+
+        pp = &((*pp)->next_pid);
+    }
+
+    pp = g_session_by_user + session_hash_user(chain->item->name);
+
+    while (*pp != 0)
+    {
+        if (*pp == chain)
+        {
+            *pp = chain->next_user;
+            break;
+        }
+
+        pp = &((*pp)->next_user);
+    }
+
+    session_display_mark(chain->item->display, 0);
+    g_session_count--;
+}
 
 extern tbus g_term_event; /* in sesman.c */
 
@@ -80,10 +321,9 @@ struct session_item *DEFAULT_CC
 session_get_bydata(char *name, int width, int height, int bpp, int type, char *client_ip)
 {
     struct session_chain *tmp;
+    struct session_item *dummy;
     enum SESMAN_CFG_SESS_POLICY policy = g_cfg->sess.policy;
 
-    tmp = g_sessions;
-
     /* convert from SCP_SESSION_TYPE namespace to SESMAN_SESSION_TYPE namespace */
     switch (type)
     {
@@ -107,6 +347,9 @@ session_get_bydata(char *name, int width, int height, int bpp, int type, char *c
             policy, name, width, height, bpp, type, client_ip);
 #endif
 
+    tc_mutex_lock(g_session_mutex);
+    tmp = g_session_by_user[session_hash_user(name)];
+
     while (tmp != 0)
     {
 #if 0
@@ -129,12 +372,22 @@ session_get_bydata(char *name, int width, int height, int bpp, int type, char *c
             tmp->item->bpp == bpp &&
             tmp->item->type == type)
         {
-            return tmp->item;
+            /* the chain item can go away once the lock is dropped */
+            dummy = g_malloc(sizeof(struct session_item), 0);
+
+            if (dummy != 0)
+            {
+                g_memcpy(dummy, tmp->item, sizeof(struct session_item));
+            }
+
+            tc_mutex_unlock(g_session_mutex);
+            return dummy;
         }
 
-        tmp = tmp->next;
+        tmp = tmp->next_user;
     }
 
+    tc_mutex_unlock(g_session_mutex);
     return 0;
 }
 
@@ -320,56 +573,117 @@ session_start_sessvc(int xpid, int wmpid, long data, char *username, int display
 }
 
 /******************************************************************************/
-/* called with the main thread
-   returns boolean */
+/* called with the session lock held
+   free displays come from the bitmap, the lock file and port probes only
+   verify that nothing outside sesman holds the candidate */
 static int APP_CC
-session_is_display_in_chain(int display)
+session_get_avail_display_from_chain(void)
 {
-    struct session_chain *chain;
-    struct session_item *item;
+    int word;
+    int bit;
+    int display;
+    int last_display;
+    tui32 bits;
 
-    chain = g_sessions;
+    if (session_display_bits_check() != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "X server -- out of memory for "
+                    "display bitmap");
+        return 0;
+    }
+
+    last_display = g_cfg->sess.x11_display_offset + g_cfg->sess.max_sessions;
 
-    while (chain != 0)
+    for (word = 0; word < g_display_bits_words; word++)
     {
-        item = chain->item;
+        bits = ~(g_display_bits[word]);
+        bit = 0;
 
-        if (item->display == display)
+        while (bits != 0)
         {
-            return 1;
-        }
+            while ((bits & 1) == 0)
+            {
+                bits >>= 1;
+                bit++;
+            }
+
+            display = g_display_bits_base + word * 32 + bit;
+
+            if (display > last_display)
+            {
+                break;
+            }
 
-        chain = chain->next;
+            if (!x_server_running_check_ports(display))
+            {
+                return display;
+            }
+
+            bits >>= 1;
+            bit++;
+        }
     }
 
+    log_message(LOG_LEVEL_ERROR, "X server -- no display in range is available");
     return 0;
 }
 
 /******************************************************************************/
-/* called with the main thread */
+#if defined(__linux__)
+/* returns error, 1 if inotify can not be used */
 static int APP_CC
-session_get_avail_display_from_chain(void)
+wait_for_xserver_inotify(int display)
 {
-    int display;
+    int fd;
+    int start;
+    int left;
+    char buf[1024];
 
-    display = g_cfg->sess.x11_display_offset;
+    fd = inotify_init();
 
-    while ((display - g_cfg->sess.x11_display_offset) <= g_cfg->sess.max_sessions)
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    /* X creates /tmp/.X<n>-lock first, then /tmp/.X11-unix/X<n> */
+    if ((inotify_add_watch(fd, "/tmp", IN_CREATE | IN_MOVED_TO) < 0) ||
+        (inotify_add_watch(fd, "/tmp/.X11-unix", IN_CREATE | IN_MOVED_TO) < 0))
+    {
+        g_file_close(fd);
+        return 1;
+    }
+
+    /* wait up to 10 secs for x server to start, the check comes after
+       the watches are added so a file created in between is not missed */
+    start = g_time3();
+
+    while (!x_server_running(display))
     {
-        if (!session_is_display_in_chain(display))
+        left = 10000 - (g_time3() - start);
+
+        if (left <= 0)
         {
-            if (!x_server_running_check_ports(display))
+            log_message(LOG_LEVEL_ERROR,
+                        "X server for display %d startup timeout",
+                        display);
+            break;
+        }
+
+        if (g_sck_can_recv(fd, left))
+        {
+            /* only used as a wake up, the names are not checked */
+            if (g_file_read(fd, buf, sizeof(buf)) < 0)
             {
-                return display;
+                break;
             }
         }
-
-        display++;
     }
 
-    log_message(LOG_LEVEL_ERROR, "X server -- no display in range is available");
+    g_file_close(fd);
     return 0;
 }
+#endif
 
 /******************************************************************************/
 static int APP_CC
@@ -377,6 +691,13 @@ wait_for_xserver(int display)
 {
     int i;
 
+#if defined(__linux__)
+    if (wait_for_xserver_inotify(display) == 0)
+    {
+        return 0;
+    }
+#endif
+
     /* give X a bit to start */
     /* wait up to 10 secs for x server to start */
     i = 0;
@@ -400,7 +721,7 @@ wait_for_xserver(int display)
 }
 
 /******************************************************************************/
-/* called with the main thread */
+/* called with the session lock held, on the main thread */
 static int APP_CC
 session_start_fork(int width, int height, int bpp, char *username,
                    char *password, tbus data, tui8 type, char *domain,
@@ -478,8 +799,9 @@ session_start_fork(int width, int height, int bpp, char *username,
     }
     else if (pid == 0)
     {
-        g_tcp_close(g_term_event);
-        g_tcp_close(g_sck);
+        /* drop the listener, the events and the scp sockets of the
+           workers, only the log stays open */
+        g_close_fds(3, log_child_fd());
         g_sprintf(geometry, "%dx%d", width, height);
         g_sprintf(depth, "%d", bpp);
         g_sprintf(screen, ":%d", display);
@@ -788,9 +1110,7 @@ session_start_fork(int width, int height, int bpp, char *username,
         temp->item->type = type;
         temp->item->status = SESMAN_SESSION_STATUS_ACTIVE;
 
-        temp->next = g_sessions;
-        g_sessions = temp;
-        g_session_count++;
+        session_chain_add(temp);
 
         return display;
     }
@@ -801,7 +1121,7 @@ session_start_fork(int width, int height, int bpp, char *username,
 }
 
 /******************************************************************************/
-/* called with the main thread */
+/* called on the main thread */
 static int APP_CC
 session_reconnect_fork(int display, char *username)
 {
@@ -815,6 +1135,7 @@ session_reconnect_fork(int display, char *username)
     }
     else if (pid == 0)
     {
+        g_close_fds(3, log_child_fd());
         env_set_user(username, 0, display,
                      g_cfg->session_variables1, g_cfg->session_variables2);
         g_snprintf(text, 255, "%s/%s", XRDP_CFG_PATH, "reconnectwm.sh");
@@ -830,6 +1151,32 @@ session_reconnect_fork(int display, char *username)
     return display;
 }
 
+/******************************************************************************/
+int DEFAULT_CC
+session_init(void)
+{
+    g_session_mutex = tc_mutex_create();
+    g_sync_mutex = tc_mutex_create();
+    g_sync_sem = tc_sem_create(0);
+    return 0;
+}
+
+/******************************************************************************/
+/* called by a worker thread, ask the main thread to call session_sync_start
+   and wait till done */
+static int APP_CC
+session_sync_request(int cmd)
+{
+    int rv;
+
+    g_sync_cmd = cmd;
+    g_set_wait_obj(g_sync_event);
+    tc_sem_dec(g_sync_sem);
+    rv = g_sync_result;
+    tc_mutex_unlock(g_sync_mutex);
+    return rv;
+}
+
 /******************************************************************************/
 /* called by a worker thread, ask the main thread to call session_sync_start
    and wait till done */
@@ -838,9 +1185,19 @@ session_start(int width, int height, int bpp, char *username, char *password,
               long data, tui8 type, char *domain, char *program,
               char *directory, char *client_ip)
 {
-    return session_start_fork(width, height, bpp, username,
-                              password, data, type, domain,
-                              program, directory, client_ip);
+    tc_mutex_lock(g_sync_mutex);
+    g_sync_width = width;
+    g_sync_height = height;
+    g_sync_bpp = bpp;
+    g_sync_username = username;
+    g_sync_password = password;
+    g_sync_data = data;
+    g_sync_type = type;
+    g_sync_domain = domain;
+    g_sync_program = program;
+    g_sync_directory = directory;
+    g_sync_client_ip = client_ip;
+    return session_sync_request(0);
 }
 
 /******************************************************************************/
@@ -849,76 +1206,149 @@ session_start(int width, int height, int bpp, char *username, char *password,
 int DEFAULT_CC
 session_reconnect(int display, char *username)
 {
-    return session_reconnect_fork(display, username);
+    tc_mutex_lock(g_sync_mutex);
+    g_sync_display = display;
+    g_sync_username = username;
+    return session_sync_request(1);
 }
 
 /******************************************************************************/
-int DEFAULT_CC
-session_kill(int pid)
+/* called by a worker thread before calling into pam, nss or crypt */
+void DEFAULT_CC
+session_auth_lock(void)
 {
-    struct session_chain *tmp;
-    struct session_chain *prev;
+    pthread_mutex_lock(&g_fork_mutex);
 
-    tmp = g_sessions;
-    prev = 0;
+    /* a waiting fork goes first so a busy server can not hold it off */
+    while (g_fork_pending)
+    {
+        pthread_cond_wait(&g_fork_cond, &g_fork_mutex);
+    }
 
-    while (tmp != 0)
+    g_fork_auth_count++;
+    pthread_mutex_unlock(&g_fork_mutex);
+}
+
+/******************************************************************************/
+void DEFAULT_CC
+session_auth_unlock(void)
+{
+    pthread_mutex_lock(&g_fork_mutex);
+    g_fork_auth_count--;
+
+    if (g_fork_auth_count == 0)
     {
-        if (tmp->item == 0)
-        {
-            log_message(LOG_LEVEL_ERROR, "session descriptor for "
-                        "pid %d is null!", pid);
+        pthread_cond_broadcast(&g_fork_cond);
+    }
 
-            if (prev == 0)
-            {
-                /* prev does no exist, so it's the first element - so we set
-                   g_sessions */
-                g_sessions = tmp->next;
-            }
-            else
-            {
-                prev->next = tmp->next;
-            }
+    pthread_mutex_unlock(&g_fork_mutex);
+}
 
-            return SESMAN_SESSION_KILL_NULLITEM;
-        }
+/******************************************************************************/
+/* called with the main thread, returns once no worker is in an auth call,
+   new ones wait till session_fork_end */
+static void APP_CC
+session_fork_begin(void)
+{
+    pthread_mutex_lock(&g_fork_mutex);
+    g_fork_pending = 1;
+
+    while (g_fork_auth_count > 0)
+    {
+        pthread_cond_wait(&g_fork_cond, &g_fork_mutex);
+    }
+
+    pthread_mutex_unlock(&g_fork_mutex);
+}
 
+/******************************************************************************/
+static void APP_CC
+session_fork_end(void)
+{
+    pthread_mutex_lock(&g_fork_mutex);
+    g_fork_pending = 0;
+    pthread_cond_broadcast(&g_fork_cond);
+    pthread_mutex_unlock(&g_fork_mutex);
+}
+
+/******************************************************************************/
+/* called with the main thread when g_sync_event is set, the session lock
+   keeps display selection and the chain insert atomic */
+int DEFAULT_CC
+session_sync_start(void)
+{
+    g_reset_wait_obj(g_sync_event);
+    session_fork_begin();
+
+    if (g_sync_cmd == 0)
+    {
+        tc_mutex_lock(g_session_mutex);
+        g_sync_result = session_start_fork(g_sync_width, g_sync_height,
+                                           g_sync_bpp, g_sync_username,
+                                           g_sync_password, g_sync_data,
+                                           g_sync_type, g_sync_domain,
+                                           g_sync_program, g_sync_directory,
+                                           g_sync_client_ip);
+        tc_mutex_unlock(g_session_mutex);
+    }
+    else
+    {
+        g_sync_result = session_reconnect_fork(g_sync_display,
+                                               g_sync_username);
+    }
+
+    session_fork_end();
+    tc_sem_inc(g_sync_sem);
+    return 0;
+}
+
+/******************************************************************************/
+/* called with the session lock held */
+static int APP_CC
+session_kill_nolock(int pid)
+{
+    struct session_chain *tmp;
+
+    tmp = g_session_by_pid[session_hash_pid(pid)];
+
+    while (tmp != 0)
+    {
         if (tmp->item->pid == pid)
         {
             /* deleting the session */
             log_message(LOG_LEVEL_INFO, "++ terminated session:  username %s, display :%d.0, session_pid %d, ip %s", tmp->item->name, tmp->item->display, tmp->item->pid, tmp->item->client_ip);
+            session_chain_remove(tmp);
             g_free(tmp->item);
-
-            if (prev == 0)
-            {
-                /* prev does no exist, so it's the first element - so we set
-                   g_sessions */
-                g_sessions = tmp->next;
-            }
-            else
-            {
-                prev->next = tmp->next;
-            }
-
             g_free(tmp);
-            g_session_count--;
             return SESMAN_SESSION_KILL_OK;
         }
 
         /* go on */
-        prev = tmp;
-        tmp = tmp->next;
+        tmp = tmp->next_pid;
     }
 
     return SESMAN_SESSION_KILL_NOTFOUND;
 }
 
+/******************************************************************************/
+int DEFAULT_CC
+session_kill(int pid)
+{
+    int rv;
+
+    tc_mutex_lock(g_session_mutex);
+    rv = session_kill_nolock(pid);
+    tc_mutex_unlock(g_session_mutex);
+    return rv;
+}
+
 /******************************************************************************/
 void DEFAULT_CC
 session_sigkill_all()
 {
     struct session_chain *tmp;
 
+    tc_mutex_lock(g_session_mutex);
     tmp = g_sessions;
 
     while (tmp != 0)
@@ -936,11 +1366,14 @@ session_sigkill_all()
         /* go on */
         tmp = tmp->next;
     }
+
+    tc_mutex_unlock(g_session_mutex);
 }
 
 /******************************************************************************/
-struct session_item *DEFAULT_CC
-session_get_bypid(int pid)
+/* called with the session lock held */
+static struct session_item *APP_CC
+session_get_bypid_nolock(int pid)
 {
     struct session_chain *tmp;
     struct session_item *dummy;
@@ -953,18 +1386,10 @@ session_get_bypid(int pid)
         return 0;
     }
 
-    tmp = g_sessions;
+    tmp = g_session_by_pid[session_hash_pid(pid)];
 
     while (tmp != 0)
     {
-        if (tmp->item == 0)
-        {
-            log_message(LOG_LEVEL_ERROR, "session descriptor for "
-                        "pid %d is null!", pid);
-            g_free(dummy);
-            return 0;
-        }
-
         if (tmp->item->pid == pid)
         {
             g_memcpy(dummy, tmp->item, sizeof(struct session_item));
@@ -972,7 +1397,7 @@ session_get_bypid(int pid)
         }
 
         /* go on */
-        tmp = tmp->next;
+        tmp = tmp->next_pid;
     }
 
     g_free(dummy);
@@ -980,8 +1405,21 @@ session_get_bypid(int pid)
 }
 
 /******************************************************************************/
-struct SCP_DISCONNECTED_SESSION *
-session_get_byuser(char *user, int *cnt, unsigned char flags)
+struct session_item *DEFAULT_CC
+session_get_bypid(int pid)
+{
+    struct session_item *rv;
+
+    tc_mutex_lock(g_session_mutex);
+    rv = session_get_bypid_nolock(pid);
+    tc_mutex_unlock(g_session_mutex);
+    return rv;
+}
+
+/******************************************************************************/
+/* called with the session lock held */
+static struct SCP_DISCONNECTED_SESSION *APP_CC
+session_get_byuser_nolock(char *user, int *cnt, unsigned char flags)
 {
     struct session_chain *tmp;
     struct SCP_DISCONNECTED_SESSION *sess;
@@ -990,7 +1428,9 @@ session_get_byuser(char *user, int *cnt, unsigned char flags)
 
     count = 0;
 
-    tmp = g_sessions;
+    /* a named user only needs its hash bucket */
+    tmp = (user == NULL) ? g_sessions :
+          g_session_by_user[session_hash_user(user)];
 
     while (tmp != 0)
     {
@@ -1009,7 +1449,7 @@ session_get_byuser(char *user, int *cnt, unsigned char flags)
         }
 
         /* go on */
-        tmp = tmp->next;
+        tmp = (user == NULL) ? tmp->next : tmp->next_user;
     }
 
     if (count == 0)
@@ -1027,7 +1467,8 @@ session_get_byuser(char *user, int *cnt, unsigned char flags)
         return 0;
     }
 
-    tmp = g_sessions;
+    tmp = (user == NULL) ? g_sessions :
+          g_session_by_user[session_hash_user(user)];
     index = 0;
 
     while (tmp != 0)
@@ -1072,9 +1513,21 @@ session_get_byuser(char *user, int *cnt, unsigned char flags)
         }
 
         /* go on */
-        tmp = tmp->next;
+        tmp = (user == NULL) ? tmp->next : tmp->next_user;
     }
 
     (*cnt) = count;
     return sess;
 }
+
+/******************************************************************************/
+struct SCP_DISCONNECTED_SESSION *
+session_get_byuser(char *user, int *cnt, unsigned char flags)
+{
+    struct SCP_DISCONNECTED_SESSION *rv;
+
+    tc_mutex_lock(g_session_mutex);
+    rv = session_get_byuser_nolock(user, cnt, flags);
+    tc_mutex_unlock(g_session_mutex);
+    return rv;
+}
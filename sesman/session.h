@@ -81,13 +81,25 @@ struct session_item
 struct session_chain
 {
   struct session_chain* next;
+  struct session_chain* prev;
+  struct session_chain* next_pid; /* pid hash bucket */
+  struct session_chain* next_user; /* user name hash bucket */
   struct session_item* item;
 };
 
+/**
+ *
+ * @brief creates the session list lock and the session start handoff
+ * @return 0 on success
+ *
+ */
+int DEFAULT_CC
+session_init(void);
+
 /**
  *
  * @brief finds a session matching the supplied parameters
- * @return session data or 0
+ * @return a copy of the session data (free with g_free) or 0
  *
  */
 struct session_item* DEFAULT_CC
@@ -110,6 +122,27 @@ session_start(int width, int height, int bpp, char* username, char* password,
 int DEFAULT_CC
 session_reconnect(int display, char* username);
 
+/**
+ *
+ * @brief runs the session start or reconnect a worker thread asked for
+ * @return 0
+ *
+ */
+int DEFAULT_CC
+session_sync_start(void);
+
+/**
+ *
+ * @brief brackets pam, nss and crypt calls on the scp worker threads so
+ *        the main thread does not fork while one is running
+ *
+ */
+void DEFAULT_CC
+session_auth_lock(void);
+
+void DEFAULT_CC
+session_auth_unlock(void);
+
 /**
  *
  * @brief kills a session
@@ -32,6 +32,7 @@ extern int g_sck;
 extern int g_pid;
 extern struct config_sesman *g_cfg; /* in sesman.c */
 extern tbus g_term_event;
+extern tbus g_sigchld_event;
 
 /******************************************************************************/
 void DEFAULT_CC
@@ -53,7 +54,8 @@ sig_sesman_shutdown(int sig)
 
     g_tcp_close(g_sck);
 
-    session_sigkill_all();
+    /* the main loop signals the sessions, the session list can not be
+       locked from here */
 
     g_snprintf(pid_file, 255, "%s/xrdp-sesman.pid", XRDP_PID_PATH);
     g_file_delete(pid_file);
@@ -123,19 +125,14 @@ sig_sesman_reload_cfg(int sig)
 void DEFAULT_CC
 sig_sesman_session_end(int sig)
 {
-    int pid;
-
     if (g_getpid() != g_pid)
     {
         return;
     }
 
-    pid = g_waitchild();
-
-    if (pid > 0)
-    {
-        session_kill(pid);
-    }
+    /* children are reaped in the main loop, this can interrupt a
+       thread that holds the session lock */
+    g_set_wait_obj(g_sigchld_event);
 }
 
 /******************************************************************************/
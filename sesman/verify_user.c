@@ -32,6 +32,7 @@
 #include <crypt.h>
 #include <shadow.h>
 #include <pwd.h>
+#include <pthread.h>
 
 #ifndef SECS_PER_DAY
 #define SECS_PER_DAY (24L*3600L)
@@ -45,10 +46,14 @@ auth_crypt_pwd(char *pwd, char *pln, char *crp);
 static int DEFAULT_CC
 auth_account_disabled(struct spwd *stp);
 
+/* getpwnam, getspnam and crypt use static storage and sesman
+   authenticates from several threads */
+static pthread_mutex_t g_auth_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /******************************************************************************/
 /* returns boolean */
-long DEFAULT_CC
-auth_userpass(char *user, char *pass, int *errorcode)
+static long DEFAULT_CC
+auth_userpass_nolock(char *user, char *pass)
 {
     const char *encr;
     const char *epass;
@@ -90,7 +95,20 @@ auth_userpass(char *user, char *pass, int *errorcode)
     {
         return 0;
     }
-    return (strcmp(encr, epass) == 0);
+    return (g_strcmp(encr, epass) == 0);
+}
+
+/******************************************************************************/
+/* returns boolean */
+long DEFAULT_CC
+auth_userpass(char *user, char *pass, int *errorcode)
+{
+    long rv;
+
+    pthread_mutex_lock(&g_auth_mutex);
+    rv = auth_userpass_nolock(user, pass);
+    pthread_mutex_unlock(&g_auth_mutex);
+    return rv;
 }
 
 /******************************************************************************/
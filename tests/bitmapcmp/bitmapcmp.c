@@ -0,0 +1,296 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * checks xrdp_bitmap_compress in libxrdp/xrdp_bitmap_compress.c gives
+ * the same bytes as xrdp_bitmap_compress_ref on random and structured
+ * bitmaps, build it with make and with make avx2 to cover both paths
+ * usage: bitmapcmp [seeds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libxrdp.h"
+
+#define NUM_PATTERNS 7
+#define NUM_ITEMS(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+static const char *g_pattern_names[NUM_PATTERNS] =
+{
+    "random", "solid", "runs", "rows", "bicolor", "mix", "noisy"
+};
+
+static const int g_bpps[] = { 8, 15, 16, 24 };
+static const int g_widths[] = { 1, 2, 3, 5, 7, 13, 16, 31, 33, 63, 64, 65, 255 };
+static const int g_heights[] = { 1, 2, 7, 64 };
+static const int g_limits[] = { 16384, 4096, 300 };
+
+/*****************************************************************************/
+/* xrdp_bitmap_compress.c only needs these from os_calls */
+void *APP_CC
+g_malloc(int size, int zero)
+{
+    return zero ? calloc(1, size) : malloc(size);
+}
+
+/*****************************************************************************/
+void APP_CC
+g_free(void *ptr)
+{
+    free(ptr);
+}
+
+/*****************************************************************************/
+void APP_CC
+g_memcpy(void *d_ptr, const void *s_ptr, int size)
+{
+    memcpy(d_ptr, s_ptr, size);
+}
+
+/*****************************************************************************/
+static unsigned int
+get_random(void)
+{
+    return ((unsigned int) rand() << 16) ^ (unsigned int) rand();
+}
+
+/*****************************************************************************/
+/* fills pixels with width * height values, each pattern aims at one kind
+   of order in the encoder, fill, mix, colour run, bicolour and fom */
+static void
+make_pixels(unsigned int *pixels, int bpp, int width, int height,
+            int pattern)
+{
+    unsigned int colors[3];
+    unsigned int mix;
+    unsigned int pixel;
+    int x;
+    int y;
+    int index;
+
+    for (index = 0; index < 3; index++)
+    {
+        colors[index] = get_random();
+    }
+    mix = bpp == 8 ? 0xff : bpp == 15 ? 0xba1f : 0xffffffff;
+    pixel = colors[0];
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            index = y * width + x;
+            switch (pattern)
+            {
+                case 0:
+                    pixel = get_random();
+                    break;
+                case 1:
+                    pixel = colors[0];
+                    break;
+                case 2:
+                    if (rand() % 8 == 0)
+                    {
+                        pixel = colors[rand() % 3];
+                    }
+                    break;
+                case 3:
+                    /* mostly the same as the line above */
+                    pixel = (y < 1 || rand() % 16 == 0) ?
+                            get_random() : pixels[index - width];
+                    break;
+                case 4:
+                    pixel = colors[(x + (rand() % 32 == 0)) & 1];
+                    break;
+                case 5:
+                    /* mostly the line above xor mix */
+                    pixel = (y < 1 || rand() % 16 == 0) ?
+                            get_random() : pixels[index - width] ^ mix;
+                    break;
+                default:
+                    pixel = (rand() % 4 == 0) ? get_random() : colors[y & 1];
+                    break;
+            }
+            pixels[index] = pixel;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* packs the pixels the way the encoder reads them */
+static void
+pack_pixels(const unsigned int *pixels, char *data, int bpp, int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        switch (bpp)
+        {
+            case 8:
+                ((unsigned char *) data)[index] = pixels[index];
+                break;
+            case 15:
+                ((unsigned short *) data)[index] = pixels[index] & 0x7fff;
+                break;
+            case 16:
+                ((unsigned short *) data)[index] = pixels[index];
+                break;
+            default:
+                ((unsigned int *) data)[index] = pixels[index] & 0xffffff;
+                break;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* sends all the lines the way libxrdp_send_bitmap does, bottom up in
+   byte_limit sized pieces, returns non zero if the two encoders differ */
+static int
+compare_bitmap(char *data, int bpp, int width, int height, int byte_limit,
+               struct stream *s1, struct stream *s2, struct stream *temp_s)
+{
+    int e;
+    int line;
+    int lines1;
+    int lines2;
+
+    e = width % 4;
+    if (e != 0)
+    {
+        e = 4 - e;
+    }
+    line = height;
+    while (line > 0)
+    {
+        init_stream(s1, 65536);
+        init_stream(s2, 65536);
+        lines1 = xrdp_bitmap_compress(data, width, height, s1, bpp,
+                                      byte_limit, line - 1, temp_s, e);
+        lines2 = xrdp_bitmap_compress_ref(data, width, height, s2, bpp,
+                                          byte_limit, line - 1, temp_s, e);
+        if (lines1 != lines2 || (s1->p - s1->data) != (s2->p - s2->data) ||
+                memcmp(s1->data, s2->data, s1->p - s1->data) != 0)
+        {
+            printf("line %d: %d lines %d bytes, ref %d lines %d bytes\n",
+                   line - 1, lines1, (int) (s1->p - s1->data),
+                   lines2, (int) (s2->p - s2->data));
+            return 1;
+        }
+        if (lines1 == 0)
+        {
+            break;
+        }
+        line -= lines1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* every pattern at every byte limit for one size, returns failures */
+static int
+check_size(unsigned int *pixels, char *data, int seed, int bpp, int width,
+           int height, struct stream *s1, struct stream *s2,
+           struct stream *temp_s)
+{
+    int limit;
+    int pattern;
+    int failed;
+
+    failed = 0;
+    for (limit = 0; limit < NUM_ITEMS(g_limits); limit++)
+    {
+        for (pattern = 0; pattern < NUM_PATTERNS; pattern++)
+        {
+            make_pixels(pixels, bpp, width, height, pattern);
+            pack_pixels(pixels, data, bpp, width * height);
+            if (compare_bitmap(data, bpp, width, height, g_limits[limit],
+                               s1, s2, temp_s) != 0)
+            {
+                printf("seed %d bpp %d %dx%d limit %d %s does not match "
+                       "ref\n", seed, bpp, width, height, g_limits[limit],
+                       g_pattern_names[pattern]);
+                failed++;
+            }
+        }
+    }
+    return failed;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct stream *s1;
+    struct stream *s2;
+    struct stream *temp_s;
+    unsigned int *pixels;
+    char *data;
+    int seeds;
+    int seed;
+    int bpp;
+    int width;
+    int height;
+    int count;
+    int failed;
+
+    seeds = argc > 1 ? atoi(argv[1]) : 20;
+    if (seeds < 1)
+    {
+        printf("usage: bitmapcmp [seeds]\n");
+        return 1;
+    }
+#if defined(__AVX2__)
+    printf("avx2 build, %d seeds\n", seeds);
+#elif defined(__SSE2__)
+    printf("sse2 build, %d seeds\n", seeds);
+#else
+    printf("scalar build, %d seeds\n", seeds);
+#endif
+    pixels = (unsigned int *) malloc(255 * 64 * 4);
+    data = (char *) malloc(255 * 64 * 4);
+    make_stream(s1);
+    make_stream(s2);
+    make_stream(temp_s);
+    init_stream(temp_s, 65536);
+    count = 0;
+    failed = 0;
+    for (seed = 1; seed <= seeds; seed++)
+    {
+        srand(seed);
+        for (bpp = 0; bpp < NUM_ITEMS(g_bpps); bpp++)
+        {
+            for (width = 0; width < NUM_ITEMS(g_widths); width++)
+            {
+                for (height = 0; height < NUM_ITEMS(g_heights); height++)
+                {
+                    failed += check_size(pixels, data, seed, g_bpps[bpp],
+                                         g_widths[width], g_heights[height],
+                                         s1, s2, temp_s);
+                    count += NUM_ITEMS(g_limits) * NUM_PATTERNS;
+                }
+            }
+        }
+    }
+    printf("%d bitmaps, %d differ\n", count, failed);
+    free_stream(s1);
+    free_stream(s2);
+    free_stream(temp_s);
+    free(pixels);
+    free(data);
+    return failed != 0;
+}
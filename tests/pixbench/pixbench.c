@@ -0,0 +1,153 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * times the pixel format kernels in common/xrdp_pixel.c against the
+ * scalar ones and checks the output is the same
+ * usage: pixbench [width] [height] [loops]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "xrdp_pixel.h"
+
+#define NUM_KERNELS 4
+
+static const char *g_kernel_names[NUM_KERNELS] =
+{
+    "r5g6b5", "x1r5g5b5", "r3g3b2", "a8"
+};
+
+/*****************************************************************************/
+static double
+get_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/*****************************************************************************/
+/* dst must hold width * height * 2 bytes */
+static void
+run_kernel(struct xrdp_pixel_procs *procs, int kernel, const void *src,
+           void *dst, int width, int height)
+{
+    switch (kernel)
+    {
+        case 0:
+            procs->to_r5g6b5(src, dst, width * height);
+            break;
+        case 1:
+            procs->to_x1r5g5b5(src, dst, width * height);
+            break;
+        case 2:
+            procs->to_r3g3b2(src, dst, width * height);
+            break;
+        case 3:
+            procs->to_a8(src, dst, width * height);
+            break;
+    }
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct xrdp_pixel_procs scalar;
+    struct xrdp_pixel_procs procs;
+    unsigned int *src;
+    char *ref;
+    char *dst;
+    double start;
+    double ms[NUM_KERNELS];
+    int width;
+    int height;
+    int loops;
+    int bytes;
+    int simd;
+    int kernel;
+    int index;
+    int rv;
+
+    width = argc > 1 ? atoi(argv[1]) : 1920;
+    height = argc > 2 ? atoi(argv[2]) : 1080;
+    loops = argc > 3 ? atoi(argv[3]) : 100;
+    if (width < 1 || height < 1 || loops < 1)
+    {
+        printf("usage: pixbench [width] [height] [loops]\n");
+        return 1;
+    }
+    bytes = width * height * 2;
+    src = (unsigned int *) malloc(width * height * 4);
+    ref = (char *) malloc(bytes);
+    dst = (char *) malloc(bytes);
+    if (src == 0 || ref == 0 || dst == 0)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (index = 0; index < width * height; index++)
+    {
+        src[index] = ((unsigned int) rand() << 16) ^ (unsigned int) rand();
+    }
+    printf("%dx%d, %d loops, default %s\n", width, height, loops,
+           xrdp_pixel_get_name(xrdp_pixel_init()));
+    xrdp_pixel_get_procs(XRDP_PIXEL_SCALAR, &scalar);
+    rv = 0;
+    for (simd = 0; simd < XRDP_PIXEL_COUNT; simd++)
+    {
+        if (xrdp_pixel_get_procs(simd, &procs) != 0)
+        {
+            printf("%-8s not available\n", xrdp_pixel_get_name(simd));
+            continue;
+        }
+        for (kernel = 0; kernel < NUM_KERNELS; kernel++)
+        {
+            memset(ref, 0, bytes);
+            memset(dst, 0, bytes);
+            run_kernel(&scalar, kernel, src, ref, width, height);
+            run_kernel(&procs, kernel, src, dst, width, height);
+            if (memcmp(ref, dst, bytes) != 0)
+            {
+                printf("%-8s %s does not match scalar\n",
+                       xrdp_pixel_get_name(simd), g_kernel_names[kernel]);
+                rv = 1;
+            }
+            start = get_ms();
+            for (index = 0; index < loops; index++)
+            {
+                run_kernel(&procs, kernel, src, dst, width, height);
+            }
+            ms[kernel] = (get_ms() - start) / loops;
+        }
+        printf("%-8s", xrdp_pixel_get_name(simd));
+        for (kernel = 0; kernel < NUM_KERNELS; kernel++)
+        {
+            printf(" %s %.3f ms", g_kernel_names[kernel], ms[kernel]);
+        }
+        printf("\n");
+    }
+    free(src);
+    free(ref);
+    free(dst);
+    return rv;
+}
@@ -0,0 +1,182 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * sends a pattern through trans_set_tls_mode over loopback to an openssl
+ * client thread and checks it arrives intact, with ktls set it also says
+ * if the kernel took over the send side or openssl kept it
+ * usage: tlsloop key.pem cert.pem [ktls] [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "trans.h"
+#include "ssl_calls.h"
+
+static int g_port = 0;
+static int g_total = 0;
+static int g_got = 0;
+static int g_bad = 0;
+
+/*****************************************************************************/
+static unsigned char
+get_pattern(int index)
+{
+    return (unsigned char) (index * 7 + (index >> 11));
+}
+
+/*****************************************************************************/
+static void *
+client_thread(void *arg)
+{
+    struct sockaddr_in addr;
+    SSL_CTX *ctx;
+    SSL *ssl;
+    char buf[65536];
+    int sck;
+    int len;
+    int index;
+
+    sck = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sck, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        printf("client connect failed\n");
+        return 0;
+    }
+    ctx = SSL_CTX_new(SSLv23_client_method());
+    ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, sck);
+    if (SSL_connect(ssl) != 1)
+    {
+        printf("client SSL_connect failed\n");
+    }
+    else
+    {
+        while (g_got < g_total)
+        {
+            len = SSL_read(ssl, buf, sizeof(buf));
+            if (len <= 0)
+            {
+                break;
+            }
+            for (index = 0; index < len; index++)
+            {
+                if ((unsigned char) buf[index] != get_pattern(g_got + index))
+                {
+                    g_bad++;
+                }
+            }
+            g_got += len;
+        }
+    }
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+    close(sck);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    pthread_t thread;
+    struct trans *trans;
+    struct stream *s;
+    int ktls;
+    int lsck;
+    int sent;
+    int chunk;
+    int index;
+
+    if (argc < 3)
+    {
+        printf("usage: tlsloop key.pem cert.pem [ktls] [megabytes]\n");
+        return 1;
+    }
+    ktls = argc > 3 ? atoi(argv[3]) : 1;
+    g_total = (argc > 4 ? atoi(argv[4]) : 8) * 1024 * 1024;
+    ssl_init();
+    lsck = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr_len = sizeof(addr);
+    if (bind(lsck, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(lsck, 1) != 0 ||
+            getsockname(lsck, (struct sockaddr *) &addr, &addr_len) != 0)
+    {
+        printf("listen failed\n");
+        return 1;
+    }
+    g_port = ntohs(addr.sin_port);
+    pthread_create(&thread, 0, client_thread, 0);
+    trans = trans_create(TRANS_MODE_TCP, 8192, 8192);
+    trans->sck = accept(lsck, 0, 0);
+    trans->status = TRANS_STATUS_UP;
+    trans->type1 = TRANS_TYPE_SERVER;
+    if (trans_set_tls_mode(trans, argv[1], argv[2], ktls) != 0)
+    {
+        printf("trans_set_tls_mode failed\n");
+        return 1;
+    }
+    make_stream(s);
+    sent = 0;
+    while (sent < g_total)
+    {
+        /* odd sizes so records do not line up with the writes */
+        chunk = 1 + (sent * 13) % 65000;
+        if (chunk > g_total - sent)
+        {
+            chunk = g_total - sent;
+        }
+        init_stream(s, chunk);
+        for (index = 0; index < chunk; index++)
+        {
+            s->p[index] = get_pattern(sent + index);
+        }
+        s->p += chunk;
+        s_mark_end(s);
+        if (trans_force_write_s(trans, s) != 0)
+        {
+            printf("trans_force_write_s failed\n");
+            break;
+        }
+        sent += chunk;
+    }
+    pthread_join(thread, 0);
+    printf("ktls %d, kernel send %s, sent %d got %d bad %d\n", ktls,
+           trans->tls->ktls_send ? "yes" : "no", sent, g_got, g_bad);
+    free_stream(s);
+    trans_delete(trans);
+    close(lsck);
+    return (g_got == g_total && g_bad == 0) ? 0 : 1;
+}
@@ -0,0 +1,927 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * checks the hextile, zrle and tight decoders in vnc/vnc.c, the rects are
+ * encoded here from a random image and the decoded pixels must match it
+ * at 8, 15, 16 and 24 bpp, fuzz feeds random and deflated random data to
+ * the decoders, they must fail cleanly
+ * usage: vncdec [fuzz [loops]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* vnc.c reads the server through trans_force_read_s, read from g_in */
+#define trans_force_read_s vncdec_read
+struct trans;
+struct stream;
+static int
+vncdec_read(struct trans *self, struct stream *in_s, int size);
+
+#include "vnc.c"
+
+#define IN_SIZE (4 * 1024 * 1024)
+#define TMP_SIZE (8 * 1024 * 1024)
+
+static unsigned char g_in[IN_SIZE];
+static int g_in_len;
+static int g_in_pos;
+static unsigned char g_tmp[TMP_SIZE];
+static unsigned char g_ztmp[TMP_SIZE];
+static z_stream g_zs[5]; /* 0 to 3 tight, 4 zrle */
+static int g_zs_inited[5];
+static int g_bpp;
+static int g_Bpp;
+static int g_cbytes;
+
+/*****************************************************************************/
+static int
+vncdec_read(struct trans *self, struct stream *in_s, int size)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+    if ((g_in_pos + size > g_in_len) ||
+        (in_s->end + size > in_s->data + in_s->size))
+    {
+        return 1;
+    }
+    memcpy(in_s->end, g_in + g_in_pos, size);
+    in_s->end += size;
+    g_in_pos += size;
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+put8(int b)
+{
+    g_in[g_in_len++] = b;
+}
+
+/*****************************************************************************/
+static void
+putn(const void *data, int bytes)
+{
+    memcpy(g_in + g_in_len, data, bytes);
+    g_in_len += bytes;
+}
+
+/*****************************************************************************/
+static unsigned int
+rnd(void)
+{
+    return (unsigned int) rand() * 2654435761u;
+}
+
+/*****************************************************************************/
+static unsigned int
+rnd_color(void)
+{
+    return rnd() & ((1u << g_bpp) - 1);
+}
+
+/*****************************************************************************/
+/* zrle cpixel, 24 bpp is b, g, r */
+static void
+put_cpixel(unsigned char *buf, int *len, unsigned int pixel)
+{
+    if (g_cbytes == 3)
+    {
+        buf[(*len)++] = pixel;
+        buf[(*len)++] = pixel >> 8;
+        buf[(*len)++] = pixel >> 16;
+    }
+    else
+    {
+        memcpy(buf + *len, &pixel, g_cbytes);
+        *len += g_cbytes;
+    }
+}
+
+/*****************************************************************************/
+/* tight tpixel, 24 bpp is r, g, b */
+static void
+put_tpixel(unsigned char *buf, int *len, unsigned int pixel)
+{
+    if (g_cbytes == 3)
+    {
+        buf[(*len)++] = pixel >> 16;
+        buf[(*len)++] = pixel >> 8;
+        buf[(*len)++] = pixel;
+    }
+    else
+    {
+        memcpy(buf + *len, &pixel, g_cbytes);
+        *len += g_cbytes;
+    }
+}
+
+/*****************************************************************************/
+static void
+set_pixel(char *img, int width, int x, int y, unsigned int pixel)
+{
+    memcpy(img + (y * width + x) * g_Bpp, &pixel, g_Bpp);
+}
+
+/*****************************************************************************/
+static unsigned int
+get_pixel(char *img, int width, int x, int y)
+{
+    unsigned int pixel;
+
+    pixel = 0;
+    memcpy(&pixel, img + (y * width + x) * g_Bpp, g_Bpp);
+    return pixel;
+}
+
+/*****************************************************************************/
+/* deflate on stream id, the decoders keep one inflate per stream */
+static int
+deflate_data(int id, unsigned char *src, int bytes, unsigned char *dst)
+{
+    z_stream *zs;
+
+    zs = g_zs + id;
+    if (!g_zs_inited[id])
+    {
+        deflateInit(zs, 6);
+        g_zs_inited[id] = 1;
+    }
+    zs->next_in = src;
+    zs->avail_in = bytes;
+    zs->next_out = dst;
+    zs->avail_out = TMP_SIZE;
+    deflate(zs, Z_SYNC_FLUSH);
+    return TMP_SIZE - zs->avail_out;
+}
+
+/*****************************************************************************/
+static void
+deflate_reset(void)
+{
+    int index;
+
+    for (index = 0; index < 5; index++)
+    {
+        if (g_zs_inited[index])
+        {
+            deflateEnd(g_zs + index);
+        }
+    }
+    memset(g_zs, 0, sizeof(g_zs));
+    memset(g_zs_inited, 0, sizeof(g_zs_inited));
+}
+
+/*****************************************************************************/
+/* returns the decoder error */
+static int
+decode(struct vnc *v, int encoding, char *data, int width, int height)
+{
+    struct stream *s;
+    int error;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    if (encoding == 5)
+    {
+        error = lib_decode_hextile(v, s, data, width, height, g_Bpp);
+    }
+    else if (encoding == 7)
+    {
+        error = lib_decode_tight(v, s, data, width, height, g_Bpp);
+    }
+    else
+    {
+        error = lib_decode_zrle(v, s, data, width, height, g_Bpp);
+    }
+    free_stream(s);
+    return error;
+}
+
+/*****************************************************************************/
+/* decode g_in and compare with img, returns 1 if it matches */
+static int
+check(struct vnc *v, int encoding, char *img, int width, int height,
+      const char *name)
+{
+    char *data;
+    int error;
+    int ok;
+
+    data = (char *) malloc(width * height * g_Bpp);
+    memset(data, 0x5a, width * height * g_Bpp);
+    error = decode(v, encoding, data, width, height);
+    ok = (error == 0) && (g_in_pos == g_in_len) &&
+         (memcmp(data, img, width * height * g_Bpp) == 0);
+    printf("bpp %2d %-16s %dx%d %s\n", g_bpp, name, width, height,
+           ok ? "ok" : "FAILED");
+    free(data);
+    return ok;
+}
+
+/*****************************************************************************/
+/* raw, background only, foreground and coloured subrects */
+static int
+test_hextile(struct vnc *v, int width, int height)
+{
+    char *img;
+    unsigned int bg;
+    unsigned int fg;
+    unsigned int pixel;
+    int tile;
+    int mode;
+    int tx;
+    int ty;
+    int tw;
+    int th;
+    int x;
+    int y;
+    int sx;
+    int sy;
+    int sw;
+    int sh;
+    int index;
+    int ok;
+
+    img = (char *) calloc(width * height, 4);
+    g_in_len = 0;
+    g_in_pos = 0;
+    tile = 0;
+    for (ty = 0; ty < height; ty += 16)
+    {
+        for (tx = 0; tx < width; tx += 16, tile++)
+        {
+            tw = MIN(16, width - tx);
+            th = MIN(16, height - ty);
+            mode = tile % 4;
+            if (mode == 0)
+            {
+                put8(1);
+                for (y = 0; y < th; y++)
+                {
+                    for (x = 0; x < tw; x++)
+                    {
+                        pixel = rnd_color();
+                        set_pixel(img, width, tx + x, ty + y, pixel);
+                        putn(&pixel, g_Bpp);
+                    }
+                }
+                continue;
+            }
+            bg = rnd_color();
+            fg = rnd_color();
+            if (mode == 1)
+            {
+                put8(2);
+                putn(&bg, g_Bpp);
+            }
+            else if (mode == 2)
+            {
+                put8(2 | 4 | 8);
+                putn(&bg, g_Bpp);
+                putn(&fg, g_Bpp);
+            }
+            else
+            {
+                put8(2 | 8 | 16);
+                putn(&bg, g_Bpp);
+            }
+            for (y = 0; y < th; y++)
+            {
+                for (x = 0; x < tw; x++)
+                {
+                    set_pixel(img, width, tx + x, ty + y, bg);
+                }
+            }
+            if (mode == 1)
+            {
+                continue;
+            }
+            put8(5);
+            for (index = 0; index < 5; index++)
+            {
+                sx = rnd() % tw;
+                sy = rnd() % th;
+                sw = 1 + rnd() % (tw - sx);
+                sh = 1 + rnd() % (th - sy);
+                pixel = fg;
+                if (mode == 3)
+                {
+                    pixel = rnd_color();
+                    putn(&pixel, g_Bpp);
+                }
+                put8((sx << 4) | sy);
+                put8(((sw - 1) << 4) | (sh - 1));
+                for (y = sy; y < sy + sh; y++)
+                {
+                    for (x = sx; x < sx + sw; x++)
+                    {
+                        set_pixel(img, width, tx + x, ty + y, pixel);
+                    }
+                }
+            }
+        }
+    }
+    ok = check(v, 5, img, width, height, "hextile");
+    free(img);
+    return ok;
+}
+
+/*****************************************************************************/
+/* one zrle packed palette tile */
+static int
+zrle_packed(unsigned char *tmp, int len, char *img, int width,
+            int tx, int ty, int tw, int th, int num_colors)
+{
+    unsigned int palette[16];
+    int bits;
+    int row_bytes;
+    int index;
+    int x;
+    int y;
+
+    bits = (num_colors == 2) ? 1 : (num_colors <= 4) ? 2 : 4;
+    tmp[len++] = num_colors;
+    for (index = 0; index < num_colors; index++)
+    {
+        palette[index] = rnd_color();
+        put_cpixel(tmp, &len, palette[index]);
+    }
+    row_bytes = (tw * bits + 7) / 8;
+    for (y = 0; y < th; y++)
+    {
+        memset(tmp + len, 0, row_bytes);
+        for (x = 0; x < tw; x++)
+        {
+            index = rnd() % num_colors;
+            set_pixel(img, width, tx + x, ty + y, palette[index]);
+            tmp[len + (x * bits) / 8] |= index << (8 - bits - (x * bits) % 8);
+        }
+        len += row_bytes;
+    }
+    return len;
+}
+
+/*****************************************************************************/
+/* one zrle plain rle or palette rle tile */
+static int
+zrle_rle(unsigned char *tmp, int len, char *img, int width,
+         int tx, int ty, int tw, int th, int use_palette)
+{
+    unsigned int palette[128];
+    unsigned int pixel;
+    int num_colors;
+    int num_pixels;
+    int pos;
+    int run;
+    int index;
+    int count;
+
+    num_colors = 2 + rnd() % 126;
+    if (use_palette)
+    {
+        tmp[len++] = 128 + num_colors;
+        for (index = 0; index < num_colors; index++)
+        {
+            palette[index] = rnd_color();
+            put_cpixel(tmp, &len, palette[index]);
+        }
+    }
+    else
+    {
+        tmp[len++] = 128;
+    }
+    num_pixels = tw * th;
+    pos = 0;
+    while (pos < num_pixels)
+    {
+        run = 1 + rnd() % 600;
+        run = MIN(run, num_pixels - pos);
+        index = rnd() % num_colors;
+        pixel = use_palette ? palette[index] : rnd_color();
+        for (count = 0; count < run; count++)
+        {
+            set_pixel(img, width, tx + (pos + count) % tw,
+                      ty + (pos + count) / tw, pixel);
+        }
+        pos += run;
+        if (use_palette)
+        {
+            if ((run == 1) && (rnd() & 1))
+            {
+                tmp[len++] = index; /* single pixel, no run length */
+                continue;
+            }
+            tmp[len++] = index | 128;
+        }
+        else
+        {
+            put_cpixel(tmp, &len, pixel);
+        }
+        run--;
+        while (run >= 255)
+        {
+            tmp[len++] = 255;
+            run -= 255;
+        }
+        tmp[len++] = run;
+    }
+    return len;
+}
+
+/*****************************************************************************/
+/* put the zrle length and deflated tile data in g_in */
+static void
+zrle_put(int len)
+{
+    int bytes;
+
+    bytes = deflate_data(4, g_tmp, len, g_ztmp);
+    g_in_len = 0;
+    g_in_pos = 0;
+    put8(bytes >> 24);
+    put8(bytes >> 16);
+    put8(bytes >> 8);
+    put8(bytes);
+    putn(g_ztmp, bytes);
+}
+
+/*****************************************************************************/
+/* every subencoding, tiles cycle through them starting at seed */
+static int
+test_zrle(struct vnc *v, int width, int height, int seed)
+{
+    char *img;
+    unsigned int pixel;
+    int tile;
+    int mode;
+    int tx;
+    int ty;
+    int tw;
+    int th;
+    int x;
+    int y;
+    int len;
+    int ok;
+
+    img = (char *) calloc(width * height, 4);
+    len = 0;
+    tile = seed;
+    for (ty = 0; ty < height; ty += 64)
+    {
+        for (tx = 0; tx < width; tx += 64, tile++)
+        {
+            tw = MIN(64, width - tx);
+            th = MIN(64, height - ty);
+            mode = tile % 7;
+            if (mode == 0) /* raw */
+            {
+                g_tmp[len++] = 0;
+                for (y = 0; y < th; y++)
+                {
+                    for (x = 0; x < tw; x++)
+                    {
+                        pixel = rnd_color();
+                        set_pixel(img, width, tx + x, ty + y, pixel);
+                        put_cpixel(g_tmp, &len, pixel);
+                    }
+                }
+            }
+            else if (mode == 1) /* solid */
+            {
+                pixel = rnd_color();
+                g_tmp[len++] = 1;
+                put_cpixel(g_tmp, &len, pixel);
+                for (y = 0; y < th; y++)
+                {
+                    for (x = 0; x < tw; x++)
+                    {
+                        set_pixel(img, width, tx + x, ty + y, pixel);
+                    }
+                }
+            }
+            else if (mode <= 4) /* packed palette, 1, 2 and 4 bits */
+            {
+                len = zrle_packed(g_tmp, len, img, width, tx, ty, tw, th,
+                                  (mode == 2) ? 2 : (mode == 3) ? 3 : 16);
+            }
+            else
+            {
+                len = zrle_rle(g_tmp, len, img, width, tx, ty, tw, th,
+                               mode == 6);
+            }
+        }
+    }
+    zrle_put(len);
+    ok = check(v, 16, img, width, height, "zrle");
+    free(img);
+    return ok;
+}
+
+/*****************************************************************************/
+/* a packed palette index past the palette must fail the decode */
+static int
+test_zrle_bad_index(struct vnc *v)
+{
+    char data[4 * 4 * 4];
+    int len;
+    int index;
+    int ok;
+
+    len = 0;
+    g_tmp[len++] = 3; /* 3 colours, 2 bits per index */
+    for (index = 0; index < 3; index++)
+    {
+        put_cpixel(g_tmp, &len, rnd_color());
+    }
+    g_tmp[len++] = 0x1b; /* 0, 1, 2, 3 */
+    for (index = 1; index < 4; index++)
+    {
+        g_tmp[len++] = 0;
+    }
+    zrle_put(len);
+    ok = decode(v, 16, data, 4, 4) != 0;
+    printf("bpp %2d %-16s %dx%d %s\n", g_bpp, "zrle bad index", 4, 4,
+           ok ? "ok" : "FAILED");
+    /* the inflate stream is out of step after an error */
+    lib_decoders_delete(v);
+    deflate_reset();
+    return ok;
+}
+
+/*****************************************************************************/
+static void
+tight_len(int bytes)
+{
+    put8((bytes & 127) | ((bytes > 127) ? 128 : 0));
+    if (bytes > 127)
+    {
+        put8(((bytes >> 7) & 127) | ((bytes > 16383) ? 128 : 0));
+        if (bytes > 16383)
+        {
+            put8(bytes >> 14);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* less than 12 bytes are sent as is */
+static void
+tight_data(int id, unsigned char *data, int bytes)
+{
+    int zbytes;
+
+    if (bytes < 12)
+    {
+        putn(data, bytes);
+        return;
+    }
+    zbytes = deflate_data(id, data, bytes, g_ztmp);
+    tight_len(zbytes);
+    putn(g_ztmp, zbytes);
+}
+
+/*****************************************************************************/
+static void
+tight_fill(char *img, int width, int height)
+{
+    unsigned int pixel;
+    int len;
+    int index;
+
+    pixel = rnd_color();
+    put8(0x80);
+    len = 0;
+    put_tpixel(g_tmp, &len, pixel);
+    putn(g_tmp, len);
+    for (index = 0; index < width * height; index++)
+    {
+        set_pixel(img, width, index % width, index / width, pixel);
+    }
+}
+
+/*****************************************************************************/
+/* the left half is one colour so the data deflates */
+static void
+tight_copy(char *img, int width, int height, int id)
+{
+    unsigned int pixel;
+    int len;
+    int x;
+    int y;
+
+    put8(id << 4);
+    len = 0;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            pixel = (x < width / 2) ? 0x123456 & ((1u << g_bpp) - 1) :
+                    rnd_color();
+            set_pixel(img, width, x, y, pixel);
+            put_tpixel(g_tmp, &len, pixel);
+        }
+    }
+    tight_data(id, g_tmp, len);
+}
+
+/*****************************************************************************/
+static void
+tight_palette(char *img, int width, int height, int id, int num_colors)
+{
+    unsigned int palette[256];
+    int row_bytes;
+    int len;
+    int index;
+    int x;
+    int y;
+
+    put8((id << 4) | 0x40);
+    put8(1);
+    put8(num_colors - 1);
+    for (index = 0; index < num_colors; index++)
+    {
+        palette[index] = rnd_color();
+        len = 0;
+        put_tpixel(g_tmp, &len, palette[index]);
+        putn(g_tmp, len);
+    }
+    row_bytes = (num_colors == 2) ? (width + 7) / 8 : width;
+    memset(g_tmp, 0, row_bytes * height);
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            index = rnd() % num_colors;
+            set_pixel(img, width, x, y, palette[index]);
+            if (num_colors == 2)
+            {
+                g_tmp[y * row_bytes + x / 8] |= index << (7 - x % 8);
+            }
+            else
+            {
+                g_tmp[y * row_bytes + x] = index;
+            }
+        }
+    }
+    tight_data(id, g_tmp, row_bytes * height);
+}
+
+/*****************************************************************************/
+/* each component is predicted from left + above - above left, clamped */
+static void
+tight_gradient(char *img, int width, int height, int id)
+{
+    unsigned int pixel;
+    int max[3];
+    int shift[3];
+    int len;
+    int k;
+    int x;
+    int y;
+    int left;
+    int above;
+    int above_left;
+    int predict;
+    int value;
+
+    if (g_bpp == 24)
+    {
+        max[0] = 255; max[1] = 255; max[2] = 255;
+        shift[0] = 16; shift[1] = 8; shift[2] = 0;
+    }
+    else if (g_bpp == 16)
+    {
+        max[0] = 31; max[1] = 63; max[2] = 31;
+        shift[0] = 11; shift[1] = 5; shift[2] = 0;
+    }
+    else
+    {
+        max[0] = 31; max[1] = 31; max[2] = 31;
+        shift[0] = 10; shift[1] = 5; shift[2] = 0;
+    }
+    put8((id << 4) | 0x40);
+    put8(2);
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            pixel = (((x * 3 + y * 5) & 0xff) * 0x010101) ^ (rnd() % 3);
+            set_pixel(img, width, x, y, pixel & ((1u << g_bpp) - 1));
+        }
+    }
+    len = 0;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            pixel = 0;
+            for (k = 0; k < 3; k++)
+            {
+                left = (x > 0) ?
+                       (get_pixel(img, width, x - 1, y) >> shift[k]) & max[k] :
+                       0;
+                above = (y > 0) ?
+                        (get_pixel(img, width, x, y - 1) >> shift[k]) & max[k] :
+                        0;
+                above_left = ((x > 0) && (y > 0)) ?
+                             (get_pixel(img, width, x - 1, y - 1) >>
+                              shift[k]) & max[k] : 0;
+                predict = MIN(MAX(left + above - above_left, 0), max[k]);
+                value = (get_pixel(img, width, x, y) >> shift[k]) & max[k];
+                pixel |= ((value - predict) & max[k]) << shift[k];
+            }
+            put_tpixel(g_tmp, &len, pixel);
+        }
+    }
+    tight_data(id, g_tmp, len);
+}
+
+/*****************************************************************************/
+static int
+test_tight(struct vnc *v, int mode, int width, int height, int id)
+{
+    static const char *names[5] =
+    {
+        "tight fill", "tight copy", "tight palette2", "tight palette",
+        "tight gradient"
+    };
+    char *img;
+    int ok;
+
+    img = (char *) calloc(width * height, 4);
+    g_in_len = 0;
+    g_in_pos = 0;
+    switch (mode)
+    {
+        case 0:
+            tight_fill(img, width, height);
+            break;
+        case 1:
+            tight_copy(img, width, height, id);
+            break;
+        case 2:
+            tight_palette(img, width, height, id, 2);
+            break;
+        case 3:
+            tight_palette(img, width, height, id, 5);
+            break;
+        default:
+            tight_gradient(img, width, height, id);
+            break;
+    }
+    ok = check(v, 7, img, width, height, names[mode]);
+    free(img);
+    return ok;
+}
+
+/*****************************************************************************/
+static void
+set_bpp(struct vnc *v, int bpp)
+{
+    g_bpp = bpp;
+    v->mod_bpp = bpp;
+    g_Bpp = (bpp + 7) / 8;
+    if (g_Bpp == 3)
+    {
+        g_Bpp = 4;
+    }
+    g_cbytes = (bpp == 24) ? 3 : g_Bpp;
+}
+
+/*****************************************************************************/
+static int
+run_tests(void)
+{
+    static const int bpps[4] = { 24, 16, 15, 8 };
+    struct vnc *v;
+    int index;
+    int mode;
+    int ok;
+
+    ok = 1;
+    for (index = 0; index < 4; index++)
+    {
+        v = (struct vnc *) calloc(1, sizeof(struct vnc));
+        deflate_reset();
+        set_bpp(v, bpps[index]);
+        ok &= test_hextile(v, 45, 37);
+        ok &= test_zrle(v, 130, 70, 0);
+        ok &= test_zrle(v, 200, 129, 3);
+        ok &= test_zrle(v, 1, 1, 1);
+        ok &= test_zrle_bad_index(v);
+        for (mode = 0; mode < 5; mode++)
+        {
+            if ((mode == 4) && (g_bpp == 8))
+            {
+                continue; /* no gradient at 8 bpp */
+            }
+            ok &= test_tight(v, mode, 37, 23, mode & 3);
+            ok &= test_tight(v, mode, 2, 1, mode & 3);
+            ok &= test_tight(v, mode, 300, 40, mode & 3);
+        }
+        lib_decoders_delete(v);
+        free(v);
+    }
+    deflate_reset();
+    printf(ok ? "all ok\n" : "failed\n");
+    return !ok;
+}
+
+/*****************************************************************************/
+/* random rects, the decoders must return without crashing, run it under
+   valgrind or with -fsanitize=address to catch bad reads */
+static int
+run_fuzz(int loops)
+{
+    static const int bpps[4] = { 24, 16, 15, 8 };
+    unsigned char src[2000];
+    struct vnc *v;
+    z_stream zs;
+    char *data;
+    int loop;
+    int encoding;
+    int width;
+    int height;
+    int bytes;
+    int index;
+
+    srand(1);
+    for (loop = 0; loop < loops; loop++)
+    {
+        v = (struct vnc *) calloc(1, sizeof(struct vnc));
+        set_bpp(v, bpps[loop & 3]);
+        width = 1 + rand() % 90;
+        height = 1 + rand() % 90;
+        g_in_len = 4 + rand() % 3000;
+        g_in_pos = 0;
+        for (index = 0; index < g_in_len; index++)
+        {
+            g_in[index] = rand();
+        }
+        encoding = (loop >> 2) % 3;
+        if (encoding == 2)
+        {
+            /* zrle, half the time with a valid deflate stream of mostly
+               zero bytes so the tile decode gets going */
+            bytes = g_in_len - 4;
+            if (rand() & 1)
+            {
+                for (index = 0; index < (int) sizeof(src); index++)
+                {
+                    src[index] = (rand() % 4 == 0) ? rand() : 0;
+                }
+                memset(&zs, 0, sizeof(zs));
+                deflateInit(&zs, 6);
+                zs.next_in = src;
+                zs.avail_in = sizeof(src);
+                zs.next_out = g_in + 4;
+                zs.avail_out = IN_SIZE - 4;
+                deflate(&zs, Z_SYNC_FLUSH);
+                bytes = (IN_SIZE - 4) - zs.avail_out;
+                deflateEnd(&zs);
+                g_in_len = bytes + 4;
+            }
+            g_in[0] = bytes >> 24;
+            g_in[1] = bytes >> 16;
+            g_in[2] = bytes >> 8;
+            g_in[3] = bytes;
+        }
+        data = (char *) malloc(width * height * g_Bpp);
+        decode(v, (encoding == 0) ? 5 : (encoding == 1) ? 7 : 16,
+               data, width, height);
+        free(data);
+        lib_decoders_delete(v);
+        free(v);
+    }
+    printf("fuzz %d loops done\n", loops);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    if ((argc > 1) && (strcmp(argv[1], "fuzz") == 0))
+    {
+        return run_fuzz((argc > 2) ? atoi(argv[2]) : 30000);
+    }
+    return run_tests();
+}
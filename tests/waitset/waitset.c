@@ -0,0 +1,146 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * checks g_obj_wait_set in common/os_calls.c when an fd in the set is
+ * closed and its number comes back as a new fd, through os_calls, with a
+ * plain close and with the old file still open through a dup
+ * usage: waitset
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "os_calls.h"
+
+/*****************************************************************************/
+/* wait on obj, returns 1 if the set says it is ready */
+static int
+wait_ready(tbus wait_set, tbus obj, int mstimeout)
+{
+    tbus robjs[1];
+
+    robjs[0] = obj;
+    if (g_obj_wait_set(wait_set, robjs, 1, 0, 0, mstimeout) != 0)
+    {
+        return -1;
+    }
+    return g_is_wait_obj_ready(wait_set, obj, 0);
+}
+
+/*****************************************************************************/
+static int
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/*****************************************************************************/
+/* an event closed and created again through os_calls */
+static int
+test_os_calls(tbus wait_set)
+{
+    tbus obj1;
+    tbus obj2;
+    int ok;
+
+    obj1 = g_create_wait_obj("waitset1");
+    ok = check("os_calls, not set", wait_ready(wait_set, obj1, 10) == 0);
+    g_delete_wait_obj(obj1);
+    obj2 = g_create_wait_obj("waitset2");
+    ok &= check("os_calls, number reused",
+                (obj2 & 0xffff) == (obj1 & 0xffff));
+    g_set_wait_obj(obj2);
+    ok &= check("os_calls, reused fd set", wait_ready(wait_set, obj2, 10) == 1);
+    g_delete_wait_obj(obj2);
+    return ok;
+}
+
+/*****************************************************************************/
+/* a pipe closed with close and a new pipe on the same number, keep_old
+   keeps the old file open through a dup */
+static int
+test_close(tbus wait_set, int keep_old)
+{
+    int fds1[2];
+    int fds2[2];
+    int old;
+    int start;
+    int ok;
+
+    if (pipe(fds1) != 0)
+    {
+        return 0;
+    }
+    ok = check(keep_old ? "dup, not set" : "close, not set",
+               wait_ready(wait_set, fds1[0], 10) == 0);
+    old = keep_old ? dup(fds1[0]) : -1;
+    close(fds1[0]);
+    if (pipe(fds2) != 0)
+    {
+        return 0;
+    }
+    ok &= check(keep_old ? "dup, number reused" : "close, number reused",
+                fds2[0] == fds1[0]);
+    if (keep_old)
+    {
+        /* the old file is readable, its registration must not make the
+           new fd look ready or keep the wait from blocking */
+        g_file_write(fds1[1], "x", 1);
+        ok &= check("dup, old file set, new fd not set",
+                    wait_ready(wait_set, fds2[0], 10) == 0);
+        start = g_time3();
+        ok &= check("dup, old file set, wait blocks",
+                    (wait_ready(wait_set, fds2[0], 100) == 0) &&
+                    (g_time3() - start >= 90));
+    }
+    g_file_write(fds2[1], "x", 1);
+    ok &= check(keep_old ? "dup, reused fd set" : "close, reused fd set",
+                wait_ready(wait_set, fds2[0], 1000) == 1);
+    close(fds1[1]);
+    close(fds2[0]);
+    close(fds2[1]);
+    if (old != -1)
+    {
+        close(old);
+    }
+    return ok;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    tbus wait_set;
+    int ok;
+
+    g_init("waitset");
+    wait_set = g_create_wait_set();
+    if (wait_set == 0)
+    {
+        printf("no wait set support\n");
+        g_deinit();
+        return 0;
+    }
+    ok = test_os_calls(wait_set);
+    ok &= test_close(wait_set, 0);
+    ok &= test_close(wait_set, 1);
+    g_delete_wait_set(wait_set);
+    g_deinit();
+    printf(ok ? "all ok\n" : "failed\n");
+    return !ok;
+}
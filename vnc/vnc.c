@@ -568,6 +568,906 @@ make_color(int r, int g, int b, int bpp)
     return 0;
 }
 
+/******************************************************************************/
+/* read exactly bytes into s */
+static int APP_CC
+lib_read_s(struct vnc *v, struct stream *s, int bytes)
+{
+    init_stream(s, bytes);
+    return trans_force_read_s(v->trans, s, bytes);
+}
+
+/******************************************************************************/
+/* zrle cpixels and tight tpixels drop the unused byte of 32 bpp, 24 bit
+   depth pixels */
+static int APP_CC
+lib_cpixel_bytes(struct vnc *v, int Bpp)
+{
+    return (v->mod_bpp == 24) ? 3 : Bpp;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_get_cpixel(const char *p, int cbytes)
+{
+    tui16 pixel16;
+    tui32 pixel32;
+
+    switch (cbytes)
+    {
+        case 1:
+            return *((const tui8 *) p);
+        case 2:
+            g_memcpy(&pixel16, p, 2);
+            return pixel16;
+        case 3:
+#if defined(B_ENDIAN)
+            return (((tui8) p[0]) << 16) | (((tui8) p[1]) << 8) |
+                   ((tui8) p[2]);
+#else
+            return ((tui8) p[0]) | (((tui8) p[1]) << 8) |
+                   (((tui8) p[2]) << 16);
+#endif
+    }
+    g_memcpy(&pixel32, p, 4);
+    return pixel32;
+}
+
+/******************************************************************************/
+/* tight tpixels of 24 bit depth are r, g, b bytes in that order whatever
+   the pixel format byte order, others are the same as cpixels */
+static int APP_CC
+lib_get_tpixel(const char *p, int tbytes)
+{
+    if (tbytes == 3)
+    {
+        return (((tui8) p[0]) << 16) | (((tui8) p[1]) << 8) | ((tui8) p[2]);
+    }
+    return lib_get_cpixel(p, tbytes);
+}
+
+/******************************************************************************/
+/* count copies of pixel at d */
+static void APP_CC
+lib_fill_pixels(char *d, int Bpp, int pixel, int count)
+{
+    tui16 *d16;
+    tui32 *d32;
+
+    if (Bpp == 1)
+    {
+        g_memset(d, pixel, count);
+    }
+    else if (Bpp == 2)
+    {
+        d16 = (tui16 *) d;
+        while (count > 0)
+        {
+            *(d16++) = pixel;
+            count--;
+        }
+    }
+    else
+    {
+        d32 = (tui32 *) d;
+        while (count > 0)
+        {
+            *(d32++) = pixel;
+            count--;
+        }
+    }
+}
+
+/******************************************************************************/
+/* data is width pixels wide */
+static void APP_CC
+lib_fill_rect(char *data, int width, int Bpp, int x, int y, int cx, int cy,
+              int pixel)
+{
+    data += (y * width + x) * Bpp;
+    while (cy > 0)
+    {
+        lib_fill_pixels(data, Bpp, pixel, cx);
+        data += width * Bpp;
+        cy--;
+    }
+}
+
+/******************************************************************************/
+/* count cpixels at s to pixels at d */
+static void APP_CC
+lib_copy_cpixels(const char *s, char *d, int cbytes, int Bpp, int count)
+{
+    tui32 *d32;
+
+    if (cbytes == Bpp)
+    {
+        g_memcpy(d, s, count * Bpp);
+        return;
+    }
+    d32 = (tui32 *) d;
+    while (count > 0)
+    {
+        *(d32++) = lib_get_cpixel(s, cbytes);
+        s += cbytes;
+        count--;
+    }
+}
+
+/******************************************************************************/
+/* count tpixels at s to pixels at d */
+static void APP_CC
+lib_copy_tpixels(const char *s, char *d, int tbytes, int Bpp, int count)
+{
+    tui32 *d32;
+
+    if (tbytes == Bpp)
+    {
+        g_memcpy(d, s, count * Bpp);
+        return;
+    }
+    d32 = (tui32 *) d;
+    while (count > 0)
+    {
+        *(d32++) = lib_get_tpixel(s, tbytes);
+        s += tbytes;
+        count--;
+    }
+}
+
+/******************************************************************************/
+/* take the rest of the input so the next rect starts on a clean stream,
+   a sync flush leaves an empty block behind once the output is all read */
+static int APP_CC
+lib_inflate_drain(z_stream *zs)
+{
+    char scratch[64];
+    int rv;
+
+    while (zs->avail_in > 0)
+    {
+        zs->next_out = (Bytef *) scratch;
+        zs->avail_out = sizeof(scratch);
+        rv = inflate(zs, Z_SYNC_FLUSH);
+        if (rv != Z_OK)
+        {
+            return (rv == Z_BUF_ERROR) ? 0 : 1;
+        }
+        if (zs->avail_out != sizeof(scratch))
+        {
+            LLOGLN(0, ("lib_inflate_drain: extra data in rect"));
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_decode_hextile(struct vnc *v, struct stream *s, char *data,
+                   int cx, int cy, int Bpp)
+{
+    int tx;
+    int ty;
+    int tw;
+    int th;
+    int sx;
+    int sy;
+    int sw;
+    int sh;
+    int xy;
+    int wh;
+    int subenc;
+    int num_subrects;
+    int bytes;
+    int index;
+    int bg;
+    int fg;
+    int pixel;
+    int error;
+
+    bg = 0;
+    fg = 0;
+    for (ty = 0; ty < cy; ty += 16)
+    {
+        th = MIN(16, cy - ty);
+        for (tx = 0; tx < cx; tx += 16)
+        {
+            tw = MIN(16, cx - tx);
+            error = lib_read_s(v, s, 1);
+            if (error != 0)
+            {
+                return error;
+            }
+            in_uint8(s, subenc);
+            if (subenc & 1) /* raw */
+            {
+                error = lib_read_s(v, s, tw * th * Bpp);
+                if (error != 0)
+                {
+                    return error;
+                }
+                for (index = 0; index < th; index++)
+                {
+                    g_memcpy(data + ((ty + index) * cx + tx) * Bpp,
+                             s->p + index * tw * Bpp, tw * Bpp);
+                }
+                continue;
+            }
+            bytes = ((subenc & 2) ? Bpp : 0) + ((subenc & 4) ? Bpp : 0) +
+                    ((subenc & 8) ? 1 : 0);
+            error = lib_read_s(v, s, bytes);
+            if (error != 0)
+            {
+                return error;
+            }
+            if (subenc & 2) /* background specified */
+            {
+                bg = lib_get_cpixel(s->p, Bpp);
+                in_uint8s(s, Bpp);
+            }
+            if (subenc & 4) /* foreground specified */
+            {
+                fg = lib_get_cpixel(s->p, Bpp);
+                in_uint8s(s, Bpp);
+            }
+            num_subrects = 0;
+            if (subenc & 8) /* any subrects */
+            {
+                in_uint8(s, num_subrects);
+            }
+            lib_fill_rect(data, cx, Bpp, tx, ty, tw, th, bg);
+            if (num_subrects < 1)
+            {
+                continue;
+            }
+            bytes = ((subenc & 16) ? Bpp + 2 : 2) * num_subrects;
+            error = lib_read_s(v, s, bytes);
+            if (error != 0)
+            {
+                return error;
+            }
+            for (index = 0; index < num_subrects; index++)
+            {
+                pixel = fg;
+                if (subenc & 16) /* subrects coloured */
+                {
+                    pixel = lib_get_cpixel(s->p, Bpp);
+                    in_uint8s(s, Bpp);
+                }
+                in_uint8(s, xy);
+                in_uint8(s, wh);
+                sx = xy >> 4;
+                sy = xy & 15;
+                sw = MIN((wh >> 4) + 1, tw - sx);
+                sh = MIN((wh & 15) + 1, th - sy);
+                if ((sw > 0) && (sh > 0))
+                {
+                    lib_fill_rect(data, cx, Bpp, tx + sx, ty + sy, sw, sh,
+                                  pixel);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* make sure bytes of inflated zrle data are ready at zrle_out_s->p */
+static int APP_CC
+lib_zrle_need(struct vnc *v, int bytes)
+{
+    struct stream *s;
+    z_stream *zs;
+    int left;
+    int index;
+    int rv;
+
+    s = v->zrle_out_s;
+    left = (int) (s->end - s->p);
+    if (left >= bytes)
+    {
+        return 0;
+    }
+    if (bytes > s->size)
+    {
+        return 1;
+    }
+    /* what is left is less than a tile, move it to the front */
+    for (index = 0; index < left; index++)
+    {
+        s->data[index] = s->p[index];
+    }
+    s->p = s->data;
+    s->end = s->data + left;
+    zs = &(v->zrle_zs);
+    while (left < bytes)
+    {
+        if (zs->avail_in == 0)
+        {
+            LLOGLN(0, ("lib_zrle_need: rect data too short"));
+            return 1;
+        }
+        zs->next_out = (Bytef *) (s->end);
+        zs->avail_out = s->size - left;
+        rv = inflate(zs, Z_SYNC_FLUSH);
+        if (rv != Z_OK)
+        {
+            LLOGLN(0, ("lib_zrle_need: inflate error %d", rv));
+            return 1;
+        }
+        s->end = (char *) (zs->next_out);
+        left = (int) (s->end - s->p);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* read a palette of num_colors cpixels */
+static int APP_CC
+lib_zrle_palette(struct vnc *v, int *palette, int num_colors, int cbytes)
+{
+    struct stream *s;
+    int index;
+
+    s = v->zrle_out_s;
+    if (lib_zrle_need(v, num_colors * cbytes) != 0)
+    {
+        return 1;
+    }
+    for (index = 0; index < num_colors; index++)
+    {
+        palette[index] = lib_get_cpixel(s->p, cbytes);
+        in_uint8s(s, cbytes);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* one tile, tw * th pixels, into v->zrle_tile */
+static int APP_CC
+lib_zrle_tile(struct vnc *v, int tw, int th, int cbytes, int Bpp)
+{
+    struct stream *s;
+    char *tile;
+    int palette[128];
+    int subenc;
+    int num_pixels;
+    int bits;
+    int row_bytes;
+    int x;
+    int y;
+    int index;
+    int pixel;
+    int run;
+    int b;
+
+    s = v->zrle_out_s;
+    tile = v->zrle_tile;
+    num_pixels = tw * th;
+    if (lib_zrle_need(v, 1) != 0)
+    {
+        return 1;
+    }
+    in_uint8(s, subenc);
+    if (subenc == 0) /* raw */
+    {
+        if (lib_zrle_need(v, num_pixels * cbytes) != 0)
+        {
+            return 1;
+        }
+        lib_copy_cpixels(s->p, tile, cbytes, Bpp, num_pixels);
+        in_uint8s(s, num_pixels * cbytes);
+    }
+    else if (subenc == 1) /* solid */
+    {
+        if (lib_zrle_palette(v, palette, 1, cbytes) != 0)
+        {
+            return 1;
+        }
+        lib_fill_pixels(tile, Bpp, palette[0], num_pixels);
+    }
+    else if (subenc <= 16) /* packed palette */
+    {
+        if (lib_zrle_palette(v, palette, subenc, cbytes) != 0)
+        {
+            return 1;
+        }
+        bits = (subenc == 2) ? 1 : (subenc <= 4) ? 2 : 4;
+        row_bytes = (tw * bits + 7) / 8;
+        if (lib_zrle_need(v, row_bytes * th) != 0)
+        {
+            return 1;
+        }
+        for (y = 0; y < th; y++)
+        {
+            for (x = 0; x < tw; x++)
+            {
+                b = (tui8) (s->p[(x * bits) / 8]);
+                index = (b >> (8 - bits - ((x * bits) & 7))) &
+                        ((1 << bits) - 1);
+                if (index >= subenc)
+                {
+                    LLOGLN(0, ("lib_zrle_tile: palette index %d out of "
+                               "range %d", index, subenc));
+                    return 1;
+                }
+                lib_fill_pixels(tile + (y * tw + x) * Bpp, Bpp,
+                                palette[index], 1);
+            }
+            in_uint8s(s, row_bytes);
+        }
+    }
+    else if ((subenc == 128) || (subenc >= 130)) /* plain or palette rle */
+    {
+        if ((subenc >= 130) &&
+            (lib_zrle_palette(v, palette, subenc - 128, cbytes) != 0))
+        {
+            return 1;
+        }
+        index = 0;
+        while (index < num_pixels)
+        {
+            if (subenc == 128)
+            {
+                if (lib_zrle_need(v, cbytes) != 0)
+                {
+                    return 1;
+                }
+                pixel = lib_get_cpixel(s->p, cbytes);
+                in_uint8s(s, cbytes);
+            }
+            else
+            {
+                if (lib_zrle_need(v, 1) != 0)
+                {
+                    return 1;
+                }
+                in_uint8(s, b);
+                if ((b & 127) >= subenc - 128)
+                {
+                    return 1;
+                }
+                pixel = palette[b & 127];
+                if ((b & 128) == 0)
+                {
+                    lib_fill_pixels(tile + index * Bpp, Bpp, pixel, 1);
+                    index++;
+                    continue;
+                }
+            }
+            run = 1;
+            do
+            {
+                if (lib_zrle_need(v, 1) != 0)
+                {
+                    return 1;
+                }
+                in_uint8(s, b);
+                run += b;
+            }
+            while (b == 255);
+            if (run > num_pixels - index)
+            {
+                return 1;
+            }
+            lib_fill_pixels(tile + index * Bpp, Bpp, pixel, run);
+            index += run;
+        }
+    }
+    else
+    {
+        LLOGLN(0, ("lib_zrle_tile: bad subencoding %d", subenc));
+        return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_decode_zrle(struct vnc *v, struct stream *s, char *data,
+                int cx, int cy, int Bpp)
+{
+    z_stream *zs;
+    int bytes;
+    int cbytes;
+    int tx;
+    int ty;
+    int tw;
+    int th;
+    int index;
+    int error;
+
+    error = lib_read_s(v, s, 4);
+    if (error != 0)
+    {
+        return error;
+    }
+    in_uint32_be(s, bytes);
+    if (bytes < 0)
+    {
+        return 1;
+    }
+    if (v->zrle_in_s == 0)
+    {
+        make_stream(v->zrle_in_s);
+        make_stream(v->zrle_out_s);
+        init_stream(v->zrle_out_s, 64 * 1024);
+    }
+    zs = &(v->zrle_zs);
+    if (!v->zrle_zs_inited)
+    {
+        if (inflateInit(zs) != Z_OK)
+        {
+            return 1;
+        }
+        v->zrle_zs_inited = 1;
+    }
+    error = lib_read_s(v, v->zrle_in_s, bytes);
+    if (error != 0)
+    {
+        return error;
+    }
+    zs->next_in = (Bytef *) (v->zrle_in_s->data);
+    zs->avail_in = bytes;
+    v->zrle_out_s->p = v->zrle_out_s->data;
+    v->zrle_out_s->end = v->zrle_out_s->data;
+    cbytes = lib_cpixel_bytes(v, Bpp);
+    for (ty = 0; ty < cy; ty += 64)
+    {
+        th = MIN(64, cy - ty);
+        for (tx = 0; tx < cx; tx += 64)
+        {
+            tw = MIN(64, cx - tx);
+            if (lib_zrle_tile(v, tw, th, cbytes, Bpp) != 0)
+            {
+                LLOGLN(0, ("lib_decode_zrle: bad tile at %d %d", tx, ty));
+                return 1;
+            }
+            for (index = 0; index < th; index++)
+            {
+                g_memcpy(data + ((ty + index) * cx + tx) * Bpp,
+                         v->zrle_tile + index * tw * Bpp, tw * Bpp);
+            }
+        }
+    }
+    return lib_inflate_drain(zs);
+}
+
+/******************************************************************************/
+/* tight compact length, 7 bits a byte with the top bit set if more
+   follow, the third byte uses all 8 bits */
+static int APP_CC
+lib_tight_length(struct vnc *v, struct stream *s, int *length)
+{
+    int index;
+    int b;
+
+    *length = 0;
+    for (index = 0; index < 3; index++)
+    {
+        if (lib_read_s(v, s, 1) != 0)
+        {
+            return 1;
+        }
+        in_uint8(s, b);
+        if (index == 2)
+        {
+            *length |= b << 14;
+            break;
+        }
+        *length |= (b & 127) << (index * 7);
+        if ((b & 128) == 0)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* bytes of filtered data into out, under 12 bytes it is sent as is */
+static int APP_CC
+lib_tight_data(struct vnc *v, struct stream *s, int stream_id,
+               char *out, int bytes)
+{
+    z_stream *zs;
+    int length;
+    int rv;
+
+    if (bytes < 12)
+    {
+        if (lib_read_s(v, s, bytes) != 0)
+        {
+            return 1;
+        }
+        g_memcpy(out, s->data, bytes);
+        return 0;
+    }
+    if (lib_tight_length(v, s, &length) != 0)
+    {
+        return 1;
+    }
+    if (lib_read_s(v, s, length) != 0)
+    {
+        return 1;
+    }
+    zs = v->tight_zs + stream_id;
+    if (!v->tight_zs_inited[stream_id])
+    {
+        if (inflateInit(zs) != Z_OK)
+        {
+            return 1;
+        }
+        v->tight_zs_inited[stream_id] = 1;
+    }
+    zs->next_in = (Bytef *) (s->data);
+    zs->avail_in = length;
+    zs->next_out = (Bytef *) out;
+    zs->avail_out = bytes;
+    while (zs->avail_out > 0)
+    {
+        if (zs->avail_in == 0)
+        {
+            LLOGLN(0, ("lib_tight_data: rect data too short"));
+            return 1;
+        }
+        rv = inflate(zs, Z_SYNC_FLUSH);
+        if (rv != Z_OK)
+        {
+            LLOGLN(0, ("lib_tight_data: inflate error %d", rv));
+            return 1;
+        }
+    }
+    return lib_inflate_drain(zs);
+}
+
+/******************************************************************************/
+/* undo the tight gradient filter, each colour component was sent as the
+   difference from left + above - above left, at 24 bit depth those are
+   the r, g, b bytes of the tpixels */
+static int APP_CC
+lib_tight_gradient(struct vnc *v, const char *s, char *data,
+                   int cx, int cy, int tbytes, int Bpp)
+{
+    int max[3];
+    int shift[3];
+    int *prev;
+    int *cur;
+    int *temp;
+    int x;
+    int y;
+    int c;
+    int est;
+    int diff;
+    int pixel;
+
+    if (v->mod_bpp == 24)
+    {
+        max[0] = 255;
+        max[1] = 255;
+        max[2] = 255;
+        shift[0] = 16;
+        shift[1] = 8;
+        shift[2] = 0;
+    }
+    else if (v->mod_bpp == 16)
+    {
+        max[0] = 31;
+        max[1] = 63;
+        max[2] = 31;
+        shift[0] = 11;
+        shift[1] = 5;
+        shift[2] = 0;
+    }
+    else if (v->mod_bpp == 15)
+    {
+        max[0] = 31;
+        max[1] = 31;
+        max[2] = 31;
+        shift[0] = 10;
+        shift[1] = 5;
+        shift[2] = 0;
+    }
+    else
+    {
+        return 1;
+    }
+    prev = (int *) g_malloc(cx * 3 * sizeof(int), 1);
+    cur = (int *) g_malloc(cx * 3 * sizeof(int), 1);
+    for (y = 0; y < cy; y++)
+    {
+        for (x = 0; x < cx; x++)
+        {
+            diff = lib_get_tpixel(s, tbytes);
+            s += tbytes;
+            pixel = 0;
+            for (c = 0; c < 3; c++)
+            {
+                est = prev[x * 3 + c];
+                if (x > 0)
+                {
+                    est += cur[(x - 1) * 3 + c] - prev[(x - 1) * 3 + c];
+                }
+                est = MAX(0, MIN(est, max[c]));
+                cur[x * 3 + c] = (est + (diff >> shift[c])) & max[c];
+                pixel |= cur[x * 3 + c] << shift[c];
+            }
+            lib_fill_pixels(data + (y * cx + x) * Bpp, Bpp, pixel, 1);
+        }
+        temp = prev;
+        prev = cur;
+        cur = temp;
+    }
+    g_free(prev);
+    g_free(cur);
+    return 0;
+}
+
+/******************************************************************************/
+static int APP_CC
+lib_decode_tight(struct vnc *v, struct stream *s, char *data,
+                 int cx, int cy, int Bpp)
+{
+    char *d;
+    int palette[256];
+    int ctrl;
+    int filter;
+    int stream_id;
+    int tbytes;
+    int num_colors;
+    int row_bytes;
+    int bytes;
+    int index;
+    int x;
+    int y;
+
+    if (lib_read_s(v, s, 1) != 0)
+    {
+        return 1;
+    }
+    in_uint8(s, ctrl);
+    for (index = 0; index < 4; index++)
+    {
+        if ((ctrl & (1 << index)) && v->tight_zs_inited[index])
+        {
+            inflateReset(v->tight_zs + index);
+        }
+    }
+    ctrl >>= 4;
+    tbytes = lib_cpixel_bytes(v, Bpp);
+    if (ctrl == 8) /* fill */
+    {
+        if (lib_read_s(v, s, tbytes) != 0)
+        {
+            return 1;
+        }
+        lib_fill_rect(data, cx, Bpp, 0, 0, cx, cy,
+                      lib_get_tpixel(s->data, tbytes));
+        return 0;
+    }
+    if (ctrl > 7)
+    {
+        /* jpeg is only sent when asked for with a quality level */
+        LLOGLN(0, ("lib_decode_tight: unsupported compression %d", ctrl));
+        return 1;
+    }
+    stream_id = ctrl & 3;
+    filter = 0;
+    if (ctrl & 4)
+    {
+        if (lib_read_s(v, s, 1) != 0)
+        {
+            return 1;
+        }
+        in_uint8(s, filter);
+    }
+    if (v->tight_s == 0)
+    {
+        make_stream(v->tight_s);
+    }
+    if (filter == 0) /* copy */
+    {
+        bytes = cx * cy * tbytes;
+        if (tbytes == Bpp)
+        {
+            return lib_tight_data(v, s, stream_id, data, bytes);
+        }
+        init_stream(v->tight_s, bytes);
+        if (lib_tight_data(v, s, stream_id, v->tight_s->data, bytes) != 0)
+        {
+            return 1;
+        }
+        lib_copy_tpixels(v->tight_s->data, data, tbytes, Bpp, cx * cy);
+    }
+    else if (filter == 1) /* palette */
+    {
+        if (lib_read_s(v, s, 1) != 0)
+        {
+            return 1;
+        }
+        in_uint8(s, num_colors);
+        num_colors++;
+        if (lib_read_s(v, s, num_colors * tbytes) != 0)
+        {
+            return 1;
+        }
+        g_memset(palette, 0, sizeof(palette));
+        for (index = 0; index < num_colors; index++)
+        {
+            palette[index] = lib_get_tpixel(s->p, tbytes);
+            in_uint8s(s, tbytes);
+        }
+        row_bytes = (num_colors == 2) ? (cx + 7) / 8 : cx;
+        bytes = row_bytes * cy;
+        init_stream(v->tight_s, bytes);
+        if (lib_tight_data(v, s, stream_id, v->tight_s->data, bytes) != 0)
+        {
+            return 1;
+        }
+        for (y = 0; y < cy; y++)
+        {
+            d = v->tight_s->data + y * row_bytes;
+            for (x = 0; x < cx; x++)
+            {
+                if (num_colors == 2)
+                {
+                    index = (d[x / 8] >> (7 - (x & 7))) & 1;
+                }
+                else
+                {
+                    index = (tui8) (d[x]);
+                }
+                lib_fill_pixels(data + (y * cx + x) * Bpp, Bpp,
+                                palette[index], 1);
+            }
+        }
+    }
+    else if (filter == 2) /* gradient */
+    {
+        bytes = cx * cy * tbytes;
+        init_stream(v->tight_s, bytes);
+        if (lib_tight_data(v, s, stream_id, v->tight_s->data, bytes) != 0)
+        {
+            return 1;
+        }
+        return lib_tight_gradient(v, v->tight_s->data, data, cx, cy,
+                                  tbytes, Bpp);
+    }
+    else
+    {
+        LLOGLN(0, ("lib_decode_tight: bad filter %d", filter));
+        return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+static void APP_CC
+lib_decoders_delete(struct vnc *v)
+{
+    int index;
+
+    if (v->zrle_zs_inited)
+    {
+        inflateEnd(&(v->zrle_zs));
+        v->zrle_zs_inited = 0;
+    }
+    for (index = 0; index < 4; index++)
+    {
+        if (v->tight_zs_inited[index])
+        {
+            inflateEnd(v->tight_zs + index);
+            v->tight_zs_inited[index] = 0;
+        }
+    }
+    free_stream(v->zrle_in_s);
+    free_stream(v->zrle_out_s);
+    free_stream(v->tight_s);
+    v->zrle_in_s = 0;
+    v->zrle_out_s = 0;
+    v->tight_s = 0;
+}
+
 /******************************************************************************/
 int DEFAULT_CC
 lib_framebuffer_update(struct vnc *v)
@@ -648,6 +1548,30 @@ lib_framebuffer_update(struct vnc *v)
                     error = v->server_paint_rect(v, x, y, cx, cy, pixel_s->data, cx, cy, 0, 0);
                 }
             }
+            else if (encoding == 5 || encoding == 7 ||
+                     encoding == 16) /* hextile, tight, zrle */
+            {
+                need_size = cx * cy * Bpp;
+                init_stream(pixel_s, need_size);
+
+                if (encoding == 5)
+                {
+                    error = lib_decode_hextile(v, s, pixel_s->data, cx, cy, Bpp);
+                }
+                else if (encoding == 7)
+                {
+                    error = lib_decode_tight(v, s, pixel_s->data, cx, cy, Bpp);
+                }
+                else
+                {
+                    error = lib_decode_zrle(v, s, pixel_s->data, cx, cy, Bpp);
+                }
+
+                if (error == 0)
+                {
+                    error = v->server_paint_rect(v, x, y, cx, cy, pixel_s->data, cx, cy, 0, 0);
+                }
+            }
             else if (encoding == 1) /* copy rect */
             {
                 init_stream(s, 8192);
@@ -1299,9 +2223,12 @@ lib_mod_connect(struct vnc *v)
         init_stream(s, 8192);
         out_uint8(s, 2);
         out_uint8(s, 0);
-        out_uint16_be(s, 4);
-        out_uint32_be(s, 0); /* raw */
+        out_uint16_be(s, 7);
         out_uint32_be(s, 1); /* copy rect */
+        out_uint32_be(s, 7); /* tight */
+        out_uint32_be(s, 16); /* zrle */
+        out_uint32_be(s, 5); /* hextile */
+        out_uint32_be(s, 0); /* raw */
         out_uint32_be(s, 0xffffff11); /* cursor */
         out_uint32_be(s, 0xffffff21); /* desktop size */
         v->server_msg(v, "VNC sending encodings", 0);
@@ -1497,6 +2424,7 @@ mod_exit(struct vnc *v)
         return 0;
     }
     trans_delete(v->trans);
+    lib_decoders_delete(v);
     g_free(v);
     return 0;
 }
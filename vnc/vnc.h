@@ -24,6 +24,8 @@
 #include "os_calls.h"
 #include "defines.h"
 
+#include <zlib.h>
+
 #define CURRENT_MOD_VER 3
 
 struct vnc
@@ -114,4 +116,13 @@ struct vnc
   struct stream *clip_data_s;
   int delay_ms;
   struct trans *trans;
+  /* zrle and tight decoders, the zlib streams last the whole session */
+  z_stream zrle_zs;
+  int zrle_zs_inited;
+  struct stream *zrle_in_s; /* compressed data for one rect */
+  struct stream *zrle_out_s; /* inflated data not decoded yet */
+  char zrle_tile[64 * 64 * 4];
+  z_stream tight_zs[4];
+  int tight_zs_inited[4];
+  struct stream *tight_s; /* filtered data for one rect */
 };
@@ -558,6 +558,9 @@ rdpup_set_cursor(short x, short y, char* cur_data, char* cur_mask);
 int
 rdpup_set_cursor_ex(short x, short y, char *cur_data, char *cur_mask, int bpp);
 int
+rdpup_set_cursor_large(short x, short y, char *cur_data, char *cur_mask,
+                       int bpp, int width, int height);
+int
 rdpup_create_os_surface(int rdpindexd, int width, int height);
 int
 rdpup_create_os_surface_bpp(int rdpindexd, int width, int height, int bpp);
@@ -604,6 +607,8 @@ rdpup_composite(short srcidx, int srcformat, short srcwidth, CARD8 srcrepeat,
 
 void
 rdpScheduleDeferredUpdate(void);
+void
+rdpup_block_handler(pointer pTimeout);
 
 int
 rdpXvInit(ScreenPtr pScreen);
@@ -683,6 +683,46 @@ set_pixel_safe(char *data, int x, int y, int width, int height, int bpp,
     }
 }
 
+/******************************************************************************/
+/* argb cursor bigger than 32x32, xup can carry up to 96x96 and xrdp crops
+   it again if the client takes less */
+static void
+rdpSpriteSetCursorLarge(CursorPtr pCurs, int w, int h)
+{
+    char *cur_data;
+    char *cur_mask;
+    char *data;
+    int i;
+    int j;
+    int p;
+    int cw;
+    int ch;
+    int paddedRowBytes;
+
+    cw = MIN(w, 96);
+    ch = MIN(h, 96);
+    cur_data = (char *)g_malloc(cw * ch * 4, 1);
+    cur_mask = (char *)g_malloc(((cw + 15) / 16) * 2 * ch, 1);
+    paddedRowBytes = PixmapBytePad(w, 32);
+    data = (char *)(pCurs->bits->argb);
+
+    for (j = 0; j < ch; j++)
+    {
+        for (i = 0; i < cw; i++)
+        {
+            p = get_pixel_safe(data, i, j, paddedRowBytes / 4, h, 32);
+            set_pixel_safe(cur_data, i, (ch - 1) - j, cw, ch, 32, p);
+        }
+    }
+
+    rdpup_begin_update();
+    rdpup_set_cursor_large(pCurs->bits->xhot, pCurs->bits->yhot,
+                           cur_data, cur_mask, 32, cw, ch);
+    rdpup_end_update();
+    g_free(cur_data);
+    g_free(cur_mask);
+}
+
 /******************************************************************************/
 void
 rdpSpriteSetCursor(DeviceIntPtr pDev, ScreenPtr pScr, CursorPtr pCurs,
@@ -716,6 +756,14 @@ rdpSpriteSetCursor(DeviceIntPtr pDev, ScreenPtr pScr, CursorPtr pCurs,
 
     w = pCurs->bits->width;
     h = pCurs->bits->height;
+    if ((pCurs->bits->argb != 0) &&
+        (g_rdpScreen.client_info.pointer_flags & 1) &&
+        (g_rdpScreen.client_info.large_pointer_flags != 0) &&
+        ((w > 32) || (h > 32)))
+    {
+        rdpSpriteSetCursorLarge(pCurs, w, h);
+        return;
+    }
     if ((pCurs->bits->argb != 0) &&
         (g_rdpScreen.client_info.pointer_flags & 1))
     {
@@ -211,6 +211,7 @@ rdpWakeupHandler(int i, pointer blockData, unsigned long err,
 static void
 rdpBlockHandler1(pointer blockData, OSTimePtr pTimeout, pointer pReadmask)
 {
+    rdpup_block_handler(pTimeout);
 }
 
 /******************************************************************************/
@@ -22,6 +22,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "rdp.h"
 #include "xrdp_rail.h"
 #include "rdpglyph.h"
+#include "xrdp_pixel.h"
 
 #include <signal.h>
 #include <sys/ipc.h>
@@ -58,10 +59,32 @@ static struct stream *g_in_s = 0;
 static int g_button_mask = 0;
 static int g_cursor_x = 0;
 static int g_cursor_y = 0;
-static OsTimerPtr g_timer = 0;
-static int g_scheduled = 0;
 static int g_count = 0;
 static int g_rdpindex = -1;
+static int g_pen_width = 1;
+
+/* frames go out when the server goes idle and the client acked the last
+   one, the timeout is for a client that stops acking */
+#define RDP_FRAME_ACK_TIMEOUT 500
+static int g_frame_pending = 0;
+static CARD32 g_frame_time = 0;
+
+/* screen image damage is kept as 64x64 tiles, a dirty tile is only sent
+   if its pixels hash different from what the client was last sent */
+#define RDP_TILE_BITS 6
+#define RDP_TILE_SIZE (1 << RDP_TILE_BITS)
+#define RDP_TILE_SET(_bits, _index) \
+    (_bits)[(_index) >> 5] |= 1u << ((_index) & 31)
+#define RDP_TILE_TEST(_bits, _index) \
+    (((_bits)[(_index) >> 5] >> ((_index) & 31)) & 1)
+static int g_tile_width = 0;
+static int g_tile_height = 0;
+static int g_tile_cols = 0;
+static int g_tile_rows = 0;
+static unsigned int *g_tile_dirty = 0; /* bit per tile */
+static unsigned int *g_tile_ll = 0; /* bit per tile, send lossless */
+static unsigned long long *g_tile_hash = 0; /* 0 is unknown */
+static int g_tile_flushing = 0;
 
 extern DevPrivateKeyRec g_rdpWindowIndex; /* from rdpmain.c */
 extern ScreenPtr g_pScreen; /* from rdpmain.c */
@@ -560,42 +583,228 @@ rdpup_send_pending(void)
 }
 
 /******************************************************************************/
-static CARD32
-rdpDeferredUpdateCallback(OsTimerPtr timer, CARD32 now, pointer arg)
+/* the next block handler sends it, see rdpup_block_handler */
+void
+rdpScheduleDeferredUpdate(void)
+{
+    g_frame_pending = 1;
+}
+
+/******************************************************************************/
+static void
+rdpup_send_frame(void)
 {
-    LLOGLN(10, ("rdpDeferredUpdateCallback"));
+    LLOGLN(10, ("rdpup_send_frame"));
+    g_frame_pending = 0;
+    g_frame_time = GetTimeInMillis();
 
     if (g_do_dirty_ons)
     {
-        if (g_rect_id == g_rect_id_ack)
-        {
-            rdpup_check_dirty_screen(&g_screenPriv);
-        }
-        else
-        {
-            LLOGLN(0, ("rdpDeferredUpdateCallback: skipping"));
-        }
+        rdpup_check_dirty_screen(&g_screenPriv);
     }
     else
     {
         rdpup_send_pending();
     }
+}
 
-    g_scheduled = 0;
+/******************************************************************************/
+/* called before the server sleeps, all the drawing for this round is done
+   so send the frame unless the client is still busy with the last one */
+void
+rdpup_block_handler(pointer pTimeout)
+{
+    CARD32 elapsed;
+
+    if (!g_frame_pending)
+    {
+        return;
+    }
+
+    if (g_rect_id == g_rect_id_ack)
+    {
+        rdpup_send_frame();
+        return;
+    }
+
+    elapsed = GetTimeInMillis() - g_frame_time;
+
+    if (elapsed >= RDP_FRAME_ACK_TIMEOUT)
+    {
+        LLOGLN(0, ("rdpup_block_handler: no ack for %d ms", (int)elapsed));
+        rdpup_send_frame();
+        return;
+    }
+
+    /* the ack wakes us up, this is in case it never comes */
+    AdjustWaitForDelay(pTimeout, RDP_FRAME_ACK_TIMEOUT - elapsed);
+}
+
+/******************************************************************************/
+/* (re)size the tile grid to the screen, the client's copy of every tile
+   is unknown after */
+static int
+rdpup_tile_check_size(void)
+{
+    int tiles;
+    int words;
+
+    if ((g_tile_width == g_rdpScreen.width) &&
+        (g_tile_height == g_rdpScreen.height) && (g_tile_hash != 0))
+    {
+        return 0;
+    }
+
+    g_free(g_tile_dirty);
+    g_free(g_tile_ll);
+    g_free(g_tile_hash);
+    g_tile_width = g_rdpScreen.width;
+    g_tile_height = g_rdpScreen.height;
+    g_tile_cols = (g_tile_width + RDP_TILE_SIZE - 1) >> RDP_TILE_BITS;
+    g_tile_rows = (g_tile_height + RDP_TILE_SIZE - 1) >> RDP_TILE_BITS;
+    tiles = g_tile_cols * g_tile_rows;
+    words = (tiles + 31) / 32;
+    LLOGLN(0, ("rdpup_tile_check_size: %dx%d tiles", g_tile_cols, g_tile_rows));
+    g_tile_dirty = (unsigned int *)g_malloc(words * 4 + 4, 1);
+    g_tile_ll = (unsigned int *)g_malloc(words * 4 + 4, 1);
+    g_tile_hash = (unsigned long long *)
+                  g_malloc(tiles * sizeof(unsigned long long) + 8, 1);
     return 0;
 }
 
 /******************************************************************************/
-void
-rdpScheduleDeferredUpdate(void)
+/* tile range covered by a box, returns 0 if there is none */
+static int
+rdpup_tile_range(int x1, int y1, int x2, int y2,
+                 int *c1, int *r1, int *c2, int *r2)
+{
+    x1 = MAX(x1, 0);
+    y1 = MAX(y1, 0);
+    x2 = MIN(x2, g_tile_width);
+    y2 = MIN(y2, g_tile_height);
+
+    if ((x1 >= x2) || (y1 >= y2))
+    {
+        return 0;
+    }
+
+    *c1 = x1 >> RDP_TILE_BITS;
+    *r1 = y1 >> RDP_TILE_BITS;
+    *c2 = (x2 - 1) >> RDP_TILE_BITS;
+    *r2 = (y2 - 1) >> RDP_TILE_BITS;
+    return 1;
+}
+
+/******************************************************************************/
+/* an order drew on the screen so the client's copy of these tiles is no
+   longer known */
+static void
+rdpup_tile_invalidate(int x, int y, int cx, int cy)
 {
-    if (!g_scheduled)
+    int c1;
+    int r1;
+    int c2;
+    int r2;
+    int col;
+    int row;
+
+    if ((g_rdpindex != -1) || g_tile_flushing)
+    {
+        return;
+    }
+
+    rdpup_tile_check_size();
+
+    if (!rdpup_tile_range(x, y, x + cx, y + cy, &c1, &r1, &c2, &r2))
+    {
+        return;
+    }
+
+    for (row = r1; row <= r2; row++)
     {
-        g_scheduled = 1;
-        g_timer = TimerSet(g_timer, 0, 40, rdpDeferredUpdateCallback, 0);
+        for (col = c1; col <= c2; col++)
+        {
+            g_tile_hash[row * g_tile_cols + col] = 0;
+        }
     }
 }
 
+/******************************************************************************/
+static void
+rdpup_tile_mark(int x1, int y1, int x2, int y2, int ll)
+{
+    int c1;
+    int r1;
+    int c2;
+    int r2;
+    int col;
+    int row;
+    int index;
+
+    rdpup_tile_check_size();
+
+    if (!rdpup_tile_range(x1, y1, x2, y2, &c1, &r1, &c2, &r2))
+    {
+        return;
+    }
+
+    for (row = r1; row <= r2; row++)
+    {
+        index = row * g_tile_cols + c1;
+
+        for (col = c1; col <= c2; col++)
+        {
+            RDP_TILE_SET(g_tile_dirty, index);
+
+            if (ll)
+            {
+                RDP_TILE_SET(g_tile_ll, index);
+            }
+
+            index++;
+        }
+    }
+}
+
+/******************************************************************************/
+/* fnv-1a, 0 is kept for unknown */
+static unsigned long long
+rdpup_tile_hash(struct image_data *id, int x, int y, int w, int h)
+{
+    unsigned long long hash;
+    unsigned char *s8;
+    unsigned int *s32;
+    int i;
+    int j;
+
+    hash = 0xcbf29ce484222325ULL;
+
+    for (j = 0; j < h; j++)
+    {
+        s8 = (unsigned char *)(id->pixels +
+                               ((y + j) * id->lineBytes) + (x * g_Bpp));
+
+        if (g_Bpp == 4)
+        {
+            s32 = (unsigned int *)s8;
+
+            for (i = 0; i < w; i++)
+            {
+                hash = (hash ^ s32[i]) * 0x100000001b3ULL;
+            }
+        }
+        else
+        {
+            for (i = 0; i < w * g_Bpp; i++)
+            {
+                hash = (hash ^ s8[i]) * 0x100000001b3ULL;
+            }
+        }
+    }
+
+    return (hash == 0) ? 1 : hash;
+}
+
 /******************************************************************************/
 /* returns error */
 static int
@@ -723,6 +932,7 @@ process_screen_size_msg(int width, int height, int bpp)
     g_rdpScreen.rdp_width = width;
     g_rdpScreen.rdp_height = height;
     g_rdpScreen.rdp_bpp = bpp;
+    g_tile_width = 0; /* new client copy, forget the tile hashes */
 
     if (bpp < 15)
     {
@@ -1234,7 +1444,8 @@ rdpup_init(void)
     if (g_out_s == 0)
     {
         make_stream(g_out_s);
-        init_stream(g_out_s, 8192 * g_Bpp + 100);
+        /* big enough for a 96x96 32 bpp cursor in one order */
+        init_stream(g_out_s, MAX(8192 * g_Bpp + 100, 64 * 1024));
     }
 
     if (g_use_uds)
@@ -1359,6 +1570,8 @@ rdpup_check(void)
             g_sck_closed = 0;
             g_begin = 0;
             g_con_number++;
+            g_rect_id_ack = g_rect_id;
+            g_tile_width = 0;
             rdpGlyphInit();
             AddEnabledDevice(g_sck);
 
@@ -1478,6 +1691,7 @@ rdpup_fill_rect(short x, short y, int cx, int cy)
     if (g_connected)
     {
         LLOGLN(10, ("  rdpup_fill_rect"));
+        rdpup_tile_invalidate(x, y, cx, cy);
         rdpup_pre_check(12);
         out_uint16_le(g_out_s, 3); /* fill rect */
         out_uint16_le(g_out_s, 12); /* size */
@@ -1499,6 +1713,7 @@ rdpup_screen_blt(short x, short y, int cx, int cy, short srcx, short srcy)
     {
         LLOGLN(10, ("  rdpup_screen_blt x %d y %d cx %d cy %d srcx %d srcy %d",
                x, y, cx, cy, srcx, srcy));
+        rdpup_tile_invalidate(x, y, cx, cy);
         rdpup_pre_check(16);
         out_uint16_le(g_out_s, 4); /* screen blt */
         out_uint16_le(g_out_s, 16); /* size */
@@ -1613,16 +1828,6 @@ convert_pixel(int in_pixel)
 int
 convert_pixels(void *src, void *dst, int num_pixels)
 {
-    unsigned int pixel;
-    unsigned int red;
-    unsigned int green;
-    unsigned int blue;
-    unsigned int *src32;
-    unsigned int *dst32;
-    unsigned short *dst16;
-    unsigned char *dst8;
-    int index;
-
     if (g_rdpScreen.depth == g_rdpScreen.rdp_bpp)
     {
         memcpy(dst, src, num_pixels * g_Bpp);
@@ -1631,61 +1836,21 @@ convert_pixels(void *src, void *dst, int num_pixels)
 
     if (g_rdpScreen.depth == 24)
     {
-        src32 = (unsigned int *)src;
-
         if (g_rdpScreen.rdp_bpp >= 24)
         {
-            dst32 = (unsigned int *)dst;
-
-            for (index = 0; index < num_pixels; index++)
-            {
-                pixel = *src32;
-                *dst32 = pixel;
-                dst32++;
-                src32++;
-            }
+            memcpy(dst, src, num_pixels * 4);
         }
         else if (g_rdpScreen.rdp_bpp == 16)
         {
-            dst16 = (unsigned short *)dst;
-
-            for (index = 0; index < num_pixels; index++)
-            {
-                pixel = *src32;
-                SPLITCOLOR32(red, green, blue, pixel);
-                pixel = COLOR16(red, green, blue);
-                *dst16 = pixel;
-                dst16++;
-                src32++;
-            }
+            xrdp_pixel_a8r8g8b8_to_r5g6b5(src, dst, num_pixels);
         }
         else if (g_rdpScreen.rdp_bpp == 15)
         {
-            dst16 = (unsigned short *)dst;
-
-            for (index = 0; index < num_pixels; index++)
-            {
-                pixel = *src32;
-                SPLITCOLOR32(red, green, blue, pixel);
-                pixel = COLOR15(red, green, blue);
-                *dst16 = pixel;
-                dst16++;
-                src32++;
-            }
+            xrdp_pixel_a8r8g8b8_to_x1r5g5b5(src, dst, num_pixels);
         }
         else if (g_rdpScreen.rdp_bpp == 8)
         {
-            dst8 = (unsigned char *)dst;
-
-            for (index = 0; index < num_pixels; index++)
-            {
-                pixel = *src32;
-                SPLITCOLOR32(red, green, blue, pixel);
-                pixel = COLOR8(red, green, blue);
-                *dst8 = pixel;
-                dst8++;
-                src32++;
-            }
+            xrdp_pixel_a8r8g8b8_to_r3g3b2(src, dst, num_pixels);
         }
     }
 
@@ -1696,18 +1861,7 @@ convert_pixels(void *src, void *dst, int num_pixels)
 int
 alpha_pixels(void* src, void* dst, int num_pixels)
 {
-  unsigned int* src32;
-  unsigned char* dst8;
-  int index;
-
-  src32 = (unsigned int*)src;
-  dst8 = (unsigned char*)dst;
-  for (index = 0; index < num_pixels; index++)
-  {
-    *dst8 = (*src32) >> 24;
-    dst8++;
-    src32++;
-  }
+  xrdp_pixel_a8r8g8b8_to_a8(src, dst, num_pixels);
   return 0;
 }
 
@@ -1773,6 +1927,7 @@ rdpup_set_pen(int style, int width)
     if (g_connected)
     {
         LLOGLN(10, ("  rdpup_set_pen"));
+        g_pen_width = MAX(width, 1);
         rdpup_pre_check(8);
         out_uint16_le(g_out_s, 17); /* set pen */
         out_uint16_le(g_out_s, 8); /* size */
@@ -1791,6 +1946,10 @@ rdpup_draw_line(short x1, short y1, short x2, short y2)
     if (g_connected)
     {
         LLOGLN(10, ("  rdpup_draw_line"));
+        rdpup_tile_invalidate(MIN(x1, x2) - g_pen_width,
+                              MIN(y1, y2) - g_pen_width,
+                              abs(x2 - x1) + g_pen_width * 2 + 1,
+                              abs(y2 - y1) + g_pen_width * 2 + 1);
         rdpup_pre_check(12);
         out_uint16_le(g_out_s, 18); /* draw line */
         out_uint16_le(g_out_s, 12); /* size */
@@ -1861,6 +2020,45 @@ rdpup_set_cursor_ex(short x, short y, char *cur_data, char *cur_mask, int bpp)
     return 0;
 }
 
+/******************************************************************************/
+/* cursor up to 96x96, data rows are width * Bpp bytes and mask rows
+   ((width + 15) / 16) * 2 bytes, both bottom up */
+int
+rdpup_set_cursor_large(short x, short y, char *cur_data, char *cur_mask,
+                       int bpp, int width, int height)
+{
+    int size;
+    int Bpp;
+    int data_bytes;
+    int mask_bytes;
+
+    if (g_connected)
+    {
+        LLOGLN(10, ("  rdpup_set_cursor_large %dx%d", width, height));
+        Bpp = (bpp == 0) ? 3 : (bpp + 7) / 8;
+        data_bytes = width * height * Bpp;
+        mask_bytes = ((width + 15) / 16) * 2 * height;
+        size = 14 + data_bytes + mask_bytes;
+        rdpup_pre_check(size);
+        out_uint16_le(g_out_s, 52); /* set cursor large */
+        out_uint16_le(g_out_s, size); /* size */
+        g_count++;
+        x = MAX(0, x);
+        x = MIN(width - 1, x);
+        y = MAX(0, y);
+        y = MIN(height - 1, y);
+        out_uint16_le(g_out_s, x);
+        out_uint16_le(g_out_s, y);
+        out_uint16_le(g_out_s, bpp);
+        out_uint16_le(g_out_s, width);
+        out_uint16_le(g_out_s, height);
+        out_uint8a(g_out_s, cur_data, data_bytes);
+        out_uint8a(g_out_s, cur_mask, mask_bytes);
+    }
+
+    return 0;
+}
+
 /******************************************************************************/
 int
 rdpup_create_os_surface(int rdpindex, int width, int height)
@@ -2111,6 +2309,11 @@ rdpup_send_area(struct image_data *id, int x, int y, int w, int h)
     {
         LLOGLN(10, ("  rdpup_send_area"));
 
+        if (id->pixels == g_rdpScreen.pfbMemory)
+        {
+            rdpup_tile_invalidate(x, y, w, h);
+        }
+
         if (id->shmem_pixels != 0)
         {
             LLOGLN(10, ("rdpup_send_area: using shmem"));
@@ -2230,6 +2433,100 @@ rdpup_send_area(struct image_data *id, int x, int y, int w, int h)
     }
 }
 
+/******************************************************************************/
+/* send the dirty tiles whose pixels changed since the client got them,
+   changed neighbours in a row go out as one area */
+static void
+rdpup_tile_flush(struct image_data *id)
+{
+    unsigned long long hash;
+    int row;
+    int col;
+    int index;
+    int start;
+    int changed;
+    int ll;
+    int tile_ll;
+    int x;
+    int y;
+    int w;
+    int h;
+    int skipped;
+
+    if (g_tile_dirty == 0)
+    {
+        return;
+    }
+
+    g_tile_flushing = 1;
+    skipped = 0;
+
+    for (row = 0; row < g_tile_rows; row++)
+    {
+        y = row << RDP_TILE_BITS;
+        h = MIN(RDP_TILE_SIZE, g_tile_height - y);
+        start = -1;
+        ll = 0;
+
+        /* one past the end to close the last run */
+        for (col = 0; col <= g_tile_cols; col++)
+        {
+            changed = 0;
+            tile_ll = 0;
+            index = row * g_tile_cols + col;
+
+            if ((col < g_tile_cols) && RDP_TILE_TEST(g_tile_dirty, index))
+            {
+                x = col << RDP_TILE_BITS;
+                w = MIN(RDP_TILE_SIZE, g_tile_width - x);
+                hash = rdpup_tile_hash(id, x, y, w, h);
+
+                if (hash != g_tile_hash[index])
+                {
+                    g_tile_hash[index] = hash;
+                    changed = 1;
+                    tile_ll = RDP_TILE_TEST(g_tile_ll, index);
+                }
+                else
+                {
+                    skipped++;
+                }
+            }
+
+            if ((start >= 0) && (!changed || (tile_ll != ll)))
+            {
+                x = start << RDP_TILE_BITS;
+                w = MIN((col - start) << RDP_TILE_BITS, g_tile_width - x);
+
+                if (ll)
+                {
+                    rdpup_set_hints(1, 1);
+                }
+
+                rdpup_send_area(id, x, y, w, h);
+
+                if (ll)
+                {
+                    rdpup_set_hints(0, 1);
+                }
+
+                start = -1;
+            }
+
+            if (changed && (start < 0))
+            {
+                start = col;
+                ll = tile_ll;
+            }
+        }
+    }
+
+    LLOGLN(10, ("rdpup_tile_flush: skipped %d unchanged tiles", skipped));
+    memset(g_tile_dirty, 0, ((g_tile_cols * g_tile_rows + 31) / 32) * 4);
+    memset(g_tile_ll, 0, ((g_tile_cols * g_tile_rows + 31) / 32) * 4);
+    g_tile_flushing = 0;
+}
+
 /******************************************************************************/
 /* split the bitmap up into 64 x 64 pixel areas */
 void
@@ -2334,6 +2631,7 @@ rdpup_paint_rect_os(int x, int y, int cx, int cy,
 {
     if (g_connected)
     {
+        rdpup_tile_invalidate(x, y, cx, cy);
         rdpup_pre_check(20);
         out_uint16_le(g_out_s, 23);
         out_uint16_le(g_out_s, 20);
@@ -2719,36 +3017,20 @@ rdpup_check_dirty_screen(rdpPixmapRec *pDirtyPriv)
                 rdpup_set_opcode(GXcopy);
                 break;
             case RDI_IMGLL:
-                rdpup_set_hints(1, 1);
-                rdpup_set_opcode(di->u.img.opcode);
-                count = REGION_NUM_RECTS(di->reg);
-
-                for (index = 0; index < count; index++)
-                {
-                    box = REGION_RECTS(di->reg)[index];
-                    LLOGLN(10, ("  RDI_IMGLL x %d y %d w %d h %d", box.x1, box.y1,
-                                box.x2 - box.x1, box.y2 - box.y1));
-                    rdpup_send_area(&id, box.x1, box.y1, box.x2 - box.x1,
-                                    box.y2 - box.y1);
-                }
-
-                rdpup_set_opcode(GXcopy);
-                rdpup_set_hints(0, 1);
-                break;
             case RDI_IMGLY:
-                rdpup_set_opcode(di->u.img.opcode);
+                /* the tiles are sent from the frame buffer after all the
+                   orders, so they carry the final pixels */
                 count = REGION_NUM_RECTS(di->reg);
 
                 for (index = 0; index < count; index++)
                 {
                     box = REGION_RECTS(di->reg)[index];
-                    LLOGLN(10, ("  RDI_IMGLY %d %d %d %d", box.x1, box.y1,
+                    LLOGLN(10, ("  RDI_IMG %d %d %d %d", box.x1, box.y1,
                                 box.x2, box.y2));
-                    rdpup_send_area(&id, box.x1, box.y1, box.x2 - box.x1,
-                                    box.y2 - box.y1);
+                    rdpup_tile_mark(box.x1, box.y1, box.x2, box.y2,
+                                    di->type == RDI_IMGLL);
                 }
 
-                rdpup_set_opcode(GXcopy);
                 break;
             case RDI_LINE:
                 LLOGLN(10, ("  RDI_LINE"));
@@ -2786,6 +3068,7 @@ rdpup_check_dirty_screen(rdpPixmapRec *pDirtyPriv)
         di = di->next;
     }
 
+    rdpup_tile_flush(&id);
     draw_item_remove_all(pDirtyPriv);
     rdpup_end_update();
     pDirtyPriv->is_dirty = 0;
@@ -2881,6 +3164,8 @@ rdpup_draw_text(int font, int flags, int mixmode,
     if (g_connected)
     {
         LLOGLN(10, ("  rdpup_draw_text"));
+        rdpup_tile_invalidate(clip_left, clip_top, clip_right - clip_left + 1,
+                              clip_bottom - clip_top + 1);
         rdpup_pre_check(32 + data_bytes);
         out_uint16_le(g_out_s, 30); /* draw text */
         out_uint16_le(g_out_s, 32 + data_bytes); /* size */
@@ -2916,6 +3201,7 @@ rdpup_composite(short srcidx, int srcformat, short srcwidth, CARD8 srcrepeat,
     if (g_connected)
     {
         LLOGLN(10, ("  rdpup_composite"));
+        rdpup_tile_invalidate(dstx, dsty, width, height);
         rdpup_pre_check(84);
         out_uint16_le(g_out_s, 33);
         out_uint16_le(g_out_s, 84); /* size */
@@ -561,6 +561,7 @@ main(int argc, char **argv)
     }
 
     g_threadid = tc_get_threadid();
+    xrdp_bitmap_hash_init(libxrdp_detect_cpu());
     g_listen = xrdp_listen_create();
     g_signal_user_interrupt(xrdp_shutdown); /* SIGINT */
     g_signal_kill(xrdp_shutdown); /* SIGKILL */
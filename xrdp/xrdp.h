@@ -37,6 +37,7 @@
 #include "file.h"
 #include "file_loc.h"
 #include "xrdp_client_info.h"
+#include "xrdp_perf.h"
 
 /* xrdp.c */
 long APP_CC
@@ -129,10 +130,11 @@ int APP_CC
 xrdp_wm_pu(struct xrdp_wm* self, struct xrdp_bitmap* control);
 int APP_CC
 xrdp_wm_send_pointer(struct xrdp_wm* self, int cache_idx,
-                     char* data, char* mask, int x, int y, int bpp);
+                     char* data, char* mask, int x, int y, int bpp,
+                     int width, int height);
 int APP_CC
 xrdp_wm_pointer(struct xrdp_wm* self, char* data, char* mask, int x, int y,
-                int bpp);
+                int bpp, int width, int height);
 int
 callback(long id, int msg, long param1, long param2, long param3, long param4);
 int APP_CC
@@ -171,14 +173,22 @@ xrdp_region_create(struct xrdp_wm* wm);
 void APP_CC
 xrdp_region_delete(struct xrdp_region* self);
 int APP_CC
-xrdp_region_add_rect(struct xrdp_region* self, struct xrdp_rect* rect);
+xrdp_region_clear(struct xrdp_region* self);
 int APP_CC
-xrdp_region_insert_rect(struct xrdp_region* self, int i, int left,
-                        int top, int right, int bottom);
+xrdp_region_add_rect(struct xrdp_region* self, struct xrdp_rect* rect);
 int APP_CC
 xrdp_region_subtract_rect(struct xrdp_region* self,
                           struct xrdp_rect* rect);
 int APP_CC
+xrdp_region_intersect_rect(struct xrdp_region* self,
+                           struct xrdp_rect* rect);
+int APP_CC
+xrdp_region_union(struct xrdp_region* self, struct xrdp_region* region);
+int APP_CC
+xrdp_region_intersect(struct xrdp_region* self, struct xrdp_region* region);
+int APP_CC
+xrdp_region_subtract(struct xrdp_region* self, struct xrdp_region* region);
+int APP_CC
 xrdp_region_get_rect(struct xrdp_region* self, int index,
                      struct xrdp_rect* rect);
 
@@ -209,6 +219,10 @@ xrdp_bitmap_copy_box(struct xrdp_bitmap* self,
                      struct xrdp_bitmap* dest,
                      int x, int y, int cx, int cy);
 int APP_CC
+xrdp_bitmap_hash_init(int cpu_opt);
+tui64 APP_CC
+xrdp_bitmap_hash_data(const char* data, int bytes, tui64 seed);
+int APP_CC
 xrdp_bitmap_hash_crc(struct xrdp_bitmap *self);
 int APP_CC
 xrdp_bitmap_copy_box_with_crc(struct xrdp_bitmap* self,
@@ -419,6 +433,10 @@ int DEFAULT_CC
 server_set_pointer_ex(struct xrdp_mod* mod, int x, int y,
                       char* data, char* mask, int bpp);
 int DEFAULT_CC
+server_set_pointer_large(struct xrdp_mod* mod, int x, int y,
+                         char* data, char* mask, int bpp,
+                         int width, int height);
+int DEFAULT_CC
 server_palette(struct xrdp_mod* mod, int* palette);
 int DEFAULT_CC
 server_msg(struct xrdp_mod* mod, char* msg, int code);
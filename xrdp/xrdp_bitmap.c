@@ -21,6 +21,8 @@
  * maybe it should be called xrdp_drawable
  */
 
+#include <string.h>
+
 #include "xrdp.h"
 #include "log.h"
 #include "crc16.h"
@@ -38,57 +40,260 @@
   while (0)
 
 
-static const int g_crc_table[256] =
+#if defined(__x86_64__) && (defined(__clang__) || \
+    (defined(__GNUC__) && \
+     ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))))
+#define XRDP_HASH_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+#define HASH_ROTL(_v, _r) (((_v) << (_r)) | ((_v) >> (64 - (_r))))
+
+/* hash a run of bytes, seed is the value returned for the previous run so
+   a bitmap can be hashed a row at a time as it is copied */
+typedef tui64 (*xrdp_hash_proc)(const tui8 *data, int bytes, tui64 seed);
+
+/*****************************************************************************/
+static tui64
+hash_read64(const tui8 *data)
+{
+    tui64 rv;
+
+    memcpy(&rv, data, 8);
+    return rv;
+}
+
+/*****************************************************************************/
+static tui32
+hash_read32(const tui8 *data)
+{
+    tui32 rv;
+
+    memcpy(&rv, data, 4);
+    return rv;
+}
+
+/*****************************************************************************/
+static tui64
+hash_round(tui64 acc, tui64 input)
+{
+    acc += input * HASH_PRIME2;
+    acc = HASH_ROTL(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+/*****************************************************************************/
+static tui64
+hash_merge(tui64 acc, tui64 val)
+{
+    acc ^= hash_round(0, val);
+    return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+/*****************************************************************************/
+static tui64
+hash_avalanche(tui64 h)
+{
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*****************************************************************************/
+/* portable 64 bit hash, the xxHash64 algorithm */
+static tui64
+xrdp_bitmap_hash_generic(const tui8 *data, int bytes, tui64 seed)
+{
+    const tui8 *end;
+    tui64 v1;
+    tui64 v2;
+    tui64 v3;
+    tui64 v4;
+    tui64 h;
+
+    end = data + bytes;
+    if (bytes >= 32)
+    {
+        v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        v2 = seed + HASH_PRIME2;
+        v3 = seed;
+        v4 = seed - HASH_PRIME1;
+        do
+        {
+            v1 = hash_round(v1, hash_read64(data));
+            v2 = hash_round(v2, hash_read64(data + 8));
+            v3 = hash_round(v3, hash_read64(data + 16));
+            v4 = hash_round(v4, hash_read64(data + 24));
+            data += 32;
+        }
+        while (data <= end - 32);
+        h = HASH_ROTL(v1, 1) + HASH_ROTL(v2, 7) +
+            HASH_ROTL(v3, 12) + HASH_ROTL(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    }
+    else
+    {
+        h = seed + HASH_PRIME5;
+    }
+    h += (tui64) bytes;
+    while (data + 8 <= end)
+    {
+        h ^= hash_round(0, hash_read64(data));
+        h = HASH_ROTL(h, 27) * HASH_PRIME1 + HASH_PRIME4;
+        data += 8;
+    }
+    if (data + 4 <= end)
+    {
+        h ^= (tui64) hash_read32(data) * HASH_PRIME1;
+        h = HASH_ROTL(h, 23) * HASH_PRIME2 + HASH_PRIME3;
+        data += 4;
+    }
+    while (data < end)
+    {
+        h ^= (*data) * HASH_PRIME5;
+        h = HASH_ROTL(h, 11) * HASH_PRIME1;
+        data++;
+    }
+    return hash_avalanche(h);
+}
+
+#if defined(XRDP_HASH_SSE42)
+/*****************************************************************************/
+/* two interleaved hardware crc32c streams, one for each 32 bit half of the
+   result, so the crc instruction latency is hidden */
+static tui64 __attribute__((target("sse4.2")))
+xrdp_bitmap_hash_sse42(const tui8 *data, int bytes, tui64 seed)
+{
+    tui64 crc_lo;
+    tui64 crc_hi;
+
+    crc_lo = seed & 0xffffffff;
+    crc_hi = seed >> 32;
+    while (bytes >= 16)
+    {
+        crc_lo = _mm_crc32_u64(crc_lo, hash_read64(data));
+        crc_hi = _mm_crc32_u64(crc_hi, hash_read64(data + 8));
+        data += 16;
+        bytes -= 16;
+    }
+    if (bytes >= 8)
+    {
+        crc_lo = _mm_crc32_u64(crc_lo, hash_read64(data));
+        data += 8;
+        bytes -= 8;
+    }
+    if (bytes >= 4)
+    {
+        crc_hi = _mm_crc32_u32((tui32) crc_hi, hash_read32(data));
+        data += 4;
+        bytes -= 4;
+    }
+    while (bytes > 0)
+    {
+        crc_lo = _mm_crc32_u8((tui32) crc_lo, *data);
+        data++;
+        bytes--;
+    }
+    return (crc_hi << 32) | crc_lo;
+}
+#endif
+
+static xrdp_hash_proc g_hash_proc = xrdp_bitmap_hash_generic;
+
+/*****************************************************************************/
+/* pick the bitmap hash for this cpu, cpu_opt is from libxrdp_detect_cpu */
+int APP_CC
+xrdp_bitmap_hash_init(int cpu_opt)
 {
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
-
-#define CRC_START(in_crc) (in_crc) = 0xFFFFFFFF
-#define CRC_PASS(in_pixel, in_crc) \
-    (in_crc) = g_crc_table[((in_crc) ^ (in_pixel)) & 0xff] ^ ((in_crc) >> 8)
-#define CRC_END(in_crc) (in_crc) = ((in_crc) ^ 0xFFFFFFFF)
+    g_hash_proc = xrdp_bitmap_hash_generic;
+#if defined(XRDP_HASH_SSE42)
+    if (cpu_opt & XRDP_CPU_SSE42)
+    {
+        g_hash_proc = xrdp_bitmap_hash_sse42;
+        log_message(LOG_LEVEL_INFO, "bitmap hash: using sse4.2 crc32c");
+        return 0;
+    }
+#endif
+    log_message(LOG_LEVEL_INFO, "bitmap hash: using generic");
+    return 0;
+}
+
+/*****************************************************************************/
+/* hash a plain buffer with the same proc the bitmap cache uses, chain
+   buffers by passing the previous return as seed */
+tui64 APP_CC
+xrdp_bitmap_hash_data(const char *data, int bytes, tui64 seed)
+{
+    return hash_avalanche(g_hash_proc((const tui8 *) data, bytes, seed));
+}
+
+/*****************************************************************************/
+static tui64
+hash_start(int width, int height, int bpp)
+{
+    tui64 seed;
+
+    seed = (tui64) (width & 0xffff);
+    seed |= ((tui64) (height & 0xffff)) << 16;
+    seed |= ((tui64) (bpp & 0xff)) << 32;
+    return seed * HASH_PRIME1;
+}
+
+/*****************************************************************************/
+static void
+hash_end(struct xrdp_bitmap *self, tui64 hash)
+{
+    self->hash = hash_avalanche(hash);
+}
+
+/*****************************************************************************/
+/* hash one row of cx pixels, for 24 bpp the unused top byte is skipped */
+static tui64
+hash_row(const tui8 *row, int cx, int bpp, tui64 hash)
+{
+    tui32 pixels[64];
+    const tui32 *s32;
+    int count;
+    int index;
+
+    if (bpp == 24)
+    {
+        s32 = (const tui32 *) row;
+        while (cx > 0)
+        {
+            count = MIN(cx, 64);
+            for (index = 0; index < count; index++)
+            {
+                pixels[index] = s32[index] & 0xffffff;
+            }
+            hash = g_hash_proc((tui8 *) pixels, count * 4, hash);
+            s32 += count;
+            cx -= count;
+        }
+        return hash;
+    }
+    if (bpp == 32)
+    {
+        return g_hash_proc(row, cx * 4, hash);
+    }
+    if (bpp == 15 || bpp == 16)
+    {
+        return g_hash_proc(row, cx * 2, hash);
+    }
+    return g_hash_proc(row, cx, hash);
+}
 
 /*****************************************************************************/
 struct xrdp_bitmap *APP_CC
@@ -890,44 +1095,35 @@ xrdp_bitmap_copy_box(struct xrdp_bitmap *self,
 int APP_CC
 xrdp_bitmap_hash_crc(struct xrdp_bitmap *self)
 {
-    void *hash;
     int bytes;
-    int crc;
     int index;
-    char hash_data[16];
+    tui64 hash;
+    tui8 *row;
 
     if (self->bpp >= 24)
     {
-        bytes = self->width * self->height * 4;
+        bytes = self->width * 4;
     }
     else if (self->bpp == 15 || self->bpp == 16)
     {
-        bytes = self->width * self->height * 2;
+        bytes = self->width * 2;
     }
     else if (self->bpp == 8)
     {
-        bytes = self->width * self->height;
+        bytes = self->width;
     }
     else
     {
         return 1;
     }
-    hash = ssl_md5_info_create();
-    ssl_md5_transform(hash, self->data, bytes);
-    ssl_md5_complete(hash, hash_data);
-    ssl_md5_info_delete(hash);
-    CRC_START(crc);
-    CRC_PASS(self->width, crc);
-    CRC_PASS(self->width >> 8, crc);
-    CRC_PASS(self->height, crc);
-    CRC_PASS(self->height >> 8, crc);
-    for (index = 0; index < 16; index++)
-    {
-        CRC_PASS(hash_data[index], crc);
-    }
-    CRC_END(crc);
-    self->crc32 = crc;
-    self->crc16 = self->crc32 & 0xffff;
+    hash = hash_start(self->width, self->height, self->bpp);
+    row = (tui8 *) (self->data);
+    for (index = 0; index < self->height; index++)
+    {
+        hash = hash_row(row, self->width, self->bpp, hash);
+        row += bytes;
+    }
+    hash_end(self, hash);
     return 0;
 }
 
@@ -940,19 +1136,15 @@ xrdp_bitmap_copy_box_with_crc(struct xrdp_bitmap *self,
                               int x, int y, int cx, int cy)
 {
     int i;
-    int j;
     int destx;
     int desty;
-    int pixel;
-    int crc;
+    int Bpp;
+    int bytes;
     int incs;
     int incd;
+    tui64 hash;
     tui8 *s8;
     tui8 *d8;
-    tui16 *s16;
-    tui16 *d16;
-    tui32 *s32;
-    tui32 *d32;
 
     if (self == 0)
     {
@@ -992,203 +1184,43 @@ xrdp_bitmap_copy_box_with_crc(struct xrdp_bitmap *self,
         return 1;
     }
 
-    CRC_START(crc);
-
-    CRC_PASS(self->width, crc);
-    CRC_PASS(self->width >> 8, crc);
-
-    CRC_PASS(self->height, crc);
-    CRC_PASS(self->height >> 8, crc);
-
-    if (self->bpp == 32)
+    if (self->bpp == 24 || self->bpp == 32)
     {
-        s32 = ((tui32 *)(self->data)) + (self->width * y + x);
-        d32 = ((tui32 *)(dest->data)) + (dest->width * desty + destx);
-        incs = self->width - cx;
-        incd = dest->width - cx;
-
-        for (i = 0; i < cy; i++)
-        {
-            j = 0;
-
-            while (j < cx - 4)
-            {
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                CRC_PASS(pixel >> 24, crc);
-                s32++;
-                d32++;
-
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                CRC_PASS(pixel >> 24, crc);
-                s32++;
-                d32++;
-
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                CRC_PASS(pixel >> 24, crc);
-                s32++;
-                d32++;
-
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                CRC_PASS(pixel >> 24, crc);
-                s32++;
-                d32++;
-
-                j += 4;
-            }
-            while (j < cx)
-            {
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                CRC_PASS(pixel >> 24, crc);
-                s32++;
-                d32++;
-
-                j += 1;
-            }
-
-            s32 += incs;
-            d32 += incd;
-        }
-    }
-    else if (self->bpp == 24)
-    {
-        s32 = ((tui32 *)(self->data)) + (self->width * y + x);
-        d32 = ((tui32 *)(dest->data)) + (dest->width * desty + destx);
-        incs = self->width - cx;
-        incd = dest->width - cx;
-
-        for (i = 0; i < cy; i++)
-        {
-            j = 0;
-
-            while (j < cx - 4)
-            {
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                s32++;
-                d32++;
-
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                s32++;
-                d32++;
-
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                s32++;
-                d32++;
-
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                s32++;
-                d32++;
-
-                j += 4;
-            }
-            while (j < cx)
-            {
-                pixel = *s32;
-                *d32 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                CRC_PASS(pixel >> 16, crc);
-                s32++;
-                d32++;
-
-                j += 1;
-            }
-
-            s32 += incs;
-            d32 += incd;
-        }
+        Bpp = 4;
     }
     else if (self->bpp == 15 || self->bpp == 16)
     {
-        s16 = ((tui16 *)(self->data)) + (self->width * y + x);
-        d16 = ((tui16 *)(dest->data)) + (dest->width * desty + destx);
-        incs = self->width - cx;
-        incd = dest->width - cx;
-
-        for (i = 0; i < cy; i++)
-        {
-            for (j = 0; j < cx; j++)
-            {
-                pixel = *s16;
-                *d16 = pixel;
-                CRC_PASS(pixel, crc);
-                CRC_PASS(pixel >> 8, crc);
-                s16++;
-                d16++;
-            }
-
-            s16 += incs;
-            d16 += incd;
-        }
+        Bpp = 2;
     }
     else if (self->bpp == 8)
     {
-        s8 = ((tui8 *)(self->data)) + (self->width * y + x);
-        d8 = ((tui8 *)(dest->data)) + (dest->width * desty + destx);
-        incs = self->width - cx;
-        incd = dest->width - cx;
-
-        for (i = 0; i < cy; i++)
-        {
-            for (j = 0; j < cx; j++)
-            {
-                pixel = *s8;
-                *d8 = pixel;
-                CRC_PASS(pixel, crc);
-                s8++;
-                d8++;
-            }
-
-            s8 += incs;
-            d8 += incd;
-        }
+        Bpp = 1;
     }
     else
     {
         return 1;
     }
 
-    CRC_END(crc);
-    dest->crc32 = crc;
-    dest->crc16 = dest->crc32 & 0xffff;
+    /* copy a row then hash it while it is still in cache */
+    hash = hash_start(cx, cy, self->bpp);
+    s8 = ((tui8 *)(self->data)) + (self->width * y + x) * Bpp;
+    d8 = ((tui8 *)(dest->data)) + (dest->width * desty + destx) * Bpp;
+    incs = self->width * Bpp;
+    incd = dest->width * Bpp;
+    bytes = cx * Bpp;
+
+    for (i = 0; i < cy; i++)
+    {
+        g_memcpy(d8, s8, bytes);
+        hash = hash_row(d8, cx, self->bpp, hash);
+        s8 += incs;
+        d8 += incd;
+    }
+
+    hash_end(dest, hash);
 
-    LLOGLN(10, ("xrdp_bitmap_copy_box_with_crc: crc16 0x%4.4x",
-           dest->crc16));
+    LLOGLN(10, ("xrdp_bitmap_copy_box_with_crc: hash 0x%16.16llx",
+           (unsigned long long) (dest->hash)));
     LLOGLN(10, ("xrdp_bitmap_copy_box_with_crc: width %d height %d",
            dest->width, dest->height));
 
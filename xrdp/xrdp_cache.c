@@ -34,6 +34,9 @@
   } \
   while (0)
 
+static int APP_CC
+xrdp_cache_load_persist_keys(struct xrdp_cache *self);
+
 /*****************************************************************************/
 static int APP_CC
 xrdp_cache_reset_lru(struct xrdp_cache *self)
@@ -70,23 +73,309 @@ xrdp_cache_reset_lru(struct xrdp_cache *self)
 
 /*****************************************************************************/
 static int APP_CC
-xrdp_cache_reset_crc(struct xrdp_cache *self)
+xrdp_cache_entries(struct xrdp_cache *self, int cache_id)
+{
+    if (cache_id == 0)
+    {
+        return self->cache1_entries;
+    }
+    if (cache_id == 1)
+    {
+        return self->cache2_entries;
+    }
+    return self->cache3_entries;
+}
+
+/*****************************************************************************/
+/* the index is sized to the client's cache so it stays at most half full,
+   if the size is unchanged the slots are already empty, every live entry
+   was removed as it was freed */
+static int APP_CC
+xrdp_cache_reset_index(struct xrdp_cache *self)
+{
+    int cache_id;
+    int index;
+    int size;
+
+    for (cache_id = 0; cache_id < XRDP_MAX_BITMAP_CACHE_ID; cache_id++)
+    {
+        size = 16;
+        while (size < xrdp_cache_entries(self, cache_id) * 2)
+        {
+            size = size * 2;
+        }
+        if ((self->index_slots[cache_id] != 0) &&
+            (self->index_mask[cache_id] == size - 1))
+        {
+            continue;
+        }
+        g_free(self->index_slots[cache_id]);
+        self->index_slots[cache_id] = (struct xrdp_cache_slot *)
+            g_malloc(sizeof(struct xrdp_cache_slot) * size, 0);
+        self->index_mask[cache_id] = size - 1;
+        for (index = 0; index < size; index++)
+        {
+            self->index_slots[cache_id][index].cache_idx = -1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* the glyph caches follow the client's glyph cache capability, clients
+   that do not send it get the old 7 to 11 x 250 layout */
+static int APP_CC
+xrdp_cache_reset_chars(struct xrdp_cache *self,
+                       struct xrdp_client_info *client_info)
+{
+    int index;
+    int have_caps;
+
+    have_caps = 0;
+    for (index = 0; index < 12; index++)
+    {
+        self->char_entries[index] = 0;
+        self->char_cell_size[index] = 0;
+        self->char_used[index] = 0;
+        self->char_lru_head[index] = -1;
+        self->char_lru_tail[index] = -1;
+    }
+    for (index = 0; index < 10; index++)
+    {
+        if ((client_info->glyph_cache_entries[index] > 0) &&
+            (client_info->glyph_cache_cell_size[index] > 0))
+        {
+            self->char_entries[index] =
+                MIN(client_info->glyph_cache_entries[index], 256);
+            self->char_cell_size[index] =
+                client_info->glyph_cache_cell_size[index];
+            have_caps = 1;
+        }
+    }
+    if (!have_caps)
+    {
+        for (index = 7; index < 12; index++)
+        {
+            self->char_entries[index] = 250;
+        }
+    }
+    for (index = 0; index < XRDP_CHAR_HASH_SIZE; index++)
+    {
+        self->char_hash[index] = -1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int APP_CC
+xrdp_cache_index_add(struct xrdp_cache *self, int cache_id, tui64 key,
+                     int cache_idx)
 {
+    struct xrdp_cache_slot *slots;
+    int mask;
+    int index;
+
+    slots = self->index_slots[cache_id];
+    mask = self->index_mask[cache_id];
+    index = (int) (key & mask);
+    while (slots[index].cache_idx != -1)
+    {
+        index = (index + 1) & mask;
+    }
+    slots[index].key = key;
+    slots[index].cache_idx = cache_idx;
+    return 0;
+}
+
+/*****************************************************************************/
+/* linear probing with backward shift delete, no tombstones */
+static int APP_CC
+xrdp_cache_index_remove(struct xrdp_cache *self, int cache_id, tui64 key,
+                        int cache_idx)
+{
+    struct xrdp_cache_slot *slots;
+    int mask;
     int index;
     int jndex;
+    int home;
 
-    for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
+    slots = self->index_slots[cache_id];
+    mask = self->index_mask[cache_id];
+    index = (int) (key & mask);
+    while ((slots[index].cache_idx != cache_idx) ||
+           (slots[index].key != key))
+    {
+        if (slots[index].cache_idx == -1)
+        {
+            LLOGLN(0, ("xrdp_cache_index_remove: error cache_idx %d not found",
+                   cache_idx));
+            return 1;
+        }
+        index = (index + 1) & mask;
+    }
+    jndex = index;
+    while (1)
     {
-        for (jndex = 0; jndex < 64 * 1024; jndex++)
+        jndex = (jndex + 1) & mask;
+        if (slots[jndex].cache_idx == -1)
         {
-            /* it's ok to deinit a zeroed out struct list16 */
-            list16_deinit(&(self->crc16[index][jndex]));
-            list16_init(&(self->crc16[index][jndex]));
+            break;
+        }
+        home = (int) (slots[jndex].key & mask);
+        /* leave it if its home is cyclically in (index, jndex] */
+        if (index <= jndex)
+        {
+            if ((index < home) && (home <= jndex))
+            {
+                continue;
+            }
         }
+        else if ((index < home) || (home <= jndex))
+        {
+            continue;
+        }
+        slots[index] = slots[jndex];
+        index = jndex;
     }
+    slots[index].cache_idx = -1;
     return 0;
 }
 
+/*****************************************************************************/
+/* remove a bitmap_items entry from the index and free it */
+static int APP_CC
+xrdp_cache_free_item(struct xrdp_cache *self, int cache_id, int cache_idx)
+{
+    struct xrdp_bitmap_item *item;
+
+    item = &(self->bitmap_items[cache_id][cache_idx]);
+    if (item->bitmap != 0)
+    {
+        xrdp_cache_index_remove(self, cache_id, item->bitmap->hash, cache_idx);
+        xrdp_bitmap_delete(item->bitmap);
+        item->bitmap = 0;
+    }
+    else if (item->persist)
+    {
+        xrdp_cache_index_remove(self, cache_id, item->persist_key, cache_idx);
+    }
+    item->persist = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+/* empty the hash chains and put entries first..first + count - 1 on the
+   lru list, oldest first */
+static void APP_CC
+xrdp_cache_small_reset(struct xrdp_small_index *index, int first, int count)
+{
+    int i;
+
+    g_memset(index, 0, sizeof(struct xrdp_small_index));
+    for (i = 0; i < XRDP_SMALL_CACHE_ENTRIES; i++)
+    {
+        index->hash_head[i] = -1;
+        index->hash_next[i] = -1;
+        index->lru_next[i] = -1;
+        index->lru_prev[i] = -1;
+    }
+    index->lru_head = -1;
+    index->lru_tail = -1;
+    count = MIN(count, XRDP_SMALL_CACHE_ENTRIES - first);
+    for (i = first; i < first + count; i++)
+    {
+        index->lru_prev[i] = index->lru_tail;
+        if (index->lru_tail >= 0)
+        {
+            index->lru_next[index->lru_tail] = i;
+        }
+        else
+        {
+            index->lru_head = i;
+        }
+        index->lru_tail = i;
+    }
+}
+
+/*****************************************************************************/
+/* move entry to the most recently used end */
+static void APP_CC
+xrdp_cache_small_touch(struct xrdp_small_index *index, int i)
+{
+    int prev;
+    int next;
+
+    if (index->lru_tail == i)
+    {
+        return;
+    }
+    prev = index->lru_prev[i];
+    next = index->lru_next[i];
+    if (prev >= 0)
+    {
+        index->lru_next[prev] = next;
+    }
+    else
+    {
+        index->lru_head = next;
+    }
+    if (next >= 0)
+    {
+        index->lru_prev[next] = prev;
+    }
+    else
+    {
+        index->lru_tail = prev;
+    }
+    index->lru_prev[i] = index->lru_tail;
+    index->lru_next[i] = -1;
+    if (index->lru_tail >= 0)
+    {
+        index->lru_next[index->lru_tail] = i;
+    }
+    else
+    {
+        index->lru_head = i;
+    }
+    index->lru_tail = i;
+}
+
+/*****************************************************************************/
+/* rehash entry i and mark it most recently used */
+static void APP_CC
+xrdp_cache_small_set(struct xrdp_small_index *index, int i, tui64 hash)
+{
+    int *pi;
+
+    /* unlink from the old chain if it is on one */
+    pi = index->hash_head + (index->hash[i] & (XRDP_SMALL_CACHE_ENTRIES - 1));
+    while (*pi >= 0)
+    {
+        if (*pi == i)
+        {
+            *pi = index->hash_next[i];
+            break;
+        }
+        pi = index->hash_next + *pi;
+    }
+    index->hash[i] = hash;
+    pi = index->hash_head + (hash & (XRDP_SMALL_CACHE_ENTRIES - 1));
+    index->hash_next[i] = *pi;
+    *pi = i;
+    xrdp_cache_small_touch(index, i);
+}
+
+/*****************************************************************************/
+/* reset the pointer and brush indexes, pointers 0 and 1 are the static
+   ones and never evicted */
+static void APP_CC
+xrdp_cache_reset_small(struct xrdp_cache *self)
+{
+    xrdp_cache_small_reset(&(self->pointer_index), 2,
+                           MIN(self->pointer_cache_entries, 32) - 2);
+    xrdp_cache_small_reset(&(self->brush_index), 0, 64);
+}
+
 /*****************************************************************************/
 struct xrdp_cache *APP_CC
 xrdp_cache_create(struct xrdp_wm *owner,
@@ -120,7 +409,10 @@ xrdp_cache_create(struct xrdp_wm *owner,
     self->pointer_cache_entries = client_info->pointer_cache_entries;
     self->xrdp_os_del_list = list_create();
     xrdp_cache_reset_lru(self);
-    xrdp_cache_reset_crc(self);
+    xrdp_cache_reset_index(self);
+    xrdp_cache_reset_chars(self, client_info);
+    xrdp_cache_reset_small(self);
+    xrdp_cache_load_persist_keys(self);
     LLOGLN(10, ("xrdp_cache_create: 0 %d 1 %d 2 %d",
                 self->cache1_entries, self->cache2_entries, self->cache3_entries));
     return self;
@@ -156,6 +448,13 @@ xrdp_cache_delete(struct xrdp_cache *self)
         }
     }
 
+    /* free all the cached pointers */
+    for (i = 0; i < 32; i++)
+    {
+        g_free(self->pointer_items[i].data);
+        g_free(self->pointer_items[i].mask);
+    }
+
     /* free all the off screen bitmaps */
     for (i = 0; i < 2000; i++)
     {
@@ -164,13 +463,10 @@ xrdp_cache_delete(struct xrdp_cache *self)
 
     list_delete(self->xrdp_os_del_list);
 
-    /* free all crc lists */
+    /* free the bitmap indexes */
     for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++)
     {
-        for (j = 0; j < 64 * 1024; j++)
-        {
-            list16_deinit(&(self->crc16[i][j]));
-        }
+        g_free(self->index_slots[i]);
     }
 
     g_free(self);
@@ -183,15 +479,17 @@ xrdp_cache_reset(struct xrdp_cache *self,
 {
     struct xrdp_wm *wm;
     struct xrdp_session *session;
+    struct xrdp_cache_slot *index_slots[XRDP_MAX_BITMAP_CACHE_ID];
+    int index_mask[XRDP_MAX_BITMAP_CACHE_ID];
     int i;
     int j;
 
-    /* free all the cached bitmaps */
+    /* free all the cached bitmaps, this empties the indexes too */
     for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++)
     {
         for (j = 0; j < XRDP_MAX_BITMAP_CACHE_IDX; j++)
         {
-            xrdp_bitmap_delete(self->bitmap_items[i][j].bitmap);
+            xrdp_cache_free_item(self, i, j);
         }
     }
 
@@ -204,14 +502,25 @@ xrdp_cache_reset(struct xrdp_cache *self,
         }
     }
 
+    /* free all the cached pointers */
+    for (i = 0; i < 32; i++)
+    {
+        g_free(self->pointer_items[i].data);
+        g_free(self->pointer_items[i].mask);
+    }
+
     /* save these */
     wm = self->wm;
     session = self->session;
+    g_memcpy(index_slots, self->index_slots, sizeof(index_slots));
+    g_memcpy(index_mask, self->index_mask, sizeof(index_mask));
     /* set whole struct to zero */
     g_memset(self, 0, sizeof(struct xrdp_cache));
     /* set some stuff back */
     self->wm = wm;
     self->session = session;
+    g_memcpy(self->index_slots, index_slots, sizeof(index_slots));
+    g_memcpy(self->index_mask, index_mask, sizeof(index_mask));
     self->use_bitmap_comp = client_info->use_bitmap_comp;
     self->cache1_entries = client_info->cache1_entries;
     self->cache1_size = client_info->cache1_size;
@@ -223,15 +532,27 @@ xrdp_cache_reset(struct xrdp_cache *self,
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
     xrdp_cache_reset_lru(self);
-    xrdp_cache_reset_crc(self);
+    xrdp_cache_reset_index(self);
+    xrdp_cache_reset_chars(self, client_info);
+    xrdp_cache_reset_small(self);
+    /* the key list only comes once per connection, libxrdp keeps it so the
+       client's persistent cache is used again after a reactivation */
+    xrdp_cache_load_persist_keys(self);
     return 0;
 }
 
-#define COMPARE_WITH_CRC32(_b1, _b2) \
- ((_b1 != 0) && (_b2 != 0) && (_b1->crc32 == _b2->crc32) && \
+#define COMPARE_WITH_HASH(_b1, _b2) \
+ ((_b1 != 0) && (_b2 != 0) && (_b1->hash == _b2->hash) && \
   (_b1->bpp == _b2->bpp) && \
   (_b1->width == _b2->width) && (_b1->height == _b2->height))
 
+/* persistent entries only have the key, it is the hash of the bitmap the
+   client stored, which covers width, height and bpp too */
+#define COMPARE_ITEM_WITH_HASH(_item, _b) \
+ (((_item)->persist && ((_item)->bitmap == 0)) ? \
+  ((_item)->persist_key == (_b)->hash) : \
+  COMPARE_WITH_HASH((_item)->bitmap, _b))
+
 /*****************************************************************************/
 static int APP_CC
 xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index)
@@ -302,6 +623,75 @@ xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index)
     return 0;
 }
 
+/*****************************************************************************/
+/* trim the lru list to the number of entries the client has */
+static int APP_CC
+xrdp_cache_check_lru_reset(struct xrdp_cache *self, int cache_id,
+                           int cache_entries)
+{
+    int index;
+    struct xrdp_lru_item *llru;
+
+    if (self->lru_reset[cache_id])
+    {
+        self->lru_reset[cache_id] = 0;
+        LLOGLN(0, ("xrdp_cache_check_lru_reset: reset detected cache_id %d",
+               cache_id));
+        self->lru_tail[cache_id] = cache_entries - 1;
+        index = self->lru_tail[cache_id];
+        llru = &(self->bitmap_lrus[cache_id][index]);
+        llru->next = -1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* seed the cache with the keys from the client's persistent key list so
+   tiles it already has on disk are drawn without sending them again */
+static int APP_CC
+xrdp_cache_load_persist_keys(struct xrdp_cache *self)
+{
+    int cache_id;
+    int cache_idx;
+    int cache_entries;
+    int count;
+    tui64 *keys;
+    struct xrdp_bitmap_item *item;
+
+    if ((self->bitmap_cache_version & 2) == 0)
+    {
+        return 0;
+    }
+    for (cache_id = 0; cache_id < XRDP_MAX_BITMAP_CACHE_ID; cache_id++)
+    {
+        if (libxrdp_get_persist_keys(self->session, cache_id,
+                                     &keys, &count) != 0)
+        {
+            continue;
+        }
+        cache_entries = xrdp_cache_entries(self, cache_id);
+        count = MIN(count, cache_entries);
+        if (count < 1)
+        {
+            continue;
+        }
+        xrdp_cache_check_lru_reset(self, cache_id, cache_entries);
+        for (cache_idx = 0; cache_idx < count; cache_idx++)
+        {
+            item = &(self->bitmap_items[cache_id][cache_idx]);
+            item->persist = 1;
+            item->persist_key = keys[cache_idx];
+            item->lru_index = cache_idx;
+            xrdp_cache_index_add(self, cache_id, keys[cache_idx], cache_idx);
+            /* keep them out of the way of new bitmaps */
+            xrdp_cache_update_lru(self, cache_id, cache_idx);
+        }
+        LLOGLN(0, ("xrdp_cache_load_persist_keys: cache_id %d keys %d",
+               cache_id, count));
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns cache id */
 int APP_CC
@@ -309,24 +699,20 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
                       int hints)
 {
     int index;
-    int jndex;
+    int mask;
     int cache_id;
     int cache_idx;
     int bmp_size;
     int e;
     int Bpp;
-    int crc16;
-    int iig;
     int found;
     int cache_entries;
     int lru_index;
-    struct list16 *ll;
-    struct xrdp_bitmap *lbm;
-    struct xrdp_lru_item *llru;
+    struct xrdp_cache_slot *slots;
 
     LLOGLN(10, ("xrdp_cache_add_bitmap:"));
-    LLOGLN(10, ("xrdp_cache_add_bitmap: crc16 0x%4.4x",
-           bitmap->crc16));
+    LLOGLN(10, ("xrdp_cache_add_bitmap: hash 0x%16.16llx",
+           (unsigned long long) (bitmap->hash)));
 
     e = (4 - (bitmap->width % 4)) & 3;
     found = 0;
@@ -360,24 +746,36 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
         return 0;
     }
 
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    for (jndex = 0; jndex < ll->count; jndex++)
+    slots = self->index_slots[cache_id];
+    mask = self->index_mask[cache_id];
+    index = (int) (bitmap->hash & mask);
+    cache_idx = slots[index].cache_idx;
+    while (cache_idx != -1)
     {
-        cache_idx = list16_get_item(ll, jndex);
-        if (COMPARE_WITH_CRC32
-                 (self->bitmap_items[cache_id][cache_idx].bitmap, bitmap))
+        if ((slots[index].key == bitmap->hash) &&
+            COMPARE_ITEM_WITH_HASH
+                 (&(self->bitmap_items[cache_id][cache_idx]), bitmap))
         {
-            LLOGLN(10, ("found bitmap at %d %d", index, jndex));
+            LLOGLN(10, ("found bitmap at %d %d", cache_id, cache_idx));
             found = 1;
             break;
         }
+        index = (index + 1) & mask;
+        cache_idx = slots[index].cache_idx;
     }
     if (found)
     {
         lru_index = self->bitmap_items[cache_id][cache_idx].lru_index;
         self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
-        xrdp_bitmap_delete(bitmap);
+        if (self->bitmap_items[cache_id][cache_idx].bitmap == 0)
+        {
+            /* first hit on a persistent entry, the client already has it */
+            self->bitmap_items[cache_id][cache_idx].bitmap = bitmap;
+        }
+        else
+        {
+            xrdp_bitmap_delete(bitmap);
+        }
 
         /* update lru to end */
         xrdp_cache_update_lru(self, cache_id, lru_index);
@@ -387,17 +785,7 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
 
     /* find lru */
 
-    /* check for reset */
-    if (self->lru_reset[cache_id])
-    {
-        self->lru_reset[cache_id] = 0;
-        LLOGLN(0, ("xrdp_cache_add_bitmap: reset detected cache_id %d",
-               cache_id));
-        self->lru_tail[cache_id] = cache_entries - 1;
-        index = self->lru_tail[cache_id];
-        llru = &(self->bitmap_lrus[cache_id][index]);
-        llru->next = -1;
-    }
+    xrdp_cache_check_lru_reset(self, cache_id, cache_entries);
 
     /* lru is item at head */
     lru_index = self->lru_head[cache_id];
@@ -413,22 +801,8 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
            self->bitmap_items[cache_id][cache_idx].bitmap,
            bitmap));
 
-    /* remove old, about to be deleted, from crc16 list */
-    lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
-    if (lbm != 0)
-    {
-        crc16 = lbm->crc16;
-        ll = &(self->crc16[cache_id][crc16]);
-        iig = list16_index_of(ll, cache_idx);
-        if (iig == -1)
-        {
-            LLOGLN(0, ("xrdp_cache_add_bitmap: error removing cache_idx"));
-        }
-        LLOGLN(10, ("xrdp_cache_add_bitmap: removing index %d from crc16 %d",
-               iig, crc16));
-        list16_remove_item(ll, iig);
-        xrdp_bitmap_delete(lbm);
-    }
+    /* remove old, about to be deleted, from the index */
+    xrdp_cache_free_item(self, cache_id, cache_idx);
 
     /* set, send bitmap and return */
 
@@ -436,14 +810,8 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
     self->bitmap_items[cache_id][cache_idx].lru_index = lru_index;
 
-    /* add to crc16 list */
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    list16_add_item(ll, cache_idx);
-    if (ll->count > 1)
-    {
-        LLOGLN(10, ("xrdp_cache_add_bitmap: count %d", ll->count));
-    }
+    /* add to the index */
+    xrdp_cache_index_add(self, cache_id, bitmap->hash, cache_idx);
 
     if (self->use_bitmap_comp)
     {
@@ -463,7 +831,8 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
             libxrdp_orders_send_bitmap2(self->session, bitmap->width,
                                         bitmap->height, bitmap->bpp,
                                         bitmap->data, cache_id, cache_idx,
-                                        hints);
+                                        hints, (int) (bitmap->hash),
+                                        (int) (bitmap->hash >> 32));
         }
         else if (self->bitmap_cache_version & 1)
         {
@@ -478,7 +847,9 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
         {
             libxrdp_orders_send_raw_bitmap2(self->session, bitmap->width,
                                             bitmap->height, bitmap->bpp,
-                                            bitmap->data, cache_id, cache_idx);
+                                            bitmap->data, cache_id, cache_idx,
+                                            (int) (bitmap->hash),
+                                            (int) (bitmap->hash >> 32));
         }
         else if (self->bitmap_cache_version & 1)
         {
@@ -549,69 +920,257 @@ xrdp_cache_add_palette(struct xrdp_cache *self, int *palette)
     return index;
 }
 
+/*****************************************************************************/
+static tui32 APP_CC
+xrdp_cache_char_hash(struct xrdp_font_char *font_item)
+{
+    tui32 hash;
+    int index;
+    int datasize;
+    tui8 *data;
+
+    hash = 2166136261U;
+    hash = (hash ^ (tui32)(font_item->offset)) * 16777619U;
+    hash = (hash ^ (tui32)(font_item->baseline)) * 16777619U;
+    hash = (hash ^ (tui32)(font_item->width)) * 16777619U;
+    hash = (hash ^ (tui32)(font_item->height)) * 16777619U;
+    datasize = FONT_DATASIZE(font_item);
+    data = (tui8 *)(font_item->data);
+    for (index = 0; index < datasize; index++)
+    {
+        hash = (hash ^ data[index]) * 16777619U;
+    }
+    return hash;
+}
+
+/*****************************************************************************/
+/* unhook a char from its font cache lru list */
+static void APP_CC
+xrdp_cache_char_lru_remove(struct xrdp_cache *self, int f, int c)
+{
+    struct xrdp_char_item *ci;
+
+    ci = &(self->char_items[f][c]);
+    if (ci->lru_prev == -1)
+    {
+        self->char_lru_head[f] = ci->lru_next;
+    }
+    else
+    {
+        self->char_items[f][ci->lru_prev].lru_next = ci->lru_next;
+    }
+    if (ci->lru_next == -1)
+    {
+        self->char_lru_tail[f] = ci->lru_prev;
+    }
+    else
+    {
+        self->char_items[f][ci->lru_next].lru_prev = ci->lru_prev;
+    }
+}
+
+/*****************************************************************************/
+/* make a char the most recently used of its font cache */
+static void APP_CC
+xrdp_cache_char_lru_add(struct xrdp_cache *self, int f, int c)
+{
+    struct xrdp_char_item *ci;
+
+    ci = &(self->char_items[f][c]);
+    ci->lru_next = -1;
+    ci->lru_prev = self->char_lru_tail[f];
+    if (ci->lru_prev == -1)
+    {
+        self->char_lru_head[f] = c;
+    }
+    else
+    {
+        self->char_items[f][ci->lru_prev].lru_next = c;
+    }
+    self->char_lru_tail[f] = c;
+}
+
+/*****************************************************************************/
+static void APP_CC
+xrdp_cache_char_hash_remove(struct xrdp_cache *self, int f, int c)
+{
+    struct xrdp_char_item *ci;
+    int *link;
+
+    ci = &(self->char_items[f][c]);
+    link = &(self->char_hash[ci->hash & (XRDP_CHAR_HASH_SIZE - 1)]);
+    while (*link != -1)
+    {
+        if (*link == f * 256 + c)
+        {
+            *link = ci->hash_next;
+            return;
+        }
+        link = &(self->char_items[*link >> 8][*link & 0xff].hash_next);
+    }
+}
+
+/*****************************************************************************/
+/* pick the font cache entry for a new glyph, an unused entry if a cache
+   that fits it has one, else the least recently used of those caches
+   returns error if no cache the client has can hold the glyph */
+static int APP_CC
+xrdp_cache_char_slot(struct xrdp_cache *self, int datasize, int *f, int *c)
+{
+    int index;
+    int cache_f;
+    int cache_c;
+    int oldest;
+
+    cache_f = -1;
+    cache_c = -1;
+    oldest = 0x7fffffff;
+    for (index = 0; index < 12; index++)
+    {
+        if ((self->char_entries[index] < 1) ||
+            ((self->char_cell_size[index] != 0) &&
+             (datasize > self->char_cell_size[index])))
+        {
+            continue;
+        }
+        if (self->char_used[index] < self->char_entries[index])
+        {
+            *f = index;
+            *c = self->char_used[index];
+            self->char_used[index]++;
+            return 0;
+        }
+        if (self->char_items[index][self->char_lru_head[index]].stamp < oldest)
+        {
+            cache_f = index;
+            cache_c = self->char_lru_head[index];
+            oldest = self->char_items[index][cache_c].stamp;
+        }
+    }
+    if (cache_f == -1)
+    {
+        return 1;
+    }
+    /* evict */
+    xrdp_cache_char_hash_remove(self, cache_f, cache_c);
+    xrdp_cache_char_lru_remove(self, cache_f, cache_c);
+    *f = cache_f;
+    *c = cache_c;
+    return 0;
+}
+
 /*****************************************************************************/
 int APP_CC
 xrdp_cache_add_char(struct xrdp_cache *self,
                     struct xrdp_font_char *font_item)
 {
-    int i;
-    int j;
-    int oldest;
     int f;
     int c;
+    int packed;
     int datasize;
+    tui32 hash;
+    struct xrdp_char_item *ci;
     struct xrdp_font_char *fi;
 
     self->char_stamp++;
 
     /* look for match */
-    for (i = 7; i < 12; i++)
+    hash = xrdp_cache_char_hash(font_item);
+    packed = self->char_hash[hash & (XRDP_CHAR_HASH_SIZE - 1)];
+    while (packed != -1)
     {
-        for (j = 0; j < 250; j++)
+        f = packed >> 8;
+        c = packed & 0xff;
+        ci = &(self->char_items[f][c]);
+        if ((ci->hash == hash) &&
+            xrdp_font_item_compare(&(ci->font_item), font_item))
         {
-            if (xrdp_font_item_compare(&self->char_items[i][j].font_item, font_item))
-            {
-                self->char_items[i][j].stamp = self->char_stamp;
-                DEBUG(("found font at %d %d", i, j));
-                return MAKELONG(j, i);
-            }
+            ci->stamp = self->char_stamp;
+            xrdp_cache_char_lru_remove(self, f, c);
+            xrdp_cache_char_lru_add(self, f, c);
+            DEBUG(("found font at %d %d", f, c));
+            return MAKELONG(c, f);
         }
+        packed = ci->hash_next;
     }
 
-    /* look for oldest */
-    f = 0;
-    c = 0;
-    oldest = 0x7fffffff;
-
-    for (i = 7; i < 12; i++)
+    datasize = FONT_DATASIZE(font_item);
+    if (xrdp_cache_char_slot(self, datasize, &f, &c) != 0)
     {
-        for (j = 0; j < 250; j++)
-        {
-            if (self->char_items[i][j].stamp < oldest)
-            {
-                oldest = self->char_items[i][j].stamp;
-                f = i;
-                c = j;
-            }
-        }
+        LLOGLN(10, ("xrdp_cache_add_char: no glyph cache for %d bytes",
+               datasize));
+        return -1;
     }
 
     DEBUG(("adding char at %d %d", f, c));
     /* set, send char and return */
-    fi = &self->char_items[f][c].font_item;
+    ci = &(self->char_items[f][c]);
+    fi = &(ci->font_item);
     g_free(fi->data);
-    datasize = FONT_DATASIZE(font_item);
     fi->data = (char *)g_malloc(datasize, 1);
     g_memcpy(fi->data, font_item->data, datasize);
     fi->offset = font_item->offset;
     fi->baseline = font_item->baseline;
     fi->width = font_item->width;
     fi->height = font_item->height;
-    self->char_items[f][c].stamp = self->char_stamp;
+    ci->stamp = self->char_stamp;
+    ci->hash = hash;
+    ci->hash_next = self->char_hash[hash & (XRDP_CHAR_HASH_SIZE - 1)];
+    self->char_hash[hash & (XRDP_CHAR_HASH_SIZE - 1)] = f * 256 + c;
+    xrdp_cache_char_lru_add(self, f, c);
     libxrdp_orders_send_font(self->session, fi, f, c);
     return MAKELONG(c, f);
 }
 
+/*****************************************************************************/
+/* copy pointer_item into the cache entry, growing its buffers as needed */
+static int APP_CC
+xrdp_cache_copy_pointer(struct xrdp_pointer_item *dst,
+                        struct xrdp_pointer_item *src,
+                        int data_bytes, int mask_bytes)
+{
+    if (dst->data_alloc < data_bytes)
+    {
+        g_free(dst->data);
+        dst->data = (char *) g_malloc(data_bytes, 0);
+        dst->data_alloc = dst->data == 0 ? 0 : data_bytes;
+    }
+    if (dst->mask_alloc < mask_bytes)
+    {
+        g_free(dst->mask);
+        dst->mask = (char *) g_malloc(mask_bytes, 0);
+        dst->mask_alloc = dst->mask == 0 ? 0 : mask_bytes;
+    }
+    if ((dst->data == 0) || (dst->mask == 0))
+    {
+        return 1;
+    }
+    g_memcpy(dst->data, src->data, data_bytes);
+    g_memcpy(dst->mask, src->mask, mask_bytes);
+    dst->x = src->x;
+    dst->y = src->y;
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->bpp = src->bpp;
+    return 0;
+}
+
+/*****************************************************************************/
+static void APP_CC
+xrdp_cache_pointer_bytes(struct xrdp_pointer_item *pointer_item,
+                         int *data_bytes, int *mask_bytes)
+{
+    int Bpp;
+
+    Bpp = (pointer_item->bpp + 7) / 8;
+    if (Bpp == 0)
+    {
+        Bpp = 3;
+    }
+    *data_bytes = pointer_item->width * pointer_item->height * Bpp;
+    *mask_bytes = ((pointer_item->width + 15) / 16) * 2 * pointer_item->height;
+}
+
 /*****************************************************************************/
 /* added the pointer to the cache and send it to client, it also sets the
    client if it finds it
@@ -621,66 +1180,69 @@ int APP_CC
 xrdp_cache_add_pointer(struct xrdp_cache *self,
                        struct xrdp_pointer_item *pointer_item)
 {
+    struct xrdp_pointer_item *pi;
+    struct xrdp_small_index *index;
+    tui64 hash;
     int i;
-    int oldest;
-    int index;
+    int data_bytes;
+    int mask_bytes;
 
     if (self == 0)
     {
         return 0;
     }
 
-    self->pointer_stamp++;
+    xrdp_cache_pointer_bytes(pointer_item, &data_bytes, &mask_bytes);
+    hash = pointer_item->width | (pointer_item->height << 16);
+    hash = (hash << 16) | (pointer_item->bpp & 0xff);
+    hash = xrdp_bitmap_hash_data(pointer_item->data, data_bytes, hash);
+    hash = xrdp_bitmap_hash_data(pointer_item->mask, mask_bytes, hash);
+    index = &(self->pointer_index);
 
     /* look for match */
-    for (i = 2; i < self->pointer_cache_entries; i++)
+    i = index->hash_head[hash & (XRDP_SMALL_CACHE_ENTRIES - 1)];
+    while (i >= 0)
     {
-        if (self->pointer_items[i].x == pointer_item->x &&
-                self->pointer_items[i].y == pointer_item->y &&
-                g_memcmp(self->pointer_items[i].data,
-                         pointer_item->data, 32 * 32 * 4) == 0 &&
-                g_memcmp(self->pointer_items[i].mask,
-                         pointer_item->mask, 32 * 32 / 8) == 0 &&
-                self->pointer_items[i].bpp == pointer_item->bpp)
+        pi = self->pointer_items + i;
+        if (index->hash[i] == hash &&
+                pi->x == pointer_item->x &&
+                pi->y == pointer_item->y &&
+                pi->width == pointer_item->width &&
+                pi->height == pointer_item->height &&
+                pi->bpp == pointer_item->bpp &&
+                g_memcmp(pi->data, pointer_item->data, data_bytes) == 0 &&
+                g_memcmp(pi->mask, pointer_item->mask, mask_bytes) == 0)
         {
-            self->pointer_items[i].stamp = self->pointer_stamp;
+            xrdp_cache_small_touch(index, i);
             xrdp_wm_set_pointer(self->wm, i);
             self->wm->current_pointer = i;
             DEBUG(("found pointer at %d", i));
             return i;
         }
+        i = index->hash_next[i];
     }
 
-    /* look for oldest */
-    index = 2;
-    oldest = 0x7fffffff;
-
-    for (i = 2; i < self->pointer_cache_entries; i++)
+    /* take the least recently used */
+    i = index->lru_head;
+    if (i < 0)
     {
-        if (self->pointer_items[i].stamp < oldest)
-        {
-            oldest = self->pointer_items[i].stamp;
-            index = i;
-        }
+        i = 2;
     }
-
-    self->pointer_items[index].x = pointer_item->x;
-    self->pointer_items[index].y = pointer_item->y;
-    g_memcpy(self->pointer_items[index].data,
-             pointer_item->data, 32 * 32 * 4);
-    g_memcpy(self->pointer_items[index].mask,
-             pointer_item->mask, 32 * 32 / 8);
-    self->pointer_items[index].stamp = self->pointer_stamp;
-    self->pointer_items[index].bpp = pointer_item->bpp;
-    xrdp_wm_send_pointer(self->wm, index,
-                         self->pointer_items[index].data,
-                         self->pointer_items[index].mask,
-                         self->pointer_items[index].x,
-                         self->pointer_items[index].y,
-                         self->pointer_items[index].bpp);
-    self->wm->current_pointer = index;
-    DEBUG(("adding pointer at %d", index));
-    return index;
+    pi = self->pointer_items + i;
+    if (xrdp_cache_copy_pointer(pi, pointer_item,
+                                data_bytes, mask_bytes) != 0)
+    {
+        return self->wm->current_pointer;
+    }
+    if (index->lru_head >= 0)
+    {
+        xrdp_cache_small_set(index, i, hash);
+    }
+    xrdp_wm_send_pointer(self->wm, i, pi->data, pi->mask,
+                         pi->x, pi->y, pi->bpp, pi->width, pi->height);
+    self->wm->current_pointer = i;
+    DEBUG(("adding pointer at %d", i));
+    return i;
 }
 
 /*****************************************************************************/
@@ -690,26 +1252,24 @@ xrdp_cache_add_pointer_static(struct xrdp_cache *self,
                               struct xrdp_pointer_item *pointer_item,
                               int index)
 {
+    struct xrdp_pointer_item *pi;
+    int data_bytes;
+    int mask_bytes;
 
     if (self == 0)
     {
         return 0;
     }
 
-    self->pointer_items[index].x = pointer_item->x;
-    self->pointer_items[index].y = pointer_item->y;
-    g_memcpy(self->pointer_items[index].data,
-             pointer_item->data, 32 * 32 * 4);
-    g_memcpy(self->pointer_items[index].mask,
-             pointer_item->mask, 32 * 32 / 8);
-    self->pointer_items[index].stamp = self->pointer_stamp;
-    self->pointer_items[index].bpp = pointer_item->bpp;
-    xrdp_wm_send_pointer(self->wm, index,
-                         self->pointer_items[index].data,
-                         self->pointer_items[index].mask,
-                         self->pointer_items[index].x,
-                         self->pointer_items[index].y,
-                         self->pointer_items[index].bpp);
+    pi = self->pointer_items + index;
+    xrdp_cache_pointer_bytes(pointer_item, &data_bytes, &mask_bytes);
+    if (xrdp_cache_copy_pointer(pi, pointer_item,
+                                data_bytes, mask_bytes) != 0)
+    {
+        return index;
+    }
+    xrdp_wm_send_pointer(self->wm, index, pi->data, pi->mask,
+                         pi->x, pi->y, pi->bpp, pi->width, pi->height);
     self->wm->current_pointer = index;
     DEBUG(("adding pointer at %d", index));
     return index;
@@ -721,49 +1281,41 @@ int APP_CC
 xrdp_cache_add_brush(struct xrdp_cache *self,
                      char *brush_item_data)
 {
+    struct xrdp_small_index *index;
+    tui64 hash;
     int i;
-    int oldest;
-    int index;
 
     if (self == 0)
     {
         return 0;
     }
 
-    self->brush_stamp++;
+    hash = xrdp_bitmap_hash_data(brush_item_data, 8, 8);
+    index = &(self->brush_index);
 
     /* look for match */
-    for (i = 0; i < 64; i++)
+    i = index->hash_head[hash & (XRDP_SMALL_CACHE_ENTRIES - 1)];
+    while (i >= 0)
     {
-        if (g_memcmp(self->brush_items[i].pattern,
-                     brush_item_data, 8) == 0)
+        if (index->hash[i] == hash &&
+                g_memcmp(self->brush_items[i].pattern,
+                         brush_item_data, 8) == 0)
         {
-            self->brush_items[i].stamp = self->brush_stamp;
+            xrdp_cache_small_touch(index, i);
             DEBUG(("found brush at %d", i));
             return i;
         }
+        i = index->hash_next[i];
     }
 
-    /* look for oldest */
-    index = 0;
-    oldest = 0x7fffffff;
-
-    for (i = 0; i < 64; i++)
-    {
-        if (self->brush_items[i].stamp < oldest)
-        {
-            oldest = self->brush_items[i].stamp;
-            index = i;
-        }
-    }
-
-    g_memcpy(self->brush_items[index].pattern,
-             brush_item_data, 8);
-    self->brush_items[index].stamp = self->brush_stamp;
+    /* take the least recently used */
+    i = index->lru_head;
+    g_memcpy(self->brush_items[i].pattern, brush_item_data, 8);
+    xrdp_cache_small_set(index, i, hash);
     libxrdp_orders_send_brush(self->session, 8, 8, 1, 0x81, 8,
-                              self->brush_items[index].pattern, index);
-    DEBUG(("adding brush at %d", index));
-    return index;
+                              self->brush_items[i].pattern, i);
+    DEBUG(("adding brush at %d", i));
+    return i;
 }
 
 /*****************************************************************************/
@@ -21,7 +21,7 @@
 #include "xrdp_encoder.h"
 #include "xrdp.h"
 #include "thread_calls.h"
-#include "fifo.h"
+#include "lfifo.h"
 
 #ifdef XRDP_RFXCODEC
 #include "rfxcodec_encode.h"
@@ -39,21 +39,40 @@
   } \
   while (0)
 
+#define XRDP_ENC_MIN_QUALITY 25 /* jpeg quality at XRDP_ENC_MAX_LEVEL */
+#define XRDP_ENC_RTT_WINDOW 64 /* rtt samples per min_rtt window */
+
+#ifdef XRDP_RFXCODEC
+/* rfx quantization for each level, 5 bytes each holding the 10 4 bit
+   values LL3 LH3 HL3 HH3 LH2 HL2 HH2 LH1 HL1 HH1, level 0 is the codec
+   default 6 6 6 6 7 7 8 8 8 9 and each level adds 1 */
+static const unsigned char g_rfx_quants[(XRDP_ENC_MAX_LEVEL + 1) * 5] =
+{
+    0x66, 0x66, 0x77, 0x88, 0x98,
+    0x77, 0x77, 0x88, 0x99, 0xa9,
+    0x88, 0x88, 0x99, 0xaa, 0xba,
+    0x99, 0x99, 0xaa, 0xbb, 0xcb,
+    0xaa, 0xaa, 0xbb, 0xcc, 0xdc
+};
+#endif
+
 /*****************************************************************************/
-static int
-process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
-static int
-process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
-static int
-process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+static XRDP_ENC_DATA_DONE *
+process_enc_jpg(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task);
+static XRDP_ENC_DATA_DONE *
+process_enc_rfx(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task);
+static XRDP_ENC_DATA_DONE *
+process_enc_h264(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task);
 
 /*****************************************************************************/
 struct xrdp_encoder *APP_CC
 xrdp_encoder_create(struct xrdp_mm *mm)
 {
     struct xrdp_encoder *self;
+    struct xrdp_enc_thread *thread;
     char buf[1024];
     int pid;
+    int index;
 
     if (mm->wm->client_info->mcs_connection_type != 6) /* LAN */
     {
@@ -67,6 +86,10 @@ xrdp_encoder_create(struct xrdp_mm *mm)
 
     self = (struct xrdp_encoder *)g_malloc(sizeof(struct xrdp_encoder), 1);
     self->mm = mm;
+    self->perf = mm->wm->session->perf;
+    self->srtt = -1;
+    self->min_rtt = 0x7fffffff;
+    self->min_rtt_window = 0x7fffffff;
 
     if (mm->wm->client_info->jpeg_codec_id != 0)
     {
@@ -79,6 +102,8 @@ xrdp_encoder_create(struct xrdp_mm *mm)
             /* XRDP_a8b8g8r8 */
             (32 << 24) | (3 << 16) | (8 << 12) | (8 << 8) | (8 << 4) | 8;
         self->process_enc = process_enc_jpg;
+        self->split_crects = 1;
+        self->num_threads = mm->wm->client_info->encoder_threads;
     }
     else if (mm->wm->client_info->rfx_codec_id != 0)
     {
@@ -111,12 +136,20 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         return 0;
     }
 
-    LLOGLN(0, ("init_xrdp_encoder: initializing encoder codec_id %d", self->codec_id));
+    self->quality = self->codec_quality;
+
+    /* only the jpeg codec has a handle per thread, others run on one */
+    self->num_threads = MAX(self->num_threads, 1);
+    self->num_threads = MIN(self->num_threads, XRDP_ENC_MAX_THREADS);
+
+    LLOGLN(0, ("init_xrdp_encoder: initializing encoder codec_id %d "
+           "threads %d", self->codec_id, self->num_threads));
 
     /* setup required FIFOs */
-    self->fifo_to_proc = fifo_create();
-    self->fifo_processed = fifo_create();
+    self->fifo_to_proc = lfifo_create();
+    self->fifo_processed = lfifo_create();
     self->mutex = tc_mutex_create();
+    self->jobs = list_create();
 
     pid = g_getpid();
     /* setup wait objects for signalling */
@@ -127,19 +160,53 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     g_snprintf(buf, 1024, "xrdp_%8.8x_encoder_term", pid);
     self->xrdp_encoder_term = g_create_wait_obj(buf);
 
-    /* create thread to process messages */
-    tc_thread_create(proc_enc_msg, self);
+    /* create threads to process messages */
+    for (index = 0; index < self->num_threads; index++)
+    {
+        thread = (struct xrdp_enc_thread *)
+                 g_malloc(sizeof(struct xrdp_enc_thread), 1);
+        thread->encoder = self;
+        thread->index = index;
+        tc_mutex_lock(self->mutex);
+        self->threads_running++;
+        tc_mutex_unlock(self->mutex);
+        if (tc_thread_create(proc_enc_msg, thread) != 0)
+        {
+            LLOGLN(0, ("xrdp_encoder_create: error creating thread %d",
+                   index));
+            tc_mutex_lock(self->mutex);
+            self->threads_running--;
+            tc_mutex_unlock(self->mutex);
+            g_free(thread);
+        }
+    }
 
     return self;
 }
 
+/*****************************************************************************/
+static void
+xrdp_encoder_free_enc(XRDP_ENC_DATA *enc)
+{
+    if (enc == 0)
+    {
+        return;
+    }
+    g_free(enc->drects);
+    g_free(enc->crects);
+    g_free(enc);
+}
+
 /*****************************************************************************/
 void APP_CC
 xrdp_encoder_delete(struct xrdp_encoder *self)
 {
     XRDP_ENC_DATA *enc;
     XRDP_ENC_DATA_DONE *enc_done;
-    FIFO *fifo;
+    XRDP_ENC_JOB *job;
+    LFIFO *fifo;
+    int index;
+    int running;
 
     LLOGLN(0, ("xrdp_encoder_delete:"));
     if (self == 0)
@@ -150,9 +217,27 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     {
         return;
     }
-    /* tell worker thread to shut down */
+    /* tell worker threads to shut down */
     g_set_wait_obj(self->xrdp_encoder_term);
-    g_sleep(1000);
+    running = 0;
+    for (index = 0; index < 100; index++)
+    {
+        tc_mutex_lock(self->mutex);
+        running = self->threads_running;
+        tc_mutex_unlock(self->mutex);
+        if (running < 1)
+        {
+            break;
+        }
+        g_sleep(100);
+    }
+    if (running > 0)
+    {
+        /* a thread is stuck in a codec, leak rather than free under it */
+        LLOGLN(0, ("xrdp_encoder_delete: %d threads still running",
+               running));
+        return;
+    }
 
     /* todo delete specific encoder */
 
@@ -165,45 +250,445 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     fifo = self->fifo_to_proc;
     if (fifo)
     {
-        while (!fifo_is_empty(fifo))
+        while (!lfifo_is_empty(fifo))
         {
-            enc = fifo_remove_item(fifo);
-            if (enc == 0)
+            enc = lfifo_remove_item(fifo);
+            xrdp_encoder_free_enc(enc);
+        }
+        lfifo_delete(fifo);
+    }
+
+    /* cleanup partly encoded jobs, tasks already in fifo_processed are
+       freed below */
+    if (self->jobs != 0)
+    {
+        for (index = 0; index < self->jobs->count; index++)
+        {
+            job = (XRDP_ENC_JOB *) list_get_item(self->jobs, index);
+            for (running = job->next_done; running < job->num_tasks;
+                 running++)
             {
-                continue;
+                enc_done = job->done[running];
+                xrdp_encoder_done_free(self, enc_done);
             }
-            g_free(enc->drects);
-            g_free(enc->crects);
-            g_free(enc);
+            xrdp_encoder_free_enc(job->enc);
+            g_free(job->done);
+            g_free(job);
         }
-        fifo_delete(fifo);
+        list_delete(self->jobs);
     }
 
     /* cleanup fifo_processed */
     fifo = self->fifo_processed;
     if (fifo)
     {
-        while (!fifo_is_empty(fifo))
+        while (!lfifo_is_empty(fifo))
         {
-            enc_done = fifo_remove_item(fifo);
+            enc_done = lfifo_remove_item(fifo);
             if (enc_done == 0)
             {
                 continue;
             }
-            g_free(enc_done->comp_pad_data);
-            g_free(enc_done);
+            if (enc_done->last)
+            {
+                xrdp_encoder_free_enc(enc_done->enc);
+            }
+            xrdp_encoder_done_free(self, enc_done);
         }
-        fifo_delete(fifo);
+        lfifo_delete(fifo);
     }
+    for (index = 0; index < self->pool_count; index++)
+    {
+        g_free(self->pool[index]);
+    }
+    tc_mutex_delete(self->mutex);
     g_free(self);
 }
 
 /*****************************************************************************/
-/* called from encoder thread */
+/* called from the main thread when level changes */
+static void
+xrdp_encoder_set_level(struct xrdp_encoder *self, int level, int now)
+{
+    int range;
+
+    LLOGLN(10, ("xrdp_encoder_set_level: level %d srtt %d min_rtt %d",
+           level, self->srtt, self->min_rtt));
+    self->level = level;
+    self->level_time = now;
+    self->drained = 0;
+    range = self->codec_quality -
+            MIN(self->codec_quality, XRDP_ENC_MIN_QUALITY);
+    self->quality = self->codec_quality -
+                    range * level / XRDP_ENC_MAX_LEVEL;
+    if (self->perf != 0)
+    {
+        self->perf->enc_level = level;
+    }
+}
+
+/*****************************************************************************/
+/* called from the main thread for each frame sent and each rtt sample,
+   rtt is -1 when only the send queue is known
+   raises level when the link backs up, at most once per rtt, and lowers
+   it again slowly once the send queue and rtt are back to normal */
+static void
+xrdp_encoder_adapt(struct xrdp_encoder *self, int rtt)
+{
+    int now;
+    int queue;
+    int congested;
+    int drained;
+    int hold;
+
+    now = g_time3();
+    queue = trans_get_send_queue_bytes(self->mm->wm->session->trans);
+    congested = queue > XRDP_ENC_QUEUE_HIGH;
+    drained = queue < XRDP_ENC_QUEUE_LOW;
+    if (rtt >= 0)
+    {
+        self->srtt = self->srtt < 0 ? rtt : (self->srtt * 7 + rtt) / 8;
+        /* min over this window and the last so the baseline can go up
+           after a route change */
+        self->min_rtt = MIN(self->min_rtt, rtt);
+        self->min_rtt_window = MIN(self->min_rtt_window, rtt);
+        self->rtt_samples++;
+        if (self->rtt_samples >= XRDP_ENC_RTT_WINDOW)
+        {
+            self->min_rtt = self->min_rtt_window;
+            self->min_rtt_window = 0x7fffffff;
+            self->rtt_samples = 0;
+        }
+    }
+    if (self->srtt >= 0)
+    {
+        if (self->srtt > self->min_rtt * 2 + 20)
+        {
+            congested = 1;
+        }
+        if (self->srtt > self->min_rtt + self->min_rtt / 2 + 10)
+        {
+            drained = 0;
+        }
+    }
+    if (self->perf != 0)
+    {
+        self->perf->srtt_msec = MAX(self->srtt, 0);
+        self->perf->send_queue_bytes = queue;
+    }
+    hold = MAX(self->srtt, 100);
+    if (congested)
+    {
+        self->drained = 0;
+        if ((self->level < XRDP_ENC_MAX_LEVEL) &&
+            (now - self->level_time >= hold))
+        {
+            xrdp_encoder_set_level(self, self->level + 1, now);
+        }
+    }
+    else if (drained)
+    {
+        self->drained++;
+        if ((self->level > 0) && (self->drained >= 8) &&
+            (now - self->level_time >= 500))
+        {
+            xrdp_encoder_set_level(self, self->level - 1, now);
+        }
+    }
+    else
+    {
+        self->drained = 0;
+    }
+}
+
+/*****************************************************************************/
+/* called from the main thread when enc goes to the encoder threads,
+   enc gets the quality for the current level */
+void APP_CC
+xrdp_encoder_frame_paint(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_enc_frame *frame;
+
+    enc->quality = self->quality;
+    enc->quant_level = self->level;
+    if (self->frame_count == XRDP_ENC_FRAMES)
+    {
+        /* never acked, forget the oldest */
+        self->frame_start = (self->frame_start + 1) % XRDP_ENC_FRAMES;
+        self->frame_count--;
+    }
+    frame = self->frames +
+            (self->frame_start + self->frame_count) % XRDP_ENC_FRAMES;
+    frame->frame_id = enc->frame_id;
+    frame->paint_time = g_time3();
+    frame->sent_time = 0;
+    self->frame_count++;
+    if (self->perf != 0)
+    {
+        self->perf->fifo_to_proc_depth = self->fifo_to_proc->count;
+        if (self->perf->fifo_to_proc_depth > self->perf->fifo_to_proc_max)
+        {
+            self->perf->fifo_to_proc_max = self->perf->fifo_to_proc_depth;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* called from the main thread when the end of frame_id is sent */
+void APP_CC
+xrdp_encoder_frame_sent(struct xrdp_encoder *self, int frame_id)
+{
+    struct xrdp_enc_frame *frame;
+    int index;
+
+    for (index = self->frame_count - 1; index >= 0; index--)
+    {
+        frame = self->frames +
+                (self->frame_start + index) % XRDP_ENC_FRAMES;
+        if (frame->frame_id == frame_id)
+        {
+            frame->sent_time = g_time3();
+            break;
+        }
+    }
+    xrdp_encoder_adapt(self, -1);
+}
+
+/*****************************************************************************/
+/* called from the main thread when frame_id is acked, an ack covers all
+   frames up to frame_id */
+void APP_CC
+xrdp_encoder_frame_ack(struct xrdp_encoder *self, int frame_id)
+{
+    struct xrdp_enc_frame *frame;
+    int now;
+    int rtt;
+
+    now = g_time3();
+    rtt = -1;
+    while (self->frame_count > 0)
+    {
+        frame = self->frames + self->frame_start;
+        if (frame->frame_id - frame_id > 0)
+        {
+            break;
+        }
+        if (self->perf != 0)
+        {
+            xrdp_perf_hist_add(&(self->perf->frame_msec),
+                               MAX(now - frame->paint_time, 0));
+        }
+        if (frame->sent_time != 0)
+        {
+            rtt = MAX(now - frame->sent_time, 0);
+        }
+        self->frame_start = (self->frame_start + 1) % XRDP_ENC_FRAMES;
+        self->frame_count--;
+    }
+    if (self->perf != 0)
+    {
+        self->perf->fifo_to_proc_depth = self->fifo_to_proc->count;
+    }
+    /* without client acks this is called right after the send */
+    if ((rtt >= 0) && self->mm->wm->client_info->use_frame_acks)
+    {
+        xrdp_encoder_adapt(self, rtt);
+    }
+}
+
+/*****************************************************************************/
+/* true if the send queue to the client is backed up */
+int APP_CC
+xrdp_encoder_congested(struct xrdp_encoder *self)
+{
+    return trans_get_send_queue_bytes(self->mm->wm->session->trans) >
+           XRDP_ENC_QUEUE_HIGH;
+}
+
+/*****************************************************************************/
+/* frames Xorg may have in flight, fewer as level goes up so Xorg merges
+   more damage into each frame */
+int APP_CC
+xrdp_encoder_ack_window(struct xrdp_encoder *self, int max_frames)
+{
+    if (max_frames < 2)
+    {
+        return max_frames;
+    }
+    return MAX(max_frames >> self->level, 1);
+}
+
+/*****************************************************************************/
+/* get the next task to work on, oldest job first, called with mutex held
+   returns nil if there is nothing to do */
+static XRDP_ENC_JOB *
+xrdp_encoder_get_task(struct xrdp_encoder *self, int *task)
+{
+    XRDP_ENC_JOB *job;
+    XRDP_ENC_DATA *enc;
+    int index;
+
+    for (index = 0; index < self->jobs->count; index++)
+    {
+        job = (XRDP_ENC_JOB *) list_get_item(self->jobs, index);
+        if (job->next_task < job->num_tasks)
+        {
+            *task = job->next_task++;
+            return job;
+        }
+    }
+    enc = (XRDP_ENC_DATA *) lfifo_remove_item(self->fifo_to_proc);
+    if (enc == 0)
+    {
+        return 0;
+    }
+    job = (XRDP_ENC_JOB *) g_malloc(sizeof(XRDP_ENC_JOB), 1);
+    job->enc = enc;
+    job->num_tasks = self->split_crects ? MAX(enc->num_crects, 1) : 1;
+    job->done = (XRDP_ENC_DATA_DONE **)
+                g_malloc(sizeof(XRDP_ENC_DATA_DONE *) * job->num_tasks, 1);
+    list_add_item(self->jobs, (tintptr) job);
+    if (job->num_tasks > 1)
+    {
+        /* wake idle threads to share the job */
+        g_set_wait_obj(self->xrdp_encoder_event_to_proc);
+    }
+    *task = job->next_task++;
+    return job;
+}
+
+/*****************************************************************************/
+/* like xrdp_encoder_get_task but when there is nothing to do,
+   event_to_proc is reset, called with mutex held */
+static XRDP_ENC_JOB *
+xrdp_encoder_next_task(struct xrdp_encoder *self, int *task)
+{
+    XRDP_ENC_JOB *job;
+
+    job = xrdp_encoder_get_task(self, task);
+    if (job == 0)
+    {
+        /* the main thread adds to fifo_to_proc without the mutex, look
+           again after the reset so an enc added in between is not missed */
+        g_reset_wait_obj(self->xrdp_encoder_event_to_proc);
+        job = xrdp_encoder_get_task(self, task);
+    }
+    return job;
+}
+
+/*****************************************************************************/
+/* store a finished task and move every finished task that is next in frame
+   order to fifo_processed, called with mutex held
+   returns true if the main thread needs to be signalled */
 static int
-process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+xrdp_encoder_task_done(struct xrdp_encoder *self, XRDP_ENC_JOB *job,
+                       int task, XRDP_ENC_DATA_DONE *enc_done)
+{
+    int signal;
+
+    job->done[task] = enc_done;
+    signal = 0;
+    while (self->jobs->count > 0)
+    {
+        job = (XRDP_ENC_JOB *) list_get_item(self->jobs, 0);
+        while ((job->next_done < job->num_tasks) &&
+               (job->done[job->next_done] != 0))
+        {
+            /* only signal when fifo_processed was empty, the main thread
+               drains it all on each wake up */
+            if (lfifo_add_item(self->fifo_processed,
+                               job->done[job->next_done]) > 0)
+            {
+                signal = 1;
+            }
+            job->next_done++;
+        }
+        if (job->next_done < job->num_tasks)
+        {
+            break;
+        }
+        /* all tasks handed back, enc is now owned by the main thread */
+        list_remove_item(self->jobs, 0);
+        g_free(job->done);
+        g_free(job);
+    }
+    return signal;
+}
+
+/*****************************************************************************/
+/* called from encoder threads, an output buffer of at least bytes, the
+   smallest free one that fits or a new one */
+static char *
+xrdp_encoder_buf_get(struct xrdp_encoder *self, int bytes, int *size)
 {
+    char *buf;
     int index;
+    int found;
+
+    found = -1;
+    tc_mutex_lock(self->mutex);
+    for (index = 0; index < self->pool_count; index++)
+    {
+        if ((self->pool_size[index] >= bytes) &&
+            ((found < 0) || (self->pool_size[index] < self->pool_size[found])))
+        {
+            found = index;
+        }
+    }
+    if (found >= 0)
+    {
+        buf = self->pool[found];
+        *size = self->pool_size[found];
+        self->pool_bytes -= *size;
+        self->pool_count--;
+        self->pool[found] = self->pool[self->pool_count];
+        self->pool_size[found] = self->pool_size[self->pool_count];
+        tc_mutex_unlock(self->mutex);
+        return buf;
+    }
+    tc_mutex_unlock(self->mutex);
+    /* round up so buffers fit more than the one crect size */
+    *size = (bytes + 0xffff) & ~0xffff;
+    return (char *) g_malloc(*size, 0);
+}
+
+/*****************************************************************************/
+/* frees enc_done, its output buffer goes back in the pool if there is
+   room, the big rfx ones are always freed so idle sessions do not sit on
+   them */
+void APP_CC
+xrdp_encoder_done_free(struct xrdp_encoder *self,
+                       XRDP_ENC_DATA_DONE *enc_done)
+{
+    if (enc_done == 0)
+    {
+        return;
+    }
+    if ((enc_done->comp_pad_data != 0) && (enc_done->comp_pad_size > 0))
+    {
+        tc_mutex_lock(self->mutex);
+        if ((self->pool_count < XRDP_ENC_POOL) &&
+            (enc_done->comp_pad_size <= XRDP_ENC_POOL_MAX_BUF) &&
+            (self->pool_bytes + enc_done->comp_pad_size <=
+             XRDP_ENC_POOL_BYTES))
+        {
+            self->pool[self->pool_count] = enc_done->comp_pad_data;
+            self->pool_size[self->pool_count] = enc_done->comp_pad_size;
+            self->pool_count++;
+            self->pool_bytes += enc_done->comp_pad_size;
+            enc_done->comp_pad_data = 0;
+        }
+        tc_mutex_unlock(self->mutex);
+    }
+    g_free(enc_done->comp_pad_data);
+    g_free(enc_done);
+}
+
+/*****************************************************************************/
+/* called from encoder thread, task is the crect index */
+static XRDP_ENC_DATA_DONE *
+process_enc_jpg(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task)
+{
     int x;
     int y;
     int cx;
@@ -211,89 +696,83 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int quality;
     int error;
     int out_data_bytes;
-    int count;
+    int out_data_size;
     char *out_data;
     XRDP_ENC_DATA_DONE *enc_done;
-    FIFO *fifo_processed;
-    tbus mutex;
-    tbus event_processed;
+    struct xrdp_encoder *self;
 
     LLOGLN(10, ("process_enc_jpg:"));
-    quality = self->codec_quality;
-    fifo_processed = self->fifo_processed;
-    mutex = self->mutex;
-    event_processed = self->xrdp_encoder_event_processed;
-    count = enc->num_crects;
-    for (index = 0; index < count; index++)
+    self = thread->encoder;
+    quality = enc->quality;
+    if (task >= enc->num_crects)
     {
-        x = enc->crects[index * 4 + 0];
-        y = enc->crects[index * 4 + 1];
-        cx = enc->crects[index * 4 + 2];
-        cy = enc->crects[index * 4 + 3];
-        if (cx < 1 || cy < 1)
-        {
-            LLOGLN(0, ("process_enc_jpg: error 1"));
-            continue;
-        }
+        return 0;
+    }
+    x = enc->crects[task * 4 + 0];
+    y = enc->crects[task * 4 + 1];
+    cx = enc->crects[task * 4 + 2];
+    cy = enc->crects[task * 4 + 3];
+    if (cx < 1 || cy < 1)
+    {
+        LLOGLN(0, ("process_enc_jpg: error 1"));
+        return 0;
+    }
 
-        LLOGLN(10, ("process_enc_jpg: x %d y %d cx %d cy %d", x, y, cx, cy));
+    LLOGLN(10, ("process_enc_jpg: x %d y %d cx %d cy %d", x, y, cx, cy));
 
-        out_data_bytes = MAX((cx + 4) * cy * 4, 8192);
-        if ((out_data_bytes < 1) || (out_data_bytes > 16 * 1024 * 1024))
-        {
-            LLOGLN(0, ("process_enc_jpg: error 2"));
-            return 1;
-        }
-        out_data = (char *) g_malloc(out_data_bytes + 256 + 2, 0);
-        if (out_data == 0)
-        {
-            LLOGLN(0, ("process_enc_jpg: error 3"));
-            return 1;
-        }
+    out_data_bytes = MAX((cx + 4) * cy * 4, 8192);
+    if ((out_data_bytes < 1) || (out_data_bytes > 16 * 1024 * 1024))
+    {
+        LLOGLN(0, ("process_enc_jpg: error 2"));
+        return 0;
+    }
+    out_data = xrdp_encoder_buf_get(self, out_data_bytes + 256 + 2,
+                                    &out_data_size);
+    if (out_data == 0)
+    {
+        LLOGLN(0, ("process_enc_jpg: error 3"));
+        return 0;
+    }
 
-        out_data[256] = 0; /* header bytes */
-        out_data[257] = 0;
-        error = libxrdp_codec_jpeg_compress(self->mm->wm->session, 0, enc->data,
-                                            enc->width, enc->height,
-                                            enc->width * 4, x, y, cx, cy,
-                                            quality,
-                                            out_data + 256 + 2, &out_data_bytes);
-        if (error < 0)
-        {
-            LLOGLN(0, ("process_enc_jpg: jpeg error %d bytes %d",
-                   error, out_data_bytes));
-            g_free(out_data);
-            return 1;
-        }
-        LLOGLN(10, ("jpeg error %d bytes %d", error, out_data_bytes));
+    out_data[256] = 0; /* header bytes */
+    out_data[257] = 0;
+    error = libxrdp_codec_jpeg_compress(self->mm->wm->session,
+                                        thread->jpeg_han, 0, enc->data,
+                                        enc->width, enc->height,
+                                        enc->width * 4, x, y, cx, cy,
+                                        quality,
+                                        out_data + 256 + 2, &out_data_bytes);
+    if (error < 0)
+    {
+        LLOGLN(0, ("process_enc_jpg: jpeg error %d bytes %d",
+               error, out_data_bytes));
         enc_done = (XRDP_ENC_DATA_DONE *)
                    g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
-        enc_done->comp_bytes = out_data_bytes + 2;
-        enc_done->pad_bytes = 256;
         enc_done->comp_pad_data = out_data;
-        enc_done->enc = enc;
-        enc_done->last = index == (enc->num_crects - 1);
-        enc_done->x = x;
-        enc_done->y = y;
-        enc_done->cx = cx;
-        enc_done->cy = cy;
-        /* done with msg */
-        /* inform main thread done */
-        tc_mutex_lock(mutex);
-        fifo_add_item(fifo_processed, enc_done);
-        tc_mutex_unlock(mutex);
-        /* signal completion for main thread */
-        g_set_wait_obj(event_processed);
+        enc_done->comp_pad_size = out_data_size;
+        xrdp_encoder_done_free(self, enc_done);
+        return 0;
     }
-    return 0;
+    LLOGLN(10, ("jpeg error %d bytes %d", error, out_data_bytes));
+    enc_done = (XRDP_ENC_DATA_DONE *)
+               g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
+    enc_done->comp_bytes = out_data_bytes + 2;
+    enc_done->pad_bytes = 256;
+    enc_done->comp_pad_data = out_data;
+    enc_done->comp_pad_size = out_data_size;
+    enc_done->x = x;
+    enc_done->y = y;
+    enc_done->cx = cx;
+    enc_done->cy = cy;
+    return enc_done;
 }
 
 #ifdef XRDP_RFXCODEC
 
 /*****************************************************************************/
-/* called from encoder thread */
-static int
-process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+/* called from encoder thread, the whole enc is one task */
+static XRDP_ENC_DATA_DONE *
+process_enc_rfx(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task)
 {
     int index;
     int x;
@@ -303,20 +782,17 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int out_data_bytes;
     int count;
     int error;
+    int out_data_size;
     char *out_data;
     XRDP_ENC_DATA_DONE *enc_done;
-    FIFO *fifo_processed;
-    tbus mutex;
-    tbus event_processed;
+    struct xrdp_encoder *self;
     struct rfx_tile *tiles;
     struct rfx_rect *rfxrects;
 
     LLOGLN(10, ("process_enc_rfx:"));
     LLOGLN(10, ("process_enc_rfx: num_crects %d num_drects %d",
            enc->num_crects, enc->num_drects));
-    fifo_processed = self->fifo_processed;
-    mutex = self->mutex;
-    event_processed = self->xrdp_encoder_event_processed;
+    self = thread->encoder;
 
     if ((enc->num_crects > 512) || (enc->num_drects > 512))
     {
@@ -326,7 +802,8 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     out_data_bytes = 16 * 1024 * 1024;
     index = 256 + sizeof(struct rfx_tile) * 512 +
                   sizeof(struct rfx_rect) * 512;
-    out_data = (char *) g_malloc(out_data_bytes + index, 0);
+    out_data = xrdp_encoder_buf_get(self, out_data_bytes + index,
+                                    &out_data_size);
     if (out_data == 0)
     {
         return 0;
@@ -347,9 +824,11 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         tiles[index].cx = cx;
         tiles[index].cy = cy;
         LLOGLN(10, ("x %d y %d cx %d cy %d", x, y, cx, cy));
-        tiles[index].quant_y = 0;
-        tiles[index].quant_cb = 0;
-        tiles[index].quant_cr = 0;
+        /* chroma goes coarser first */
+        tiles[index].quant_y = enc->quant_level;
+        tiles[index].quant_cb = MIN(enc->quant_level * 2,
+                                    XRDP_ENC_MAX_LEVEL);
+        tiles[index].quant_cr = tiles[index].quant_cb;
     }
 
     count = enc->num_drects;
@@ -369,7 +848,9 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     error = rfxcodec_encode(self->codec_handle, out_data + 256, &out_data_bytes,
                             enc->data, enc->width, enc->height, enc->width * 4,
                             rfxrects, enc->num_drects,
-                            tiles, enc->num_crects, 0, 0);
+                            tiles, enc->num_crects,
+                            (const char *) g_rfx_quants,
+                            XRDP_ENC_MAX_LEVEL + 1);
     LLOGLN(10, ("process_enc_rfx: rfxcodec_encode rv %d", error));
 
     enc_done = (XRDP_ENC_DATA_DONE *)
@@ -377,28 +858,18 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     enc_done->comp_bytes = out_data_bytes;
     enc_done->pad_bytes = 256;
     enc_done->comp_pad_data = out_data;
-    enc_done->enc = enc;
-    enc_done->last = 1;
+    enc_done->comp_pad_size = out_data_size;
     enc_done->cx = self->mm->wm->screen->width;
     enc_done->cy = self->mm->wm->screen->height;
-
-    /* done with msg */
-    /* inform main thread done */
-    tc_mutex_lock(mutex);
-    fifo_add_item(fifo_processed, enc_done);
-    tc_mutex_unlock(mutex);
-    /* signal completion for main thread */
-    g_set_wait_obj(event_processed);
-
-    return 0;
+    return enc_done;
 }
 
 #else
 
 /*****************************************************************************/
 /* called from encoder thread */
-static int
-process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+static XRDP_ENC_DATA_DONE *
+process_enc_rfx(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task)
 {
     return 0;
 }
@@ -407,22 +878,81 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
 
 /*****************************************************************************/
 /* called from encoder thread */
-static int
-process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+static XRDP_ENC_DATA_DONE *
+process_enc_h264(struct xrdp_enc_thread *thread, XRDP_ENC_DATA *enc, int task)
 {
     LLOGLN(0, ("process_enc_x264:"));
     return 0;
 }
 
+/*****************************************************************************/
+/* called from encoder thread, takes tasks until there are none left
+   returns error */
+static int
+process_enc_tasks(struct xrdp_enc_thread *thread)
+{
+    XRDP_ENC_JOB *job;
+    XRDP_ENC_DATA *enc;
+    XRDP_ENC_DATA_DONE *enc_done;
+    struct xrdp_encoder *self;
+    int task;
+    int last;
+    tui64 start_time;
+    tui64 end_time;
+
+    self = thread->encoder;
+    start_time = 0;
+    end_time = 0;
+    tc_mutex_lock(self->mutex);
+    job = xrdp_encoder_next_task(self, &task);
+    tc_mutex_unlock(self->mutex);
+    while (job != 0)
+    {
+        enc = job->enc;
+        last = task == job->num_tasks - 1;
+        /* do work */
+        if (self->perf != 0)
+        {
+            start_time = g_time4();
+        }
+        enc_done = self->process_enc(thread, enc, task);
+        if (self->perf != 0)
+        {
+            end_time = g_time4();
+        }
+        if (enc_done == 0)
+        {
+            /* nothing to send but the main thread still needs the task
+               to keep frame order and to know when enc is done */
+            enc_done = (XRDP_ENC_DATA_DONE *)
+                       g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
+        }
+        enc_done->enc = enc;
+        enc_done->last = last;
+        /* inform main thread done */
+        tc_mutex_lock(self->mutex);
+        if (self->perf != 0)
+        {
+            xrdp_perf_hist_add(&(self->perf->encode_usec),
+                               end_time - start_time);
+        }
+        if (xrdp_encoder_task_done(self, job, task, enc_done))
+        {
+            g_set_wait_obj(self->xrdp_encoder_event_processed);
+        }
+        /* get next task */
+        job = xrdp_encoder_next_task(self, &task);
+        tc_mutex_unlock(self->mutex);
+    }
+    return 0;
+}
+
 /**
  * Encoder thread main loop
  *****************************************************************************/
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg)
 {
-    XRDP_ENC_DATA *enc;
-    FIFO *fifo_to_proc;
-    tbus mutex;
     tbus event_to_proc;
     tbus term_obj;
     tbus lterm_obj;
@@ -432,23 +962,31 @@ proc_enc_msg(void *arg)
     int timeout;
     tbus robjs[32];
     tbus wobjs[32];
+    tbus wait_set;
+    struct xrdp_enc_thread *thread;
     struct xrdp_encoder *self;
 
     LLOGLN(0, ("proc_enc_msg: thread is running"));
 
-    self = (struct xrdp_encoder *) arg;
-    if (self == 0)
+    thread = (struct xrdp_enc_thread *) arg;
+    if (thread == 0)
     {
-        LLOGLN(0, ("proc_enc_msg: self nil"));
+        LLOGLN(0, ("proc_enc_msg: thread nil"));
         return 0;
     }
+    self = thread->encoder;
+
+    if (self->process_enc == process_enc_jpg)
+    {
+        /* the session jpeg handle can not be shared between threads */
+        thread->jpeg_han = libxrdp_codec_jpeg_create(self->mm->wm->session);
+    }
 
-    fifo_to_proc = self->fifo_to_proc;
-    mutex = self->mutex;
     event_to_proc = self->xrdp_encoder_event_to_proc;
 
     term_obj = g_get_term_event();
     lterm_obj = self->xrdp_encoder_term;
+    wait_set = g_create_wait_set();
 
     cont = 1;
     while (cont)
@@ -460,44 +998,39 @@ proc_enc_msg(void *arg)
         robjs[robjs_count++] = lterm_obj;
         robjs[robjs_count++] = event_to_proc;
 
-        if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
+        if (g_obj_wait_set(wait_set, robjs, robjs_count,
+                           wobjs, wobjs_count, timeout) != 0)
         {
             /* error, should not get here */
             g_sleep(100);
         }
 
-        if (g_is_wait_obj_set(term_obj)) /* global term */
+        if (g_is_wait_obj_ready(wait_set, term_obj, 0)) /* global term */
         {
             LLOGLN(0, ("proc_enc_msg: global term"));
             break;
         }
 
-        if (g_is_wait_obj_set(lterm_obj)) /* xrdp_mm term */
+        if (g_is_wait_obj_ready(wait_set, lterm_obj, 0)) /* xrdp_mm term */
         {
             LLOGLN(0, ("proc_enc_msg: xrdp_mm term"));
             break;
         }
 
-        if (g_is_wait_obj_set(event_to_proc))
+        if (g_is_wait_obj_ready(wait_set, event_to_proc, 0))
         {
-            /* clear it right away */
-            g_reset_wait_obj(event_to_proc);
-            /* get first msg */
-            tc_mutex_lock(mutex);
-            enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
-            tc_mutex_unlock(mutex);
-            while (enc != 0)
-            {
-                /* do work */
-                self->process_enc(self, enc);
-                /* get next msg */
-                tc_mutex_lock(mutex);
-                enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
-                tc_mutex_unlock(mutex);
-            }
+            /* event_to_proc stays set while there are tasks to hand out
+               so all idle threads wake up */
+            process_enc_tasks(thread);
         }
 
     } /* end while (cont) */
-    LLOGLN(0, ("proc_enc_msg: thread exit"));
+    g_delete_wait_set(wait_set);
+    LLOGLN(0, ("proc_enc_msg: thread %d exit", thread->index));
+    libxrdp_codec_jpeg_delete(self->mm->wm->session, thread->jpeg_han);
+    g_free(thread);
+    tc_mutex_lock(self->mutex);
+    self->threads_running--;
+    tc_mutex_unlock(self->mutex);
     return 0;
 }
@@ -3,9 +3,30 @@
 #define _XRDP_ENCODER_H
 
 #include "arch.h"
-#include "fifo.h"
+#include "lfifo.h"
+#include "list.h"
+
+#define XRDP_ENC_MAX_THREADS 16
+#define XRDP_ENC_FRAMES 64
+#define XRDP_ENC_MAX_LEVEL 4 /* congestion levels, 0 is full quality */
+#define XRDP_ENC_QUEUE_HIGH (128 * 1024) /* send queue bytes, congested */
+#define XRDP_ENC_QUEUE_LOW (16 * 1024) /* send queue bytes, drained */
+#define XRDP_ENC_POOL 16 /* free output buffers kept for reuse */
+#define XRDP_ENC_POOL_BYTES (4 * 1024 * 1024)
+#define XRDP_ENC_POOL_MAX_BUF (1024 * 1024) /* bigger ones are freed */
 
 struct xrdp_enc_data;
+struct xrdp_enc_data_done;
+struct xrdp_enc_thread;
+struct xrdp_perf_stats;
+
+/* a frame between server_paint_rects and the client ack */
+struct xrdp_enc_frame
+{
+    int frame_id;
+    int paint_time;
+    int sent_time; /* zero until the frame end marker is sent */
+};
 
 /* for codec mode operations */
 struct xrdp_encoder
@@ -17,14 +38,42 @@ struct xrdp_encoder
     tbus xrdp_encoder_event_to_proc;
     tbus xrdp_encoder_event_processed;
     tbus xrdp_encoder_term;
-    FIFO *fifo_to_proc;
-    FIFO *fifo_processed;
-    tbus mutex;
-    int (*process_enc)(struct xrdp_encoder *self, struct xrdp_enc_data *enc);
+    LFIFO *fifo_to_proc; /* main thread adds, encoder threads remove */
+    LFIFO *fifo_processed; /* encoder threads add, main thread removes */
+    tbus mutex; /* serializes the encoder threads */
+    struct xrdp_enc_data_done *(*process_enc)(struct xrdp_enc_thread *thread,
+                                              struct xrdp_enc_data *enc,
+                                              int task);
+    int split_crects; /* each crect is encoded as its own task */
+    int num_threads;
+    int threads_running;
+    struct list *jobs; /* XRDP_ENC_JOB in frame order */
     void *codec_handle;
     int frame_id_client; /* last frame id received from client */
     int frame_id_server; /* last frame id received from Xorg */
     int frame_id_server_sent;
+    struct xrdp_perf_stats *perf; /* nil if not collecting */
+    struct xrdp_enc_frame frames[XRDP_ENC_FRAMES]; /* not yet acked */
+    int frame_start;
+    int frame_count;
+    /* congestion control, see xrdp_encoder_adapt */
+    int level;
+    int level_time; /* when level last changed */
+    int drained; /* samples in a row with an empty link */
+    int srtt; /* smoothed ack rtt, -1 until the first sample */
+    int min_rtt; /* lowest rtt over the last two sample windows */
+    int min_rtt_window;
+    int rtt_samples;
+    int quality; /* jpeg quality for level */
+    int ack_pending; /* Xorg ack held back while the link is backed up */
+    int ack_flags;
+    int ack_frame_id;
+    int ack_time;
+    /* free output buffers, under mutex, see xrdp_encoder_buf_get */
+    char *pool[XRDP_ENC_POOL];
+    int pool_size[XRDP_ENC_POOL];
+    int pool_count;
+    int pool_bytes;
 };
 
 /* used when scheduling tasks in xrdp_encoder.c */
@@ -40,6 +89,8 @@ struct xrdp_enc_data
     int height;
     int flags;
     int frame_id;
+    int quality; /* jpeg quality */
+    int quant_level; /* rfx quantization, 0 to XRDP_ENC_MAX_LEVEL */
 };
 
 typedef struct xrdp_enc_data XRDP_ENC_DATA;
@@ -50,6 +101,7 @@ struct xrdp_enc_data_done
     int comp_bytes;
     int pad_bytes;
     char *comp_pad_data;
+    int comp_pad_size; /* bytes at comp_pad_data, for the buffer pool */
     struct xrdp_enc_data *enc;
     int last; /* true is this is last message for enc */
     int x;
@@ -60,10 +112,44 @@ struct xrdp_enc_data_done
 
 typedef struct xrdp_enc_data_done XRDP_ENC_DATA_DONE;
 
+/* an XRDP_ENC_DATA split into tasks, tasks may finish in any order on
+   any thread but are handed back to the main thread in order */
+struct xrdp_enc_job
+{
+    struct xrdp_enc_data *enc;
+    int num_tasks;
+    int next_task; /* next task to give to a thread */
+    int next_done; /* next task to add to fifo_processed */
+    struct xrdp_enc_data_done **done; /* num_tasks */
+};
+
+typedef struct xrdp_enc_job XRDP_ENC_JOB;
+
+/* one per encoder thread */
+struct xrdp_enc_thread
+{
+    struct xrdp_encoder *encoder;
+    int index;
+    void *jpeg_han;
+};
+
 struct xrdp_encoder *APP_CC
 xrdp_encoder_create(struct xrdp_mm *mm);
 void APP_CC
 xrdp_encoder_delete(struct xrdp_encoder *self);
+void APP_CC
+xrdp_encoder_frame_paint(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+void APP_CC
+xrdp_encoder_frame_sent(struct xrdp_encoder *self, int frame_id);
+void APP_CC
+xrdp_encoder_frame_ack(struct xrdp_encoder *self, int frame_id);
+int APP_CC
+xrdp_encoder_congested(struct xrdp_encoder *self);
+int APP_CC
+xrdp_encoder_ack_window(struct xrdp_encoder *self, int max_frames);
+void APP_CC
+xrdp_encoder_done_free(struct xrdp_encoder *self,
+                       XRDP_ENC_DATA_DONE *enc_done);
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg);
 
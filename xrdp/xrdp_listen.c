@@ -274,6 +274,9 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
         /* close, don't delete this */
         g_close_wait_obj(self->pro_done_event);
         xrdp_listen_create_pro_done(self);
+        /* the epoll set is shared with the parent, don't change it */
+        g_delete_wait_set(self->wait_set);
+        self->wait_set = 0;
         /* delete listener, child need not listen */
         trans_delete(self->listen_trans);
         self->listen_trans = 0;
@@ -439,6 +442,8 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         term_obj = g_get_term_event(); /*Global termination event */
         sync_obj = g_get_sync_event();
         done_obj = self->pro_done_event;
+        self->wait_set = g_create_wait_set();
+        self->listen_trans->wait_set = self->wait_set;
         cont = 1;
 
         while (cont)
@@ -462,7 +467,8 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
             }
 
             /* wait - timeout -1 means wait indefinitely*/
-            if (g_obj_wait(robjs, robjs_count, 0, 0, timeout) != 0)
+            if (g_obj_wait_set(self->wait_set, robjs, robjs_count, 0, 0,
+                               timeout) != 0)
             {
                 /* error, should not get here */
                 g_sleep(100);
@@ -514,7 +520,8 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
             robjs[robjs_count++] = done_obj;
 
             /* wait - timeout -1 means wait indefinitely*/
-            if (g_obj_wait(robjs, robjs_count, 0, 0, timeout) != 0)
+            if (g_obj_wait_set(self->wait_set, robjs, robjs_count, 0, 0,
+                               timeout) != 0)
             {
                 /* error, should not get here */
                 g_sleep(100);
@@ -533,6 +540,8 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
                 xrdp_listen_delete_done_pro(self);
             }
         }
+        g_delete_wait_set(self->wait_set);
+        self->wait_set = 0;
     }
     else
     {
@@ -51,6 +51,11 @@
   } \
   while (0)
 
+/* a held Xorg frame ack is retried every XRDP_MM_ACK_POLL ms and sent
+   anyway after XRDP_MM_ACK_HOLD ms */
+#define XRDP_MM_ACK_POLL 10
+#define XRDP_MM_ACK_HOLD 1000
+
 /*****************************************************************************/
 struct xrdp_mm *APP_CC
 xrdp_mm_create(struct xrdp_wm *owner)
@@ -466,6 +471,7 @@ xrdp_mm_setup_mod1(struct xrdp_mm *self)
             self->mod->server_paint_rect_bpp = server_paint_rect_bpp;
             self->mod->server_composite = server_composite;
             self->mod->server_paint_rects = server_paint_rects;
+            self->mod->server_set_pointer_large = server_set_pointer_large;
             self->mod->si = (tintptr) &(self->wm->session->si);
         }
     }
@@ -2056,6 +2062,14 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
     if (self->encoder != 0)
     {
         read_objs[(*rcount)++] = self->encoder->xrdp_encoder_event_processed;
+        if (self->encoder->ack_pending)
+        {
+            /* poll for the send queue to drain */
+            if ((*timeout < 0) || (*timeout > XRDP_MM_ACK_POLL))
+            {
+                *timeout = XRDP_MM_ACK_POLL;
+            }
+        }
     }
 
     return rv;
@@ -2138,6 +2152,36 @@ xrdp_mm_check_chan(struct xrdp_mm *self)
     return 0;
 }
 
+/*****************************************************************************/
+/* codec mode without client frame acks, ack Xorg right away unless the
+   link to the client is backed up, then hold the ack so Xorg merges the
+   damage into a later frame instead of queueing more behind it */
+static int APP_CC
+xrdp_mm_mod_frame_ack(struct xrdp_mm *self, int flags, int frame_id)
+{
+    struct xrdp_encoder *encoder;
+    int now;
+
+    encoder = self->encoder;
+    now = g_time3();
+    if (xrdp_encoder_congested(encoder))
+    {
+        if (!encoder->ack_pending)
+        {
+            encoder->ack_pending = 1;
+            encoder->ack_time = now;
+        }
+        encoder->ack_flags = flags;
+        encoder->ack_frame_id = frame_id;
+        if (now - encoder->ack_time < XRDP_MM_ACK_HOLD)
+        {
+            return 0;
+        }
+    }
+    encoder->ack_pending = 0;
+    return self->mod->mod_frame_ack(self->mod, flags, frame_id);
+}
+
 /*****************************************************************************/
 int APP_CC
 xrdp_mm_check_wait_objs(struct xrdp_mm *self)
@@ -2208,13 +2252,22 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
 
         use_frame_acks = self->wm->client_info->use_frame_acks;
 
+        if (self->encoder->ack_pending)
+        {
+            xrdp_mm_mod_frame_ack(self, self->encoder->ack_flags,
+                                  self->encoder->ack_frame_id);
+        }
+
         if (g_is_wait_obj_set(self->encoder->xrdp_encoder_event_processed))
         {
+            /* encoder threads only signal when fifo_processed was empty so
+               reset first, then drain it */
             g_reset_wait_obj(self->encoder->xrdp_encoder_event_processed);
-            tc_mutex_lock(self->encoder->mutex);
+            /* markers and surface bits of everything done so far go out
+               together */
+            libxrdp_batch_begin(self->wm->session);
             enc_done = (XRDP_ENC_DATA_DONE*)
-                       fifo_remove_item(self->encoder->fifo_processed);
-            tc_mutex_unlock(self->encoder->mutex);
+                       lfifo_remove_item(self->encoder->fifo_processed);
             while (enc_done != 0)
             {
                 /* do something with msg */
@@ -2243,6 +2296,11 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
                     libxrdp_fastpath_send_frame_marker(self->wm->session, 1,
                                                        enc_done->enc->frame_id);
                 }
+                if (enc_done->last)
+                {
+                    xrdp_encoder_frame_sent(self->encoder,
+                                            enc_done->enc->frame_id);
+                }
 
                 /* free enc_done */
                 if (enc_done->last)
@@ -2250,14 +2308,18 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
                     LLOGLN(10, ("xrdp_mm_check_wait_objs: last set"));
                     if (use_frame_acks == 0)
                     {
-                        self->mod->mod_frame_ack(self->mod,
-                                                 enc_done->enc->flags,
-                                                 enc_done->enc->frame_id);
+                        /* no acks from the client, the frame is done once
+                           it is sent */
+                        xrdp_encoder_frame_ack(self->encoder,
+                                               enc_done->enc->frame_id);
+                        xrdp_mm_mod_frame_ack(self, enc_done->enc->flags,
+                                              enc_done->enc->frame_id);
                     }
                     else
                     {
 #if 1
                         ex = self->wm->client_info->max_unacknowledged_frame_count;
+                        ex = xrdp_encoder_ack_window(self->encoder, ex);
                         if (self->encoder->frame_id_client + ex > self->encoder->frame_id_server)
                         {
                             if (self->encoder->frame_id_server > self->encoder->frame_id_server_sent)
@@ -2273,13 +2335,11 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
                     g_free(enc_done->enc->crects);
                     g_free(enc_done->enc);
                 }
-                g_free(enc_done->comp_pad_data);
-                g_free(enc_done);
-                tc_mutex_lock(self->encoder->mutex);
+                xrdp_encoder_done_free(self->encoder, enc_done);
                 enc_done = (XRDP_ENC_DATA_DONE*)
-                           fifo_remove_item(self->encoder->fifo_processed);
-                tc_mutex_unlock(self->encoder->mutex);
+                           lfifo_remove_item(self->encoder->fifo_processed);
             }
+            libxrdp_batch_end(self->wm->session);
         }
     }
     return rv;
@@ -2298,7 +2358,9 @@ xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id)
     {
         return 1;
     }
+    xrdp_encoder_frame_ack(self->encoder, frame_id);
     ex = self->wm->client_info->max_unacknowledged_frame_count;
+    ex = xrdp_encoder_ack_window(self->encoder, ex);
     if (self->encoder->frame_id_client + ex > self->encoder->frame_id_server)
     {
         if (self->encoder->frame_id_server > self->encoder->frame_id_server_sent)
@@ -2341,6 +2403,7 @@ server_begin_update(struct xrdp_mod *mod)
 
     wm = (struct xrdp_wm *)(mod->wm);
     p = xrdp_painter_create(wm, wm->session);
+    libxrdp_batch_begin(wm->session);
     xrdp_painter_begin_update(p);
     mod->painter = (long)p;
     return 0;
@@ -2360,6 +2423,7 @@ server_end_update(struct xrdp_mod *mod)
     }
 
     xrdp_painter_end_update(p);
+    libxrdp_batch_end(p->session);
     xrdp_painter_delete(p);
     mod->painter = 0;
     return 0;
@@ -2572,18 +2636,19 @@ server_paint_rects(struct xrdp_mod* mod, int num_drects, short *drects,
         enc_data->flags = flags;
         enc_data->frame_id = frame_id;
         mm->encoder->frame_id_server = frame_id;
+        xrdp_encoder_frame_paint(mm->encoder, enc_data);
         if (width == 0 || height == 0)
         {
             LLOGLN(10, ("server_paint_rects: error"));
         }
 
         /* insert into fifo for encoder thread to process */
-        tc_mutex_lock(mm->encoder->mutex);
-        fifo_add_item(mm->encoder->fifo_to_proc, (void *) enc_data);
-        tc_mutex_unlock(mm->encoder->mutex);
-
-        /* signal xrdp_encoder thread */
-        g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
+        if (lfifo_add_item(mm->encoder->fifo_to_proc, (void *) enc_data) > 0)
+        {
+            /* signal xrdp_encoder thread, not needed if the fifo was not
+               empty, the encoder threads drain it */
+            g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
+        }
 
         return 0;
     }
@@ -2617,7 +2682,7 @@ server_set_pointer(struct xrdp_mod *mod, int x, int y,
     struct xrdp_wm *wm;
 
     wm = (struct xrdp_wm *)(mod->wm);
-    xrdp_wm_pointer(wm, data, mask, x, y, 0);
+    xrdp_wm_pointer(wm, data, mask, x, y, 0, 32, 32);
     return 0;
 }
 
@@ -2629,7 +2694,22 @@ server_set_pointer_ex(struct xrdp_mod *mod, int x, int y,
     struct xrdp_wm *wm;
 
     wm = (struct xrdp_wm *)(mod->wm);
-    xrdp_wm_pointer(wm, data, mask, x, y, bpp);
+    xrdp_wm_pointer(wm, data, mask, x, y, bpp, 32, 32);
+    return 0;
+}
+
+/*****************************************************************************/
+/* pointer bigger than 32x32, xrdp_wm_pointer crops it if the client can
+   not take the size */
+int DEFAULT_CC
+server_set_pointer_large(struct xrdp_mod *mod, int x, int y,
+                         char *data, char *mask, int bpp,
+                         int width, int height)
+{
+    struct xrdp_wm *wm;
+
+    wm = (struct xrdp_wm *)(mod->wm);
+    xrdp_wm_pointer(wm, data, mask, x, y, bpp, width, height);
     return 0;
 }
 
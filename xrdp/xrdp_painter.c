@@ -20,6 +20,15 @@
 
 #include "xrdp.h"
 
+/* glyphs of one text that went into the same font cache */
+struct xrdp_text_run
+{
+    int f;
+    int x; /* from the start of the text */
+    int offset; /* into the glyph data */
+    int bytes;
+};
+
 /*****************************************************************************/
 struct xrdp_painter *APP_CC
 xrdp_painter_create(struct xrdp_wm *wm, struct xrdp_session *session)
@@ -31,6 +40,7 @@ xrdp_painter_create(struct xrdp_wm *wm, struct xrdp_session *session)
     self->session = session;
     self->rop = 0xcc; /* copy gota use 0xcc*/
     self->clip_children = 1;
+    self->region = xrdp_region_create(wm);
     return self;
 }
 
@@ -43,6 +53,7 @@ xrdp_painter_delete(struct xrdp_painter *self)
         return;
     }
 
+    xrdp_region_delete(self->region);
     g_free(self);
 }
 
@@ -388,7 +399,8 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
     }
 
     xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-    region = xrdp_region_create(self->wm);
+    region = self->region;
+    xrdp_region_clear(region);
 
     if (dst->type != WND_TYPE_OFFSCREEN)
     {
@@ -476,7 +488,6 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
         }
     }
 
-    xrdp_region_delete(region);
     return 0;
 }
 
@@ -506,6 +517,9 @@ xrdp_painter_draw_text(struct xrdp_painter *self,
     struct xrdp_rect draw_rect;
     struct xrdp_font *font;
     struct xrdp_font_char *font_item;
+    struct xrdp_text_run *runs;
+    int run_count;
+    int data_bytes;
     twchar *wstr;
 
     if (self == 0)
@@ -538,27 +552,68 @@ xrdp_painter_draw_text(struct xrdp_painter *self,
     wstr = (twchar *)g_malloc((len + 2) * sizeof(twchar), 0);
     g_mbstowcs(wstr, text, len + 1);
     font = self->font;
-    f = 0;
     k = 0;
     total_width = 0;
     total_height = 0;
+    data_bytes = 0;
+    run_count = 0;
     data = (char *)g_malloc(len * 4, 1);
+    runs = (struct xrdp_text_run *)
+           g_malloc(len * sizeof(struct xrdp_text_run), 1);
 
     for (index = 0; index < len; index++)
     {
         font_item = font->font_items + wstr[index];
         i = xrdp_cache_add_char(self->wm->cache, font_item);
-        f = HIWORD(i);
-        c = LOWORD(i);
-        data[index * 2] = c;
-        data[index * 2 + 1] = k;
-        k = font_item->incby;
-        total_width += k;
+
+        /* -1 is a glyph too big for the client's glyph caches, it is left
+           out and the next one moves over by its width */
+        if (i != -1)
+        {
+            f = HIWORD(i);
+            c = LOWORD(i);
+
+            /* a text order names one font cache, glyphs of other sizes can
+               be in another one so they go in another order */
+            if ((run_count == 0) || (runs[run_count - 1].f != f))
+            {
+                runs[run_count].f = f;
+                runs[run_count].x = total_width;
+                runs[run_count].offset = data_bytes;
+                runs[run_count].bytes = 0;
+                run_count++;
+                k = 0;
+            }
+
+            data[data_bytes++] = c;
+            runs[run_count - 1].bytes++;
+
+            if ((k > 127) || (k < -128))
+            {
+                /* left out glyphs can make the gap too big for one byte,
+                   0x80 says a 16 bit little endian one follows */
+                data[data_bytes++] = 0x80;
+                data[data_bytes++] = k;
+                data[data_bytes++] = k >> 8;
+                runs[run_count - 1].bytes += 3;
+            }
+            else
+            {
+                data[data_bytes++] = k;
+                runs[run_count - 1].bytes++;
+            }
+
+            k = 0;
+        }
+
+        k += font_item->incby;
+        total_width += font_item->incby;
         total_height = MAX(total_height, font_item->height);
     }
 
     xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-    region = xrdp_region_create(self->wm);
+    region = self->region;
+    xrdp_region_clear(region);
 
     if (dst->type != WND_TYPE_OFFSCREEN)
     {
@@ -578,20 +633,24 @@ xrdp_painter_draw_text(struct xrdp_painter *self,
     {
         if (rect_intersect(&rect, &clip_rect, &draw_rect))
         {
-            x1 = x;
-            y1 = y + total_height;
-            flags = 0x03; /* 0x03 0x73; TEXT2_IMPLICIT_X and something else */
-            libxrdp_orders_text(self->session, f, flags, 0,
-                                self->fg_color, 0,
-                                x - 1, y - 1, x + total_width, y + total_height,
-                                0, 0, 0, 0,
-                                x1, y1, data, len * 2, &draw_rect);
+            for (index = 0; index < run_count; index++)
+            {
+                x1 = x + runs[index].x;
+                y1 = y + total_height;
+                flags = 0x03; /* 0x03 0x73; TEXT2_IMPLICIT_X and something else */
+                libxrdp_orders_text(self->session, runs[index].f, flags, 0,
+                                    self->fg_color, 0,
+                                    x - 1, y - 1, x + total_width,
+                                    y + total_height, 0, 0, 0, 0, x1, y1,
+                                    data + runs[index].offset,
+                                    runs[index].bytes, &draw_rect);
+            }
         }
 
         k++;
     }
 
-    xrdp_region_delete(region);
+    g_free(runs);
     g_free(data);
     g_free(wstr);
     return 0;
@@ -629,7 +688,8 @@ xrdp_painter_draw_text2(struct xrdp_painter *self,
     }
 
     xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-    region = xrdp_region_create(self->wm);
+    region = self->region;
+    xrdp_region_clear(region);
 
     if (dst->type != WND_TYPE_OFFSCREEN)
     {
@@ -677,7 +737,6 @@ xrdp_painter_draw_text2(struct xrdp_painter *self,
         k++;
     }
 
-    xrdp_region_delete(region);
     return 0;
 }
 
@@ -726,7 +785,8 @@ xrdp_painter_copy(struct xrdp_painter *self,
     if (src->type == WND_TYPE_SCREEN)
     {
         xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-        region = xrdp_region_create(self->wm);
+        region = self->region;
+        xrdp_region_clear(region);
 
         if (dst->type != WND_TYPE_OFFSCREEN)
         {
@@ -755,14 +815,14 @@ xrdp_painter_copy(struct xrdp_painter *self,
             k++;
         }
 
-        xrdp_region_delete(region);
     }
     else if (src->type == WND_TYPE_OFFSCREEN)
     {
         //g_writeln("xrdp_painter_copy: todo");
 
         xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-        region = xrdp_region_create(self->wm);
+        region = self->region;
+        xrdp_region_clear(region);
 
         if (dst->type != WND_TYPE_OFFSCREEN)
         {
@@ -818,13 +878,13 @@ xrdp_painter_copy(struct xrdp_painter *self,
             k++;
         }
 
-        xrdp_region_delete(region);
     }
     else if (src->data != 0)
         /* todo, the non bitmap cache part is gone, it should be put back */
     {
         xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-        region = xrdp_region_create(self->wm);
+        region = self->region;
+        xrdp_region_clear(region);
 
         if (dst->type != WND_TYPE_OFFSCREEN)
         {
@@ -886,7 +946,6 @@ xrdp_painter_copy(struct xrdp_painter *self,
             j += 63;
         }
 
-        xrdp_region_delete(region);
     }
 
     return 0;
@@ -934,7 +993,8 @@ xrdp_painter_composite(struct xrdp_painter* self,
     if (src->type == WND_TYPE_OFFSCREEN)
     {
         xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-        region = xrdp_region_create(self->wm);
+        region = self->region;
+        xrdp_region_clear(region);
         xrdp_region_add_rect(region, &clip_rect);
         dstx += dx;
         dsty += dy;
@@ -967,7 +1027,6 @@ xrdp_painter_composite(struct xrdp_painter* self,
             }
             k++;
         }
-        xrdp_region_delete(region);
     }
     return 0;
 }
@@ -1000,7 +1059,8 @@ xrdp_painter_line(struct xrdp_painter *self,
     }
 
     xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-    region = xrdp_region_create(self->wm);
+    region = self->region;
+    xrdp_region_clear(region);
 
     if (dst->type != WND_TYPE_OFFSCREEN)
     {
@@ -1037,6 +1097,5 @@ xrdp_painter_line(struct xrdp_painter *self,
         k++;
     }
 
-    xrdp_region_delete(region);
     return 0;
 }
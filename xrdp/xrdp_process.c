@@ -55,6 +55,7 @@ xrdp_process_delete(struct xrdp_process *self)
     g_delete_wait_obj(self->self_term_event);
     libxrdp_exit(self->session);
     xrdp_wm_delete(self->wm);
+    xrdp_perf_delete(self->perf);
     trans_delete(self->server_trans);
     g_free(self);
 }
@@ -185,6 +186,7 @@ xrdp_process_main_loop(struct xrdp_process *self)
     tbus robjs[32];
     tbus wobjs[32];
     tbus term_obj;
+    tbus wait_set;
 
     DEBUG(("xrdp_process_main_loop"));
     self->status = 1;
@@ -201,12 +203,23 @@ xrdp_process_main_loop(struct xrdp_process *self)
     self->session->callback = callback;
     /* this function is just above */
     self->session->is_term = xrdp_is_term;
+    if (self->session->client_info->perf_stats)
+    {
+        self->perf = xrdp_perf_create(g_getpid(), self->session_id);
+        if (self->perf == 0)
+        {
+            g_writeln("xrdp_process_main_loop: xrdp_perf_create failed");
+        }
+        self->session->perf = self->perf;
+    }
 
     if (libxrdp_process_incoming(self->session) == 0)
     {
         init_stream(self->server_trans->in_s, 32 * 1024);
 
         term_obj = g_get_term_event();
+        wait_set = g_create_wait_set();
+        self->server_trans->wait_set = wait_set;
         cont = 1;
 
         while (cont)
@@ -222,7 +235,8 @@ xrdp_process_main_loop(struct xrdp_process *self)
             trans_get_wait_objs_rw(self->server_trans, robjs, &robjs_count,
                                    wobjs, &wobjs_count, &timeout);
             /* wait */
-            if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
+            if (g_obj_wait_set(wait_set, robjs, robjs_count,
+                               wobjs, wobjs_count, timeout) != 0)
             {
                 /* error, should not get here */
                 g_sleep(100);
@@ -248,6 +262,8 @@ xrdp_process_main_loop(struct xrdp_process *self)
                 break;
             }
         }
+        self->server_trans->wait_set = 0;
+        g_delete_wait_set(wait_set);
         /* send disconnect message if possible */
         libxrdp_disconnect(self->session);
     }
@@ -16,10 +16,21 @@
  * limitations under the License.
  *
  * region
+ *
+ * a region is kept as y-x banded rects in one array, like the X server
+ * and pixman do: rects are sorted by top then left, all rects in a band
+ * have the same top and bottom, rects in a band do not touch and no two
+ * touching bands have the same x spans, those get merged into one band
+ * union, intersect and subtract are done band by band so each is linear
+ * in the number of rects
  */
 
 #include "xrdp.h"
 
+#define REGION_OP_UNION     0
+#define REGION_OP_INTERSECT 1
+#define REGION_OP_SUBTRACT  2
+
 /*****************************************************************************/
 struct xrdp_region *APP_CC
 xrdp_region_create(struct xrdp_wm *wm)
@@ -28,8 +39,6 @@ xrdp_region_create(struct xrdp_wm *wm)
 
     self = (struct xrdp_region *)g_malloc(sizeof(struct xrdp_region), 1);
     self->wm = wm;
-    self->rects = list_create();
-    self->rects->auto_free = 1;
     return self;
 }
 
@@ -42,275 +51,476 @@ xrdp_region_delete(struct xrdp_region *self)
         return;
     }
 
-    list_delete(self->rects);
+    g_free(self->rects);
+    g_free(self->out_rects);
     g_free(self);
 }
 
 /*****************************************************************************/
+/* remove all rects, the storage is kept for the next use */
 int APP_CC
-xrdp_region_add_rect(struct xrdp_region *self, struct xrdp_rect *rect)
+xrdp_region_clear(struct xrdp_region *self)
 {
-    struct xrdp_rect *r;
-
-    r = (struct xrdp_rect *)g_malloc(sizeof(struct xrdp_rect), 1);
-    *r = *rect;
-    list_add_item(self->rects, (long)r);
+    self->num_rects = 0;
     return 0;
 }
 
 /*****************************************************************************/
-int APP_CC
-xrdp_region_insert_rect(struct xrdp_region *self, int i, int left,
-                        int top, int right, int bottom)
+/* append a rect to the output array, growing it if needed */
+static int APP_CC
+xrdp_region_out(struct xrdp_region *self, int left, int top,
+                int right, int bottom)
 {
+    struct xrdp_rect *rects;
     struct xrdp_rect *r;
+    int size;
 
-    r = (struct xrdp_rect *)g_malloc(sizeof(struct xrdp_rect), 1);
+    if (self->num_out_rects >= self->out_size)
+    {
+        size = MAX(16, self->out_size * 2);
+        rects = (struct xrdp_rect *)g_malloc(sizeof(struct xrdp_rect) * size,
+                                             0);
+        if (rects == 0)
+        {
+            return 1;
+        }
+        g_memcpy(rects, self->out_rects,
+                 sizeof(struct xrdp_rect) * self->num_out_rects);
+        g_free(self->out_rects);
+        self->out_rects = rects;
+        self->out_size = size;
+    }
+    r = self->out_rects + self->num_out_rects;
     r->left = left;
     r->top = top;
     r->right = right;
     r->bottom = bottom;
-    list_insert_item(self->rects, i, (long)r);
+    self->num_out_rects++;
     return 0;
 }
 
 /*****************************************************************************/
-int APP_CC
-xrdp_region_subtract_rect(struct xrdp_region *self,
-                          struct xrdp_rect *rect)
+/* returns the index one past the band that starts at index */
+static int APP_CC
+xrdp_region_band_end(struct xrdp_rect *rects, int index, int count)
 {
-    struct xrdp_rect *r;
-    struct xrdp_rect rect1;
-    int i;
+    int top;
 
-    for (i = self->rects->count - 1; i >= 0; i--)
+    top = rects[index].top;
+    index++;
+    while ((index < count) && (rects[index].top == top))
     {
-        r = (struct xrdp_rect *)list_get_item(self->rects, i);
-        rect1 = *r;
-        r = &rect1;
+        index++;
+    }
+    return index;
+}
 
-        if (rect->left <= r->left &&
-                rect->top <= r->top &&
-                rect->right >= r->right &&
-                rect->bottom >= r->bottom)
-        {
-            /* rect is not visible */
-            list_remove_item(self->rects, i);
-        }
-        else if (rect->right < r->left ||
-                 rect->bottom < r->top ||
-                 rect->top > r->bottom ||
-                 rect->left > r->right)
-        {
-            /* rect are not related */
-        }
-        else if (rect->left <= r->left &&
-                 rect->right >= r->right &&
-                 rect->bottom < r->bottom &&
-                 rect->top <= r->top)
-        {
-            /* partially covered(whole top) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, rect->bottom,
-                                    r->right, r->bottom);
-        }
-        else if (rect->top <= r->top &&
-                 rect->bottom >= r->bottom &&
-                 rect->right < r->right &&
-                 rect->left <= r->left)
-        {
-            /* partially covered(left) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, rect->right, r->top,
-                                    r->right, r->bottom);
-        }
-        else if (rect->left <= r->left &&
-                 rect->right >= r->right &&
-                 rect->top > r->top &&
-                 rect->bottom >= r->bottom)
+/*****************************************************************************/
+/* merge the band starting at cur_band into the one starting at
+   prev_band if they touch and have the same x spans,
+   returns the start of the last band in the output */
+static int APP_CC
+xrdp_region_coalesce(struct xrdp_region *self, int prev_band, int cur_band)
+{
+    struct xrdp_rect *prev;
+    struct xrdp_rect *cur;
+    int count;
+    int index;
+
+    count = self->num_out_rects - cur_band;
+    if (count == 0)
+    {
+        return prev_band;
+    }
+    if (prev_band == cur_band)
+    {
+        return cur_band;
+    }
+    if (cur_band - prev_band != count)
+    {
+        return cur_band;
+    }
+    prev = self->out_rects + prev_band;
+    cur = self->out_rects + cur_band;
+    if (prev->bottom != cur->top)
+    {
+        return cur_band;
+    }
+    for (index = 0; index < count; index++)
+    {
+        if ((prev[index].left != cur[index].left) ||
+            (prev[index].right != cur[index].right))
         {
-            /* partially covered(bottom) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
+            return cur_band;
         }
-        else if (rect->top <= r->top &&
-                 rect->bottom >= r->bottom &&
-                 rect->left > r->left &&
-                 rect->right >= r->right)
+    }
+    for (index = 0; index < count; index++)
+    {
+        prev[index].bottom = cur[index].bottom;
+    }
+    self->num_out_rects = cur_band;
+    return prev_band;
+}
+
+/*****************************************************************************/
+/* copy the x spans of a band to the output with new top and bottom */
+static int APP_CC
+xrdp_region_out_band(struct xrdp_region *self, struct xrdp_rect *rects,
+                     int start, int end, int top, int bottom)
+{
+    while (start < end)
+    {
+        if (xrdp_region_out(self, rects[start].left, top,
+                            rects[start].right, bottom) != 0)
         {
-            /* partially covered(right) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    rect->left, r->bottom);
+            return 1;
         }
-        else if (rect->left <= r->left &&
-                 rect->top <= r->top &&
-                 rect->right < r->right &&
-                 rect->bottom < r->bottom)
+        start++;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* x spans of two bands that overlap between top and bottom */
+static int APP_CC
+xrdp_region_out_overlap(struct xrdp_region *self, int op,
+                        struct xrdp_rect *r1, int s1, int e1,
+                        struct xrdp_rect *r2, int s2, int e2,
+                        int top, int bottom)
+{
+    int left;
+    int right;
+    struct xrdp_rect *r;
+
+    if (op == REGION_OP_INTERSECT)
+    {
+        while ((s1 < e1) && (s2 < e2))
         {
-            /* partially covered(top left) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, rect->right, r->top,
-                                    r->right, rect->bottom);
-            xrdp_region_insert_rect(self, i, r->left, rect->bottom,
-                                    r->right, r->bottom);
+            left = MAX(r1[s1].left, r2[s2].left);
+            right = MIN(r1[s1].right, r2[s2].right);
+            if (left < right)
+            {
+                if (xrdp_region_out(self, left, top, right, bottom) != 0)
+                {
+                    return 1;
+                }
+            }
+            if (r1[s1].right < r2[s2].right)
+            {
+                s1++;
+            }
+            else if (r2[s2].right < r1[s1].right)
+            {
+                s2++;
+            }
+            else
+            {
+                s1++;
+                s2++;
+            }
         }
-        else if (rect->left <= r->left &&
-                 rect->bottom >= r->bottom &&
-                 rect->right < r->right &&
-                 rect->top > r->top)
+    }
+    else if (op == REGION_OP_SUBTRACT)
+    {
+        while (s1 < e1)
         {
-            /* partially covered(bottom left) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
-            xrdp_region_insert_rect(self, i, rect->right, rect->top,
-                                    r->right, r->bottom);
+            left = r1[s1].left;
+            right = r1[s1].right;
+            /* skip subtrahends left of this span */
+            while ((s2 < e2) && (r2[s2].right <= left))
+            {
+                s2++;
+            }
+            while ((s2 < e2) && (r2[s2].left < right))
+            {
+                if (r2[s2].left > left)
+                {
+                    if (xrdp_region_out(self, left, top, r2[s2].left,
+                                        bottom) != 0)
+                    {
+                        return 1;
+                    }
+                }
+                left = MAX(left, r2[s2].right);
+                if (r2[s2].right >= right)
+                {
+                    break;
+                }
+                s2++;
+            }
+            if (left < right)
+            {
+                if (xrdp_region_out(self, left, top, right, bottom) != 0)
+                {
+                    return 1;
+                }
+            }
+            s1++;
         }
-        else if (rect->left > r->left &&
-                 rect->right >= r->right &&
-                 rect->top <= r->top &&
-                 rect->bottom < r->bottom)
+    }
+    else
+    {
+        /* union, take spans in left order and merge the ones that touch */
+        left = 0;
+        right = 0;
+        while ((s1 < e1) || (s2 < e2))
         {
-            /* partially covered(top right) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    rect->left, r->bottom);
-            xrdp_region_insert_rect(self, i, rect->left, rect->bottom,
-                                    r->right, r->bottom);
+            if ((s2 >= e2) || ((s1 < e1) && (r1[s1].left < r2[s2].left)))
+            {
+                r = r1 + s1;
+                s1++;
+            }
+            else
+            {
+                r = r2 + s2;
+                s2++;
+            }
+            if ((right > left) && (r->left <= right))
+            {
+                right = MAX(right, r->right);
+                continue;
+            }
+            if (right > left)
+            {
+                if (xrdp_region_out(self, left, top, right, bottom) != 0)
+                {
+                    return 1;
+                }
+            }
+            left = r->left;
+            right = r->right;
         }
-        else if (rect->left > r->left &&
-                 rect->right >= r->right &&
-                 rect->top > r->top &&
-                 rect->bottom >= r->bottom)
+        if (right > left)
         {
-            /* partially covered(bottom right) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
-            xrdp_region_insert_rect(self, i, r->left, rect->top,
-                                    rect->left, r->bottom);
+            if (xrdp_region_out(self, left, top, right, bottom) != 0)
+            {
+                return 1;
+            }
         }
-        else if (rect->left > r->left &&
-                 rect->top <= r->top &&
-                 rect->right < r->right &&
-                 rect->bottom >= r->bottom)
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* self = self op (r2, n2), both banded, result is banded */
+static int APP_CC
+xrdp_region_op(struct xrdp_region *self, struct xrdp_rect *r2, int n2,
+               int op)
+{
+    struct xrdp_rect *r1;
+    struct xrdp_rect *temp;
+    int n1;
+    int i1;
+    int i2;
+    int e1;
+    int e2;
+    int top;
+    int bottom;
+    int ytop;
+    int ybot;
+    int prev_band;
+    int cur_band;
+    int size;
+
+    r1 = self->rects;
+    n1 = self->num_rects;
+    self->num_out_rects = 0;
+    prev_band = 0;
+    i1 = 0;
+    i2 = 0;
+    ybot = 0;
+    if (n1 > 0)
+    {
+        ybot = r1[0].top;
+    }
+    if (n2 > 0)
+    {
+        ybot = (n1 > 0) ? MIN(ybot, r2[0].top) : r2[0].top;
+    }
+    while ((i1 < n1) && (i2 < n2))
+    {
+        e1 = xrdp_region_band_end(r1, i1, n1);
+        e2 = xrdp_region_band_end(r2, i2, n2);
+        /* part of a band that only one region covers */
+        if (r1[i1].top < r2[i2].top)
         {
-            /* 2 rects, one on each end */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    rect->left, r->bottom);
-            xrdp_region_insert_rect(self, i, rect->right, r->top,
-                                    r->right, r->bottom);
+            top = MAX(r1[i1].top, ybot);
+            bottom = MIN(r1[i1].bottom, r2[i2].top);
+            if ((top < bottom) && (op != REGION_OP_INTERSECT))
+            {
+                cur_band = self->num_out_rects;
+                if (xrdp_region_out_band(self, r1, i1, e1, top, bottom) != 0)
+                {
+                    return 1;
+                }
+                prev_band = xrdp_region_coalesce(self, prev_band, cur_band);
+            }
+            ytop = r2[i2].top;
         }
-        else if (rect->left <= r->left &&
-                 rect->top > r->top &&
-                 rect->right >= r->right &&
-                 rect->bottom < r->bottom)
+        else if (r2[i2].top < r1[i1].top)
         {
-            /* 2 rects, one on each end */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
-            xrdp_region_insert_rect(self, i, r->left, rect->bottom,
-                                    r->right, r->bottom);
+            top = MAX(r2[i2].top, ybot);
+            bottom = MIN(r2[i2].bottom, r1[i1].top);
+            if ((top < bottom) && (op == REGION_OP_UNION))
+            {
+                cur_band = self->num_out_rects;
+                if (xrdp_region_out_band(self, r2, i2, e2, top, bottom) != 0)
+                {
+                    return 1;
+                }
+                prev_band = xrdp_region_coalesce(self, prev_band, cur_band);
+            }
+            ytop = r1[i1].top;
         }
-        else if (rect->left > r->left &&
-                 rect->right < r->right &&
-                 rect->top <= r->top &&
-                 rect->bottom < r->bottom)
+        else
         {
-            /* partially covered(top) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    rect->left, r->bottom);
-            xrdp_region_insert_rect(self, i, rect->left, rect->bottom,
-                                    rect->right, r->bottom);
-            xrdp_region_insert_rect(self, i, rect->right, r->top,
-                                    r->right, r->bottom);
+            ytop = r1[i1].top;
         }
-        else if (rect->top > r->top &&
-                 rect->bottom < r->bottom &&
-                 rect->left <= r->left &&
-                 rect->right < r->right)
+        /* part of the bands both regions cover */
+        ybot = MIN(r1[i1].bottom, r2[i2].bottom);
+        if (ybot > ytop)
         {
-            /* partially covered(left) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
-            xrdp_region_insert_rect(self, i, rect->right, rect->top,
-                                    r->right, rect->bottom);
-            xrdp_region_insert_rect(self, i, r->left, rect->bottom,
-                                    r->right, r->bottom);
+            cur_band = self->num_out_rects;
+            if (xrdp_region_out_overlap(self, op, r1, i1, e1, r2, i2, e2,
+                                        ytop, ybot) != 0)
+            {
+                return 1;
+            }
+            prev_band = xrdp_region_coalesce(self, prev_band, cur_band);
         }
-        else if (rect->left > r->left &&
-                 rect->right < r->right &&
-                 rect->bottom >= r->bottom &&
-                 rect->top > r->top)
+        if (r1[i1].bottom == ybot)
         {
-            /* partially covered(bottom) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    rect->left, r->bottom);
-            xrdp_region_insert_rect(self, i, rect->left, r->top,
-                                    rect->right, rect->top);
-            xrdp_region_insert_rect(self, i, rect->right, r->top,
-                                    r->right, r->bottom);
+            i1 = e1;
         }
-        else if (rect->top > r->top &&
-                 rect->bottom < r->bottom &&
-                 rect->right >= r->right &&
-                 rect->left > r->left)
+        if (r2[i2].bottom == ybot)
         {
-            /* partially covered(right) */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
-            xrdp_region_insert_rect(self, i, r->left, rect->top,
-                                    rect->left, rect->bottom);
-            xrdp_region_insert_rect(self, i, r->left, rect->bottom,
-                                    r->right, r->bottom);
+            i2 = e2;
         }
-        else if (rect->left > r->left &&
-                 rect->top > r->top &&
-                 rect->right < r->right &&
-                 rect->bottom < r->bottom)
+    }
+    /* whatever is left only one region covers */
+    if (op != REGION_OP_INTERSECT)
+    {
+        while (i1 < n1)
         {
-            /* totally contained, 4 rects */
-            list_remove_item(self->rects, i);
-            xrdp_region_insert_rect(self, i, r->left, r->top,
-                                    r->right, rect->top);
-            xrdp_region_insert_rect(self, i, r->left, rect->top,
-                                    rect->left, rect->bottom);
-            xrdp_region_insert_rect(self, i, r->left, rect->bottom,
-                                    r->right, r->bottom);
-            xrdp_region_insert_rect(self, i, rect->right, rect->top,
-                                    r->right, rect->bottom);
+            e1 = xrdp_region_band_end(r1, i1, n1);
+            top = MAX(r1[i1].top, ybot);
+            cur_band = self->num_out_rects;
+            if (xrdp_region_out_band(self, r1, i1, e1, top,
+                                     r1[i1].bottom) != 0)
+            {
+                return 1;
+            }
+            prev_band = xrdp_region_coalesce(self, prev_band, cur_band);
+            i1 = e1;
         }
-        else
+    }
+    if (op == REGION_OP_UNION)
+    {
+        while (i2 < n2)
         {
-            g_writeln("error in xrdp_region_subtract_rect");
+            e2 = xrdp_region_band_end(r2, i2, n2);
+            top = MAX(r2[i2].top, ybot);
+            cur_band = self->num_out_rects;
+            if (xrdp_region_out_band(self, r2, i2, e2, top,
+                                     r2[i2].bottom) != 0)
+            {
+                return 1;
+            }
+            prev_band = xrdp_region_coalesce(self, prev_band, cur_band);
+            i2 = e2;
         }
     }
-
+    /* swap the output in, the old array is reused next time */
+    temp = self->rects;
+    size = self->size;
+    self->rects = self->out_rects;
+    self->size = self->out_size;
+    self->num_rects = self->num_out_rects;
+    self->out_rects = temp;
+    self->out_size = size;
+    self->num_out_rects = 0;
     return 0;
 }
 
 /*****************************************************************************/
+/* returns boolean, false if the rect is empty */
+static int APP_CC
+xrdp_region_rect_valid(struct xrdp_rect *rect)
+{
+    return (rect->left < rect->right) && (rect->top < rect->bottom);
+}
+
+/*****************************************************************************/
+/* union of the region and rect */
 int APP_CC
-xrdp_region_get_rect(struct xrdp_region *self, int index,
-                     struct xrdp_rect *rect)
+xrdp_region_add_rect(struct xrdp_region *self, struct xrdp_rect *rect)
 {
-    struct xrdp_rect *r;
+    if (!xrdp_region_rect_valid(rect))
+    {
+        return 0;
+    }
+    return xrdp_region_op(self, rect, 1, REGION_OP_UNION);
+}
 
-    r = (struct xrdp_rect *)list_get_item(self->rects, index);
+/*****************************************************************************/
+int APP_CC
+xrdp_region_subtract_rect(struct xrdp_region *self,
+                          struct xrdp_rect *rect)
+{
+    if ((self->num_rects == 0) || !xrdp_region_rect_valid(rect))
+    {
+        return 0;
+    }
+    return xrdp_region_op(self, rect, 1, REGION_OP_SUBTRACT);
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_region_intersect_rect(struct xrdp_region *self,
+                           struct xrdp_rect *rect)
+{
+    if (!xrdp_region_rect_valid(rect))
+    {
+        self->num_rects = 0;
+        return 0;
+    }
+    return xrdp_region_op(self, rect, 1, REGION_OP_INTERSECT);
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_region_union(struct xrdp_region *self, struct xrdp_region *region)
+{
+    return xrdp_region_op(self, region->rects, region->num_rects,
+                          REGION_OP_UNION);
+}
 
-    if (r == 0)
+/*****************************************************************************/
+int APP_CC
+xrdp_region_intersect(struct xrdp_region *self, struct xrdp_region *region)
+{
+    return xrdp_region_op(self, region->rects, region->num_rects,
+                          REGION_OP_INTERSECT);
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_region_subtract(struct xrdp_region *self, struct xrdp_region *region)
+{
+    return xrdp_region_op(self, region->rects, region->num_rects,
+                          REGION_OP_SUBTRACT);
+}
+
+/*****************************************************************************/
+int APP_CC
+xrdp_region_get_rect(struct xrdp_region *self, int index,
+                     struct xrdp_rect *rect)
+{
+    if ((index < 0) || (index >= self->num_rects))
     {
         return 1;
     }
 
-    *rect = *r;
+    *rect = self->rects[index];
     return 0;
 }
@@ -146,7 +146,10 @@ struct xrdp_mod
                             int num_crects, short *crects,
                             char *data, int width, int height,
                             int flags, int frame_id);
-  tintptr server_dumby[100 - 43]; /* align, 100 minus the number of server
+  int (*server_set_pointer_large)(struct xrdp_mod* v, int x, int y,
+                                  char* data, char* mask, int bpp,
+                                  int width, int height);
+  tintptr server_dumby[100 - 44]; /* align, 100 minus the number of server
                                      functions above */
   /* common */
   tintptr handle; /* pointer to self as int */
@@ -182,6 +185,17 @@ struct xrdp_bitmap_item
   int stamp;
   int lru_index;
   struct xrdp_bitmap* bitmap;
+  /* client loaded this entry from its persistent cache, bitmap is 0 until
+     the first hit */
+  int persist;
+  tui64 persist_key;
+};
+
+/* slot in the bitmap cache index, cache_idx is -1 when the slot is empty */
+struct xrdp_cache_slot
+{
+  tui64 key;
+  int cache_idx;
 };
 
 struct xrdp_lru_item
@@ -200,6 +214,10 @@ struct xrdp_char_item
 {
   int stamp;
   struct xrdp_font_char font_item;
+  tui32 hash;
+  int hash_next; /* next in hash bucket, font * 256 + char or -1 */
+  int lru_next; /* char index in the same font cache or -1 */
+  int lru_prev;
 };
 
 struct xrdp_pointer_item
@@ -207,9 +225,26 @@ struct xrdp_pointer_item
   int stamp;
   int x; /* hotspot */
   int y;
-  char data[32 * 32 * 4];
-  char mask[32 * 32 / 8];
+  int width; /* 32 up to 384 */
+  int height;
+  char* data; /* bottom up rows of width * Bpp bytes */
+  char* mask; /* bottom up rows of ((width + 15) / 16) * 2 bytes */
   int bpp;
+  int data_alloc; /* bytes allocated when owned by the cache */
+  int mask_alloc;
+};
+
+/* hash chains and lru order for the pointer and brush caches */
+#define XRDP_SMALL_CACHE_ENTRIES 64
+struct xrdp_small_index
+{
+  tui64 hash[XRDP_SMALL_CACHE_ENTRIES];
+  int hash_head[XRDP_SMALL_CACHE_ENTRIES]; /* bucket is hash & 63 */
+  int hash_next[XRDP_SMALL_CACHE_ENTRIES];
+  int lru_next[XRDP_SMALL_CACHE_ENTRIES];
+  int lru_prev[XRDP_SMALL_CACHE_ENTRIES];
+  int lru_head; /* least recently used */
+  int lru_tail;
 };
 
 struct xrdp_brush_item
@@ -223,6 +258,8 @@ struct xrdp_brush_item
 /* moved to xrdp_constants.h
 #define XRDP_BITMAP_CACHE_ENTRIES 2048 */
 
+#define XRDP_CHAR_HASH_SIZE 4096 /* power of 2 */
+
 /* difference caches */
 struct xrdp_cache
 {
@@ -243,8 +280,9 @@ struct xrdp_cache
   int lru_tail[XRDP_MAX_BITMAP_CACHE_ID];
   int lru_reset[XRDP_MAX_BITMAP_CACHE_ID];
 
-  /* crc optimize */
-  struct list16 crc16[XRDP_MAX_BITMAP_CACHE_ID][64 * 1024];
+  /* bitmap index, open addressing hash table keyed by bitmap hash */
+  struct xrdp_cache_slot* index_slots[XRDP_MAX_BITMAP_CACHE_ID];
+  int index_mask[XRDP_MAX_BITMAP_CACHE_ID];
 
   int use_bitmap_comp;
   int cache1_entries;
@@ -258,12 +296,20 @@ struct xrdp_cache
   /* font */
   int char_stamp;
   struct xrdp_char_item char_items[12][256];
+  int char_entries[12]; /* usable entries in each font cache */
+  int char_cell_size[12]; /* max glyph data bytes, 0 for any */
+  int char_used[12]; /* entries filled so far, filled in order */
+  int char_lru_head[12]; /* least recently used */
+  int char_lru_tail[12];
+  int char_hash[XRDP_CHAR_HASH_SIZE]; /* font * 256 + char or -1 */
   /* pointer */
   int pointer_stamp;
   struct xrdp_pointer_item pointer_items[32];
   int pointer_cache_entries;
+  struct xrdp_small_index pointer_index;
   int brush_stamp;
   struct xrdp_brush_item brush_items[64];
+  struct xrdp_small_index brush_index;
   struct xrdp_os_bitmap_item os_bitmap_items[2000];
   struct list* xrdp_os_del_list;
 };
@@ -395,6 +441,7 @@ struct xrdp_process
   //int app_sck;
   tbus done_event;
   int session_id;
+  struct xrdp_perf_stats* perf; /* outlives session, encoder threads use it */
 };
 
 /* rdp listener */
@@ -405,13 +452,20 @@ struct xrdp_listen
   struct list* process_list;
   tbus pro_done_event;
   struct xrdp_startup_params* startup_params;
+  tbus wait_set;
 };
 
 /* region */
 struct xrdp_region
 {
   struct xrdp_wm* wm; /* owner */
-  struct list* rects;
+  struct xrdp_rect* rects; /* y-x banded, see xrdp_region.c */
+  int num_rects;
+  int size;
+  /* output of the last operation, swapped with rects and reused */
+  struct xrdp_rect* out_rects;
+  int num_out_rects;
+  int out_size;
 };
 
 /* painter */
@@ -429,6 +483,7 @@ struct xrdp_painter
   struct xrdp_session* session;
   struct xrdp_wm* wm; /* owner */
   struct xrdp_font* font;
+  struct xrdp_region* region; /* clip region, reused by each draw call */
 };
 
 /* window or bitmap */
@@ -480,9 +535,8 @@ struct xrdp_bitmap
   /* for popup */
   struct xrdp_bitmap* popped_from;
   int item_height;
-  /* crc */
-  int crc32;
-  int crc16;
+  /* content hash, see xrdp_bitmap_copy_box_with_crc */
+  tui64 hash;
 };
 
 #define NUM_FONTS 0x4e00
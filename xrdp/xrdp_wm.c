@@ -187,25 +187,75 @@ xrdp_wm_get_pixel(char *data, int x, int y, int width, int bpp)
 }
 
 /*****************************************************************************/
+/* data and mask rows are bottom up, a pointer bigger than the client
+   takes is cropped to its top left corner */
 int APP_CC
 xrdp_wm_pointer(struct xrdp_wm *self, char *data, char *mask, int x, int y,
-                int bpp)
+                int bpp, int width, int height)
 {
-    int bytes;
+    int Bpp;
+    int max;
+    int w;
+    int h;
+    int j;
+    int src_and_line;
+    int dst_and_line;
+    char *crop_data;
+    char *crop_mask;
     struct xrdp_pointer_item pointer_item;
 
     if (bpp == 0)
     {
         bpp = 24;
     }
-    bytes = ((bpp + 7) / 8) * 32 * 32;
+    Bpp = (bpp + 7) / 8;
+    max = libxrdp_get_pointer_max(self->session);
+    w = MIN(width, max);
+    h = MIN(height, max);
+    if ((w < 1) || (h < 1))
+    {
+        return 1;
+    }
+    crop_data = 0;
+    crop_mask = 0;
+    if ((w != width) || (h != height))
+    {
+        DEBUG(("xrdp_wm_pointer: cropping %dx%d to %dx%d",
+               width, height, w, h));
+        src_and_line = ((width + 15) / 16) * 2;
+        dst_and_line = ((w + 15) / 16) * 2;
+        crop_data = (char *) g_malloc(w * h * Bpp, 0);
+        crop_mask = (char *) g_malloc(dst_and_line * h, 0);
+        if ((crop_data == 0) || (crop_mask == 0))
+        {
+            g_free(crop_data);
+            g_free(crop_mask);
+            return 1;
+        }
+        /* the top rows are at the end */
+        for (j = 0; j < h; j++)
+        {
+            g_memcpy(crop_data + j * w * Bpp,
+                     data + (j + height - h) * width * Bpp, w * Bpp);
+            g_memcpy(crop_mask + j * dst_and_line,
+                     mask + (j + height - h) * src_and_line, dst_and_line);
+        }
+        data = crop_data;
+        mask = crop_mask;
+        x = MIN(x, w - 1);
+        y = MIN(y, h - 1);
+    }
     g_memset(&pointer_item, 0, sizeof(struct xrdp_pointer_item));
     pointer_item.x = x;
     pointer_item.y = y;
+    pointer_item.width = w;
+    pointer_item.height = h;
     pointer_item.bpp = bpp;
-    g_memcpy(pointer_item.data, data, bytes);
-    g_memcpy(pointer_item.mask, mask, 32 * 32 / 8);
+    pointer_item.data = data;
+    pointer_item.mask = mask;
     self->screen->pointer = xrdp_cache_add_pointer(self->cache, &pointer_item);
+    g_free(crop_data);
+    g_free(crop_mask);
     return 0;
 }
 
@@ -315,10 +365,67 @@ xrdp_wm_load_pointer(struct xrdp_wm *self, char *file_name, char *data,
 /*****************************************************************************/
 int APP_CC
 xrdp_wm_send_pointer(struct xrdp_wm *self, int cache_idx,
-                     char *data, char *mask, int x, int y, int bpp)
+                     char *data, char *mask, int x, int y, int bpp,
+                     int width, int height)
 {
-    return libxrdp_send_pointer(self->session, cache_idx, data, mask,
-                                x, y, bpp);
+    int Bpp;
+    int w;
+    int h;
+    int i;
+    int j;
+    int rv;
+    int src_and_line;
+    char *src_mask;
+    char *dst_mask;
+    char *pad_data;
+    char pad_mask[128];
+
+    if ((width == 32) && (height == 32))
+    {
+        return libxrdp_send_pointer(self->session, cache_idx, data, mask,
+                                    x, y, bpp);
+    }
+    if (((width > 32) || (height > 32)) &&
+        (libxrdp_get_pointer_max(self->session) > 32))
+    {
+        return libxrdp_send_pointer_large(self->session, cache_idx, data,
+                                          mask, x, y, bpp, width, height);
+    }
+    /* pad or crop to 32x32, keeping the top left corner, padding is
+       transparent */
+    if (bpp == 0)
+    {
+        bpp = 24;
+    }
+    Bpp = (bpp + 7) / 8;
+    w = MIN(width, 32);
+    h = MIN(height, 32);
+    pad_data = (char *) g_malloc(32 * 32 * Bpp, 1);
+    if (pad_data == 0)
+    {
+        return 1;
+    }
+    g_memset(pad_mask, 0xff, sizeof(pad_mask));
+    src_and_line = ((width + 15) / 16) * 2;
+    /* rows are bottom up, so the top rows are at the end */
+    for (j = 0; j < h; j++)
+    {
+        g_memcpy(pad_data + (j + 32 - h) * 32 * Bpp,
+                 data + (j + height - h) * width * Bpp, w * Bpp);
+        src_mask = mask + (j + height - h) * src_and_line;
+        dst_mask = pad_mask + (j + 32 - h) * 4;
+        for (i = 0; i < w; i++)
+        {
+            if ((src_mask[i / 8] & (0x80 >> (i % 8))) == 0)
+            {
+                dst_mask[i / 8] &= ~(0x80 >> (i % 8));
+            }
+        }
+    }
+    rv = libxrdp_send_pointer(self->session, cache_idx, pad_data, pad_mask,
+                              MIN(x, 31), MIN(y, 31), bpp);
+    g_free(pad_data);
+    return rv;
 }
 
 /*****************************************************************************/
@@ -521,16 +628,25 @@ xrdp_wm_load_static_pointers(struct xrdp_wm *self)
 {
     struct xrdp_pointer_item pointer_item;
     char file_path[256];
+    char data[32 * 32 * 4];
+    char mask[32 * 32 / 8];
 
     DEBUG(("sending cursor"));
     g_snprintf(file_path, 255, "%s/cursor1.cur", XRDP_SHARE_PATH);
     g_memset(&pointer_item, 0, sizeof(pointer_item));
+    g_memset(data, 0, sizeof(data));
+    g_memset(mask, 0, sizeof(mask));
+    pointer_item.data = data;
+    pointer_item.mask = mask;
+    pointer_item.width = 32;
+    pointer_item.height = 32;
     xrdp_wm_load_pointer(self, file_path, pointer_item.data,
                          pointer_item.mask, &pointer_item.x, &pointer_item.y);
     xrdp_cache_add_pointer_static(self->cache, &pointer_item, 1);
     DEBUG(("sending cursor"));
     g_snprintf(file_path, 255, "%s/cursor0.cur", XRDP_SHARE_PATH);
-    g_memset(&pointer_item, 0, sizeof(pointer_item));
+    g_memset(data, 0, sizeof(data));
+    g_memset(mask, 0, sizeof(mask));
     xrdp_wm_load_pointer(self, file_path, pointer_item.data,
                          pointer_item.mask, &pointer_item.x, &pointer_item.y);
     xrdp_cache_add_pointer_static(self->cache, &pointer_item, 0);
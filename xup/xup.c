@@ -1022,6 +1022,53 @@ process_server_set_pointer_ex(struct mod *mod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* cursor bigger than 32x32, the order length is 16 bit so up to 96x96
+   return error */
+static int APP_CC
+process_server_set_pointer_large(struct mod *mod, struct stream *s)
+{
+    int rv;
+    int x;
+    int y;
+    int bpp;
+    int Bpp;
+    int width;
+    int height;
+    int data_bytes;
+    int mask_bytes;
+    char *cur_data;
+    char *cur_mask;
+
+    in_sint16_le(s, x);
+    in_sint16_le(s, y);
+    in_uint16_le(s, bpp);
+    in_uint16_le(s, width);
+    in_uint16_le(s, height);
+    if ((width < 1) || (width > 96) || (height < 1) || (height > 96))
+    {
+        g_writeln("process_server_set_pointer_large: bad size %dx%d",
+                  width, height);
+        return 1;
+    }
+    Bpp = (bpp == 0) ? 3 : (bpp + 7) / 8;
+    data_bytes = width * height * Bpp;
+    mask_bytes = ((width + 15) / 16) * 2 * height;
+    if (!s_check_rem(s, data_bytes + mask_bytes))
+    {
+        return 1;
+    }
+    cur_data = (char *) g_malloc(data_bytes, 0);
+    cur_mask = (char *) g_malloc(mask_bytes, 0);
+    in_uint8a(s, cur_data, data_bytes);
+    in_uint8a(s, cur_mask, mask_bytes);
+    rv = mod->server_set_pointer_large(mod, x, y, cur_data, cur_mask, bpp,
+                                       width, height);
+    g_free(cur_data);
+    g_free(cur_mask);
+    return rv;
+}
+
 /******************************************************************************/
 /* return error */
 static int APP_CC
@@ -1338,6 +1385,9 @@ lib_mod_process_orders(struct mod *mod, int type, struct stream *s)
         case 51: /* server_set_pointer_ex */
             rv = process_server_set_pointer_ex(mod, s);
             break;
+        case 52: /* server_set_pointer_large */
+            rv = process_server_set_pointer_large(mod, s);
+            break;
         case 60: /* server_paint_rect_shmem */
             rv = process_server_paint_rect_shmem(mod, s);
             break;
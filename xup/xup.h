@@ -139,8 +139,11 @@ struct mod
                             int num_crects, short *crects,
                             char *data, int width, int height,
                             int flags, int frame_id);
+  int (*server_set_pointer_large)(struct mod* v, int x, int y,
+                                  char* data, char* mask, int bpp,
+                                  int width, int height);
 
-  tintptr server_dumby[100 - 43]; /* align, 100 minus the number of server
+  tintptr server_dumby[100 - 44]; /* align, 100 minus the number of server
                                      functions above */
   /* common */
   tintptr handle; /* pointer to self as long */